@@ -34,6 +34,8 @@ namespace fiducial_vlam
   PAMA_PARAM(cal_marker_length, float, 0.0450)              /* length of a marker on the charuco board  */ \
   PAMA_PARAM(cal_stationary_capture_ms, int, 0)             /* Duration that calibration target needs to be stationary. 0 => infinite */ \
   PAMA_PARAM(cal_bootstrap_reserve_fraction, double, 0.2)   /* % of calibration images to reserve for bootstrap validation */ \
+  PAMA_PARAM(cal_bootstrap_max_sets, int, 0)                /* 0->calibrate every combination of images, N->a random sample of N combinations */ \
+  PAMA_PARAM(cal_motion_gate_threshold, double, 0.0)        /* Mean gray level change of a thumbnail that skips marker detection. 0 => detect every frame */ \
  /* End of list */
 
   struct CalibrateContext
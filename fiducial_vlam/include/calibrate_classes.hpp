@@ -53,6 +53,7 @@ namespace fiducial_vlam
     std::vector<int> aruco_ids_{};
     std::vector<std::vector<cv::Point2f>> aruco_corners_{};
     BoardProjection board_projection_{};
+    bool moving_{false};
 
   public:
     ImageHolder(cv::Mat gray,
@@ -67,6 +68,12 @@ namespace fiducial_vlam
                                              const cv::Ptr<cv::aruco::Dictionary> &aruco_dictionary,
                                              const CharucoboardConfig &cbm);
 
+    // An image that skipped marker detection because the scene was moving. It
+    // carries the detections of the last image that was detected.
+    static std::shared_ptr<ImageHolder> make_moving(const cv::Mat &gray,
+                                                    const rclcpp::Time &time_stamp,
+                                                    const ImageHolder &last_detected);
+
     inline const auto &gray() const
     { return gray_; }  //
     inline const auto &time_stamp() const
@@ -77,6 +84,8 @@ namespace fiducial_vlam
     { return aruco_corners_; } //
     inline const auto &board_projection() const
     { return board_projection_; } //
+    inline const auto &moving() const
+    { return moving_; } //
 
     void detect_markers(const CharucoboardConfig &cbm,
                         bool precise_not_quick);
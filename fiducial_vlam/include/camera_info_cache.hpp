@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "fiducial_vlam_msgs/msg/camera_info.hpp"
+#include "fiducial_vlam_msgs/msg/observations_synced.hpp"
+#include "fiducial_vlam_msgs/msg/observations_synced_packed.hpp"
+#include "fvlam/camera_info.hpp"
+
+namespace fiducial_vlam
+{
+// ==============================================================================
+// calibration_id function
+// ==============================================================================
+
+  // A hash of every field of a CameraInfo message other than calibration_id. Never
+  // returns 0 because 0 marks a message from a publisher that does not version
+  // its calibration.
+  std::uint64_t calibration_id(const fiducial_vlam_msgs::msg::CameraInfo &msg);
+
+// ==============================================================================
+// CameraInfoCache class
+// ==============================================================================
+
+  // Decodes the CameraInfo in an ObservationsSynced message only when its
+  // calibration_id changes. A publisher may send only the imager_frame_id and
+  // calibration_id (width == 0) once a receiver has seen the full calibration.
+  // Not thread safe, each subscription callback should have its own cache.
+  class CameraInfoCache
+  {
+    struct Entry
+    {
+      std::uint64_t calibration_id_;
+      fvlam::CameraInfo camera_info_;
+    };
+
+    std::map<std::string, Entry> entries_{};
+    std::shared_ptr<const fvlam::CameraInfoMap> camera_info_map_{};
+    std::uint64_t decode_count_{0};
+    std::uint64_t missing_count_{0};
+
+    template<class TObservationsSynced>
+    std::shared_ptr<const fvlam::CameraInfoMap> camera_info_map_from(TObservationsSynced &msg);
+
+  public:
+    // The calibration for this message. Returns nullptr if the message carries only
+    // an id whose full calibration has not been received yet.
+    const fvlam::CameraInfo *camera_info(fiducial_vlam_msgs::msg::CameraInfo &msg);
+
+    // The calibrations for all the entries in this message. The same map is returned
+    // until a calibration changes so it can be held on to without a copy. Returns
+    // nullptr if any entry's calibration is not known yet.
+    std::shared_ptr<const fvlam::CameraInfoMap> camera_info_map(fiducial_vlam_msgs::msg::ObservationsSynced &msg);
+
+    std::shared_ptr<const fvlam::CameraInfoMap> camera_info_map(fiducial_vlam_msgs::msg::ObservationsSyncedPacked &msg);
+
+    // The number of CameraInfo messages that have been decoded.
+    std::uint64_t decode_count() const
+    { return decode_count_; }
+
+    // The number of lookups that failed because the full calibration was not known.
+    std::uint64_t missing_count() const
+    { return missing_count_; }
+  };
+}
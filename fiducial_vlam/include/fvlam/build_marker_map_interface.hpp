@@ -6,6 +6,7 @@
 #pragma ide diagnostic ignored "OCUnusedTypeAliasInspection"
 
 #include <memory>
+#include <vector>
 
 #include "transform3_with_covariance.hpp"
 
@@ -37,6 +38,12 @@ namespace fvlam
 
     // Given the observations that have been added so far, create and return a marker_map.
     virtual std::unique_ptr<MarkerMap> build() = 0;
+
+    // True if process() may be called from several threads at once and while a
+    // build() is running. Frames still being processed when a build starts go
+    // into the next build.
+    virtual bool process_is_concurrent() const
+    { return false; }
   };
 
   template<class TBmmContext>
@@ -51,9 +58,12 @@ namespace fvlam
   struct BuildMarkerMapRecorderContext
   {
     std::string bmm_recorded_observations_name_;
+    int flush_every_n_; // Flush the recording to disk after this many observations
 
-    explicit BuildMarkerMapRecorderContext(std::string bmm_recorded_observations_name) :
-      bmm_recorded_observations_name_{std::move(bmm_recorded_observations_name)}
+    explicit BuildMarkerMapRecorderContext(std::string bmm_recorded_observations_name,
+                                           int flush_every_n = 30) :
+      bmm_recorded_observations_name_{std::move(bmm_recorded_observations_name)},
+      flush_every_n_{flush_every_n}
     {}
 
     template<class T>
@@ -65,6 +75,7 @@ namespace fvlam
 // ==============================================================================
 
   class SolveTMarker0Marker1Interface; //
+  class TMarker0Marker1AccumulatorsInterface; //
   using SolveTMarker0Marker1Factory = std::function<std::unique_ptr<SolveTMarker0Marker1Interface>(void)>;
 
   struct BuildMarkerMapTmmContext
@@ -81,17 +92,26 @@ namespace fvlam
     NoiseStrategy mm_between_factor_noise_strategy_;
     double mm_between_factor_noise_fixed_sigma_r_;
     double mm_between_factor_noise_fixed_sigma_t_;
+    bool incremental_; // Keep an iSAM2 solution between builds and only add the links that changed
+    std::size_t shard_count_; // 0->process() from one thread, N->concurrent process() with the pairs split over N shards
+    int isam_relinearize_skip_; // With incremental_, relinearize every N builds
 
     explicit BuildMarkerMapTmmContext(SolveTMarker0Marker1Factory solve_tmm_factory,
                                       bool try_shonan_initialization = false,
                                       NoiseStrategy mm_between_factor_noise_strategy = NoiseStrategy::minimum,
                                       double mm_between_factor_noise_fixed_sigma_r = 0.1,
-                                      double mm_between_factor_noise_fixed_sigma_t = 0.3) :
+                                      double mm_between_factor_noise_fixed_sigma_t = 0.3,
+                                      bool incremental = false,
+                                      std::size_t shard_count = 0,
+                                      int isam_relinearize_skip = 1) :
       solve_tmm_factory_{std::move(solve_tmm_factory)},
       try_shonan_initialization_{try_shonan_initialization},
       mm_between_factor_noise_strategy_{mm_between_factor_noise_strategy},
       mm_between_factor_noise_fixed_sigma_r_{mm_between_factor_noise_fixed_sigma_r},
-      mm_between_factor_noise_fixed_sigma_t_{mm_between_factor_noise_fixed_sigma_t}
+      mm_between_factor_noise_fixed_sigma_t_{mm_between_factor_noise_fixed_sigma_t},
+      incremental_{incremental},
+      shard_count_{shard_count},
+      isam_relinearize_skip_{isam_relinearize_skip}
     {}
 
     template<class T>
@@ -131,8 +151,56 @@ namespace fvlam
                             const Observation &observation1,
                             const CameraInfo &camera_info) = 0;
 
+    // Solve for the pose of one marker in the camera frame. A frame with n markers
+    // has n(n-1)/2 pairs, so builders solve each observation once per frame with this
+    // and hand the results to accumulate_solved for every pair.
+    virtual Transform3 solve_t_camera_marker(const Observation &observation,
+                                             const CameraInfo &camera_info) = 0;
+
+    // Same as accumulate but with both t_camera_marker poses already solved
+    // from one image.
+    virtual void accumulate_solved(const Transform3 &t_camera_marker0,
+                                   const Transform3 &t_camera_marker1) = 0;
+
     // Given the observations that have been added so far, create and return a marker_map.
     virtual Transform3WithCovariance t_marker0_marker1() = 0;
+
+    // Make a store of accumulators for many marker pairs that averages the same
+    // way as this solver.
+    virtual std::unique_ptr<TMarker0Marker1AccumulatorsInterface> make_accumulators() const = 0;
+  };
+
+// ==============================================================================
+// TMarker0Marker1AccumulatorsInterface class
+// ==============================================================================
+
+// The running sums for every marker pair a map builder has seen, held contiguously
+// and indexed by a pair index. The estimator type is fixed by the implementation so
+// a whole frame of pairs is accumulated with one virtual call.
+  class TMarker0Marker1AccumulatorsInterface
+  {
+  public:
+    // One pair seen in a frame: the index of its accumulator and the indices of the
+    // two markers' t_camera_marker poses.
+    struct Pair
+    {
+      std::size_t pair_ix_;
+      std::size_t m0_;
+      std::size_t m1_;
+    };
+
+    virtual ~TMarker0Marker1AccumulatorsInterface() = default;
+
+    // Add an accumulator with no samples and return its pair index.
+    virtual std::size_t add_pair() = 0;
+
+    // Accumulate t_camera_markers[m0_].inverse() * t_camera_markers[m1_] for each pair.
+    virtual void accumulate_solved(const std::vector<Transform3> &t_camera_markers,
+                                   const std::vector<Pair> &pairs) = 0;
+
+    virtual Transform3WithCovariance t_marker0_marker1(std::size_t pair_ix) const = 0;
+
+    virtual std::size_t size() const = 0;
   };
 
 
@@ -145,9 +213,12 @@ namespace fvlam
   struct SolveTmmContextCvSolvePnp
   {
     bool average_on_space_not_manifold_{true};
+    bool undistort_lookup_{false}; // Normalize corners through a per-imager UndistortionMap before SolvePnp
 
-    explicit SolveTmmContextCvSolvePnp(bool average_on_space_not_manifold) :
-      average_on_space_not_manifold_{average_on_space_not_manifold}
+    explicit SolveTmmContextCvSolvePnp(bool average_on_space_not_manifold,
+                                       bool undistort_lookup = false) :
+      average_on_space_not_manifold_{average_on_space_not_manifold},
+      undistort_lookup_{undistort_lookup}
     {}
   };
 
@@ -221,7 +292,7 @@ namespace fvlam
       return base_.mean() + first_sample_;
     }
 
-    auto cov()
+    auto cov() const
     { return base_.cov(); }
   };
 
@@ -253,7 +324,7 @@ namespace fvlam
       return tr;
     }
 
-    auto cov()
+    auto cov() const
     { return base_.cov(); }
   };
 
@@ -289,7 +360,7 @@ namespace fvlam
       return tr;
     }
 
-    auto cov()
+    auto cov() const
     { return base_.cov(); }
   };
 
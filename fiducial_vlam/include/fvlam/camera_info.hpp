@@ -3,7 +3,11 @@
 #pragma ide diagnostic ignored "NotImplementedFunctions"
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 
 #include <Eigen/Geometry>
 #include "transform3_with_covariance.hpp"
@@ -157,6 +161,22 @@ namespace fvlam
     const auto &t_camera_imager() const
     { return t_camera_imager_; }
 
+    // A hash of the intrinsics. Used to notice when the calibration of an imager changes.
+    std::size_t calibration_hash() const
+    {
+      std::size_t seed{std::hash<std::uint32_t>{}(width_)};
+      auto combine = [&seed](std::size_t h)
+      { seed ^= h + 0x9e3779b9 + (seed << 6) + (seed >> 2); };
+      combine(std::hash<std::uint32_t>{}(height_));
+      for (int i = 0; i < camera_matrix_.size(); i += 1) {
+        combine(std::hash<double>{}(camera_matrix_.data()[i]));
+      }
+      for (int i = 0; i < dist_coeffs_.size(); i += 1) {
+        combine(std::hash<double>{}(dist_coeffs_.data()[i]));
+      }
+      return seed;
+    }
+
     template<class T>
     static CameraInfo from(T &other);
 
@@ -215,4 +235,38 @@ namespace fvlam
 
 // Used for specializing the from/to methods on CameraInfo
   using CvCameraCalibration = std::pair<cv::Matx<double, 3, 3>, cv::Vec<double, 5>>;
+
+// ==============================================================================
+// CalibrationCache class
+// ==============================================================================
+
+// The calibration of each imager converted to a solver's type. Intrinsics rarely
+// change so the conversion is done once per imager instead of once per frame. An
+// entry is converted again when the calibration_hash of its CameraInfo changes.
+// The cache can be shared by solvers running on different threads.
+  template<class TCalibration>
+  class CalibrationCache
+  {
+    struct Entry
+    {
+      std::size_t calibration_hash_{0};
+      std::shared_ptr<const TCalibration> calibration_{};
+    };
+
+    std::mutex mutex_{};
+    std::map<std::string, Entry> m_{};
+
+  public:
+    std::shared_ptr<const TCalibration> get(const CameraInfo &camera_info)
+    {
+      auto calibration_hash = camera_info.calibration_hash();
+      std::lock_guard<std::mutex> lock{mutex_};
+      auto &entry = m_[camera_info.imager_frame_id()];
+      if (!entry.calibration_ || entry.calibration_hash_ != calibration_hash) {
+        entry.calibration_hash_ = calibration_hash;
+        entry.calibration_ = std::make_shared<const TCalibration>(camera_info.to<TCalibration>());
+      }
+      return entry.calibration_;
+    }
+  };
 }
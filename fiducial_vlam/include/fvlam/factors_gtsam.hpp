@@ -4,17 +4,20 @@
 #pragma ide diagnostic ignored "modernize-use-nodiscard"
 
 #include "fvlam/logger.hpp"
+#include "fvlam/observation.hpp"
 #include "fvlam/transform3_with_covariance.hpp"
 #include <gtsam/geometry/Cal3DS2.h>
 #include <gtsam/geometry/PinholeCamera.h>
 #include <gtsam/geometry/Point3.h>
 #include <gtsam/geometry/Pose3.h>
 #include <gtsam/inference/Symbol.h>
+#include <gtsam/linear/GaussianFactorGraph.h>
 #include <gtsam/nonlinear/NonlinearFactorGraph.h>
 #include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
 #include <gtsam/nonlinear/Marginals.h>
 #include <gtsam/slam/BetweenFactor.h>
 #include <gtsam/slam/PriorFactor.h>
+#include <array>
 
 namespace fvlam
 {
@@ -103,8 +106,17 @@ namespace fvlam
                                                                        const gtsam::Values &result,
                                                                        gtsam::Key key, bool invert = false)
     {
-      auto pose = result.at<gtsam::Pose3>(key);
-      auto cov = static_cast<gtsam::Matrix6>(marginals.marginalCovariance(key));
+      return transform3_with_covariance(result.at<gtsam::Pose3>(key),
+                                        static_cast<gtsam::Matrix6>(marginals.marginalCovariance(key)),
+                                        invert);
+    }
+
+    static Transform3WithCovariance transform3_with_covariance(const gtsam::Pose3 &pose_in,
+                                                               const Pose3CovarianceMatrixGtsam &cov_in,
+                                                               bool invert = false)
+    {
+      auto pose = pose_in;
+      auto cov = cov_in;
 
       if (invert) {
         // cov inverse formula from Matías Mattamala: Handling Uncertainty in Estimation Problems with Lie Groups
@@ -117,10 +129,45 @@ namespace fvlam
       return Transform3WithCovariance{Transform3::from(pose), cov_ros_from_gtsam(pose, cov)};
     }
 
+    // Invert a 6x6 information matrix. Returns false if it is not positive definite.
+    static bool cov_from_information(const Pose3CovarianceMatrixGtsam &information,
+                                     Pose3CovarianceMatrixGtsam &cov)
+    {
+      Eigen::LLT<Pose3CovarianceMatrixGtsam> llt{information};
+      if (llt.info() != Eigen::Success) {
+        return false;
+      }
+      cov = llt.solve(Pose3CovarianceMatrixGtsam::Identity());
+      return true;
+    }
+
+    // When the graph has a single pose variable, its covariance is the inverse of the
+    // 6x6 information matrix of the graph linearized at the solution. This is what
+    // gtsam::Marginals computes, without the elimination and Bayes tree.
+    static bool single_pose_covariance(const gtsam::NonlinearFactorGraph &graph,
+                                       const gtsam::Values &result,
+                                       Pose3CovarianceMatrixGtsam &cov)
+    {
+      if (result.size() != 1) {
+        return false;
+      }
+      auto linear = graph.linearize(result);
+      auto information = linear->hessian().first;
+      if (information.rows() != gtsam::Pose3::dimension || information.cols() != gtsam::Pose3::dimension) {
+        return false;
+      }
+      return cov_from_information(information, cov);
+    }
+
     static Transform3WithCovariance extract_transform3_with_covariance(const gtsam::NonlinearFactorGraph &graph,
                                                                        const gtsam::Values &result,
                                                                        gtsam::Key key, bool invert = false)
     {
+      Pose3CovarianceMatrixGtsam cov;
+      if (single_pose_covariance(graph, result, cov)) {
+        return transform3_with_covariance(result.at<gtsam::Pose3>(key), cov, invert);
+      }
+
       auto marginals{construct_marginals(graph, result)};
       return extract_transform3_with_covariance(marginals, result, key, invert);
     }
@@ -369,11 +416,25 @@ namespace fvlam
 // QuadResectioningOffsetFactor class
 // ==============================================================================
 
-  class QuadResectioningOffsetFactor : public gtsam::NoiseModelFactor1<gtsam::Pose3>
+  // Resection a camera from the NCorners corners of one marker at once. The corner
+  // count is a template parameter so the corners are held in std::arrays and the
+  // residual and Jacobian are built in fixed size Eigen blocks. Only the final copy
+  // into the gtsam::Vector and gtsam::Matrix that NoiseModelFactor1 requires is
+  // dynamically sized.
+  template<std::size_t NCorners>
+  class CornersResectioningOffsetFactor : public gtsam::NoiseModelFactor1<gtsam::Pose3>
   {
+  public:
+    static constexpr int ErrorDim = 2 * static_cast<int>(NCorners);
+    using PointsFImage = std::array<gtsam::Point2, NCorners>;
+    using PointsFWorld = std::array<gtsam::Point3, NCorners>;
+    using ErrorVector = Eigen::Matrix<double, ErrorDim, 1>;
+    using ErrorJacobian = Eigen::Matrix<double, ErrorDim, gtsam::Pose3::dimension>;
+
+  private:
     gtsam::Key key_camera_;
-    const std::vector<gtsam::Point2> points_f_image_;
-    const std::vector<gtsam::Point3> points_f_world_;
+    const PointsFImage points_f_image_;
+    const PointsFWorld points_f_world_;
     bool use_transform_;
     gtsam::Pose3 t_camera_imager_;
     std::shared_ptr<const gtsam::Cal3DS2> cal3ds2_;
@@ -381,22 +442,41 @@ namespace fvlam
     std::string debug_str_;
     bool throwCheirality_;     // If true, rethrows Cheirality exceptions (default: false)
 
+    void project(const gtsam::PinholeCamera<gtsam::Cal3DS2> &camera,
+                 ErrorVector &e, ErrorJacobian *H, const gtsam::Matrix66 *HT) const
+    {
+      gtsam::Matrix26 Hi;
+      for (std::size_t i = 0; i < NCorners; i += 1) {
+        auto r = static_cast<int>(2 * i);
+        e.template segment<2>(r) = camera.project(points_f_world_[i],
+                                                  H ? gtsam::OptionalJacobian<2, 6>(Hi) : boost::none) -
+                                   points_f_image_[i];
+        if (H) {
+          if (HT) {
+            H->template block<2, 6>(r, 0) = Hi * *HT;
+          } else {
+            H->template block<2, 6>(r, 0) = Hi;
+          }
+        }
+      }
+    }
+
   public:
     /// Construct factor given known point P and its projection p
-    QuadResectioningOffsetFactor(gtsam::Key key_camera,
-                                 std::vector<gtsam::Point2> points_f_image,
-                                 const gtsam::SharedNoiseModel &model,
-                                 std::vector<gtsam::Point3> points_f_world,
-                                 bool use_transform,
-                                 gtsam::Pose3 t_camera_imager,
-                                 std::shared_ptr<const gtsam::Cal3DS2> &cal3ds2,
-                                 Logger &logger,
-                                 std::string debug_str,
-                                 bool throwCheirality = false) :
+    CornersResectioningOffsetFactor(gtsam::Key key_camera,
+                                    const PointsFImage &points_f_image,
+                                    const gtsam::SharedNoiseModel &model,
+                                    const PointsFWorld &points_f_world,
+                                    bool use_transform,
+                                    gtsam::Pose3 t_camera_imager,
+                                    std::shared_ptr<const gtsam::Cal3DS2> &cal3ds2,
+                                    Logger &logger,
+                                    std::string debug_str,
+                                    bool throwCheirality = false) :
       NoiseModelFactor1<gtsam::Pose3>(model, key_camera),
       key_camera_{key_camera},
-      points_f_image_{std::move(points_f_image)},
-      points_f_world_{std::move(points_f_world)},
+      points_f_image_(points_f_image),
+      points_f_world_(points_f_world),
       use_transform_{use_transform},
       t_camera_imager_{std::move(t_camera_imager)},
       cal3ds2_{cal3ds2},
@@ -406,7 +486,7 @@ namespace fvlam
     {}
 
     /// shorthand for this class
-    typedef QuadResectioningOffsetFactor This;
+    typedef CornersResectioningOffsetFactor This;
 
     /// shorthand for a smart pointer to a factor
     typedef boost::shared_ptr<This> shared_ptr;
@@ -422,48 +502,27 @@ namespace fvlam
                                 boost::optional<gtsam::Matrix &> H = boost::none) const override
     {
       try {
-        if (!use_transform_) {
-          auto camera = gtsam::PinholeCamera<gtsam::Cal3DS2>{pose, *cal3ds2_};
-          if (!H) {
-            return (gtsam::Vector8{}
-              << camera.project(points_f_world_[0]) - points_f_image_[0],
-              camera.project(points_f_world_[1]) - points_f_image_[1],
-              camera.project(points_f_world_[2]) - points_f_image_[2],
-              camera.project(points_f_world_[3]) - points_f_image_[3]).finished();
-          }
+        ErrorVector e;
+        ErrorJacobian J;
 
-          gtsam::Matrix26 H0, H1, H2, H3;
-          gtsam::Vector2 e0 = camera.project(points_f_world_[0], H0) - points_f_image_[0];
-          gtsam::Vector2 e1 = camera.project(points_f_world_[1], H1) - points_f_image_[1];
-          gtsam::Vector2 e2 = camera.project(points_f_world_[2], H2) - points_f_image_[2];
-          gtsam::Vector2 e3 = camera.project(points_f_world_[3], H3) - points_f_image_[3];
-
-          *H = (gtsam::Matrix86{} << H0, H1, H2, H3).finished();
-          return (gtsam::Vector8{} << e0, e1, e2, e3).finished();
+        if (!use_transform_) {
+          project(gtsam::PinholeCamera<gtsam::Cal3DS2>{pose, *cal3ds2_}, e, H ? &J : nullptr, nullptr);
+        } else if (!H) {
+          project(gtsam::PinholeCamera<gtsam::Cal3DS2>{pose.compose(t_camera_imager_), *cal3ds2_},
+                  e, nullptr, nullptr);
+        } else {
+          gtsam::Matrix66 HT;
+          auto camera = gtsam::PinholeCamera<gtsam::Cal3DS2>{pose.compose(t_camera_imager_, HT), *cal3ds2_};
+          project(camera, e, &J, &HT);
         }
 
-        if (!H) {
-          auto camera = gtsam::PinholeCamera<gtsam::Cal3DS2>{pose.compose(t_camera_imager_), *cal3ds2_};
-          return (gtsam::Vector8{}
-            << camera.project(points_f_world_[0]) - points_f_image_[0],
-            camera.project(points_f_world_[1]) - points_f_image_[1],
-            camera.project(points_f_world_[2]) - points_f_image_[2],
-            camera.project(points_f_world_[3]) - points_f_image_[3]).finished();
+        if (H) {
+          *H = J;
         }
-
-        gtsam::Matrix HT;
-        auto camera = gtsam::PinholeCamera<gtsam::Cal3DS2>{pose.compose(t_camera_imager_, HT), *cal3ds2_};
-        gtsam::Matrix26 H0, H1, H2, H3;
-        gtsam::Vector2 e0 = camera.project(points_f_world_[0], H0) - points_f_image_[0];
-        gtsam::Vector2 e1 = camera.project(points_f_world_[1], H1) - points_f_image_[1];
-        gtsam::Vector2 e2 = camera.project(points_f_world_[2], H2) - points_f_image_[2];
-        gtsam::Vector2 e3 = camera.project(points_f_world_[3], H3) - points_f_image_[3];
-
-        *H = (gtsam::Matrix86{} << H0 * HT, H1 * HT, H2 * HT, H3 * HT).finished();
-        return (gtsam::Vector8{} << e0, e1, e2, e3).finished();
+        return e;
 
       } catch (gtsam::CheiralityException &e) {
-        if (H) *H = gtsam::Matrix86::Zero();
+        if (H) *H = ErrorJacobian::Zero();
 
         if (!debug_str_.empty()) {
           logger_.error() << e.what() << ": " << debug_str_ << " point moved behind camera "
@@ -474,7 +533,9 @@ namespace fvlam
           throw gtsam::CheiralityException(key_camera_);
       }
       auto max_e = gtsam::Vector2{2.0 * cal3ds2_->px(), 2.0 * cal3ds2_->py()};
-      return (gtsam::Vector8{} << max_e, max_e, max_e, max_e).finished();
+      return max_e.replicate<static_cast<int>(NCorners), 1>();
     }
   };
+
+  using QuadResectioningOffsetFactor = CornersResectioningOffsetFactor<Observation::ArraySize>;
 }
@@ -5,11 +5,19 @@
 #pragma ide diagnostic ignored "OCUnusedStructInspection"
 #pragma ide diagnostic ignored "OCUnusedTypeAliasInspection"
 
+#include <cstdint>
 #include <memory>
+#include <vector>
 
+#include "camera_info.hpp"
 #include "observation.hpp"
 #include "transform3_with_covariance.hpp"
 
+namespace gtsam
+{
+  class Cal3DS2; //
+}
+
 namespace rclcpp
 {
   class Time;
@@ -27,17 +35,46 @@ namespace fvlam
   class CameraInfoMap; //
   class MapEnvironment; //
   class MarkerMap; //
+  class UndistortionMap; //
+
+// ==============================================================================
+// LocalizeCameraCaches class
+// ==============================================================================
+
+// The per-imager calibration conversions that localizers use. A node makes one
+// and passes it to each localizer it builds, so the OpenCV localizer, the GTSAM
+// localizer and the PnP localizer that seeds it convert a calibration once
+// between them. The caches lock, so localizers on different threads can share them.
+  struct LocalizeCameraCaches
+  {
+    CalibrationCache<CvCameraCalibration> cv_calibrations_{};
+    CalibrationCache<gtsam::Cal3DS2> gtsam_calibrations_{};
+    CalibrationCache<UndistortionMap> undistortions_{};
+  };
 
 // ==============================================================================
 // LocalizeCameraInterface class
 // ==============================================================================
 
+// How a solve ended. A solver whose iteration or time budget runs out returns its
+// best estimate so far instead of nothing.
+  enum class SolveStatus
+  {
+    converged, // also for solvers that do not iterate
+    budget_estimate, // the budget ran out, the optimizer's best estimate is returned
+    budget_seed, // the budget ran out before the first step, the initial value is returned
+  };
+
 // An interface used to localize a camera from fiducial marker observations.
   class LocalizeCameraInterface
   {
   public:
     virtual ~LocalizeCameraInterface() = default;
 
+    // How the last solve_t_map_camera call ended.
+    virtual SolveStatus last_solve_status() const
+    { return SolveStatus::converged; }
+
     // Given observations of fiducial markers and a map of world locations of those
     // markers, figure out the camera pose in the world frame.
     virtual Transform3WithCovariance solve_t_map_camera(const Observations &observations,
@@ -49,11 +86,69 @@ namespace fvlam
     virtual Transform3WithCovariance solve_t_map_camera(const ObservationsSynced &observations_synced,
                                                         const CameraInfoMap &camera_info_map,
                                                         const MarkerMap &map) = 0;
+
+    // Solve a made up frame, see warm_up_localize_camera(), leaving the state that
+    // carries from one real frame to the next, a tracking pose for instance, as it was.
+    virtual void warm_up(const ObservationsSynced &observations_synced,
+                         const CameraInfoMap &camera_info_map,
+                         const MarkerMap &map)
+    { solve_t_map_camera(observations_synced, camera_info_map, map); }
+
+    // Forget the state that carries from one frame to the next. Call this when the
+    // map changes so a pose solved against the old map is not used as a seed.
+    virtual void reset_tracking()
+    {}
   };
 
+// Without caches the localizer makes its own.
   template<class TLcContext>
   std::unique_ptr<LocalizeCameraInterface> make_localize_camera(const TLcContext &lc_context,
-                                                                Logger &logger);
+                                                                Logger &logger,
+                                                                std::shared_ptr<LocalizeCameraCaches> caches = {});
+
+// Wrap a localizer so that a frame that sees the same markers as the last solved
+// frame, with no corner moved more than max_corner_motion pixels, gets the last
+// solution back without a solve. Meant for parked or hovering cameras. The map and
+// calibrations must also be unchanged.
+  std::unique_ptr<LocalizeCameraInterface> make_static_scene_localize_camera(
+    std::unique_ptr<LocalizeCameraInterface> localize_camera,
+    double max_corner_motion);
+
+// Solve for the pose of each of count frames at observations_synced. The frames are
+// split into contiguous runs that are solved concurrently. Each run has its own solver
+// so tracking seeds carry from frame to frame within a run. The runs share one set
+// of calibration caches.
+// thread_count 0 uses every hardware thread. The result has one entry per frame.
+  template<class TLcContext>
+  std::vector<Transform3WithCovariance> solve_t_map_cameras(const TLcContext &lc_context,
+                                                            const ObservationsSynced *observations_synced,
+                                                            std::size_t count,
+                                                            const CameraInfoMap &camera_info_map,
+                                                            const MarkerMap &map,
+                                                            Logger &logger,
+                                                            std::size_t thread_count = 0);
+
+  template<class TLcContext>
+  std::vector<Transform3WithCovariance> solve_t_map_cameras(const TLcContext &lc_context,
+                                                            const std::vector<ObservationsSynced> &observations_synced,
+                                                            const CameraInfoMap &camera_info_map,
+                                                            const MarkerMap &map,
+                                                            Logger &logger,
+                                                            std::size_t thread_count = 0)
+  {
+    return solve_t_map_cameras(lc_context, observations_synced.data(), observations_synced.size(),
+                               camera_info_map, map, logger, thread_count);
+  }
+
+// Solve once for a made up frame so that the calibration caches, solver structures
+// and allocations that the first real frame would otherwise pay for are in place.
+// The frame is a camera in front of the first marker in the map, seeing the
+// markers that project into each imager of camera_info_map. It is solved with
+// LocalizeCameraInterface::warm_up() so tracking state is kept. Does nothing
+// without a camera_info or a marker with a pose.
+  void warm_up_localize_camera(LocalizeCameraInterface &localize_camera,
+                               const CameraInfoMap &camera_info_map,
+                               const MarkerMap &map);
 
 // ==============================================================================
 // LocalizeCameraCvContext class
@@ -61,6 +156,7 @@ namespace fvlam
 
   struct LocalizeCameraCvContext
   {
+    bool undistort_lookup_{false}; // true -> corners normalized through a per-imager UndistortionMap, then pinhole PnP
 
     template<class T>
     static LocalizeCameraCvContext from(T &other);
@@ -75,13 +171,28 @@ namespace fvlam
     double &corner_measurement_sigma_;
     int &gtsam_factor_type_;
     bool &use_marker_covariance_;
+    int &tracking_mode_; // 0 -> PnP initial value every frame, 1 -> last pose, 2 -> constant velocity prediction
+    double &tracking_max_error_; // RMS corner error (pixels) above which a tracked solve is redone from PnP
+    int &max_iterations_; // 0 -> the optimizer default of 100
+    double &max_solve_ms_; // 0 -> no time budget, N -> return the best estimate after N ms
+    bool &undistort_lookup_; // true -> undistort the corners once per frame and solve with the pinhole model
 
     explicit LocalizeCameraGtsamFactorContext(double &corner_measurement_sigma,
                                               int &gtsam_factor_type,
-                                              bool &use_marker_covariance) :
+                                              bool &use_marker_covariance,
+                                              int &tracking_mode,
+                                              double &tracking_max_error,
+                                              int &max_iterations,
+                                              double &max_solve_ms,
+                                              bool &undistort_lookup) :
       corner_measurement_sigma_{corner_measurement_sigma},
       gtsam_factor_type_{gtsam_factor_type},
-      use_marker_covariance_{use_marker_covariance}
+      use_marker_covariance_{use_marker_covariance},
+      tracking_mode_{tracking_mode},
+      tracking_max_error_{tracking_max_error},
+      max_iterations_{max_iterations},
+      max_solve_ms_{max_solve_ms},
+      undistort_lookup_{undistort_lookup}
     {}
 
     template<class T>
@@ -100,9 +211,21 @@ namespace fvlam
     double border_color_blue_{0.0};
 //    int aruco_dictionary_id_{0};
     int &corner_refinement_method_;
+    int &roi_full_scan_every_n_; // 0 -> always scan the full frame
+    double &roi_padding_; // fraction of a marker's size that its ROI window is grown by
+    double &pyramid_scale_; // < 1.0 -> find candidates on a downscaled image
+    int &detector_backend_; // 0 -> CPU, 1 -> OpenCV T-API (OpenCL) if available
 
-    explicit FiducialMarkerContext(int &corner_refinement_method) :
-      corner_refinement_method_{corner_refinement_method}
+    explicit FiducialMarkerContext(int &corner_refinement_method,
+                                   int &roi_full_scan_every_n,
+                                   double &roi_padding,
+                                   double &pyramid_scale,
+                                   int &detector_backend) :
+      corner_refinement_method_{corner_refinement_method},
+      roi_full_scan_every_n_{roi_full_scan_every_n},
+      roi_padding_{roi_padding},
+      pyramid_scale_{pyramid_scale},
+      detector_backend_{detector_backend}
     {}
 
     template<class T>
@@ -119,6 +242,16 @@ namespace fvlam
     virtual Observations detect_markers(cv::Mat &gray_image,
                                         const std::string &camera_frame_id) = 0;
 
+    // Look for fiducial markers in a gray image, replacing the contents of observations
+    // but keeping its storage and imager_frame_id.
+    virtual void detect_markers(cv::Mat &gray_image,
+                                Observations &observations) = 0;
+
+    // Decode only these marker ids. An empty list decodes every id in the dictionary.
+    // This can be called from a different thread than detect_markers, the new
+    // dictionary is picked up at the start of the next detection.
+    virtual void restrict_to_marker_ids(const std::vector<std::uint64_t> &marker_ids) = 0;
+
     // Draw the boundary around detected markers.
     virtual void annotate_image_with_detected_markers(cv::Mat &color_image,
                                                       const Observations &observations) = 0;
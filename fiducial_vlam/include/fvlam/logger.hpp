@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <sstream>
 
 // ==============================================================================
@@ -25,39 +26,50 @@ namespace fvlam
       level_fatal,
     };
 
+    // The stream is only constructed when the level is enabled. A disabled
+    // StreamProxy costs one test_level() call and the << operators reduce
+    // to a branch. The arguments to << are still evaluated so expensive ones
+    // (to_string() and the like) should be guarded with output_debug() etc.
     class StreamProxy
     {
       Logger &logger_;
       Levels level_;
-      bool test_level_;
-      std::ostringstream oss_;
+      std::optional<std::ostringstream> oss_;
 
     public:
       StreamProxy(Logger &logger, Levels level) :
         logger_{logger},
         level_{level},
-        test_level_{logger.test_level(level)},
         oss_{}
-      {}
+      {
+        if (logger.test_level(level)) {
+          oss_.emplace();
+        }
+      }
 
       ~StreamProxy()
       {
-        logger_.log_line(level_, oss_.str());
+        if (oss_) {
+          logger_.log_line(level_, oss_->str());
+        }
       }
 
+      StreamProxy(StreamProxy const &) = delete;
+      StreamProxy &operator=(StreamProxy const &) = delete;
+
       template<typename V>
       StreamProxy &operator<<(V const &value)
       {
-        if (test_level_) {
-          oss_ << value;
+        if (oss_) {
+          *oss_ << value;
         }
         return *this;
       }
 
       StreamProxy &operator<<(std::basic_ostream<char> &(*func)(std::basic_ostream<char> &))
       {
-        if (test_level_) {
-          func(oss_);
+        if (oss_) {
+          func(*oss_);
         }
         return *this;
       }
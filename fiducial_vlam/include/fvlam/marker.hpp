@@ -39,6 +39,13 @@ namespace fvlam
     // Prevent modification if true
     bool is_fixed_{false};
 
+    // The corners in the world frame, computed once when the marker is added to a
+    // MarkerMap so that localization does not transform them every frame. They are
+    // only valid for the marker length they were computed with.
+    bool corners3_f_world_valid_{false};
+    double corners3_f_world_marker_length_{0.0};
+    Array3 corners3_f_world_{};
+
     inline static Array2 unit_corners2_f_marker()
     {
       return Array2{Translate2{-1, 1},
@@ -65,24 +72,33 @@ namespace fvlam
                     unit_corners2[3] * half_marker_length};
     }
 
+    inline static Points3<ArraySize> calc_corners3_f_marker_points(double marker_length)
+    {
+      return to_points3(unit_corners3_f_marker()) * (marker_length / 2.0);
+    }
+
     inline static Array3 calc_corners3_f_marker(double marker_length)
     {
-      auto half_marker_length{marker_length / 2.0};
-      auto unit_corners3{unit_corners3_f_marker()};
-      return Array3{unit_corners3[0] * half_marker_length,
-                    unit_corners3[1] * half_marker_length,
-                    unit_corners3[2] * half_marker_length,
-                    unit_corners3[3] * half_marker_length};
+      return from_points3(calc_corners3_f_marker_points(marker_length));
     }
 
   public:
+    // The corners in the world frame as one block of points, for code that goes
+    // on to transform or project them.
+    inline Points3<ArraySize> calc_corners3_f_world_points(double marker_length) const
+    {
+      if (corners3_f_world_valid_ && marker_length == corners3_f_world_marker_length_) {
+        return to_points3(corners3_f_world_);
+      }
+      return transform_points(t_map_marker_.tf(), calc_corners3_f_marker_points(marker_length));
+    }
+
     inline Array3 calc_corners3_f_world(double marker_length) const
     {
-      auto corners_f_marker = calc_corners3_f_marker(marker_length);
-      return Array3{t_map_marker_.tf() * corners_f_marker[0],
-                    t_map_marker_.tf() * corners_f_marker[1],
-                    t_map_marker_.tf() * corners_f_marker[2],
-                    t_map_marker_.tf() * corners_f_marker[3]};
+      if (corners3_f_world_valid_ && marker_length == corners3_f_world_marker_length_) {
+        return corners3_f_world_;
+      }
+      return from_points3(transform_points(t_map_marker_.tf(), calc_corners3_f_marker_points(marker_length)));
     }
 
   public:
@@ -106,6 +122,27 @@ namespace fvlam
     const auto &t_map_marker() const
     { return t_map_marker_; }
 
+    // Compute and keep the world frame corners for this marker length.
+    void cache_corners_f_world(double marker_length)
+    {
+      corners3_f_world_valid_ = false;
+      corners3_f_world_ = calc_corners3_f_world(marker_length);
+      corners3_f_world_marker_length_ = marker_length;
+      corners3_f_world_valid_ = true;
+    }
+
+    // Keep world frame corners that were computed earlier, for instance ones
+    // read from a map cache file.
+    void cache_corners_f_world(double marker_length, const Array3 &corners3_f_world)
+    {
+      corners3_f_world_ = corners3_f_world;
+      corners3_f_world_marker_length_ = marker_length;
+      corners3_f_world_valid_ = true;
+    }
+
+    bool has_corners_f_world(double marker_length) const
+    { return corners3_f_world_valid_ && marker_length == corners3_f_world_marker_length_; }
+
     template<class T>
     static Marker from(T &other);
 
@@ -201,6 +238,31 @@ namespace fvlam
     MapEnvironment map_environment_;
     std::map<std::uint64_t, Marker> m_{};
 
+    // Lookup table from marker id to marker for the ids a dictionary can have.
+    // Lookups on the localization path are then one indexed load instead of a
+    // walk down the tree. Ids beyond the table are looked up in m_. The pointers
+    // are to the nodes of m_ so the table is rebuilt when the map is copied.
+    static constexpr std::uint64_t dense_index_limit_{4096};
+    std::vector<const Marker *> dense_index_{};
+
+    void index_marker(const Marker &marker)
+    {
+      if (marker.id() < dense_index_limit_) {
+        if (marker.id() >= dense_index_.size()) {
+          dense_index_.resize(marker.id() + 1, nullptr);
+        }
+        dense_index_[marker.id()] = &marker;
+      }
+    }
+
+    void rebuild_index()
+    {
+      dense_index_.clear();
+      for (auto &marker_pair : m_) {
+        index_marker(marker_pair.second);
+      }
+    }
+
   public:
     explicit MarkerMap() :
       map_environment_{}
@@ -210,15 +272,33 @@ namespace fvlam
       map_environment_{std::move(map_environment)}
     {}
 
+    MarkerMap(const MarkerMap &other) :
+      map_environment_{other.map_environment_}, m_{other.m_}
+    {
+      rebuild_index();
+    }
+
+    MarkerMap &operator=(const MarkerMap &other)
+    {
+      if (this != &other) {
+        map_environment_ = other.map_environment_;
+        m_ = other.m_;
+        rebuild_index();
+      }
+      return *this;
+    }
+
+    // Moving a std::map keeps its nodes so the index stays valid.
+    MarkerMap(MarkerMap &&other) noexcept = default;
+
+    MarkerMap &operator=(MarkerMap &&other) noexcept = default;
+
     const auto &map_environment() const
     { return map_environment_; }
 
     auto marker_length() const
     { return map_environment_.marker_length(); }
 
-    auto &m_mutable()
-    { return m_; }
-
     auto &m() const
     { return m_; }
 
@@ -243,22 +323,61 @@ namespace fvlam
 
     Marker *find_marker(int id)
     {
-      auto marker_pair = m_.find(id);
-      return marker_pair == m_.end() ? nullptr : &marker_pair->second;
+      return const_cast<Marker *>(find_marker_const(id));
     }
 
     const Marker *find_marker_const(std::uint64_t id) const
     {
+      if (id < dense_index_limit_) {
+        return id < dense_index_.size() ? dense_index_[id] : nullptr;
+      }
       auto marker_pair = m_.find(id);
       return marker_pair == m_.end() ? nullptr : &marker_pair->second;
     }
 
     void add_marker(Marker marker)
     {
-      m_.emplace(marker.id(), std::move(marker));
+      if (!marker.has_corners_f_world(marker_length())) {
+        marker.cache_corners_f_world(marker_length());
+      }
+      auto marker_pair = m_.emplace(marker.id(), std::move(marker));
+      if (marker_pair.second) {
+        index_marker(marker_pair.first->second);
+      }
+    }
+
+    // Add the marker or replace the marker with the same id.
+    void replace_marker(Marker marker)
+    {
+      if (!marker.has_corners_f_world(marker_length())) {
+        marker.cache_corners_f_world(marker_length());
+      }
+      auto id = marker.id();
+      auto marker_pair = m_.insert_or_assign(id, std::move(marker));
+      index_marker(marker_pair.first->second);
+    }
+
+    bool remove_marker(std::uint64_t id)
+    {
+      if (m_.erase(id) == 0) {
+        return false;
+      }
+      if (id < dense_index_.size()) {
+        dense_index_[id] = nullptr;
+      }
+      return true;
     }
 
     void save(const std::string &filename, Logger &logger) const; //
     static MarkerMap load(const std::string &filename, Logger &logger); //
+
+    // A binary snapshot of the map, corners included, that loads with one read.
+    bool save_binary(const std::string &filename, Logger &logger) const; //
+    static MarkerMap load_binary(const std::string &filename, Logger &logger); //
+
+    // Load a YAML map file through a binary snapshot kept next to it. The YAML
+    // file is the source of truth. The snapshot is rebuilt when the YAML file's
+    // size or modification time no longer match the ones it was built from.
+    static MarkerMap load_cached(const std::string &filename, Logger &logger); //
   };
 }
@@ -0,0 +1,82 @@
+#pragma once
+#pragma ide diagnostic ignored "modernize-use-nodiscard"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "marker.hpp"
+
+namespace fvlam
+{
+  class Logger; //
+
+// ==============================================================================
+// MarkerMapTiles class
+// ==============================================================================
+
+  // A MarkerMap split into cubes tile_size on a side so that a localizer on a
+  // large site only has to hold the part of the map around it. A tile directory
+  // holds an index of the marker ids in each tile, the MapEnvironment that all
+  // the tiles share, and a binary map snapshot per tile. The index is written
+  // last so a reader never sees an index of tiles that are not there yet.
+  class MarkerMapTiles
+  {
+  public:
+    using TileKey = std::array<int, 3>;
+
+  private:
+    std::string directory_{};
+    std::int64_t index_stamp_{0};
+    double tile_size_{0.};
+    MapEnvironment map_environment_{};
+    std::map<TileKey, std::vector<std::uint64_t>> tile_ids_{};
+    std::map<std::uint64_t, TileKey> id_tiles_{};
+
+  public:
+    // Read the index and the environment of a tile directory. is_valid() is false
+    // if either could not be read.
+    MarkerMapTiles(std::string directory, Logger &logger);
+
+    auto is_valid() const
+    { return tile_size_ > 0.; }
+
+    auto tile_size() const
+    { return tile_size_; }
+
+    // The index_stamp() of the index that was read.
+    auto stamp() const
+    { return index_stamp_; }
+
+    const auto &map_environment() const
+    { return map_environment_; }
+
+    // The ids of the markers in each tile
+    const auto &tile_ids() const
+    { return tile_ids_; }
+
+    TileKey tile_of(const Translate3 &position) const
+    { return tile_of(position, tile_size_); }
+
+    // Returns false if the marker is in none of the tiles.
+    bool find_tile(std::uint64_t id, TileKey &key) const;
+
+    // A missing or unreadable tile loads as an empty map in the shared environment.
+    MarkerMap load_tile(const TileKey &key, Logger &logger) const;
+
+    // Changes when the tile's file is rewritten. 0 if there is no file.
+    std::int64_t tile_stamp(const TileKey &key) const;
+
+    // Changes when the index in directory is rewritten, which save() does last,
+    // so a reader can tell when to read the index again. 0 if there is no index.
+    static std::int64_t index_stamp(const std::string &directory);
+
+    static TileKey tile_of(const Translate3 &position, double tile_size);
+
+    // Split map into tiles and write them and their index to directory, which is
+    // created if needed. Markers without a valid pose are left out.
+    static bool save(const MarkerMap &map, double tile_size, const std::string &directory, Logger &logger);
+  };
+}
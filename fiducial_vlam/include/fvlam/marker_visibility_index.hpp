@@ -0,0 +1,72 @@
+#pragma once
+#pragma ide diagnostic ignored "modernize-use-nodiscard"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "transform3_with_covariance.hpp"
+
+namespace fvlam
+{
+  class CameraInfo; //
+  class MarkerMap; //
+
+// ==============================================================================
+// MarkerVisibilityIndex class
+// ==============================================================================
+
+  // A uniform grid over the positions of the markers in a MarkerMap so that the
+  // markers near a point, or the ones a camera can see from a pose, are found
+  // without walking the whole map. The index is a snapshot of the marker poses
+  // and ids, it does not refer to the map and is rebuilt when the map changes.
+  class MarkerVisibilityIndex
+  {
+    struct Entry
+    {
+      std::uint64_t id_;
+      Translate3::MuVector position_;
+      Translate3::MuVector normal_; // marker z axis, the side its pattern faces
+    };
+
+    struct CellHash
+    {
+      std::size_t operator()(const Eigen::Vector3i &cell) const
+      {
+        auto h = std::size_t(cell.x()) * 73856093u;
+        h ^= std::size_t(cell.y()) * 19349663u;
+        h ^= std::size_t(cell.z()) * 83492791u;
+        return h;
+      }
+    };
+
+    double cell_size_;
+    double marker_length_;
+    std::vector<Entry> entries_{};
+    std::unordered_map<Eigen::Vector3i, std::vector<std::size_t>, CellHash> cells_{};
+
+    Eigen::Vector3i cell_of(const Translate3::MuVector &position) const;
+
+    template<class TFunc>
+    void for_each_within(const Translate3::MuVector &center, double radius, TFunc func) const;
+
+  public:
+    // cell_size is in map units. Something near the typical viewing distance keeps
+    // both the number of cells visited and the number of markers tested small.
+    explicit MarkerVisibilityIndex(const MarkerMap &map, double cell_size = 2.0);
+
+    auto size() const
+    { return entries_.size(); }
+
+    // The ids of the markers whose centers are within radius of center.
+    std::vector<std::uint64_t> markers_within(const Translate3 &center, double radius) const;
+
+    // The ids of the markers that may be in view of a camera at t_map_camera: no
+    // farther than max_range, facing the camera and with some part of the marker
+    // projecting inside the image by the pinhole model. Lens distortion is ignored
+    // so the test errs toward including markers at the image edges.
+    std::vector<std::uint64_t> markers_in_view(const Transform3 &t_map_camera,
+                                               const CameraInfo &camera_info,
+                                               double max_range) const;
+  };
+}
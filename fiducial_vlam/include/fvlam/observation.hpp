@@ -4,13 +4,17 @@
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 #pragma ide diagnostic ignored "OCUnusedTypeAliasInspection"
 
+#include <mutex>
+#include <string>
+#include <unordered_set>
 #include <vector>
 
+#include "camera_info.hpp"
 #include "transform3_with_covariance.hpp"
 
 namespace fvlam
 {
-  class CameraInfo;
+  class UndistortionMap; //
 
 // ==============================================================================
 // Stamp class
@@ -51,6 +55,63 @@ namespace fvlam
     bool equals(const Stamp &other, double tol = 1.0e-9, bool check_relative_also = true) const;
   };
 
+// ==============================================================================
+// FrameId class
+// ==============================================================================
+
+  // A frame id string kept once in a process wide table. A FrameId is a pointer
+  // into the table so Observations and ObservationsSynced copy their frame ids
+  // without allocating. Strings are never removed from the table, a system only
+  // has a handful of frame ids. Converts from std::string so frame ids can still
+  // be passed as strings.
+  class FrameId
+  {
+    const std::string *s_;
+
+    static const std::string *intern(const std::string &s)
+    {
+      // Most lookups on a thread are for the id it looked up last.
+      thread_local const std::string *last{nullptr};
+      if (last != nullptr && *last == s) {
+        return last;
+      }
+
+      static std::mutex mutex{};
+      static std::unordered_set<std::string> table{};
+      std::lock_guard<std::mutex> lock{mutex};
+      auto it = table.find(s);
+      if (it == table.end()) {
+        it = table.emplace(s).first;
+      }
+      last = &*it;
+      return last;
+    }
+
+  public:
+    FrameId() :
+      FrameId(std::string{})
+    {}
+
+    FrameId(const std::string &s) :
+      s_{intern(s)}
+    {}
+
+    FrameId(const char *s) :
+      FrameId(std::string{s})
+    {}
+
+    const std::string &str() const
+    { return *s_; }
+
+    // Two tables can exist if fvlam is linked into more than one library without
+    // merged symbols, so differing pointers fall back to comparing the strings.
+    bool operator==(const FrameId &other) const
+    { return s_ == other.s_ || *s_ == *other.s_; }
+
+    bool operator!=(const FrameId &other) const
+    { return !(*this == other); }
+  };
+
 // ==============================================================================
 // Observation class
 // ==============================================================================
@@ -142,6 +203,8 @@ namespace fvlam
     bool equals(const Observation &other, double tol = 1.0e-9, bool check_relative_also = true) const;
 
     Transform3 solve_t_camera_marker(const CameraInfo &camera_info, double marker_length) const; //
+    Transform3 solve_t_camera_marker(const CvCameraCalibration &camera_calibration, double marker_length) const; //
+    Transform3 solve_t_camera_marker(const UndistortionMap &undistortion_map, double marker_length) const; //
     Transform3 solve_t_marker_camera(const CameraInfo &camera_info, double marker_length) const; //
     Transform3 solve_t_base_marker(const CameraInfo &camera_info, double marker_length) const; //
     Transform3 solve_t_marker_base(const CameraInfo &camera_info, double marker_length) const; //
@@ -153,16 +216,23 @@ namespace fvlam
 
   class Observations
   {
-    std::string imager_frame_id_; // One or more imagers are components of a camera.
+    FrameId imager_frame_id_; // One or more imagers are components of a camera.
     std::vector<Observation> v_;
 
   public:
-    Observations(std::string imager_frame_id) :
-      imager_frame_id_{std::move(imager_frame_id)}
+    Observations(FrameId imager_frame_id) :
+      imager_frame_id_{imager_frame_id}
     {}
 
     auto &imager_frame_id() const
-    { return imager_frame_id_; }
+    { return imager_frame_id_.str(); }
+
+    // Empty the observations for reuse. The vector keeps its capacity.
+    void reset(FrameId imager_frame_id)
+    {
+      imager_frame_id_ = imager_frame_id;
+      v_.clear();
+    }
 
     auto &v_mutable()
     { return v_; }
@@ -179,6 +249,10 @@ namespace fvlam
     template<typename T>
     static Observations from(T &other);
 
+    // Replace the contents with other's, keeping this object's storage.
+    template<typename T>
+    void assign_from(T &other);
+
     template<typename T>
     T to() const;
 
@@ -197,19 +271,28 @@ namespace fvlam
   class ObservationsSynced
   {
     Stamp stamp_; // The stamp for the synced observations.
-    std::string camera_frame_id_; // A camera has one of more imagers..
+    FrameId camera_frame_id_; // A camera has one of more imagers..
     std::vector<Observations> v_{};
 
   public:
-    ObservationsSynced(Stamp stamp, std::string camera_frame_id) :
-      stamp_(stamp), camera_frame_id_{std::move(camera_frame_id)}
+    ObservationsSynced(Stamp stamp, FrameId camera_frame_id) :
+      stamp_(stamp), camera_frame_id_{camera_frame_id}
     {}
 
     auto &stamp() const
     { return stamp_; }
 
     auto &camera_frame_id() const
-    { return camera_frame_id_; }
+    { return camera_frame_id_.str(); }
+
+    // Empty for reuse. The vector keeps its capacity but the Observations in it
+    // are destroyed, see ObservationsSyncedArena to keep theirs.
+    void reset(Stamp stamp, FrameId camera_frame_id)
+    {
+      stamp_ = stamp;
+      camera_frame_id_ = camera_frame_id;
+      v_.clear();
+    }
 
     auto &v_mutable()
     { return v_; }
@@ -236,4 +319,51 @@ namespace fvlam
 
     bool equals(const ObservationsSynced &other, double tol = 1.0e-9, bool check_relative_also = true) const;
   };
+
+// ==============================================================================
+// ObservationsSyncedArena class
+// ==============================================================================
+
+  // Storage for building one ObservationsSynced per frame. When a frame is started
+  // the Observations of the last frame are set aside, with the capacity of their
+  // vectors, and handed back out by add_observations(). Once the number of imagers
+  // and markers per frame settles, building a frame doesn't touch the heap. The
+  // frame is only valid until the next begin_frame(), anything that keeps it past
+  // that has to copy it.
+  class ObservationsSyncedArena
+  {
+    ObservationsSynced observations_synced_{Stamp{}, FrameId{}};
+    std::vector<Observations> spares_{};
+
+  public:
+    ObservationsSynced &begin_frame(Stamp stamp, FrameId camera_frame_id)
+    {
+      // Set aside back to front so the next frame gets the same buffer for the
+      // same position, they are likely to need the same capacity.
+      auto &v = observations_synced_.v_mutable();
+      for (auto it = v.rbegin(); it != v.rend(); ++it) {
+        spares_.emplace_back(std::move(*it));
+      }
+      observations_synced_.reset(stamp, camera_frame_id);
+      return observations_synced_;
+    }
+
+    // Add an empty Observations for an imager to the current frame. The reference
+    // is good until the next call.
+    Observations &add_observations(FrameId imager_frame_id)
+    {
+      auto &v = observations_synced_.v_mutable();
+      if (spares_.empty()) {
+        v.emplace_back(imager_frame_id);
+      } else {
+        v.emplace_back(std::move(spares_.back()));
+        spares_.pop_back();
+        v.back().reset(imager_frame_id);
+      }
+      return v.back();
+    }
+
+    const ObservationsSynced &observations_synced() const
+    { return observations_synced_; }
+  };
 }
@@ -2,6 +2,12 @@
 #pragma ide diagnostic ignored "modernize-use-nodiscard"
 #pragma ide diagnostic ignored "NotImplementedFunctions"
 
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "camera_info.hpp"
 #include "marker.hpp"
 #include "observation.hpp"
@@ -54,7 +60,276 @@ namespace fvlam
 
     bool equals(const ObservationsSeries &other, double tol = 1.0e-9, bool check_relative_also = true) const;
 
-    void save(const std::string &filename, Logger &logger) const; //
+    // load() reads either the YAML or the binary format. load() returns a series
+    // with an empty map, marker_length() 0, if the file could not be read.
+    bool save(const std::string &filename, Logger &logger) const; //
     static ObservationsSeries load(const std::string &filename, Logger &logger); //
+
+    // The binary format is laid out to be read in place by ObservationsSeriesMapped.
+    bool save_binary(const std::string &filename, Logger &logger) const; //
+    static ObservationsSeries load_binary(const std::string &filename, Logger &logger); //
+    static bool is_binary_file(const std::string &filename); //
+  };
+
+// ==============================================================================
+// ObservationsSeriesWriter class
+// ==============================================================================
+
+  // Writes an ObservationsSeries file one ObservationsSynced at a time so the series
+  // never has to be held in memory. The file is in the same format that
+  // ObservationsSeries::save writes and is loaded with ObservationsSeries::load.
+  // Each ObservationsSynced is one line so the file can be loaded up to the
+  // last flush even if the writer never closes it.
+  class ObservationsSeriesWriter
+  {
+    std::string filename_;
+    Logger &logger_;
+    std::ofstream os_{};
+    std::uint64_t written_count_{0};
+
+  public:
+    ObservationsSeriesWriter(std::string filename, Logger &logger) :
+      filename_{std::move(filename)}, logger_{logger}
+    {}
+
+    // Create the file and write the map and camera infos that the observations refer to.
+    bool open(const MarkerMap &map, const CameraInfoMap &camera_info_map);
+
+    void write(const ObservationsSynced &observations_synced);
+
+    void flush();
+
+    void close();
+
+    auto is_open() const
+    { return os_.is_open(); }
+
+    auto written_count() const
+    { return written_count_; }
+  };
+
+// ==============================================================================
+// ObservationsSeriesMapped class
+// ==============================================================================
+
+  // A binary ObservationsSeries file mapped into memory. The observations are
+  // fixed size records that are read in place. Nothing is parsed or copied
+  // until at() is called for a frame, so opening a long recording is quick and
+  // the pages are only read when they are used.
+  //
+  // File layout, all in host byte order and each array aligned to 8 bytes:
+  //  FileHeader
+  //  header: the marker map and camera infos as ObservationsSeries YAML
+  //  strings: a uint32 size and then the bytes of each frame id
+  //  FrameRecord[frame_count]
+  //  ObservationsRecord[observations_count]
+  //  ObservationRecord[observation_count]
+  class ObservationsSeriesMapped
+  {
+  public:
+    static constexpr std::uint32_t current_version = 1;
+
+    struct FileHeader
+    {
+      char magic_[8]; // "FVLAMOS"
+      std::uint32_t version_;
+      std::uint32_t byte_order_; // 0x01020304 as written by the host
+      std::uint64_t header_offset_;
+      std::uint64_t header_size_;
+      std::uint64_t strings_offset_;
+      std::uint64_t strings_count_;
+      std::uint64_t frames_offset_;
+      std::uint64_t frame_count_;
+      std::uint64_t observations_offset_;
+      std::uint64_t observations_count_;
+      std::uint64_t observation_offset_;
+      std::uint64_t observation_count_;
+    };
+
+    // One ObservationsSynced
+    struct FrameRecord
+    {
+      std::int32_t sec_;
+      std::uint32_t nanosec_;
+      std::uint32_t camera_frame_id_ix_; // Index into the strings
+      std::uint32_t observations_count_;
+      std::uint64_t observations_begin_; // Index of the first ObservationsRecord
+    };
+
+    // One Observations
+    struct ObservationsRecord
+    {
+      std::uint32_t imager_frame_id_ix_; // Index into the strings
+      std::uint32_t observation_count_;
+      std::uint64_t observation_begin_; // Index of the first ObservationRecord
+    };
+
+    // One Observation
+    struct ObservationRecord
+    {
+      std::uint64_t id_;
+      std::uint64_t is_valid_;
+      double corners_f_image_[8]; // x0, y0, x1, y1, ...
+      double cov_[4]; // Row major
+    };
+
+  private:
+    std::string filename_;
+    const std::uint8_t *data_{nullptr};
+    std::size_t data_size_{0};
+    MarkerMap map_{};
+    CameraInfoMap camera_info_map_{};
+    std::vector<std::string> strings_{};
+    const FileHeader *file_header_{nullptr};
+    const FrameRecord *frames_{nullptr};
+    const ObservationsRecord *observations_{nullptr};
+    const ObservationRecord *observation_{nullptr};
+
+    ObservationsSeriesMapped() = default;
+
+  public:
+    ~ObservationsSeriesMapped();
+
+    ObservationsSeriesMapped(const ObservationsSeriesMapped &) = delete;
+    ObservationsSeriesMapped &operator=(const ObservationsSeriesMapped &) = delete;
+
+    // Returns an empty pointer if the file can not be mapped or is not a valid binary series.
+    static std::unique_ptr<ObservationsSeriesMapped> open(const std::string &filename, Logger &logger);
+
+    auto &map() const
+    { return map_; }
+
+    auto &camera_info_map() const
+    { return camera_info_map_; }
+
+    std::size_t size() const
+    { return file_header_->frame_count_; }
+
+    const FrameRecord &frame(std::size_t i) const
+    { return frames_[i]; }
+
+    const ObservationsRecord &observations(std::size_t i) const
+    { return observations_[i]; }
+
+    const ObservationRecord &observation(std::size_t i) const
+    { return observation_[i]; }
+
+    const std::string &string(std::size_t ix) const
+    { return strings_[ix]; }
+
+    // Build the ObservationsSynced for frame i.
+    ObservationsSynced at(std::size_t i) const;
+  };
+
+// ==============================================================================
+// ObservationsSeriesReader class
+// ==============================================================================
+
+  // Reads a recorded ObservationsSeries one ObservationsSynced at a time. The map
+  // and camera infos are available as soon as the reader is open. Binary files
+  // are read in place through ObservationsSeriesMapped. YAML files are parsed one
+  // frame at a time. Either way memory use does not depend on the length of the
+  // recording.
+  //
+  // Sample code:
+  //  auto reader = fvlam::ObservationsSeriesReader::open(filename, logger);
+  //  for (auto &observations_synced : *reader) {
+  //    bmm->process(observations_synced, reader->camera_info_map());
+  //  }
+  //
+  class ObservationsSeriesReader
+  {
+  public:
+    // The source of frames for one file format.
+    class Source
+    {
+    public:
+      virtual ~Source() = default;
+
+      virtual bool next(ObservationsSynced &observations_synced) = 0;
+    };
+
+    class Iterator
+    {
+      ObservationsSeriesReader *reader_;
+      ObservationsSynced current_{Stamp{}, ""};
+
+    public:
+      explicit Iterator(ObservationsSeriesReader *reader) :
+        reader_{reader}
+      {
+        ++(*this);
+      }
+
+      Iterator &operator++()
+      {
+        if (reader_ != nullptr && !reader_->next(current_)) {
+          reader_ = nullptr;
+        }
+        return *this;
+      }
+
+      const ObservationsSynced &operator*() const
+      { return current_; }
+
+      const ObservationsSynced *operator->() const
+      { return &current_; }
+
+      bool operator!=(const Iterator &other) const
+      { return reader_ != other.reader_; }
+    };
+
+  private:
+    MarkerMap map_;
+    CameraInfoMap camera_info_map_;
+    std::unique_ptr<Source> source_;
+    std::uint64_t read_count_{0};
+
+  public:
+    ObservationsSeriesReader(MarkerMap map, CameraInfoMap camera_info_map, std::unique_ptr<Source> source) :
+      map_{std::move(map)}, camera_info_map_{std::move(camera_info_map)}, source_{std::move(source)}
+    {}
+
+    // Returns an empty pointer if the file can not be opened.
+    static std::unique_ptr<ObservationsSeriesReader> open(const std::string &filename, Logger &logger);
+
+    auto &map() const
+    { return map_; }
+
+    auto &camera_info_map() const
+    { return camera_info_map_; }
+
+    auto read_count() const
+    { return read_count_; }
+
+    // Returns false when there are no more frames.
+    bool next(ObservationsSynced &observations_synced)
+    {
+      if (!source_ || !source_->next(observations_synced)) {
+        source_.reset();
+        return false;
+      }
+      read_count_ += 1;
+      return true;
+    }
+
+    // Replaces the contents of batch with up to max_count frames. Returns the
+    // number of frames read, 0 at the end of the series.
+    std::size_t next_batch(std::vector<ObservationsSynced> &batch, std::size_t max_count)
+    {
+      batch.clear();
+      ObservationsSynced observations_synced{Stamp{}, ""};
+      while (batch.size() < max_count && next(observations_synced)) {
+        batch.emplace_back(std::move(observations_synced));
+      }
+      return batch.size();
+    }
+
+    // Frames can only be iterated once.
+    Iterator begin()
+    { return Iterator{this}; }
+
+    Iterator end()
+    { return Iterator{nullptr}; }
   };
-}
\ No newline at end of file
+}
@@ -5,6 +5,8 @@
 #pragma ide diagnostic ignored "OCUnusedStructInspection"
 #pragma ide diagnostic ignored "OCUnusedTypeAliasInspection"
 
+#include <array>
+
 #include <Eigen/Geometry>
 
 namespace fvlam
@@ -520,5 +522,79 @@ namespace fvlam
 
     bool equals(const Transform3WithCovariance &other, double tol = 1.0e-9, bool check_relative_also = true) const;
   };
-}
 
+// ==============================================================================
+// Batch point kernels
+// ==============================================================================
+
+  // Blocks of N points, one point per column, for the loops that put many points
+  // through one transform or one camera. With N fixed at compile time Eigen unrolls
+  // and vectorizes the products, and the rotation becomes a matrix once per block
+  // instead of a quaternion product per point.
+  template<int N>
+  using Points2 = Eigen::Matrix<double, 2, N>;
+  template<int N>
+  using Points3 = Eigen::Matrix<double, 3, N>;
+
+  template<std::size_t N>
+  inline Points3<N> to_points3(const std::array<Translate3, N> &translates)
+  {
+    Points3<N> points;
+    for (std::size_t i = 0; i < N; i += 1) {
+      points.col(i) = translates[i].t();
+    }
+    return points;
+  }
+
+  template<int N>
+  inline std::array<Translate3, N> from_points3(const Points3<N> &points)
+  {
+    std::array<Translate3, N> translates;
+    for (int i = 0; i < N; i += 1) {
+      translates[i] = Translate3{points.col(i)};
+    }
+    return translates;
+  }
+
+  template<int N>
+  inline std::array<Translate2, N> from_points2(const Points2<N> &points)
+  {
+    std::array<Translate2, N> translates;
+    for (int i = 0; i < N; i += 1) {
+      translates[i] = Translate2{points.col(i)};
+    }
+    return translates;
+  }
+
+  // points_f_a = t_a_b * points_f_b
+  template<int N>
+  inline Points3<N> transform_points(const Transform3 &t_a_b, const Points3<N> &points_f_b)
+  {
+    return (t_a_b.r().q().toRotationMatrix() * points_f_b).colwise() + t_a_b.t().t();
+  }
+
+  // Project points in a camera frame, z forward, to pixels with the k1, k2, p1, p2, k3
+  // distortion model that OpenCV uses and then the camera matrix. Returns false if
+  // any of the points is not in front of the camera, points_f_image is then not set.
+  template<int N>
+  inline bool project_points(const Eigen::Matrix3d &camera_matrix,
+                             const Eigen::Matrix<double, 5, 1> &dist_coeffs,
+                             const Points3<N> &points_f_camera,
+                             Points2<N> &points_f_image)
+  {
+    if (!(points_f_camera.row(2).array() > 0.).all()) {
+      return false;
+    }
+
+    Eigen::Array<double, 1, N> x = points_f_camera.row(0).array() / points_f_camera.row(2).array();
+    Eigen::Array<double, 1, N> y = points_f_camera.row(1).array() / points_f_camera.row(2).array();
+    Eigen::Array<double, 1, N> r2 = x * x + y * y;
+    Eigen::Array<double, 1, N> radial = 1. + r2 * (dist_coeffs(0) + r2 * (dist_coeffs(1) + r2 * dist_coeffs(4)));
+    Eigen::Array<double, 1, N> xd = x * radial + 2. * dist_coeffs(2) * x * y + dist_coeffs(3) * (r2 + 2. * x * x);
+    Eigen::Array<double, 1, N> yd = y * radial + dist_coeffs(2) * (r2 + 2. * y * y) + 2. * dist_coeffs(3) * x * y;
+
+    points_f_image.row(0) = (camera_matrix(0, 0) * xd + camera_matrix(0, 1) * yd + camera_matrix(0, 2)).matrix();
+    points_f_image.row(1) = (camera_matrix(1, 1) * yd + camera_matrix(1, 2)).matrix();
+    return true;
+  }
+}
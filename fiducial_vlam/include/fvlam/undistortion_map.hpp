@@ -0,0 +1,77 @@
+#pragma once
+#pragma ide diagnostic ignored "modernize-use-nodiscard"
+
+#include <vector>
+
+#include "camera_info.hpp"
+#include "observation.hpp"
+
+namespace fvlam
+{
+// ==============================================================================
+// UndistortionMap class
+// ==============================================================================
+
+  // A lookup table from distorted pixels to normalized image coordinates for one
+  // imager. Inverting the distortion model takes an iterative solve per point, the
+  // table does that once per grid node when the calibration is seen and a corner
+  // is then a bilinear interpolation and one Newton step. Corners turned into ideal pixels, K times the
+  // normalized coordinates, can be used with pinhole_camera_info() by any solver
+  // and the solver no longer evaluates the distortion model.
+  //
+  // The grid extends a margin past the image edges. Points outside it use the
+  // iterative solve. Made by CameraInfo::to<UndistortionMap>() so it can be held
+  // in a CalibrationCache.
+  class UndistortionMap
+  {
+  public:
+    using Normalized = Eigen::Vector2d;
+
+  private:
+    CameraInfo pinhole_camera_info_;
+    CameraInfo::CameraMatrix camera_matrix_;
+    CameraInfo::DistCoeffs dist_coeffs_;
+    bool no_distortion_;
+    double grid_step_;
+    double grid_origin_; // the pixel x and y of node 0, 0
+    int grid_cols_;
+    int grid_rows_;
+    std::vector<Normalized> grid_{}; // row major
+    double max_lookup_error_{0.};
+
+    // The pixel as normalized coordinates with the distortion still in.
+    Normalized distorted_normalized(const Translate2 &pixel) const;
+
+    // The distortion model and its derivative.
+    Normalized distort(const Normalized &undistorted, Eigen::Matrix2d &jacobian) const;
+
+  public:
+    static constexpr double default_grid_step = 8.;
+
+    explicit UndistortionMap(const CameraInfo &camera_info, double grid_step = default_grid_step);
+
+    // The camera_info this map was made from with the distortion coefficients zeroed.
+    const auto &pinhole_camera_info() const
+    { return pinhole_camera_info_; }
+
+    // The largest difference, in pixels, between a lookup and the iterative solve
+    // at the centers of the grid cells.
+    auto max_lookup_error() const
+    { return max_lookup_error_; }
+
+    // Undistort by inverting the distortion model iteratively.
+    Normalized normalized_exact(const Translate2 &pixel) const;
+
+    // Undistort with the lookup table.
+    Normalized normalized(const Translate2 &pixel) const;
+
+    // The pixel the point would be at with the pinhole model.
+    Translate2 ideal_pixel(const Translate2 &pixel) const;
+
+    Observation undistort(const Observation &observation) const;
+
+    // Replace undistorted's observations with observations' in ideal pixels,
+    // keeping undistorted's storage.
+    void undistort(const Observations &observations, Observations &undistorted) const;
+  };
+}
@@ -0,0 +1,24 @@
+#pragma once
+#pragma ide diagnostic ignored "modernize-use-nodiscard"
+
+#include "opencv2/core/mat.hpp"
+#include "sensor_msgs/msg/image.hpp"
+
+namespace fiducial_vlam
+{
+// ==============================================================================
+// Mono8Ingress class
+// ==============================================================================
+
+  // Produce a mono8 cv::Mat from an image message with as little copying as possible.
+  // If the message is already mono8, the returned Mat references the message buffer
+  // and is only valid while the message is alive. Otherwise the image is converted
+  // into a buffer that is owned by this object and reused from frame to frame.
+  class Mono8Ingress
+  {
+    cv::Mat pooled_gray_{};
+
+  public:
+    cv::Mat gray(const sensor_msgs::msg::Image &image_msg);
+  };
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fvlam/camera_info.hpp"
+#include "fvlam/observation.hpp"
+
+namespace fiducial_vlam
+{
+// ==============================================================================
+// InProcessObservations class
+// ==============================================================================
+
+  // Hands fvlam::ObservationsSynced from a publisher to subscribers of the same
+  // topic that are composed into the same process, skipping the conversion to and
+  // from fiducial_vlam_msgs. The registry is a function local static in an inline
+  // function so the node libraries loaded into one container share it.
+  //
+  // The callbacks run on the publisher's thread, not on the subscriber's executor,
+  // so a subscriber must guard any state that its executor also touches. Only
+  // subscribers that opt in are registered here. They do not also subscribe to the
+  // ROS topic so a frame is never delivered twice.
+  class InProcessObservations
+  {
+  public:
+    using Callback = std::function<void(const std::shared_ptr<const fvlam::CameraInfoMap> &camera_info_map,
+                                        const std::shared_ptr<const fvlam::ObservationsSynced> &observations_synced)>;
+
+  private:
+    // A callback is called with its slot locked so that a Subscription can wait
+    // out a call in progress before its subscriber goes away.
+    struct Slot
+    {
+      std::mutex mutex_{};
+      Callback callback_{};
+    };
+
+  public:
+    // Unregisters the callback when destroyed.
+    class Subscription
+    {
+      friend class InProcessObservations;
+
+      std::string topic_;
+      std::uint64_t key_;
+      std::shared_ptr<Slot> slot_;
+
+      Subscription(std::string topic, std::uint64_t key, std::shared_ptr<Slot> slot) :
+        topic_{std::move(topic)}, key_{key}, slot_{std::move(slot)}
+      {}
+
+    public:
+      // Waits for a callback that is running on a publisher's thread to return.
+      ~Subscription()
+      {
+        {
+          auto &r = registry();
+          std::lock_guard<std::mutex> lock{r.mutex_};
+          auto it = r.topics_.find(topic_);
+          if (it != r.topics_.end()) {
+            it->second.erase(key_);
+            if (it->second.empty()) {
+              r.topics_.erase(it);
+            }
+          }
+        }
+        std::lock_guard<std::mutex> lock{slot_->mutex_};
+        slot_->callback_ = Callback{};
+      }
+
+      Subscription(const Subscription &) = delete;
+      Subscription &operator=(const Subscription &) = delete;
+    };
+
+    // The topic should be fully qualified (see rclcpp::expand_topic_or_service_name)
+    // so that relative names from nodes in different namespaces don't collide.
+    static std::unique_ptr<Subscription> subscribe(const std::string &topic, Callback callback)
+    {
+      auto &r = registry();
+      std::lock_guard<std::mutex> lock{r.mutex_};
+      auto key = r.next_key_++;
+      auto slot = std::make_shared<Slot>();
+      slot->callback_ = std::move(callback);
+      r.topics_[topic].emplace(key, slot);
+      return std::unique_ptr<Subscription>{new Subscription{topic, key, std::move(slot)}};
+    }
+
+    static bool has_subscribers(const std::string &topic)
+    {
+      auto &r = registry();
+      std::lock_guard<std::mutex> lock{r.mutex_};
+      return r.topics_.find(topic) != r.topics_.end();
+    }
+
+    // Returns the number of subscribers the frame was handed to. The callbacks
+    // are called without the registry lock held so they may publish in turn.
+    static std::size_t publish(const std::string &topic,
+                               const std::shared_ptr<const fvlam::CameraInfoMap> &camera_info_map,
+                               const std::shared_ptr<const fvlam::ObservationsSynced> &observations_synced)
+    {
+      std::vector<std::shared_ptr<Slot>> slots{};
+      {
+        auto &r = registry();
+        std::lock_guard<std::mutex> lock{r.mutex_};
+        auto it = r.topics_.find(topic);
+        if (it == r.topics_.end()) {
+          return 0;
+        }
+        for (auto &key_slot : it->second) {
+          slots.emplace_back(key_slot.second);
+        }
+      }
+
+      std::size_t delivered{0};
+      for (auto &slot : slots) {
+        std::lock_guard<std::mutex> lock{slot->mutex_};
+        if (slot->callback_) {
+          slot->callback_(camera_info_map, observations_synced);
+          delivered += 1;
+        }
+      }
+      return delivered;
+    }
+
+  private:
+    struct Registry
+    {
+      std::mutex mutex_{};
+      std::uint64_t next_key_{0};
+      std::map<std::string, std::map<std::uint64_t, std::shared_ptr<Slot>>> topics_{};
+    };
+
+    static Registry &registry()
+    {
+      static Registry registry{};
+      return registry;
+    }
+  };
+}
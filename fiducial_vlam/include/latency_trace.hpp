@@ -0,0 +1,170 @@
+#pragma once
+#pragma ide diagnostic ignored "modernize-use-nodiscard"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fvlam/logger.hpp"
+#include "fvlam/observation.hpp"
+#include "stage_latency.hpp"
+
+namespace fiducial_vlam
+{
+// ==============================================================================
+// LatencyTrace class
+// ==============================================================================
+
+  // The age of a frame, now minus its image stamp, as it passes each checkpoint
+  // between vdet, vloc and vmap. Ages are measured against the system clock so
+  // they are only meaningful when the camera driver stamps images with the system
+  // clock (the ROS default) and, across processes, when the hosts are synced.
+  //
+  // There is one trace per process, a function local static in an inline function
+  // like the InProcessObservations registry, so nodes composed into one container
+  // record into the same trace and any one of them can report the whole pipeline.
+  // The histograms are always recorded into. Individual records are only kept,
+  // in a bounded ring, after set_keep_records(true) so they can be written out.
+  class LatencyTrace
+  {
+  public:
+    enum Checkpoints
+    {
+      det_image_received = 0, // vdet image callback
+      det_markers_detected, // vdet markers found in the image
+      det_observations_published, // vdet observations handed to ROS and in process subscribers
+      det_observations_synced, // vdet multi: observations from all cameras grouped and sent
+      loc_observations_received, // vloc observations callback
+      loc_pose_published, // vloc camera pose, odom and tf published
+      map_observations_received, // vmap observations callback
+      map_observations_processed, // vmap observations added to the map builder
+      checkpoint_count
+    };
+
+    struct Record
+    {
+      std::int64_t stamp_ns_;
+      std::int64_t age_ns_;
+      int checkpoint_;
+    };
+
+  private:
+    static constexpr std::size_t record_capacity = 65536;
+
+    std::array<LatencyHistogram, checkpoint_count> histograms_{};
+
+    std::mutex mutex_{};
+    bool keep_records_{false};
+    std::vector<Record> records_{};
+    std::size_t next_record_{0};
+
+    LatencyTrace() = default;
+
+  public:
+    static LatencyTrace &instance()
+    {
+      static LatencyTrace trace{};
+      return trace;
+    }
+
+    static const char *checkpoint_name(int checkpoint)
+    {
+      static const char *names[] = {"det_image_received", "det_markers_detected", "det_observations_published",
+                                    "det_observations_synced", "loc_observations_received", "loc_pose_published",
+                                    "map_observations_received", "map_observations_processed"};
+      return names[checkpoint];
+    }
+
+    LatencyTrace(const LatencyTrace &) = delete;
+    LatencyTrace &operator=(const LatencyTrace &) = delete;
+
+    void record(Checkpoints checkpoint, const fvlam::Stamp &stamp)
+    {
+      auto stamp_ns = static_cast<std::int64_t>(stamp.sec()) * 1000000000 + stamp.nanosec();
+      if (stamp_ns == 0) {
+        return;
+      }
+      auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+      auto age_ns = now_ns - stamp_ns;
+
+      histograms_[checkpoint].record(std::chrono::nanoseconds{age_ns});
+
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (!keep_records_) {
+        return;
+      }
+      Record record{stamp_ns, age_ns, checkpoint};
+      if (records_.size() < record_capacity) {
+        records_.emplace_back(record);
+      } else {
+        records_[next_record_] = record;
+      }
+      next_record_ = (next_record_ + 1) % record_capacity;
+    }
+
+    void set_keep_records(bool keep_records)
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      keep_records_ = keep_records;
+    }
+
+    // Only the checkpoints that frames have passed are reported.
+    void report(fvlam::Logger &logger) const
+    {
+      for (int checkpoint = 0; checkpoint < checkpoint_count; checkpoint += 1) {
+        auto summary = histograms_[checkpoint].summary();
+        if (summary.count_ == 0) {
+          continue;
+        }
+        logger.info() << std::fixed << std::setprecision(3)
+                      << "Age at " << checkpoint_name(checkpoint) << ": " << summary.count_
+                      << " samples, p50 " << summary.p50_ms_
+                      << " ms, p95 " << summary.p95_ms_
+                      << " ms, p99 " << summary.p99_ms_
+                      << " ms, max " << summary.max_ms_ << " ms";
+      }
+    }
+
+    // One line per record, oldest first: stamp_ns checkpoint age_ms. Lines with
+    // the same stamp trace one frame through the pipeline.
+    void write(const std::string &filename, fvlam::Logger &logger)
+    {
+      std::vector<Record> records{};
+      std::size_t first{0};
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        records = records_;
+        first = records_.size() < record_capacity ? 0 : next_record_;
+      }
+
+      std::ofstream out{filename};
+      if (!out) {
+        logger.warn() << "Could not open latency trace file " << filename;
+        return;
+      }
+      out << std::fixed << std::setprecision(3);
+      for (std::size_t i = 0; i < records.size(); i += 1) {
+        auto &record = records[(first + i) % records.size()];
+        out << record.stamp_ns_ << " " << checkpoint_name(record.checkpoint_) << " "
+            << 1.0e-6 * static_cast<double>(record.age_ns_) << "\n";
+      }
+      logger.info() << "Wrote " << records.size() << " latency trace records to " << filename;
+    }
+
+    void reset()
+    {
+      for (auto &histogram : histograms_) {
+        histogram.reset();
+      }
+      std::lock_guard<std::mutex> lock{mutex_};
+      records_.clear();
+      next_record_ = 0;
+    }
+  };
+}
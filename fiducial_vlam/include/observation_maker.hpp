@@ -4,6 +4,7 @@
 #include <memory>
 #include <string>
 
+#include "rclcpp/callback_group.hpp"
 #include "ros2_shared/param_macros.hpp"
 
 namespace rclcpp
@@ -19,10 +20,12 @@ namespace fvlam
   class ObservationsSynced; //
   class MapEnvironment; //
   class MarkerMap; //
+  class Transform3WithCovariance; //
 }
 
 namespace fiducial_vlam
 {
+  struct StageLatencies; //
   struct VdetContext; //
   struct VlocContext; //
 
@@ -35,9 +38,13 @@ namespace fiducial_vlam
   public:
     using OnObservationCallback = std::function<void(const fvlam::CameraInfoMap &,
                                                      const fvlam::ObservationsSynced &)>;
+    using OnWarmUpCallback = std::function<void(const fvlam::CameraInfoMap &)>;
 
     virtual ~ObservationMakerInterface() = default;
 
+    // A new map has been received.
+    virtual void on_marker_map(const fvlam::MarkerMap &marker_map) = 0;
+
     virtual void report_diagnostics(fvlam::Logger &logger,
                                     const rclcpp::Time &end_time) = 0;
   };
@@ -47,7 +54,9 @@ namespace fiducial_vlam
     rclcpp::Node &node,
     fvlam::Logger &logger,
     const fvlam::MapEnvironment &map_environment,
-    const ObservationMakerInterface::OnObservationCallback &on_observation_callback);
+    const ObservationMakerInterface::OnObservationCallback &on_observation_callback,
+    StageLatencies *stage_latencies = nullptr, // ingress, detect, publish and annotate times go here
+    const ObservationMakerInterface::OnWarmUpCallback &on_warm_up_callback = nullptr); // see det_warm_up_enable
 
   std::unique_ptr<ObservationMakerInterface> make_multi_observation_maker(
     VlocContext &cxt,
@@ -71,6 +80,9 @@ namespace fiducial_vlam
   public:
     virtual ~ObservationPublisherInterface() = default;
 
+    // Create the publisher now instead of with the first observations.
+    virtual void warm_up() = 0;
+
     virtual void publish_observations_synced(const fvlam::CameraInfoMap &camera_info_map,
                                              const fvlam::ObservationsSynced &observations_synced) = 0;
 
@@ -81,7 +93,10 @@ namespace fiducial_vlam
   std::unique_ptr<ObservationPublisherInterface> make_observation_publisher(
     rclcpp::Node &node,
     fvlam::Logger &logger,
-    const std::string &pub_observations_synced_topic);
+    const std::string &pub_observations_synced_topic,
+    int camera_info_every_n,
+    bool in_process,
+    bool packed);
 
 // ==============================================================================
 // MarkerMapSubscriberInterface class
@@ -91,10 +106,23 @@ namespace fiducial_vlam
   {
   public:
     using OnMapEnvironmentChanged = std::function<void(const fvlam::MapEnvironment &map_environment)>;
+    using OnMarkerMap = std::function<void(const fvlam::MarkerMap &marker_map)>;
 
     virtual ~MarkerMapSubscriberInterface() = default;
 
-    virtual fvlam::MarkerMap const &marker_map() const = 0;
+    // The most recently received map. The map is never modified once it has been
+    // handed out so the snapshot can be used from another thread. Cheap enough to
+    // call once per frame, it never waits for a map update.
+    virtual std::shared_ptr<const fvlam::MarkerMap> marker_map() const = 0;
+
+    // Called with each localized frame, the pose may be invalid. A subscriber that
+    // only holds part of the map uses it to decide which part.
+    virtual void update_residency(const fvlam::ObservationsSynced &observations_synced,
+                                  const fvlam::Transform3WithCovariance &t_map_camera)
+    {
+      (void) observations_synced;
+      (void) t_map_camera;
+    }
 
     virtual void report_diagnostics(fvlam::Logger &logger,
                                     const rclcpp::Time &end_time) = 0;
@@ -104,5 +132,22 @@ namespace fiducial_vlam
     VdetContext &cxt,
     rclcpp::Node &node,
     fvlam::Logger &logger,
-    const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed);
+    const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed,
+    const MarkerMapSubscriberInterface::OnMarkerMap &on_marker_map,
+    rclcpp::CallbackGroup::SharedPtr map_callback_group = nullptr); // nullptr->node's default group
+
+  // Instead of subscribing to the map topic, load the map from a directory of
+  // tiles written by fvlam::MarkerMapTiles::save. Only the tiles within
+  // tiles_radius tiles of the camera are held, they are loaded and evicted on a
+  // background thread as the camera moves. Until there is a pose, the tiles of
+  // the observed markers are loaded. The index is read again when it is saved
+  // again, and held tiles whose files changed are reloaded. The callbacks are
+  // called on the node's default callback group.
+  std::unique_ptr<MarkerMapSubscriberInterface> make_tiled_marker_map_subscriber(
+    const std::string &tiles_directory,
+    int tiles_radius,
+    rclcpp::Node &node,
+    fvlam::Logger &logger,
+    const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed,
+    const MarkerMapSubscriberInterface::OnMarkerMap &on_marker_map);
 }
\ No newline at end of file
@@ -0,0 +1,185 @@
+#pragma once
+#pragma ide diagnostic ignored "modernize-use-nodiscard"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+
+#include "fvlam/logger.hpp"
+
+namespace fiducial_vlam
+{
+// ==============================================================================
+// LatencyHistogram class
+// ==============================================================================
+
+  // A histogram of durations that can be recorded into from any number of threads
+  // without a lock. Buckets are spaced 8 per octave starting at 1 us, so a reported
+  // percentile is within about 9% of the true value. Durations longer than the last
+  // bucket (about 16 s) land in the last bucket. The max is exact.
+  class LatencyHistogram
+  {
+    static constexpr int buckets_per_octave = 8;
+    static constexpr int bucket_count = 24 * buckets_per_octave;
+
+    std::array<std::atomic<std::uint64_t>, bucket_count> counts_{};
+    std::atomic<std::uint64_t> max_ns_{0};
+
+    static int bucket_from_ns(std::uint64_t ns)
+    {
+      if (ns < 1000) {
+        return 0;
+      }
+      auto bucket = static_cast<int>(std::log2(static_cast<double>(ns) / 1000.) * buckets_per_octave) + 1;
+      return bucket < bucket_count ? bucket : bucket_count - 1;
+    }
+
+    // The upper edge of a bucket in milliseconds.
+    static double ms_from_bucket(int bucket)
+    {
+      return 0.001 * std::exp2(static_cast<double>(bucket) / buckets_per_octave);
+    }
+
+  public:
+    struct Summary
+    {
+      std::uint64_t count_{0};
+      double p50_ms_{0.};
+      double p95_ms_{0.};
+      double p99_ms_{0.};
+      double max_ms_{0.};
+    };
+
+    void record(std::chrono::steady_clock::duration duration)
+    {
+      auto ns = static_cast<std::uint64_t>(std::max(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(),
+        static_cast<std::chrono::nanoseconds::rep>(0)));
+
+      counts_[bucket_from_ns(ns)].fetch_add(1, std::memory_order_relaxed);
+
+      auto max_ns = max_ns_.load(std::memory_order_relaxed);
+      while (ns > max_ns && !max_ns_.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) {}
+    }
+
+    // The percentiles are read while other threads may be recording so they are
+    // only consistent to within the few samples that arrive during the read.
+    Summary summary() const
+    {
+      std::array<std::uint64_t, bucket_count> counts{};
+      std::uint64_t total{0};
+      for (int i = 0; i < bucket_count; i += 1) {
+        counts[i] = counts_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+      }
+
+      Summary summary{};
+      summary.count_ = total;
+      summary.max_ms_ = 1.0e-6 * static_cast<double>(max_ns_.load(std::memory_order_relaxed));
+      if (total == 0) {
+        return summary;
+      }
+
+      auto percentile = [&counts, total, &summary](double p) -> double
+      {
+        auto rank = static_cast<std::uint64_t>(std::ceil(p * static_cast<double>(total)));
+        std::uint64_t seen{0};
+        for (int i = 0; i < bucket_count; i += 1) {
+          seen += counts[i];
+          if (seen >= rank) {
+            return std::min(ms_from_bucket(i), summary.max_ms_);
+          }
+        }
+        return summary.max_ms_;
+      };
+
+      summary.p50_ms_ = percentile(0.50);
+      summary.p95_ms_ = percentile(0.95);
+      summary.p99_ms_ = percentile(0.99);
+      return summary;
+    }
+
+    void reset()
+    {
+      for (auto &count : counts_) {
+        count.store(0, std::memory_order_relaxed);
+      }
+      max_ns_.store(0, std::memory_order_relaxed);
+    }
+  };
+
+// ==============================================================================
+// StageLatencies class
+// ==============================================================================
+
+  // The duration of each stage of the image to pose pipeline. The stages may run
+  // on different threads.
+  struct StageLatencies
+  {
+    enum Stages
+    {
+      ingress = 0, // image message to mono8 cv::Mat
+      detect, // marker detection
+      localize, // camera pose from observations
+      publish_observations, // building and publishing the observations message
+      publish_pose, // building and publishing pose, odom and tf messages
+      annotate, // drawing on and publishing image_marked
+      stage_count
+    };
+
+    std::array<LatencyHistogram, stage_count> histograms_{};
+
+    static const char *stage_name(int stage)
+    {
+      static const char *names[] = {"ingress", "detect", "localize", "publish_observations", "publish_pose", "annotate"};
+      return names[stage];
+    }
+
+    LatencyHistogram &operator[](Stages stage)
+    { return histograms_[stage]; }
+
+    void report(fvlam::Logger &logger) const
+    {
+      for (int stage = 0; stage < stage_count; stage += 1) {
+        auto summary = histograms_[stage].summary();
+        logger.info() << std::fixed << std::setprecision(3)
+                      << "Latency " << stage_name(stage) << ": " << summary.count_
+                      << " samples, p50 " << summary.p50_ms_
+                      << " ms, p95 " << summary.p95_ms_
+                      << " ms, p99 " << summary.p99_ms_
+                      << " ms, max " << summary.max_ms_ << " ms";
+      }
+    }
+
+    void reset()
+    {
+      for (auto &histogram : histograms_) {
+        histogram.reset();
+      }
+    }
+  };
+
+  // Record the time from construction to destruction into a histogram.
+  class ScopedLatency
+  {
+    LatencyHistogram &histogram_;
+    std::chrono::steady_clock::time_point start_{std::chrono::steady_clock::now()};
+
+  public:
+    explicit ScopedLatency(LatencyHistogram &histogram) :
+      histogram_{histogram}
+    {}
+
+    ~ScopedLatency()
+    {
+      histogram_.record(std::chrono::steady_clock::now() - start_);
+    }
+
+    ScopedLatency(const ScopedLatency &) = delete;
+    ScopedLatency &operator=(const ScopedLatency &) = delete;
+  };
+}
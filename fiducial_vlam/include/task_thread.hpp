@@ -2,14 +2,21 @@
 #ifndef _TASK_THREAD_HPP
 #define _TASK_THREAD_HPP
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <chrono>
+#include <cstdint>
 #include <functional>
 #include <future>
+#include <deque>
+#include <exception>
+#include <limits>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace task_thread
 {
@@ -26,6 +33,9 @@ namespace task_thread
   //  cqi.try_pop(pi5);
   //  std::cout << *pi5 << " " << *cqi.pop() << std::endl;
   //
+  // The wait in pop() and pop_or_abort() is not polled. A consumer wakes as soon
+  // as an item is pushed or, after abort is set, notify_one() is called.
+  //
   template<typename TItem>
   class ConcurrentQueue
   {
@@ -63,9 +73,8 @@ namespace task_thread
     TItem pop()
     {
       std::unique_lock<std::mutex> lock{m_};
-      while (q_.empty()) {
-        cv_.wait_for(lock, std::chrono::milliseconds(250));
-      }
+      cv_.wait(lock, [this]() -> bool
+      { return !q_.empty(); });
       return Popper(q_).pop();
     }
 
@@ -80,12 +89,12 @@ namespace task_thread
       return true;
     }
 
+    // Set abort and then call notify_one() to wake the consumer.
     bool pop_or_abort(TItem &popped_item, volatile int &abort)
     {
       std::unique_lock<std::mutex> lock{m_};
-      while (!abort && q_.empty()) {
-        cv_.wait_for(lock, std::chrono::milliseconds(250));
-      }
+      cv_.wait(lock, [this, &abort]() -> bool
+      { return abort || !q_.empty(); });
       if (abort) {
         return false;
       }
@@ -94,8 +103,39 @@ namespace task_thread
       return true;
     }
 
+    // Replace anything in the queue with this item. Returns the number
+    // of items that were discarded.
+    std::size_t push_replace(TItem item)
+    {
+      std::unique_lock<std::mutex> lock{m_};
+      std::size_t discarded = q_.size();
+      while (!q_.empty()) {
+        q_.pop();
+      }
+      q_.push(std::move(item));
+      lock.unlock(); // Unlock so the notify-ee can access the resource immediately
+      cv_.notify_one();
+      return discarded;
+    }
+
+    // Push the item only if the queue is empty. Returns true if it was pushed.
+    bool push_if_empty(TItem item)
+    {
+      std::unique_lock<std::mutex> lock{m_};
+      if (!q_.empty()) {
+        return false;
+      }
+      q_.push(std::move(item));
+      lock.unlock();
+      cv_.notify_one();
+      return true;
+    }
+
+    // Taking the lock orders this notify after a waiter's test of its abort
+    // flag, so a flag set just before the call is never missed.
     void notify_one()
     {
+      { std::lock_guard<std::mutex> lock{m_}; }
       cv_.notify_one();
     }
 
@@ -112,6 +152,156 @@ namespace task_thread
     }
   };
 
+  // What a BoundedConcurrentQueue does with a push when it is full.
+  enum class OverflowPolicy
+  {
+    block,       // Wait for the consumer to make room.
+    drop_newest, // Discard the item being pushed.
+    drop_oldest, // Discard the item at the front of the queue.
+  };
+
+  // A ConcurrentQueue that holds at most capacity items so memory use stays
+  // bounded when the consumer falls behind. abort() wakes every blocked producer
+  // and consumer at once, after which push() and pop_or_abort() return false.
+  //
+  // Sample code:
+  //  task_thread::BoundedConcurrentQueue<int> bq{2, task_thread::OverflowPolicy::drop_oldest};
+  //  bq.push(1);
+  //  bq.push(2);
+  //  bq.push(3); // 1 is discarded
+  //  int i;
+  //  bq.pop_or_abort(i);
+  //  std::cout << i << " " << bq.dropped_count() << std::endl; // 2 1
+  //
+  template<typename TItem>
+  class BoundedConcurrentQueue
+  {
+    const std::size_t capacity_;
+    const OverflowPolicy policy_;
+    std::deque<TItem> q_{};
+    std::mutex m_{};
+    std::condition_variable not_empty_cv_{};
+    std::condition_variable not_full_cv_{};
+    std::condition_variable empty_cv_{};
+    std::uint64_t dropped_count_{0};
+    bool abort_{false};
+
+  public:
+    BoundedConcurrentQueue(std::size_t capacity, OverflowPolicy policy) :
+      capacity_{std::max(std::size_t{1}, capacity)}, policy_{policy}
+    {}
+
+    // Returns false if the item was not queued, because it was dropped or the
+    // queue was aborted.
+    bool push(TItem item)
+    {
+      std::unique_lock<std::mutex> lock{m_};
+      if (q_.size() >= capacity_) {
+        switch (policy_) {
+          case OverflowPolicy::block:
+            not_full_cv_.wait(lock, [this]() -> bool
+            { return abort_ || q_.size() < capacity_; });
+            break;
+
+          case OverflowPolicy::drop_newest:
+            dropped_count_ += 1;
+            return false;
+
+          case OverflowPolicy::drop_oldest:
+            dropped_count_ += 1;
+            q_.pop_front();
+            break;
+        }
+      }
+      if (abort_) {
+        return false;
+      }
+      q_.emplace_back(std::move(item));
+      lock.unlock();
+      not_empty_cv_.notify_one();
+      return true;
+    }
+
+    bool try_pop(TItem &popped_item)
+    {
+      std::unique_lock<std::mutex> lock{m_};
+      if (q_.empty()) {
+        return false;
+      }
+      popped_item = std::move(q_.front());
+      q_.pop_front();
+      auto drained = q_.empty();
+      lock.unlock();
+      not_full_cv_.notify_one();
+      if (drained) {
+        empty_cv_.notify_all();
+      }
+      return true;
+    }
+
+    // Waits for an item. Returns false once the queue has been aborted.
+    bool pop_or_abort(TItem &popped_item)
+    {
+      std::unique_lock<std::mutex> lock{m_};
+      not_empty_cv_.wait(lock, [this]() -> bool
+      { return abort_ || !q_.empty(); });
+      if (abort_) {
+        return false;
+      }
+      popped_item = std::move(q_.front());
+      q_.pop_front();
+      auto drained = q_.empty();
+      lock.unlock();
+      not_full_cv_.notify_one();
+      if (drained) {
+        empty_cv_.notify_all();
+      }
+      return true;
+    }
+
+    // Waits until the consumer has taken every item, or the queue is aborted.
+    void wait_until_empty()
+    {
+      std::unique_lock<std::mutex> lock{m_};
+      empty_cv_.wait(lock, [this]() -> bool
+      { return abort_ || q_.empty(); });
+    }
+
+    void abort()
+    {
+      {
+        std::lock_guard<std::mutex> lock{m_};
+        abort_ = true;
+      }
+      not_empty_cv_.notify_all();
+      not_full_cv_.notify_all();
+      empty_cv_.notify_all();
+    }
+
+    std::size_t capacity() const
+    {
+      return capacity_;
+    }
+
+    std::uint64_t dropped_count()
+    {
+      std::lock_guard<std::mutex> lock{m_};
+      return dropped_count_;
+    }
+
+    bool empty()
+    {
+      std::lock_guard<std::mutex> lock{m_};
+      return q_.empty();
+    }
+
+    std::size_t size()
+    {
+      std::lock_guard<std::mutex> lock{m_};
+      return q_.size();
+    }
+  };
+
   // TaskThread is instantiated with a work object. The functors in the queue
   // contain code that operates on the work object. The functors are executed
   // on a thread. A convenient way to return results from a functor calculation
@@ -139,11 +329,10 @@ namespace task_thread
   template<class TWork>
   class TaskThread
   {
-    ConcurrentQueue<std::packaged_task<void(TWork &)>> q_{};
+    BoundedConcurrentQueue<std::packaged_task<void(TWork &)>> q_;
     std::unique_ptr<TWork> work_;
-    std::thread thread_;
     bool run_on_start_thread_; // for debugging - execute task on the starting thread.
-    volatile int abort_{0};
+    std::thread thread_;
 
     static void run(TaskThread *tt)
     {
@@ -152,37 +341,49 @@ namespace task_thread
       std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
       std::packaged_task<void(TWork &)> task{};
-      while (tt->q_.pop_or_abort(task, tt->abort_)) {
+      while (tt->q_.pop_or_abort(task)) {
         task(*tt->work_);
       }
     }
 
   public:
-    TaskThread(std::unique_ptr<TWork> work, bool run_on_start_thread = false) :
-      work_{std::move(work)}, thread_{run, this}, run_on_start_thread_{run_on_start_thread}
+    // With a capacity of 0 the queue is unbounded. Otherwise policy says what a
+    // push to a full queue does. With OverflowPolicy::block a task must not push
+    // to its own TaskThread.
+    TaskThread(std::unique_ptr<TWork> work, bool run_on_start_thread = false,
+               std::size_t capacity = 0, OverflowPolicy policy = OverflowPolicy::block) :
+      q_{capacity > 0 ? capacity : std::numeric_limits<std::size_t>::max(), policy},
+      work_{std::move(work)}, run_on_start_thread_{run_on_start_thread}, thread_{run, this}
     {}
 
+    // Tasks still in the queue are discarded.
     ~TaskThread()
     {
-      abort_ = 1;
-      q_.notify_one();
+      q_.abort();
       thread_.join();
     }
 
     void abort()
     {
-      abort_ = 1;
-      q_.notify_one();
+      q_.abort();
     }
 
+    // Returns false if the task was not queued, because the overflow policy
+    // dropped it or the thread has been aborted.
     template <class TTask>
-    void push(TTask task)
+    bool push(TTask task)
     {
       if (run_on_start_thread_) {
         task(*work_);
-      } else {
-        q_.push(std::packaged_task<void(TWork &)>{std::move(task)});
+        return true;
       }
+      return q_.push(std::packaged_task<void(TWork &)>{std::move(task)});
+    }
+
+    // Tasks dropped by the overflow policy.
+    std::uint64_t dropped_count()
+    {
+      return q_.dropped_count();
     }
 
     bool empty()
@@ -195,10 +396,598 @@ namespace task_thread
       return q_.size();
     }
 
+    // Returns once the thread has taken every queued task. The last one might
+    // still be running.
     void wait_until_empty()
     {
-      while (!empty()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+      q_.wait_until_empty();
+    }
+  };
+
+  // LatestTaskThread is a pipeline stage that executes tasks on its own thread
+  // but holds at most one task waiting to run. Pushing a task discards any task
+  // that has not started yet so the stage always works on the newest input
+  // instead of falling further behind. There is no work object, the tasks
+  // capture whatever state they need. The thread is joined in the destructor so
+  // declare a LatestTaskThread after the objects its tasks reference.
+  //
+  // Sample code:
+  //  task_thread::LatestTaskThread stage{};
+  //  for (int i = 0; i < 10; i += 1) {
+  //    auto dropped = stage.push([i]() { std::cout << i << std::endl; });
+  //    std::cout << "dropped " << dropped << std::endl;
+  //  }
+  //
+  class LatestTaskThread
+  {
+    ConcurrentQueue<std::packaged_task<void()>> q_{};
+    volatile int abort_{0};
+    std::thread thread_;
+
+    static void run(LatestTaskThread *tt)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+      std::packaged_task<void()> task{};
+      while (tt->q_.pop_or_abort(task, tt->abort_)) {
+        task();
+      }
+    }
+
+  public:
+    LatestTaskThread() :
+      thread_{run, this}
+    {}
+
+    ~LatestTaskThread()
+    {
+      abort_ = 1;
+      q_.notify_one();
+      thread_.join();
+    }
+
+    // Returns the number of stale tasks that were discarded.
+    template<class TTask>
+    std::size_t push(TTask task)
+    {
+      return q_.push_replace(std::packaged_task<void()>{std::move(task)});
+    }
+
+    // Push the task only if no task is waiting, so a waiting task is never
+    // replaced. Returns true if it was pushed.
+    template<class TTask>
+    bool push_if_empty(TTask task)
+    {
+      return q_.push_if_empty(std::packaged_task<void()>{std::move(task)});
+    }
+
+    bool empty()
+    {
+      return q_.empty();
+    }
+  };
+
+  // SharedWorkerPool is a set of threads that many clients submit tasks to. Each
+  // client has a slot that holds at most one waiting task (newest wins like
+  // LatestTaskThread). The workers visit the slots round-robin so a busy client
+  // can not starve the others, and a client's tasks never run concurrently with
+  // each other so the client's objects only need to be used by one thread at a time.
+  // One pool is normally shared by all the nodes in a process, see shared().
+  //
+  // Sample code:
+  //  auto &pool = task_thread::SharedWorkerPool::shared(4);
+  //  task_thread::SharedWorkerPool::Client camera0{pool};
+  //  task_thread::SharedWorkerPool::Client camera1{pool};
+  //  camera0.push([]() { std::cout << "camera0" << std::endl; });
+  //  camera1.push([]() { std::cout << "camera1" << std::endl; });
+  //
+  class SharedWorkerPool
+  {
+    struct Slot
+    {
+      std::packaged_task<void()> task_{};
+      bool pending_{false};
+      bool running_{false};
+    };
+
+    std::mutex m_{};
+    std::condition_variable cv_{};
+    std::vector<Slot *> slots_{};
+    std::size_t next_slot_{0};
+    bool abort_{false};
+    std::vector<std::thread> threads_{};
+
+    // Find the next slot, round-robin, that has a task and is not running. Called with m_ locked.
+    Slot *next_ready_slot()
+    {
+      for (std::size_t i = 0; i < slots_.size(); i += 1) {
+        auto idx = (next_slot_ + i) % slots_.size();
+        auto slot = slots_[idx];
+        if (slot->pending_ && !slot->running_) {
+          next_slot_ = idx + 1;
+          return slot;
+        }
+      }
+      return nullptr;
+    }
+
+    static void run(SharedWorkerPool *pool)
+    {
+      std::unique_lock<std::mutex> lock{pool->m_};
+      while (true) {
+        Slot *slot{nullptr};
+        pool->cv_.wait(lock, [pool, &slot]() -> bool
+        {
+          return pool->abort_ || (slot = pool->next_ready_slot()) != nullptr;
+        });
+        if (pool->abort_) {
+          return;
+        }
+
+        auto task = std::move(slot->task_);
+        slot->pending_ = false;
+        slot->running_ = true;
+        lock.unlock();
+
+        task();
+
+        lock.lock();
+        slot->running_ = false;
+        pool->cv_.notify_all(); // This slot may have another task or a client may be waiting to leave.
+      }
+    }
+
+  public:
+    explicit SharedWorkerPool(std::size_t thread_count)
+    {
+      for (std::size_t i = 0; i < std::max(std::size_t{1}, thread_count); i += 1) {
+        threads_.emplace_back(run, this);
+      }
+    }
+
+    ~SharedWorkerPool()
+    {
+      {
+        std::unique_lock<std::mutex> lock{m_};
+        abort_ = true;
+      }
+      cv_.notify_all();
+      for (auto &thread : threads_) {
+        thread.join();
+      }
+    }
+
+    // The pool shared by the whole process. The thread count is set by the first caller.
+    static SharedWorkerPool &shared(std::size_t thread_count)
+    {
+      static SharedWorkerPool pool{thread_count};
+      return pool;
+    }
+
+    std::size_t thread_count() const
+    {
+      return threads_.size();
+    }
+
+    class Client
+    {
+      SharedWorkerPool &pool_;
+      Slot slot_{};
+
+    public:
+      explicit Client(SharedWorkerPool &pool) :
+        pool_{pool}
+      {
+        std::unique_lock<std::mutex> lock{pool_.m_};
+        pool_.slots_.emplace_back(&slot_);
+      }
+
+      // Wait for a running task then leave the pool. A waiting task is discarded.
+      ~Client()
+      {
+        std::unique_lock<std::mutex> lock{pool_.m_};
+        slot_.pending_ = false;
+        pool_.cv_.wait(lock, [this]() -> bool
+        { return !slot_.running_; });
+        auto it = std::find(pool_.slots_.begin(), pool_.slots_.end(), &slot_);
+        pool_.slots_.erase(it);
+        pool_.next_slot_ = 0;
+        slot_.task_ = std::packaged_task<void()>{};
+      }
+
+      // Returns the number of stale tasks that were discarded.
+      template<class TTask>
+      std::size_t push(TTask task)
+      {
+        std::unique_lock<std::mutex> lock{pool_.m_};
+        std::size_t discarded = slot_.pending_ ? 1 : 0;
+        slot_.task_ = std::packaged_task<void()>{std::move(task)};
+        slot_.pending_ = true;
+        lock.unlock();
+        pool_.cv_.notify_all();
+        return discarded;
+      }
+
+      // Push the task only if no task is waiting. Returns true if it was pushed.
+      template<class TTask>
+      bool push_if_empty(TTask task)
+      {
+        std::unique_lock<std::mutex> lock{pool_.m_};
+        if (slot_.pending_) {
+          return false;
+        }
+        slot_.task_ = std::packaged_task<void()>{std::move(task)};
+        slot_.pending_ = true;
+        lock.unlock();
+        pool_.cv_.notify_all();
+        return true;
+      }
+    };
+  };
+
+  // ForkJoinPool runs the iterations of a loop on a set of threads and returns
+  // when they are all done. The calling thread works on the loop too, so a pool
+  // with N threads runs N + 1 iterations at once. One loop runs at a time, a
+  // second caller waits for the first loop to finish.
+  //
+  // Sample code:
+  //  task_thread::ForkJoinPool pool{3};
+  //  std::vector<double> results(4);
+  //  pool.parallel_for(results.size(), [&results](std::size_t i)
+  //  { results[i] = std::sqrt(i); });
+  //
+  class ForkJoinPool
+  {
+    std::mutex loop_m_{}; // Held for the duration of a parallel_for
+    std::mutex m_{};
+    std::condition_variable start_cv_{};
+    std::condition_variable done_cv_{};
+    const std::function<void(std::size_t)> *fn_{nullptr};
+    std::size_t n_{0};
+    std::atomic<std::size_t> next_{0};
+    std::size_t active_{0};
+    std::uint64_t generation_{0};
+    bool abort_{false};
+    std::exception_ptr exception_{}; // The first exception thrown by fn in a parallel_for
+    std::vector<std::thread> threads_{};
+
+    void work()
+    {
+      for (auto i = next_.fetch_add(1); i < n_; i = next_.fetch_add(1)) {
+        try {
+          (*fn_)(i);
+        } catch (...) {
+          // Keep the first exception for parallel_for to rethrow and hand out no
+          // more indices. Calls already running finish as usual.
+          std::lock_guard<std::mutex> lock{m_};
+          if (!exception_) {
+            exception_ = std::current_exception();
+          }
+          next_ = n_;
+        }
+      }
+    }
+
+    static void run(ForkJoinPool *pool)
+    {
+      std::uint64_t generation{0};
+      std::unique_lock<std::mutex> lock{pool->m_};
+      while (true) {
+        pool->start_cv_.wait(lock, [pool, &generation]() -> bool
+        { return pool->abort_ || pool->generation_ != generation; });
+        if (pool->abort_) {
+          return;
+        }
+        generation = pool->generation_;
+        lock.unlock();
+
+        pool->work();
+
+        lock.lock();
+        if (--pool->active_ == 0) {
+          pool->done_cv_.notify_all();
+        }
+      }
+    }
+
+  public:
+    explicit ForkJoinPool(std::size_t thread_count)
+    {
+      for (std::size_t i = 0; i < thread_count; i += 1) {
+        threads_.emplace_back(run, this);
+      }
+    }
+
+    ~ForkJoinPool()
+    {
+      {
+        std::unique_lock<std::mutex> lock{m_};
+        abort_ = true;
+      }
+      start_cv_.notify_all();
+      for (auto &thread : threads_) {
+        thread.join();
+      }
+    }
+
+    std::size_t thread_count() const
+    {
+      return threads_.size();
+    }
+
+    // Call fn(i) for i in [0, n). Returns after all the calls have returned. If a
+    // call throws, the indices not yet started are skipped and the first
+    // exception is rethrown once every worker has stopped using fn.
+    void parallel_for(std::size_t n, const std::function<void(std::size_t)> &fn)
+    {
+      if (n <= 1 || threads_.empty()) {
+        for (std::size_t i = 0; i < n; i += 1) {
+          fn(i);
+        }
+        return;
+      }
+
+      std::lock_guard<std::mutex> loop_lock{loop_m_};
+      {
+        std::unique_lock<std::mutex> lock{m_};
+        fn_ = &fn;
+        n_ = n;
+        next_ = 0;
+        active_ = threads_.size();
+        generation_ += 1;
+      }
+      start_cv_.notify_all();
+
+      work();
+
+      std::unique_lock<std::mutex> lock{m_};
+      done_cv_.wait(lock, [this]() -> bool
+      { return active_ == 0; });
+      fn_ = nullptr;
+      if (exception_) {
+        std::exception_ptr exception{};
+        std::swap(exception, exception_);
+        std::rethrow_exception(exception);
+      }
+    }
+  };
+
+  // WorkStealingPool runs independent tasks on a set of worker threads. Each worker
+  // has its own deque. A task submitted from a worker goes on that worker's deque
+  // and is run newest first, which keeps nested work on a warm cache. Tasks
+  // submitted from other threads are spread round-robin. A worker with an empty
+  // deque steals the oldest task from another worker. Unlike TaskThread there is no
+  // work object, and unlike ForkJoinPool several callers can use the pool at once.
+  // One pool is normally shared by the whole process, see shared().
+  //
+  // Sample code:
+  //  auto &pool = task_thread::WorkStealingPool::shared();
+  //  auto f = pool.submit([]() { return 6 * 7; });
+  //  std::vector<double> results(1000);
+  //  pool.parallel_for(results.size(), [&results](std::size_t i)
+  //  { results[i] = std::sqrt(i); });
+  //  std::cout << f.get() << std::endl;
+  //
+  class WorkStealingPool
+  {
+    struct Worker
+    {
+      std::mutex m_{};
+      std::deque<std::packaged_task<void()>> tasks_{};
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_{};
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<std::size_t> next_worker_{0};
+    std::mutex sleep_m_{};
+    std::condition_variable sleep_cv_{};
+    bool abort_{false};
+    std::vector<std::thread> threads_{};
+
+    // The pool and index of the worker running on this thread, if any.
+    struct ThisWorker
+    {
+      WorkStealingPool *pool_{nullptr};
+      std::size_t index_{0};
+    };
+
+    static ThisWorker &this_worker()
+    {
+      static thread_local ThisWorker this_worker{};
+      return this_worker;
+    }
+
+    void enqueue(std::packaged_task<void()> task)
+    {
+      auto &tw = this_worker();
+      auto index = tw.pool_ == this ? tw.index_ : next_worker_.fetch_add(1) % workers_.size();
+      {
+        std::lock_guard<std::mutex> lock{workers_[index]->m_};
+        workers_[index]->tasks_.emplace_back(std::move(task));
+      }
+      queued_.fetch_add(1);
+      { std::lock_guard<std::mutex> lock{sleep_m_}; }
+      sleep_cv_.notify_one();
+    }
+
+    // Take a task from the back of our own deque, or else from the front of another's.
+    bool take_task(std::size_t index, std::packaged_task<void()> &task)
+    {
+      for (std::size_t i = 0; i < workers_.size(); i += 1) {
+        auto &worker = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock{worker.m_};
+        if (!worker.tasks_.empty()) {
+          if (i == 0) {
+            task = std::move(worker.tasks_.back());
+            worker.tasks_.pop_back();
+          } else {
+            task = std::move(worker.tasks_.front());
+            worker.tasks_.pop_front();
+          }
+          queued_.fetch_sub(1);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    static void run(WorkStealingPool *pool, std::size_t index)
+    {
+      pool->this_worker() = ThisWorker{pool, index};
+      std::packaged_task<void()> task{};
+      while (true) {
+        if (pool->take_task(index, task)) {
+          task();
+          continue;
+        }
+        std::unique_lock<std::mutex> lock{pool->sleep_m_};
+        pool->sleep_cv_.wait(lock, [pool]() -> bool
+        { return pool->abort_ || pool->queued_.load() > 0; });
+        if (pool->abort_) {
+          return;
+        }
+      }
+    }
+
+  public:
+    // A pool with no threads runs every task on the submitting thread.
+    explicit WorkStealingPool(std::size_t thread_count)
+    {
+      for (std::size_t i = 0; i < std::max(std::size_t{1}, thread_count); i += 1) {
+        workers_.emplace_back(std::make_unique<Worker>());
+      }
+      for (std::size_t i = 0; i < thread_count; i += 1) {
+        threads_.emplace_back(run, this, i);
+      }
+    }
+
+    // Tasks that have not started are discarded. Their futures report broken_promise.
+    ~WorkStealingPool()
+    {
+      {
+        std::unique_lock<std::mutex> lock{sleep_m_};
+        abort_ = true;
+      }
+      sleep_cv_.notify_all();
+      for (auto &thread : threads_) {
+        thread.join();
+      }
+    }
+
+    // The pool shared by the whole process. It has one thread fewer than the
+    // hardware because callers of parallel_for work on their loop too.
+    static WorkStealingPool &shared()
+    {
+      static WorkStealingPool pool{std::max(1u, std::thread::hardware_concurrency()) - 1};
+      return pool;
+    }
+
+    std::size_t thread_count() const
+    {
+      return threads_.size();
+    }
+
+    // Queue fn to run on a worker. The future holds its result or exception.
+    template<class TFn>
+    auto submit(TFn fn) -> std::future<std::invoke_result_t<TFn>>
+    {
+      std::packaged_task<std::invoke_result_t<TFn>()> task{std::move(fn)};
+      auto future = task.get_future();
+      if (threads_.empty()) {
+        task();
+      } else {
+        enqueue(std::packaged_task<void()>{[task = std::move(task)]() mutable -> void
+                                           { task(); }});
+      }
+      return future;
+    }
+
+    // Call fn(i) for i in [0, n) and return after all the calls have returned. The
+    // indices are handed out grain at a time. At most max_concurrency threads,
+    // counting the caller, work on the loop, 0 means as many as the pool has. The
+    // first exception thrown by fn is rethrown here after the loop has stopped.
+    // May be called from inside a task, the caller runs other queued tasks while it
+    // waits so nested loops don't deadlock.
+    void parallel_for(std::size_t n, const std::function<void(std::size_t)> &fn,
+                      std::size_t grain = 1, std::size_t max_concurrency = 0)
+    {
+      grain = std::max(std::size_t{1}, grain);
+      auto chunk_count = (n + grain - 1) / grain;
+      auto helper_count = std::min(threads_.size(), chunk_count > 0 ? chunk_count - 1 : 0);
+      if (max_concurrency > 0) {
+        helper_count = std::min(helper_count, max_concurrency - 1);
+      }
+
+      struct Loop
+      {
+        std::atomic<std::size_t> next_chunk_{0};
+        std::atomic<bool> failed_{false};
+        std::exception_ptr exception_{};
+        std::mutex m_{};
+        std::condition_variable done_cv_{};
+        std::size_t started_{0};
+        std::size_t finished_{0};
+      } loop{};
+
+      auto work = [&loop, &fn, n, grain, chunk_count]() -> void
+      {
+        for (auto c = loop.next_chunk_.fetch_add(1); c < chunk_count && !loop.failed_;
+             c = loop.next_chunk_.fetch_add(1)) {
+          try {
+            for (auto i = c * grain; i < std::min(n, (c + 1) * grain); i += 1) {
+              fn(i);
+            }
+          } catch (...) {
+            std::lock_guard<std::mutex> lock{loop.m_};
+            if (!loop.failed_.exchange(true)) {
+              loop.exception_ = std::current_exception();
+            }
+          }
+        }
+      };
+
+      for (std::size_t h = 0; h < helper_count; h += 1) {
+        enqueue(std::packaged_task<void()>{[&loop, &work]() -> void
+                                           {
+                                             {
+                                               std::lock_guard<std::mutex> lock{loop.m_};
+                                               loop.started_ += 1;
+                                             }
+                                             work();
+                                             std::lock_guard<std::mutex> lock{loop.m_};
+                                             loop.finished_ += 1;
+                                             loop.done_cv_.notify_all();
+                                           }});
+      }
+
+      work();
+
+      // Helpers that have not started yet are still in a deque. Run them, or
+      // whatever else is queued, rather than sleep.
+      auto &tw = this_worker();
+      auto index = tw.pool_ == this ? tw.index_ : 0;
+      std::packaged_task<void()> task{};
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock{loop.m_};
+          if (loop.finished_ == helper_count) {
+            break;
+          }
+          if (loop.started_ == helper_count) {
+            loop.done_cv_.wait(lock, [&loop, helper_count]() -> bool
+            { return loop.finished_ == helper_count; });
+            break;
+          }
+        }
+        if (take_task(index, task)) {
+          task();
+        } else {
+          std::this_thread::yield();
+        }
+      }
+
+      if (loop.exception_) {
+        std::rethrow_exception(loop.exception_);
       }
     }
   };
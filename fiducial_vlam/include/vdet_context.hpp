@@ -26,6 +26,8 @@ namespace fiducial_vlam
   //  Image Marked - A copy of the Image Raw frame with the fiducial markers annotated
   //    message: sensor_msgs::msg::Image
   //    enable parameter: det_pub_image_marked_enable (true)
+  //      Only annotated and published, on a background thread, when there are subscribers.
+  //    rate limit parameter: det_pub_image_marked_max_hz (0.0 - no limit)
   //    topic parameter: det_pub_image_marked_topic ("image_marked")
   //    frame_id parameter: det_pub_image_marked_frame_id (same as image_raw)
   //  Observations - The marker corner locations found in a single image
@@ -39,6 +41,11 @@ namespace fiducial_vlam
   #define VDET_ALL_PARAMS \
   /* Aruco markers detection parameters - done by opencv */ \
   PAMA_PARAM(det_corner_refinement_method, int, 2)        /* OpenCV 4.x argument to detect corners. 0 = none, 1 = subpix, 2 = contour, 3 = apriltag */\
+  PAMA_PARAM(det_roi_full_scan_every_n, int, 0)           /* 0->always scan the full frame, N->search only around last frame's markers with a full scan every N frames */\
+  PAMA_PARAM(det_roi_padding, double, 0.5)                /* ROI tracking: grow each marker's bounding box by this fraction of its size */\
+  PAMA_PARAM(det_detector_backend, int, 0)                /* 0->CPU, 1->OpenCV T-API (OpenCL) when available (launch only) */\
+  PAMA_PARAM(det_pyramid_scale, double, 1.0)              /* 1.0->full resolution search, <1.0->find candidates on an image scaled by this factor, refine at full resolution */\
+  PAMA_PARAM(det_restrict_dictionary_to_map, bool, false) /* decode only the ids in the map, rebuilt when a new map arrives (launch only) */\
   /* One or more imagers are components of a camera. This is the transform from this imager to the camera */\
   PAMA_PARAM(det_t_camera_imager_x, double, 0.)           /* imager->camera transform component */\
   PAMA_PARAM(det_t_camera_imager_y, double, 0.)           /* imager->camera transform component */\
@@ -53,9 +60,18 @@ namespace fiducial_vlam
 /* Subscription message quality */\
   PAMA_PARAM(det_sub_image_raw_best_effort_not_reliable, bool, true) /* subscribe to image_ros message with best_effort (gazebo camera) not reliable (tello_ros) (launch only) */\
   PAMA_PARAM(det_sub_camera_info_best_effort_not_reliable, bool, true) /* subscribe to camera_info message with best_effort (gazebo camera) not reliable (tello_ros) (launch only) */\
+  /* Threading */\
+  PAMA_PARAM(det_pipeline_enable, bool, false)            /* detect on a worker thread, a frame that arrives while busy replaces any waiting frame (launch only) */\
+  PAMA_PARAM(det_pipeline_pool_threads, int, 0)           /* 0->this detector has its own worker thread, N->detectors in this process share a pool of N threads (launch only) */\
+  PAMA_PARAM(det_log_async, bool, false)                  /* hand log lines to a background thread so logging doesn't stall the image callback (launch only) */\
+  PAMA_PARAM(det_warm_up_enable, bool, true)              /* create publishers at startup and run the detector on a blank image at the first camera_info and each new map (launch only) */\
   /* Messages to publish */\
   PAMA_PARAM(det_pub_image_marked_enable, bool, true)     /* publish the image_marked at every frame  */\
   PAMA_PARAM(det_pub_observations_enable, bool, true)     /* publish the observations at every frame  */\
+  PAMA_PARAM(det_pub_observations_in_process, bool, false) /* also hand observations directly to subscribers composed into this process, skip the ROS message if nobody else listens (launch only) */\
+  PAMA_PARAM(det_pub_observations_packed, bool, false) /* publish fiducial_vlam_msgs::msg::ObservationsSyncedPacked instead of ObservationsSynced, subscribers must match (launch only) */\
+  PAMA_PARAM(det_pub_camera_info_every_n, int, 1)       /* 1->full CameraInfo in every observations message, N->full every N messages and on change, only its id in between (launch only) */\
+  PAMA_PARAM(det_pub_image_marked_max_hz, double, 0.)     /* 0.0->annotate every frame, otherwise the most image_marked messages per second  */\
   /* Publish topics */\
   PAMA_PARAM(det_pub_image_marked_topic, std::string, "image_marked") /* topic for republishing the image with borders around the fiducial markers  */\
   PAMA_PARAM(det_pub_observations_topic, std::string, "observations") /* topic for publishing observations from this imager  */\
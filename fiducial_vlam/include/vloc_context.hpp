@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 
 #include "ros2_shared/param_macros.hpp"
@@ -75,6 +77,12 @@ namespace fiducial_vlam
   /* vlocnode flags */\
   PAMA_PARAM(loc_camera_algorithm, int, 0)                /* 0 - OpenCV SolvePnp, 1 - GTSAM factor */\
   PAMA_PARAM(loc_cmd, std::string, )                      /* commands to vloc_node (diagnostics, ...) */\
+  PAMA_PARAM(loc_pipeline_enable, bool, false)            /* localize and publish on a worker thread, only the newest waiting frame is kept (launch only) */\
+  PAMA_PARAM(loc_log_async, bool, false)                  /* hand log lines to a background thread so logging doesn't stall localization (launch only) */\
+  PAMA_PARAM(loc_callback_groups_enable, bool, false)     /* map subscription and diagnostics timer in their own callback groups, off the image path (launch only) */\
+  PAMA_PARAM(loc_executor_threads, int, 1)                /* vloc_main: 1->single threaded executor, N->multi threaded with N threads, 0->one per cpu (launch only) */\
+  PAMA_PARAM(loc_latency_trace_file, std::string, )       /* keep per frame latency trace records and write them to this file on the diagnostics command (launch only) */\
+  PAMA_PARAM(loc_warm_up_enable, bool, true)              /* create publishers and the localizer at startup and solve a made up frame when the detector warms up (launch only) */\
    /* Camera frame -> base link frame transform */\
   PAMA_PARAM(loc_t_base_camera_x, double, 0.)            /* camera->base transform component */\
   PAMA_PARAM(loc_t_base_camera_y, double, 0.)            /* camera->base transform component */\
@@ -83,14 +91,27 @@ namespace fiducial_vlam
   PAMA_PARAM(loc_t_base_camera_pitch, double, 0.0)   /* camera->base transform component */\
   PAMA_PARAM(loc_t_base_camera_yaw, double, -M_PI_2)          /* camera->base transform component */\
   /* Parameters for GTSAM localization techniques */\
-  PAMA_PARAM(loc_gtsam_factor_type, int, 2)               /* 0 - Resectioning, 1 - ProjectBetween, 2 - QuadResectioning, 3 - PoseBetween */ \
+  PAMA_PARAM(loc_gtsam_factor_type, int, 2)               /* 0 - Resectioning, 1 - ProjectBetween, 2 - QuadResectioning, 3 - PoseBetween, 4 - fixed-size resection solver (no factor graph) */ \
   PAMA_PARAM(loc_corner_measurement_sigma, double, 0.5)   /* Noise model in GTSAM for marker corners in the image (sigma in pixels) */\
   PAMA_PARAM(loc_use_marker_covariance, bool, false)      /* When localizing a camera, use the covariance stored in the marker. */\
+  PAMA_PARAM(loc_gtsam_tracking_mode, int, 0)             /* Initial value for the optimizer: 0 - OpenCV SolvePnp every frame, 1 - last pose, 2 - constant velocity prediction */\
+  PAMA_PARAM(loc_gtsam_tracking_max_error, double, 2.0)   /* A tracked solve with a larger RMS corner error (pixels) is redone from SolvePnp, not checked for factor type 3 */\
+  PAMA_PARAM(loc_gtsam_max_iterations, int, 0)            /* 0->optimizer default (100), N->stop after N iterations with the best estimate so far */\
+  PAMA_PARAM(loc_gtsam_max_solve_ms, double, 0.)          /* 0->no time budget, N->stop the solve after N ms with the best estimate so far */\
+  PAMA_PARAM(loc_undistort_lookup, bool, false)          /* undistort corners once per frame with a lookup table cached per calibration, then solve with the pinhole model */\
+  PAMA_PARAM(loc_static_scene_max_motion, double, 0.)     /* 0->solve every frame, N->reuse the last pose while the same markers are seen and no corner moves more than N pixels */\
   /* Subscription topics */\
   PAMA_PARAM(loc_sub_multi_observations_topic, std::string, ) /* topic for subscription to observations from vdet_nodes. separate with ":" (launch_only)  */\
+  PAMA_PARAM(loc_multi_sync_slop_ms, double, 10.0)   /* observations from different vdet_nodes with stamps this close are synced (launch only) */\
+  PAMA_PARAM(loc_multi_sync_deadline_ms, int, 0)      /* 0->wait for every vdet_node, N->send what has arrived N ms after the first (launch only) */\
   PAMA_PARAM(loc_sub_map_topic, std::string, "/fiducial_map") /* topic for subscription to fiducial_vlam_msgs::msg::Map (launch only)  */\
+  PAMA_PARAM(loc_map_tiles_dir, std::string, )         /* load the map from this vmap tile directory, only the tiles near the camera, instead of subscribing to the map topic (launch only) */\
+  PAMA_PARAM(loc_map_tiles_radius, int, 1)            /* with loc_map_tiles_dir: hold the tiles within N tiles of the camera's tile (launch only) */\
   /* Messages to publish */\
   PAMA_PARAM(loc_pub_observations_enable, bool, true)     /* publish the observations at every frame  */\
+  PAMA_PARAM(loc_pub_observations_in_process, bool, false) /* also hand observations directly to subscribers composed into this process, skip the ROS message if nobody else listens (launch only) */\
+  PAMA_PARAM(loc_pub_observations_packed, bool, false) /* publish fiducial_vlam_msgs::msg::ObservationsSyncedPacked instead of ObservationsSynced, subscribers must match (launch only) */\
+  PAMA_PARAM(loc_pub_camera_info_every_n, int, 1)       /* 1->full CameraInfo in every observations message, N->full every N messages and on change, only its id in between (launch only) */\
   PAMA_PARAM(loc_pub_camera_pose_enable, bool, true)      /* publish the pose of the camera at every frame  */\
   PAMA_PARAM(loc_pub_camera_odom_enable, bool, true)      /* publish the odometry of the camera at every frame  */\
   PAMA_PARAM(loc_pub_base_pose_enable, bool, true)        /* publish the pose of the base at every frame  */\
@@ -101,12 +122,14 @@ namespace fiducial_vlam
   PAMA_PARAM(loc_pub_tf_imager_per_marker_enable, bool, false) /* publish the camera tf as determined by each visible marker  */\
   PAMA_PARAM(loc_pub_tf_camera_per_marker_enable, bool, false) /* publish the camera tf as determined by each visible marker  */\
   PAMA_PARAM(loc_pub_tf_marker_per_marker_enable, bool, false) /* publish each marker tf as determined by camera pose and observation  */\
+  PAMA_PARAM(loc_pub_diagnostics_enable, bool, false)     /* publish per-stage latency percentiles once a second  */\
   /* Publish topics */\
   PAMA_PARAM(loc_pub_observations_topic, std::string, "/fiducial_observations") /* topic for publishing fiducial observations  */\
   PAMA_PARAM(loc_pub_camera_pose_topic, std::string, "camera_pose") /* topic for publishing camera pose  */\
   PAMA_PARAM(loc_pub_camera_odom_topic, std::string, "camera_odom") /* topic for publishing camera odometry  */\
   PAMA_PARAM(loc_pub_base_pose_topic, std::string, "base_pose") /* topic for publishing base pose  */\
   PAMA_PARAM(loc_pub_base_odom_topic, std::string, "base_odom") /* topic for publishing base odometry  */\
+  PAMA_PARAM(loc_pub_diagnostics_topic, std::string, "/diagnostics") /* topic for publishing diagnostic_msgs::msg::DiagnosticArray  */\
   /* Frame ids for published messages */\
   PAMA_PARAM(loc_pub_map_frame_id, std::string, "map")    /* frame_id for marker and tf messages - normally "map"  */\
   PAMA_PARAM(loc_pub_base_odom_child_frame_id, std::string, "base_link") /* frame_id for base_link frame  */\
@@ -124,18 +147,21 @@ namespace fiducial_vlam
 
   struct VlocDiagnostics
   {
-    std::uint64_t sub_camera_info_count_{0};
-    std::uint64_t sub_image_raw_count_{0};
-    std::uint64_t sub_map_count_{0};
-    std::uint64_t empty_observations_count_{0};
-    std::uint64_t invalid_t_map_camera_count_{0};
-    std::uint64_t pub_observations_count_{0};
-    std::uint64_t pub_camera_pose_count_{0};
-    std::uint64_t pub_camera_odom_count_{0};
-    std::uint64_t pub_base_pose_count_{0};
-    std::uint64_t pub_base_odom_count_{0};
-    std::uint64_t pub_tf_count_{0};
-    std::uint64_t pub_image_marked_count_{0};
+    // Updated from the image path, the localize stage and the command timer.
+    std::atomic<std::uint64_t> sub_camera_info_count_{0};
+    std::atomic<std::uint64_t> sub_image_raw_count_{0};
+    std::atomic<std::uint64_t> sub_map_count_{0};
+    std::atomic<std::uint64_t> empty_observations_count_{0};
+    std::atomic<std::uint64_t> invalid_t_map_camera_count_{0};
+    std::atomic<std::uint64_t> budget_t_map_camera_count_{0};
+    std::atomic<std::uint64_t> dropped_observations_count_{0};
+    std::atomic<std::uint64_t> pub_observations_count_{0};
+    std::atomic<std::uint64_t> pub_camera_pose_count_{0};
+    std::atomic<std::uint64_t> pub_camera_odom_count_{0};
+    std::atomic<std::uint64_t> pub_base_pose_count_{0};
+    std::atomic<std::uint64_t> pub_base_odom_count_{0};
+    std::atomic<std::uint64_t> pub_tf_count_{0};
+    std::atomic<std::uint64_t> pub_image_marked_count_{0};
     rclcpp::Time start_time_;
 
     explicit VlocDiagnostics(const rclcpp::Time &start_time) :
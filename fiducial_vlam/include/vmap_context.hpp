@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include "ros2_shared/param_macros.hpp"
 
 namespace rclcpp
@@ -16,7 +18,10 @@ namespace fiducial_vlam
 {
 #define VMAP_ALL_PARAMS \
   PAMA_PARAM(map_save_filename, std::string, "fiducial_marker_locations.yaml") /* name of the file to store the marker map in  */\
+  PAMA_PARAM(map_save_tiles_dir, std::string, )         /* also store the marker map split into tiles in this directory, for vloc_node's loc_map_tiles_dir */\
+  PAMA_PARAM(map_save_tile_size, double, 10.)           /* edge length of a map tile in meters */\
   PAMA_PARAM(map_load_filename, std::string, "fiducial_marker_locations.yaml")  /* name of the file to load the marker map from  */\
+  PAMA_PARAM(map_load_use_snapshot, bool, true)           /* load the map through a binary snapshot next to the map file, rebuilt when the file changes  */\
   PAMA_PARAM(map_init_style, int, 1)                      /* 0->marker id, pose from file, 1->marker id, pose as parameter, 2->camera pose as parameter  */\
   PAMA_PARAM(map_init_id, int, 0)                         /* marker id for map initialization */\
   PAMA_PARAM(map_init_pose_x, double, 2.)                 /* pose component for map initialization */\
@@ -33,6 +38,10 @@ namespace fiducial_vlam
   PAMA_PARAM(map_cmd, std::string, )                      /* commands to the build_marker_map system  */\
   PAMA_PARAM(map_corner_measurement_sigma, double, 2.0)   /* Noise model in GTSAM for marker corners in the image (sigma in pixels) */\
   PAMA_PARAM(map_compute_on_thread, int, 1)               /* Do heavy-duty computation on a thread. */\
+  PAMA_PARAM(map_log_async, bool, false)                  /* hand log lines to a background thread (launch only) */\
+  PAMA_PARAM(map_callback_groups_enable, bool, false)     /* take observations on their own callback group so map building and publishing never delay them (launch only) */\
+  PAMA_PARAM(map_executor_threads, int, 1)                /* vmap_main: 1->single threaded executor, N->multi threaded with N threads, 0->one per cpu (launch only) */\
+  PAMA_PARAM(map_latency_trace_file, std::string, )       /* keep per frame latency trace records and write them to this file on the diagnostics command (launch only) */\
   /* End of list */
 
 
@@ -40,13 +49,18 @@ namespace fiducial_vlam
   // Subscriptions:
   //  Observations - Only when a map is being built.
   //    messsage: fiducial_vlam_msgs::msg::Observations
-  //    topic parameter: psm_sub_observations_topic ("fiducial_observations")
+  //    topic parameter: psm_sub_observations_topic ("fiducial_observations") - several topics, one per robot
+  //      for a fleet map server, are separated by ':'
+  //    in-process parameter: psm_sub_observations_in_process (false) - take them from a publisher composed
+  //      into this process (det_pub_observations_in_process or loc_pub_observations_in_process) instead
   // Publications:
   //  Marker Map - At a regular interval. Either loaded from a file or as a map is being built from observations
   //    message: fiducial_vlam_msgs::msg::Map
   //    topic parameter: psm_pub_map_topic ("fiducial_map")
   //    frame_id parameter: psm_pub_map_frame_id ("map")
   //    publish frequency parameter: psm_pub_map_frequency_hz (0.5)
+  //    delta parameters: psm_pub_map_delta_enable (false), psm_pub_map_full_every_n (10) - a full map
+  //      every N periods and only the changed markers in between
   //  Marker Visualizations - message with flattened cubes for rviz to visualize the marker locations.
   //    message: visualization_msgs::msg::MarkerArray
   //    enable parameter: psm_pub_visuals_enable (true)
@@ -58,9 +72,13 @@ namespace fiducial_vlam
   //    topic: "tf"
   //    frame_id: same as Marker Map
   //    child_frame_id parameter: psl_pub_tf_marker_child_frame_id ("marker_")
+  //  Region - visuals and marker tfs can be limited to the markers near a point
+  //    parameters: psm_pub_region_radius (0 -> every marker), psm_pub_region_x/y/z
   //
 #define PSM_ALL_PARAMS \
-  PAMA_PARAM(psm_sub_observations_topic, std::string, "/fiducial_observations") /* topic for subscription to fiducial_vlam_msgs::msg::Observations  */\
+  PAMA_PARAM(psm_sub_observations_topic, std::string, "/fiducial_observations") /* topic, or ':' separated topics, for subscription to fiducial_vlam_msgs::msg::Observations  */\
+  PAMA_PARAM(psm_sub_observations_packed, bool, false) /* subscribe to fiducial_vlam_msgs::msg::ObservationsSyncedPacked instead of ObservationsSynced (launch only) */\
+  PAMA_PARAM(psm_sub_observations_in_process, bool, false) /* take observations directly from a publisher composed into this process instead of the topic (launch only) */\
   \
   PAMA_PARAM(psm_pub_visuals_enable, bool, true)          /* Enable publishing of the marker visualizations */\
   PAMA_PARAM(psm_pub_tf_marker_enable, bool, true)        /* Enable publishing of marker tfs */\
@@ -72,6 +90,12 @@ namespace fiducial_vlam
   PAMA_PARAM(psm_pub_tf_marker_child_frame_id, std::string, "marker_") /* frame_id prefix for each marker in the tf message  */\
   \
   PAMA_PARAM(psm_pub_map_frequency_hz, double, 0.)        /* Hz => rate at which the marker map is published */\
+  PAMA_PARAM(psm_pub_map_delta_enable, bool, false)       /* between full maps publish only the markers that changed, on periods where the map changed */\
+  PAMA_PARAM(psm_pub_map_full_every_n, int, 10)           /* with deltas enabled, publish the full map every N periods */\
+  PAMA_PARAM(psm_pub_region_radius, double, 0.)           /* 0->visuals and marker tfs for every marker, N->only markers within N of the region center */\
+  PAMA_PARAM(psm_pub_region_x, double, 0.)                /* region center component */\
+  PAMA_PARAM(psm_pub_region_y, double, 0.)                /* region center component */\
+  PAMA_PARAM(psm_pub_region_z, double, 0.)                /* region center component */\
   /* End of list */
 
 
@@ -79,13 +103,22 @@ namespace fiducial_vlam
 #define BMM_ALL_PARAMS \
   PAMA_PARAM(bmm_algorithm, int, 1)                       /* 0->record observations to file, 1->t_marker0_marker1, 2->isam_betweenfactor  */\
   PAMA_PARAM(bmm_use_every_n_msg, int, 1)                 /* 1=>use all frames, 2=>use every other frame, ...   */\
+  PAMA_PARAM(bmm_keyframe_enable, bool, false)            /* Only process frames that add a marker pair or have moved enough since the last processed frame  */\
+  PAMA_PARAM(bmm_keyframe_min_corner_motion, double, 20.) /* Mean corner motion (pixels) of shared markers that makes a frame a keyframe  */\
+  PAMA_PARAM(bmm_build_on_thread, bool, true)             /* process observations and build maps on a worker thread, not the executor  */\
+  PAMA_PARAM(bmm_build_queue_max_frames, int, 0)          /* 0->unbounded, N->drop arriving frames while N are waiting for the worker thread  */\
   PAMA_PARAM(bmm_recorded_observations_name, std::string, "observations.yaml") /* topic for publishing map of markers  */                   \
+  PAMA_PARAM(bmm_recorded_flush_every_n, int, 30)         /* flush the observations recording to disk after this many frames  */\
   PAMA_PARAM(bmm_solve_tmm_algorithm, int, 1)             /* 0->cv-SolvePnp+EstimateMAC  */\
   PAMA_PARAM(average_on_space_not_manifold, bool, true)   /* Estimate t_marker0_marker1 in TangentSpace or Manifold space  */\
+  PAMA_PARAM(bmm_tmm_undistort_lookup, bool, false)       /* Undistort corners with a lookup table cached per calibration before SolvePnp  */\
   PAMA_PARAM(bmm_tmm_try_shonan, bool, false)             /* Use Shonan Rotational Averaging to initialize optimization initial values  */\
   PAMA_PARAM(bmm_tmm_noise_strategy, int, 1)              /* 0->use estimate from samples, 1->use fixed sigmas if estimate is below fixed, 2->use fixed sigma  */\
   PAMA_PARAM(bmm_tmm_fixed_sigma_r, double, 0.1)          /* Fixed r sigma to use for measurement noise model when optimizing.  */\
   PAMA_PARAM(bmm_tmm_fixed_sigma_t, double, 0.3)          /* Fixed t sigma to use for measurement noise model when optimizing. */\
+  PAMA_PARAM(bmm_tmm_incremental, bool, false)            /* Refine the map with iSAM2 between builds instead of solving from scratch each build. */\
+  PAMA_PARAM(bmm_tmm_isam_relinearize_skip, int, 1)      /* bmm_tmm_incremental: relinearize every N builds, each build is one iSAM2 update with all the frames since the last (launch only) */\
+  PAMA_PARAM(bmm_tmm_shards, int, 0)                      /* 0->frames processed in order on the builder thread, N->frames processed concurrently on the worker pool, marker pairs split over N locked shards (launch only) */\
   /* End of list */
 
   struct VmapContext
@@ -97,10 +130,15 @@ namespace fiducial_vlam
 
   struct VmapDiagnostics
   {
-    std::uint64_t sub_observations_count_{0};
-    std::uint64_t process_observations_count_{0};
+    // Updated on a publisher's thread when observations are taken in-process.
+    std::atomic<std::uint64_t> sub_observations_count_{0};
+    std::atomic<std::uint64_t> process_observations_count_{0};
+    std::atomic<std::uint64_t> no_calibration_count_{0};
+    std::atomic<std::uint64_t> keyframe_skip_count_{0};
+    std::atomic<std::uint64_t> queue_full_skip_count_{0};
     std::uint64_t build_count{0};
     std::uint64_t pub_map_count_{0};
+    std::uint64_t pub_map_delta_count_{0};
     std::uint64_t pub_visuals_count_{0};
     std::uint64_t pub_tf_count_{0};
     rclcpp::Time start_time_;
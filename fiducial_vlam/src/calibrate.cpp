@@ -11,6 +11,7 @@
 #include "opencv2/calib3d.hpp"
 #include "opencv2/core.hpp"
 #include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc.hpp"
 #include "rclcpp/logging.hpp"
 #include "ros2_shared/string_printf.hpp"
 #include "task_thread.hpp"
@@ -21,6 +22,11 @@ namespace fiducial_vlam
 
   constexpr static auto time_display_captured_image_marked = std::chrono::milliseconds(1500);
 
+  // The motion gate compares thumbnails this wide. Detection is forced after
+  // this many frames are skipped so the board's presence is never stale for long.
+  constexpr static int motion_gate_thumbnail_width = 80;
+  constexpr static int motion_gate_max_skipped_frames = 5;
+
   constexpr static auto camera_info_file_name = "camera_info.yaml";
   constexpr static auto captured_image_file_name = "captured_image";
   constexpr static auto marked_image_file_name = "marked_image";
@@ -119,6 +125,18 @@ namespace fiducial_vlam
     return image_holder;
   }
 
+  std::shared_ptr<ImageHolder> ImageHolder::make_moving(const cv::Mat &gray,
+                                                        const rclcpp::Time &time_stamp,
+                                                        const ImageHolder &last_detected)
+  {
+    auto image_holder{std::make_shared<ImageHolder>(gray, time_stamp, last_detected.aruco_dictionary_)};
+    image_holder->aruco_ids_ = last_detected.aruco_ids_;
+    image_holder->aruco_corners_ = last_detected.aruco_corners_;
+    image_holder->board_projection_ = last_detected.board_projection_;
+    image_holder->moving_ = true;
+    return image_holder;
+  }
+
   void ImageHolder::detect_markers(const CharucoboardConfig &cbm,
                                    bool precise_not_quick)
   {
@@ -204,6 +222,30 @@ namespace fiducial_vlam
 
     bool capture_next_image_{false};
 
+    cv::Mat last_thumbnail_{};
+    std::shared_ptr<ImageHolder> last_detected_{};
+    int skipped_frame_count_{0};
+
+    // Compare a tiny version of this frame with the last one. A moving board can't
+    // be captured so the full resolution marker detection is skipped while the mean
+    // gray level change is over cal_motion_gate_threshold.
+    bool scene_moving(const cv::Mat &gray)
+    {
+      if (cal_cxt_.cal_motion_gate_threshold_ <= 0.) {
+        return false;
+      }
+
+      cv::Mat thumbnail{};
+      auto scale = static_cast<double>(motion_gate_thumbnail_width) / std::max(1, gray.cols);
+      cv::resize(gray, thumbnail, cv::Size{}, scale, scale, cv::INTER_AREA);
+
+      auto moving = !last_thumbnail_.empty() &&
+                    cv::norm(thumbnail, last_thumbnail_, cv::NORM_L1) / thumbnail.total() >
+                    cal_cxt_.cal_motion_gate_threshold_;
+      last_thumbnail_ = thumbnail;
+      return moving;
+    }
+
   public:
     CalibrateCameraProcessImageImpl(rclcpp::Logger &logger,
                                     const CalibrateContext &cal_cxt,
@@ -231,7 +273,17 @@ namespace fiducial_vlam
         return Observations{};
       }
 
-      auto image_holder = make_image_holder(gray->image, time_stamp);
+      // A manual capture always gets a full detection.
+      std::shared_ptr<ImageHolder> image_holder{};
+      if (scene_moving(gray->image) && !capture_next_image_ && last_detected_ &&
+          skipped_frame_count_ < motion_gate_max_skipped_frames) {
+        image_holder = ImageHolder::make_moving(gray->image, time_stamp, *last_detected_);
+        skipped_frame_count_ += 1;
+      } else {
+        image_holder = make_image_holder(gray->image, time_stamp);
+        last_detected_ = image_holder;
+        skipped_frame_count_ = 0;
+      }
 
       // Check if a manual capture has been requested
       if (capture_next_image_) {
@@ -245,7 +297,7 @@ namespace fiducial_vlam
       if (color_marked.dims != 0) {
 
         // Annotate the image with info we have collected so far.
-        if (!image_holder->aruco_ids().empty()) {
+        if (!image_holder->aruco_ids().empty() && !image_holder->moving()) {
           AnnotateImages::with_detected_markers(color_marked,
                                                 image_holder->aruco_corners(),
                                                 image_holder->aruco_ids());
@@ -251,9 +251,11 @@ namespace fiducial_vlam
       last_board_projection_ = image_holder->board_projection();
     }
 
+    // An image that skipped detection because the scene was moving is never stationary.
     bool test_stationary(std::shared_ptr<ImageHolder> &image_holder)
     {
-      return last_board_projection_.corner_pixel_delta(image_holder->board_projection()) < delta_threshold;
+      return !image_holder->moving() &&
+             last_board_projection_.corner_pixel_delta(image_holder->board_projection()) < delta_threshold;
     }
 
 
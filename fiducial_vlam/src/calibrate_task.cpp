@@ -12,9 +12,14 @@
 #include "opencv2/imgproc.hpp"
 #include "rclcpp/rclcpp.hpp"
 #include "ros2_shared/string_printf.hpp"
+#include "task_thread.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <map>
+#include <numeric>
+#include <random>
+#include <set>
 
 namespace fiducial_vlam
 {
@@ -523,10 +528,19 @@ namespace fiducial_vlam
       // Do some per captured image tasks to prepare for calibration.
       prepare_captured_images(res);
 
-      // Loop over the images finding the checkerboard junctions
-      for (auto &captured_iamge : captured_images_->captured_images()) {
-        interpolate_junction_locations(captured_iamge, res);
-      }
+      // Find the checkerboard junctions in each image.
+      auto &captured_images = captured_images_->captured_images();
+      res.junctions_f_board_.resize(captured_images.size());
+      res.junctions_f_image_.resize(captured_images.size());
+      res.junction_id_index_maps_.resize(captured_images.size());
+      task_thread::WorkStealingPool::shared().parallel_for(
+        captured_images.size(),
+        [this, &captured_images, &res](std::size_t i) -> void
+        {
+          interpolate_junction_locations(captured_images[i], res.captured_images_marked_[i],
+                                         res.junctions_f_board_[i], res.junctions_f_image_[i],
+                                         res.junction_id_index_maps_[i]);
+        });
 
       // Loop over all the possible calibration styles.
       for (int calib_style = 0; calib_style < CalibrationStyles::number_of_styles; calib_style += 1) {
@@ -562,22 +576,94 @@ namespace fiducial_vlam
       return task_res;
     }
 
+    // The number of ways to choose selection_size of set_size, or limit + 1 if that is
+    // more than limit.
+    static std::size_t count_combinations(std::size_t set_size, std::size_t selection_size, std::size_t limit)
+    {
+      if (selection_size > set_size) {
+        return 0;
+      }
+      selection_size = std::min(selection_size, set_size - selection_size);
+      std::size_t count{1};
+      for (std::size_t i = 1; i <= selection_size; i += 1) {
+        count = count * (set_size - selection_size + i) / i; // Exact at every step
+        if (count > limit) {
+          return limit + 1;
+        }
+      }
+      return count;
+    }
+
+    // Every combination of selection_size images, or a random sample of
+    // cal_bootstrap_max_sets distinct combinations if there are more than that.
+    // The sample is seeded the same way each time so a report can be reproduced.
+    std::vector<std::vector<std::size_t>> bootstrap_selections(std::size_t set_size,
+                                                               std::size_t selection_size) const
+    {
+      std::vector<std::vector<std::size_t>> selections{};
+      if (selection_size > set_size) {
+        return selections;
+      }
+      auto max_sets = static_cast<std::size_t>(std::max(0, cal_cxt_.cal_bootstrap_max_sets_));
+
+      if (max_sets == 0 || count_combinations(set_size, selection_size, max_sets) <= max_sets) {
+        GenerateCombinations<std::size_t> combinations(set_size, selection_size);
+        while (combinations.next()) {
+          selections.emplace_back(combinations.selection());
+        }
+        return selections;
+      }
+
+      std::mt19937 gen{5489u};
+      std::vector<std::size_t> images(set_size);
+      std::iota(images.begin(), images.end(), 0);
+      std::set<std::vector<std::size_t>> chosen{};
+      while (selections.size() < max_sets) {
+        std::shuffle(images.begin(), images.end(), gen);
+        std::vector<std::size_t> selection(images.begin(), images.begin() + selection_size);
+        std::sort(selection.begin(), selection.end());
+        if (chosen.insert(selection).second) {
+          selections.emplace_back(std::move(selection));
+        }
+      }
+      return selections;
+    }
+
+    // The subset calibrations are independent so they run on the shared worker pool.
+    // The results are appended in the same order as the selections.
     void calibrate_with_image_sets(int calibration_style,
                                    CalibrateCameraResult &res)
     {
       std::size_t set_size = res.junctions_f_image_.size();
       std::size_t reserve_size = static_cast<size_t>(std::round(set_size * cal_cxt_.cal_bootstrap_reserve_fraction_));
-      std::size_t selection_size = std::max(4UL, std::min(set_size, set_size - reserve_size));
-
-      GenerateCombinations<std::size_t> combinations(set_size, selection_size);
-      while (combinations.next()) {
-        do_calibration(calibration_style, combinations.selection(), res);
+      // With fewer than 4 images, GenerateCombinations has always used them all.
+      std::size_t selection_size = std::min(set_size, std::max(4UL, set_size - reserve_size));
+
+      auto selections = bootstrap_selections(set_size, selection_size);
+      std::vector<CalibrateCameraResult::CalibrationResult> cals(selections.size());
+      task_thread::WorkStealingPool::shared().parallel_for(
+        selections.size(),
+        [this, calibration_style, &selections, &cals, &res](std::size_t i) -> void
+        {
+          cals[i] = calibrate(calibration_style, selections[i], res);
+        });
+
+      for (auto &cal : cals) {
+        res.calibration_results_.emplace_back(std::move(cal));
       }
     }
 
     void do_calibration(int calibration_style,
                         const std::vector<size_t> &images_for_calibration,
                         CalibrateCameraResult &res)
+    {
+      res.calibration_results_.emplace_back(calibrate(calibration_style, images_for_calibration, res));
+    }
+
+    // Only reads res so several calibrations can run at once.
+    CalibrateCameraResult::CalibrationResult calibrate(int calibration_style,
+                                                       const std::vector<size_t> &images_for_calibration,
+                                                       const CalibrateCameraResult &res) const
     {
       CalibrateCameraResult::CalibrationResult cal{};
 
@@ -596,12 +682,12 @@ namespace fiducial_vlam
       }
 
       // Create references to the vectors to use for calibration.
-      std::vector<std::vector<cv::Vec3f>> &junctions_f_board{!images_for_calibration.empty() ?
-                                                             junctions_f_board_tmp :
-                                                             res.junctions_f_board_};
-      std::vector<std::vector<cv::Vec2f>> &junctions_f_image{!images_for_calibration.empty() ?
-                                                             junctions_f_image_tmp :
-                                                             res.junctions_f_image_};
+      const std::vector<std::vector<cv::Vec3f>> &junctions_f_board{!images_for_calibration.empty() ?
+                                                                   junctions_f_board_tmp :
+                                                                   res.junctions_f_board_};
+      const std::vector<std::vector<cv::Vec2f>> &junctions_f_image{!images_for_calibration.empty() ?
+                                                                   junctions_f_image_tmp :
+                                                                   res.junctions_f_image_};
 
       auto image_size{captured_images_->image_size()};
 
@@ -731,27 +817,51 @@ namespace fiducial_vlam
         cal.stdDeviationsIntrinsics_, cal.stdDeviationsExtrinsics_, cal.perViewErrors_,
         cal.flags_);
 
-      // Do our own calculation of the re-projection error.
-      calculate_reprojection_errors(junctions_f_board, junctions_f_image, cal);
+      // Do our own calculation of the re-projection error. This is over all the
+      // images so the images not used for a subset calibration validate it.
+      calculate_reprojection_errors(res.junctions_f_board_, res.junctions_f_image_, cal);
 
-      res.calibration_results_.emplace_back(std::move(cal));
+      return cal;
     }
 
-    void interpolate_junction_locations(std::shared_ptr<ImageHolder> captured_image,
-                                        CalibrateCameraResult &res)
+    // Only touches its own image and outputs so the images can be processed at once.
+    void interpolate_junction_locations(const std::shared_ptr<ImageHolder> &captured_image,
+                                        cv::Mat &captured_image_marked,
+                                        std::vector<cv::Vec3f> &js_f_board,
+                                        std::vector<cv::Vec2f> &js_f_image,
+                                        CalibrateCameraResult::JunctionIdIndexMap &j_id_index_map) const
     {
-      // Create a bunch of vectors to store the data we find.
-      std::vector<cv::Vec3f> js_f_board{};
-      std::vector<cv::Vec2f> js_f_image{};
-      CalibrateCameraResult::JunctionIdIndexMap j_id_index_map{};
-
-      // Figure out which image we can mark.
-      auto &captured_image_marked = res.captured_images_marked_[res.junctions_f_board_.size()];
-
       // Calculate the local homography for each found marker and build a map indexed by
       // the ArucoId.
       auto markers_homography = calculate_markers_homography(captured_image);
 
+      // Map the junctions adjacent to each marker from the board to the image with one
+      // perspectiveTransform per marker. The junctions are walked in the same order
+      // below and pick up their image locations in turn.
+      struct MarkerJunctions
+      {
+        std::vector<cv::Point2f> f_facade_{};
+        std::vector<cv::Point2f> f_image_{};
+        std::size_t next_{0};
+      };
+      std::map<ArucoId, MarkerJunctions> marker_junctions{};
+
+      for (JunctionId junction_id = 0; junction_id < cbm_.max_junction_id_; junction_id += 1) {
+        auto adjacent_aruco_ids = cbm_.get_adjacent_arucos(junction_id);
+        auto junction_location = cbm_.junction_id_to_junction_location(junction_id);
+        for (std::size_t i = 0; i < adjacent_aruco_ids.size(); i += 1) {
+          if (markers_homography.count(adjacent_aruco_ids[i]) > 0) {
+            marker_junctions[adjacent_aruco_ids[i]].f_facade_.emplace_back(
+              cv::Point2f(junction_location(0), junction_location(1)));
+          }
+        }
+      }
+
+      for (auto &mj : marker_junctions) {
+        cv::perspectiveTransform(mj.second.f_facade_, mj.second.f_image_,
+                                 std::get<0>(markers_homography.find(mj.first)->second));
+      }
+
       // Walk over all the junctions on the board.
       for (JunctionId junction_id = 0; junction_id < cbm_.max_junction_id_; junction_id += 1) {
 
@@ -761,7 +871,6 @@ namespace fiducial_vlam
 
         // Figure out where this junction is on the facade.
         auto junction_location = cbm_.junction_id_to_junction_location(junction_id);
-        std::vector<cv::Point2f> junction_f_facade{cv::Point2f(junction_location(0), junction_location(1))};
 
         // For both of the adjacent aruco markers, check that they have been detected, and
         // use the local marker homography to figure out where the junction should be in the
@@ -774,11 +883,10 @@ namespace fiducial_vlam
           auto find_ptr = markers_homography.find(adjacent_aruco_ids[i]);
           if (find_ptr != markers_homography.end()) {
 
-            // Map the junction location on the board to a the junction location in the image using the
-            // homography transformation of the adjacent aruco marker.
-            std::vector<cv::Point2f> junction_f_image;
-            cv::perspectiveTransform(junction_f_facade, junction_f_image, std::get<0>(find_ptr->second));
-            local_junctions_f_image.emplace_back(junction_f_image[0]);
+            // The junction location in the image using the homography transformation of
+            // the adjacent aruco marker.
+            auto &mj = marker_junctions[adjacent_aruco_ids[i]];
+            local_junctions_f_image.emplace_back(mj.f_image_[mj.next_++]);
 
             // Pick out the location of the corner of this marker that is closest to the
             // junction.
@@ -817,13 +925,9 @@ namespace fiducial_vlam
 
         AnnotateImages::with_detected_junction(captured_image_marked, local_junctions_f_image[0], win_size);
       }
-
-      res.junctions_f_board_.emplace_back(std::move(js_f_board));
-      res.junctions_f_image_.emplace_back(std::move(js_f_image));
-      res.junction_id_index_maps_.emplace_back(std::move(j_id_index_map));
     }
 
-    MarkersHomography calculate_markers_homography(std::shared_ptr<ImageHolder> captured_image)
+    MarkersHomography calculate_markers_homography(const std::shared_ptr<ImageHolder> &captured_image) const
     {
       MarkersHomography markers_homography{};
 
@@ -851,8 +955,8 @@ namespace fiducial_vlam
     // be and the image coordinates of the closest corners of the aruco markers. We want the window
     // size as large as possible be it can't include the aruco corner because the sub-pixel algorithm
     // might lock on to the aruco corner instead of the black square junction.
-    cv::Size calculate_sub_pix_win_size(cv::Point2f &mean_junction_f_image,
-                                        std::vector<cv::Point2f> &closest_corners_f_image)
+    static cv::Size calculate_sub_pix_win_size(cv::Point2f &mean_junction_f_image,
+                                               std::vector<cv::Point2f> &closest_corners_f_image)
     {
       // Figure out the window using one of the aruco corners.
       auto size2f{cv::Size2f(std::abs(mean_junction_f_image.x - closest_corners_f_image[0].x),
@@ -879,9 +983,9 @@ namespace fiducial_vlam
 
     void calculate_reprojection_errors(const std::vector<std::vector<cv::Vec3f>> &junctions_f_board,
                                        const std::vector<std::vector<cv::Vec2f>> &junctions_f_image,
-                                       CalibrateCameraResult::CalibrationResult &cal)
+                                       CalibrateCameraResult::CalibrationResult &cal) const
     {
-      std::vector<bool> included(cal.images_for_calibration_.size(), false);
+      std::vector<bool> included(junctions_f_board.size(), false);
       for (auto image_index : cal.images_for_calibration_) {
         included[image_index] = true;
       }
@@ -910,7 +1014,7 @@ namespace fiducial_vlam
 
     double calc_single_image_reprojection_error(const std::vector<cv::Vec3f> &junctions_f_board,
                                                 const std::vector<cv::Vec2f> &junctions_f_image,
-                                                const CalibrateCameraResult::CalibrationResult &cal)
+                                                const CalibrateCameraResult::CalibrationResult &cal) const
     {
       // Figure out the location of the board relative to the camera.
       cv::Vec3d rvec, tvec;
@@ -935,20 +1039,27 @@ namespace fiducial_vlam
       return std::sqrt(total_error_squared / junctions_f_image.size());
     }
 
+    // Each image is prepared on the shared worker pool.
     void prepare_captured_images(CalibrateCameraResult &res)
     {
-      for (auto &ci : captured_images_->captured_images()) {
-        // Redetect the aruco corners using precision
-        ci->detect_markers(cbm_, true);
-
-        // Create the color marked images for annotating
-        cv::Mat cim{};
-        cv::cvtColor(ci->gray(), cim, cv::COLOR_GRAY2BGR);
-        res.captured_images_marked_.push_back(cim);
-
-        // Annotate the charuco markers.
-        AnnotateImages::with_detected_markers(cim, ci->aruco_corners(), ci->aruco_ids());
-      }
+      auto &captured_images = captured_images_->captured_images();
+      res.captured_images_marked_.resize(captured_images.size());
+      task_thread::WorkStealingPool::shared().parallel_for(
+        captured_images.size(),
+        [this, &captured_images, &res](std::size_t i) -> void
+        {
+          auto &ci = captured_images[i];
+
+          // Redetect the aruco corners using precision
+          ci->detect_markers(cbm_, true);
+
+          // Create the color marked images for annotating
+          auto &cim = res.captured_images_marked_[i];
+          cv::cvtColor(ci->gray(), cim, cv::COLOR_GRAY2BGR);
+
+          // Annotate the charuco markers.
+          AnnotateImages::with_detected_markers(cim, ci->aruco_corners(), ci->aruco_ids());
+        });
     }
 
     std::string save_calibration(const rclcpp::Time &now,
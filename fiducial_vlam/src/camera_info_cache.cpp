@@ -0,0 +1,130 @@
+#include "camera_info_cache.hpp"
+
+namespace fiducial_vlam
+{
+// ==============================================================================
+// calibration_id function
+// ==============================================================================
+
+  namespace
+  {
+    // FNV-1a, good enough to tell calibrations apart and cheap enough to run on
+    // every published frame.
+    class Fnv1a
+    {
+      std::uint64_t h_{14695981039346656037ULL};
+
+    public:
+      void add(const void *data, std::size_t size)
+      {
+        auto p = static_cast<const unsigned char *>(data);
+        for (std::size_t i = 0; i < size; i += 1) {
+          h_ = (h_ ^ p[i]) * 1099511628211ULL;
+        }
+      }
+
+      template<class T>
+      void add(const T &value)
+      { add(&value, sizeof(value)); }
+
+      std::uint64_t value() const
+      { return h_; }
+    };
+  }
+
+  std::uint64_t calibration_id(const fiducial_vlam_msgs::msg::CameraInfo &msg)
+  {
+    Fnv1a h{};
+    h.add(msg.imager_frame_id.data(), msg.imager_frame_id.size());
+    h.add(msg.width);
+    h.add(msg.height);
+    h.add(msg.fx);
+    h.add(msg.fy);
+    h.add(msg.cx);
+    h.add(msg.cy);
+    h.add(msg.k1);
+    h.add(msg.k2);
+    h.add(msg.p1);
+    h.add(msg.p2);
+    h.add(msg.k3);
+    h.add(msg.is_valid);
+    h.add(msg.t_camera_imager.translation.x);
+    h.add(msg.t_camera_imager.translation.y);
+    h.add(msg.t_camera_imager.translation.z);
+    h.add(msg.t_camera_imager.rotation.x);
+    h.add(msg.t_camera_imager.rotation.y);
+    h.add(msg.t_camera_imager.rotation.z);
+    h.add(msg.t_camera_imager.rotation.w);
+    auto id = h.value();
+    return id != 0 ? id : 1;
+  }
+
+// ==============================================================================
+// CameraInfoCache class
+// ==============================================================================
+
+  const fvlam::CameraInfo *CameraInfoCache::camera_info(fiducial_vlam_msgs::msg::CameraInfo &msg)
+  {
+    auto entry = entries_.find(msg.imager_frame_id);
+
+    // A publisher that does not version its calibration sends an id of 0. Its
+    // messages are decoded every time.
+    if (msg.calibration_id != 0 &&
+        entry != entries_.end() &&
+        entry->second.calibration_id_ == msg.calibration_id) {
+      return &entry->second.camera_info_;
+    }
+
+    // Only the id was sent and it doesn't match what we have.
+    if (msg.width == 0) {
+      missing_count_ += 1;
+      return nullptr;
+    }
+
+    decode_count_ += 1;
+    auto camera_info = fvlam::CameraInfo::from(msg);
+    auto result = entries_.insert_or_assign(msg.imager_frame_id, Entry{msg.calibration_id, camera_info});
+    camera_info_map_.reset(); // The cached map may hold the old calibration.
+    return &result.first->second.camera_info_;
+  }
+
+  template<class TObservationsSynced>
+  std::shared_ptr<const fvlam::CameraInfoMap> CameraInfoCache::camera_info_map_from(TObservationsSynced &msg)
+  {
+    auto changed = !camera_info_map_ || camera_info_map_->size() != msg.observations_synced.size();
+
+    for (auto &observations_msg : msg.observations_synced) {
+      auto &ci_msg = observations_msg.camera_info;
+      auto decode_count = decode_count_;
+      if (camera_info(ci_msg) == nullptr) {
+        return std::shared_ptr<const fvlam::CameraInfoMap>{};
+      }
+      changed = changed ||
+                decode_count != decode_count_ ||
+                camera_info_map_->m().count(ci_msg.imager_frame_id) == 0;
+    }
+
+    if (changed) {
+      auto camera_info_map = std::make_shared<fvlam::CameraInfoMap>();
+      for (auto &observations_msg : msg.observations_synced) {
+        auto &imager_frame_id = observations_msg.camera_info.imager_frame_id;
+        camera_info_map->m_mutable().emplace(imager_frame_id, entries_.find(imager_frame_id)->second.camera_info_);
+      }
+      camera_info_map_ = std::move(camera_info_map);
+    }
+
+    return camera_info_map_;
+  }
+
+  std::shared_ptr<const fvlam::CameraInfoMap> CameraInfoCache::camera_info_map(
+    fiducial_vlam_msgs::msg::ObservationsSynced &msg)
+  {
+    return camera_info_map_from(msg);
+  }
+
+  std::shared_ptr<const fvlam::CameraInfoMap> CameraInfoCache::camera_info_map(
+    fiducial_vlam_msgs::msg::ObservationsSyncedPacked &msg)
+  {
+    return camera_info_map_from(msg);
+  }
+}
@@ -1,7 +1,9 @@
+#include <algorithm>
 
 #include "fiducial_vlam_msgs/msg/map.hpp"
 #include "fiducial_vlam_msgs/msg/observations.hpp"
 #include "fiducial_vlam_msgs/msg/observations_synced.hpp"
+#include "fiducial_vlam_msgs/msg/observations_synced_packed.hpp"
 #include "fvlam/camera_info.hpp"
 #include "fvlam/marker.hpp"
 #include "fvlam/observation.hpp"
@@ -170,6 +172,18 @@ namespace fvlam
     return camera_info_map;
   }
 
+  template<>
+  CameraInfoMap CameraInfoMap::from<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>(
+    fiducial_vlam_msgs::msg::ObservationsSyncedPacked &other)
+  {
+    auto camera_info_map = CameraInfoMap{};
+    for (auto &observations_msg : other.observations_synced) {
+      auto camera_info = CameraInfo::from(observations_msg.camera_info);
+      camera_info_map.m_mutable().emplace(camera_info.imager_frame_id(), camera_info);
+    }
+    return camera_info_map;
+  }
+
   // ==============================================================================
 // from fvlam/marker.hpp
 // ==============================================================================
@@ -278,14 +292,22 @@ namespace fvlam
   }
 
   template<>
-  Observations Observations::from<fiducial_vlam_msgs::msg::Observations>(
+  void Observations::assign_from<fiducial_vlam_msgs::msg::Observations>(
     fiducial_vlam_msgs::msg::Observations &other)
   {
-    fvlam::Observations observations{other.camera_info.imager_frame_id};
+    reset(other.camera_info.imager_frame_id);
+    v_.reserve(other.observations.size());
     for (auto &obs : other.observations) {
-      auto observation = Observation::from(obs);
-      observations.v_mutable().emplace_back(observation);
+      v_.emplace_back(Observation::from(obs));
     }
+  }
+
+  template<>
+  Observations Observations::from<fiducial_vlam_msgs::msg::Observations>(
+    fiducial_vlam_msgs::msg::Observations &other)
+  {
+    fvlam::Observations observations{other.camera_info.imager_frame_id};
+    observations.assign_from(other);
     return observations;
   }
 
@@ -306,7 +328,8 @@ namespace fvlam
     <std::vector<fiducial_vlam_msgs::msg::Observation>>() const
   {
     std::vector<fiducial_vlam_msgs::msg::Observation> msgs;
-    for (auto observation : v_) {
+    msgs.reserve(v_.size());
+    for (auto &observation : v_) {
       fiducial_vlam_msgs::msg::Observation msg;
       msg.id = observation.id();
       msg.x0 = observation.corners_f_image()[0].x();
@@ -321,4 +344,62 @@ namespace fvlam
     }
     return msgs;
   }
+
+  template<>
+  void Observations::assign_from<fiducial_vlam_msgs::msg::ObservationsPacked>(
+    fiducial_vlam_msgs::msg::ObservationsPacked &other)
+  {
+    reset(other.camera_info.imager_frame_id);
+    auto count = std::min(other.ids.size(), other.corners.size() / 8);
+    v_.reserve(count);
+    const float *c = other.corners.data();
+    for (std::size_t i = 0; i < count; i += 1, c += 8) {
+      v_.emplace_back(Observation{other.ids[i],
+                                  c[0], c[1],
+                                  c[2], c[3],
+                                  c[4], c[5],
+                                  c[6], c[7]});
+    }
+  }
+
+  template<>
+  Observations Observations::from<fiducial_vlam_msgs::msg::ObservationsPacked>(
+    fiducial_vlam_msgs::msg::ObservationsPacked &other)
+  {
+    fvlam::Observations observations{other.camera_info.imager_frame_id};
+    observations.assign_from(other);
+    return observations;
+  }
+
+  // The camera_info is left for the caller to fill in.
+  template<>
+  fiducial_vlam_msgs::msg::ObservationsPacked Observations::to
+    <fiducial_vlam_msgs::msg::ObservationsPacked>() const
+  {
+    fiducial_vlam_msgs::msg::ObservationsPacked msg;
+    msg.ids.resize(v_.size());
+    msg.corners.resize(v_.size() * 8);
+    float *c = msg.corners.data();
+    for (std::size_t i = 0; i < v_.size(); i += 1) {
+      msg.ids[i] = v_[i].id();
+      for (auto &corner : v_[i].corners_f_image()) {
+        *c++ = static_cast<float>(corner.x());
+        *c++ = static_cast<float>(corner.y());
+      }
+    }
+    return msg;
+  }
+
+  template<>
+  ObservationsSynced ObservationsSynced::from<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>(
+    fiducial_vlam_msgs::msg::ObservationsSyncedPacked &other)
+  {
+    auto stamp = Stamp::from(other.header.stamp);
+    auto observations_synced = ObservationsSynced{stamp, other.header.frame_id};
+    observations_synced.v_mutable().reserve(other.observations_synced.size());
+    for (auto &observations_msg : other.observations_synced) {
+      observations_synced.v_mutable().emplace_back(Observations::from(observations_msg));
+    }
+    return observations_synced;
+  }
 }
@@ -0,0 +1,139 @@
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fvlam/localize_camera_interface.hpp"
+#include "fvlam/logger.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/observation.hpp"
+#include "opencv2/imgcodecs.hpp"
+
+// Replay a directory of recorded frames through FiducialMarker::detect_markers and
+// report the latency of each frame and the throughput for every corner refinement
+// method. ROS is not used so the results are repeatable from run to run.
+//
+// usage: detect_benchmark_main <image_directory> [dictionary_id] [iterations]
+
+namespace
+{
+  std::vector<cv::Mat> load_frames(const std::string &directory)
+  {
+    std::vector<std::filesystem::path> paths;
+    for (auto &entry : std::filesystem::directory_iterator(directory)) {
+      auto extension = entry.path().extension().string();
+      std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+      if (extension == ".png" || extension == ".jpg" || extension == ".jpeg" ||
+          extension == ".bmp" || extension == ".pgm" || extension == ".tif" || extension == ".tiff") {
+        paths.emplace_back(entry.path());
+      }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<cv::Mat> frames;
+    for (auto &path : paths) {
+      auto gray = cv::imread(path.string(), cv::IMREAD_GRAYSCALE);
+      if (!gray.empty()) {
+        frames.emplace_back(gray);
+      }
+    }
+    return frames;
+  }
+
+  double percentile(const std::vector<double> &sorted, double p)
+  {
+    auto index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+  }
+
+  void run_method(int corner_refinement_method,
+                  const fvlam::MapEnvironment &map_environment,
+                  std::vector<cv::Mat> &frames,
+                  int iterations,
+                  fvlam::Logger &logger)
+  {
+    int roi_full_scan_every_n{0};
+    double roi_padding{0.5};
+    double pyramid_scale{1.0};
+    int detector_backend{0};
+    auto fm_context = fvlam::FiducialMarkerContext{corner_refinement_method,
+                                                   roi_full_scan_every_n,
+                                                   roi_padding,
+                                                   pyramid_scale,
+                                                   detector_backend};
+    auto fiducial_marker = fvlam::make_fiducial_marker(fm_context, map_environment, logger);
+
+    // One pass to warm up the caches and the detector state.
+    for (auto &frame : frames) {
+      fiducial_marker->detect_markers(frame, "");
+    }
+
+    std::vector<double> latencies_ms;
+    latencies_ms.reserve(frames.size() * iterations);
+    std::size_t marker_count{0};
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i += 1) {
+      for (auto &frame : frames) {
+        auto frame_start = std::chrono::steady_clock::now();
+        auto observations = fiducial_marker->detect_markers(frame, "");
+        auto frame_end = std::chrono::steady_clock::now();
+        latencies_ms.emplace_back(std::chrono::duration<double, std::milli>(frame_end - frame_start).count());
+        marker_count += observations.v().size();
+      }
+    }
+    auto total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    auto mean_ms = total_s * 1000. / static_cast<double>(latencies_ms.size());
+
+    std::cout << std::fixed << std::setprecision(3)
+              << std::setw(8) << corner_refinement_method
+              << std::setw(10) << percentile(latencies_ms, 0.0)
+              << std::setw(10) << percentile(latencies_ms, 0.5)
+              << std::setw(10) << percentile(latencies_ms, 0.9)
+              << std::setw(10) << percentile(latencies_ms, 0.99)
+              << std::setw(10) << percentile(latencies_ms, 1.0)
+              << std::setw(10) << mean_ms
+              << std::setw(10) << std::setprecision(1) << static_cast<double>(latencies_ms.size()) / total_s
+              << std::setw(10) << std::setprecision(2)
+              << static_cast<double>(marker_count) / static_cast<double>(latencies_ms.size())
+              << std::endl;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <image_directory> [dictionary_id] [iterations]" << std::endl;
+    return 1;
+  }
+
+  std::string directory{argv[1]};
+  int dictionary_id = argc > 2 ? std::stoi(argv[2]) : 0;
+  int iterations = argc > 3 ? std::max(1, std::stoi(argv[3])) : 10;
+
+  auto frames = load_frames(directory);
+  if (frames.empty()) {
+    std::cerr << "No images found in " << directory << std::endl;
+    return 1;
+  }
+
+  fvlam::LoggerCout logger{fvlam::Logger::level_warn};
+  auto map_environment = fvlam::MapEnvironment{"detect_benchmark", dictionary_id, 0.0};
+
+  std::cout << frames.size() << " frames " << frames[0].cols << "x" << frames[0].rows
+            << ", dictionary " << dictionary_id << ", " << iterations << " iterations" << std::endl;
+  std::cout << "  refine    min ms    p50 ms    p90 ms    p99 ms    max ms   mean ms       fps   markers" << std::endl;
+
+  // 0 = none, 1 = subpix, 2 = contour, 3 = apriltag
+  for (int corner_refinement_method = 0; corner_refinement_method <= 3; corner_refinement_method += 1) {
+    run_method(corner_refinement_method, map_environment, frames, iterations, logger);
+  }
+
+  return 0;
+}
@@ -1,9 +1,12 @@
 #pragma ide diagnostic ignored "modernize-use-nodiscard"
 
+#include <future>
 #include <memory>
 
 #include "fvlam/build_marker_map_interface.hpp"
+#include "fvlam/logger.hpp"
 #include "fvlam/observations_series.hpp"
+#include "task_thread.hpp"
 
 namespace fvlam
 {
@@ -12,13 +15,21 @@ namespace fvlam
 // BuildMarkerMapRecorder class
 // ==============================================================================
 
+  // Observations are written to the file as they arrive by a writer thread, so
+  // memory use does not grow with the length of the recording and a crash loses
+  // at most the observations since the last flush. The writer's queue is bounded
+  // too. When the disk falls behind, process() waits for room and the frames
+  // back up into vmap's builder queue, which bmm_build_queue_max_frames bounds.
   class BuildMarkerMapRecorder : public BuildMarkerMapInterface
   {
+    static constexpr std::size_t writer_queue_capacity{64};
+
     BuildMarkerMapRecorderContext recorder_context_;
     Logger &logger_;
     MarkerMap map_initial_;
     CameraInfoMap camera_info_map_;
-    std::vector<ObservationsSynced> observations_synced_list_{};
+    std::uint64_t recorded_count_{0};
+    task_thread::TaskThread<ObservationsSeriesWriter> writer_task_;
 
   public:
     BuildMarkerMapRecorder(BuildMarkerMapRecorderContext recorder_context,
@@ -27,14 +38,30 @@ namespace fvlam
       recorder_context_{std::move(recorder_context)}, logger_{logger},
       map_initial_{std::move(map_initial)},
       camera_info_map_{},
-      observations_synced_list_{}
+      writer_task_{std::make_unique<ObservationsSeriesWriter>(
+                     recorder_context_.bmm_recorded_observations_name_, logger_),
+                   false, writer_queue_capacity, task_thread::OverflowPolicy::block}
     {}
 
     ~BuildMarkerMapRecorder() override// virtual destructor
     {
-      ObservationsSeries os{std::move(map_initial_), std::move(camera_info_map_),
-                            std::move(observations_synced_list_)};
-      os.save(recorder_context_.bmm_recorded_observations_name_, logger_);
+      // With nothing recorded, still leave a file with the map in it.
+      if (recorded_count_ == 0) {
+        ObservationsSeries os{std::move(map_initial_), std::move(camera_info_map_)};
+        os.save(recorder_context_.bmm_recorded_observations_name_, logger_);
+        return;
+      }
+
+      // The writer thread drops queued tasks when it is destroyed so wait for
+      // the queue to drain.
+      std::promise<void> closed{};
+      auto closed_future = closed.get_future();
+      writer_task_.push([&closed](ObservationsSeriesWriter &writer) -> void
+                        {
+                          writer.close();
+                          closed.set_value();
+                        });
+      closed_future.wait();
     }
 
     // Take the location of markers in one image and add them to the marker map
@@ -42,17 +69,37 @@ namespace fvlam
     void process(const ObservationsSynced &observations_synced,
                  const CameraInfoMap &camera_info_map) override
     {
-      // Walk through the camera_info_map and add to our map and camera_infos
-      // that we don't already know about. Currently all the camera_info_maps will
-      // be the same, but that might loosen in the future.
-      for (auto &camera_info_pair: camera_info_map.m()) {
-        auto camera_info_it = camera_info_map_.m().find(camera_info_pair.first);
-        if (camera_info_it == camera_info_map_.m().end()) {
-          camera_info_map_.m_mutable().emplace(camera_info_pair.first, camera_info_pair.second);
+      // The camera infos are written at the front of the file so they have to be
+      // known when the first observations are written. Currently all the
+      // camera_info_maps will be the same, but that might loosen in the future.
+      if (recorded_count_ == 0) {
+        camera_info_map_ = camera_info_map;
+        writer_task_.push([map = map_initial_, camera_info_map](ObservationsSeriesWriter &writer) -> void
+                          {
+                            writer.open(map, camera_info_map);
+                          });
+
+      } else {
+        for (auto &camera_info_pair: camera_info_map.m()) {
+          if (camera_info_map_.m().find(camera_info_pair.first) == camera_info_map_.m().end()) {
+            logger_.warn() << "Recorder: camera info for " << camera_info_pair.first
+                           << " arrived after recording started and is not saved";
+            camera_info_map_.m_mutable().emplace(camera_info_pair.first, camera_info_pair.second);
+          }
         }
       }
 
-      observations_synced_list_.emplace_back(observations_synced);
+      recorded_count_ += 1;
+      auto flush = recorder_context_.flush_every_n_ > 0 &&
+                   recorded_count_ % recorder_context_.flush_every_n_ == 0;
+
+      writer_task_.push([observations_synced, flush](ObservationsSeriesWriter &writer) -> void
+                        {
+                          writer.write(observations_synced);
+                          if (flush) {
+                            writer.flush();
+                          }
+                        });
     }
 
     // Given the observations that have been added so far, create and return a marker_map.
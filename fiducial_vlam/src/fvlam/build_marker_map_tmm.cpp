@@ -1,23 +1,111 @@
 #pragma ide diagnostic ignored "modernize-use-nodiscard"
 
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 #include "fvlam/build_marker_map_interface.hpp"
 #include "fvlam/camera_info.hpp"
 #include "fvlam/factors_gtsam.hpp"
 #include "fvlam/logger.hpp"
 #include "fvlam/marker.hpp"
+#include "fvlam/undistortion_map.hpp"
 #include <gtsam/nonlinear/GaussNewtonOptimizer.h>
+#include <gtsam/nonlinear/ISAM2.h>
 #include <gtsam/nonlinear/Marginals.h>
 #include <gtsam/nonlinear/NonlinearFactorGraph.h>
 #include <gtsam/sfm/ShonanAveraging.h>
 #include <gtsam/slam/BetweenFactor.h>
 #include <gtsam/slam/InitializePose3.h>
 #include <opencv2/calib3d/calib3d.hpp>
+#include "task_thread.hpp"
 
 namespace fvlam
 {
-  template<class SolveTmm>
+// ==============================================================================
+// TMarker0Marker1Accumulators class
+// ==============================================================================
+
+  template<class TEstimator>
+  class TMarker0Marker1Accumulators : public TMarker0Marker1AccumulatorsInterface
+  {
+    std::vector<TEstimator> estimators_{};
+
+  public:
+    std::size_t add_pair() override
+    {
+      estimators_.emplace_back();
+      return estimators_.size() - 1;
+    }
+
+    void accumulate_solved(const std::vector<Transform3> &t_camera_markers,
+                           const std::vector<Pair> &pairs) override
+    {
+      for (auto &pair : pairs) {
+        estimators_[pair.pair_ix_].accumulate(t_camera_markers[pair.m0_].inverse() * t_camera_markers[pair.m1_]);
+      }
+    }
+
+    Transform3WithCovariance t_marker0_marker1(std::size_t pair_ix) const override
+    {
+      auto &estimator = estimators_[pair_ix];
+      return Transform3WithCovariance{estimator.mean(), estimator.cov()};
+    }
+
+    std::size_t size() const override
+    {
+      return estimators_.size();
+    }
+  };
+
+// ==============================================================================
+// TMarker0Marker1Snapshot class
+// ==============================================================================
+
+  // The estimates of a sharded builder's pairs. The frames are accumulated in the
+  // shards and each build copies the shards' estimates here.
+  class TMarker0Marker1Snapshot : public TMarker0Marker1AccumulatorsInterface
+  {
+    std::vector<Transform3WithCovariance> t_marker0_marker1s_{};
+
+  public:
+    std::size_t add_pair() override
+    {
+      t_marker0_marker1s_.emplace_back();
+      return t_marker0_marker1s_.size() - 1;
+    }
+
+    void accumulate_solved(const std::vector<Transform3> &t_camera_markers,
+                           const std::vector<Pair> &pairs) override
+    {
+      (void) t_camera_markers;
+      (void) pairs;
+    }
+
+    Transform3WithCovariance t_marker0_marker1(std::size_t pair_ix) const override
+    {
+      return t_marker0_marker1s_[pair_ix];
+    }
+
+    std::size_t size() const override
+    {
+      return t_marker0_marker1s_.size();
+    }
+
+    void set(std::size_t pair_ix, Transform3WithCovariance t_marker0_marker1)
+    {
+      t_marker0_marker1s_[pair_ix] = std::move(t_marker0_marker1);
+    }
+  };
+
+// ==============================================================================
+// MarkerMarkerGraph class
+// ==============================================================================
+
   class MarkerMarkerGraph
   {
   public:
@@ -55,13 +143,35 @@ namespace fvlam
       }
     };
 
+    // One measured link between two markers. id0_ is always less than id1_. The
+    // link's measurements are summed in accumulators_ at its index in edges_.
+    struct Edge
+    {
+      std::uint64_t id0_;
+      std::uint64_t id1_;
+    };
+
+    constexpr static std::size_t bad_edge_ix = SIZE_MAX;
+
+    struct PairHash
+    {
+      std::size_t operator()(const std::pair<std::uint64_t, std::uint64_t> &ids) const
+      {
+        return std::hash<std::uint64_t>{}(ids.first * 0x9E3779B97F4A7C15ULL ^ ids.second);
+      }
+    };
+
   private:
     std::map<std::uint64_t, fvlam::Marker> fixed_markers_{};
-    std::map<std::uint64_t, std::map<std::uint64_t, SolveTmm>> solve_tmm_map_{};
-    std::map<std::uint64_t, std::set<std::uint64_t>> back_links_{};
+    std::vector<Edge> edges_{}; // In the order the links were first seen
+    std::unordered_map<std::pair<std::uint64_t, std::uint64_t>, std::size_t, PairHash> edge_ix_{}; // (id0, id1) -> index into edges_
+    std::map<std::uint64_t, std::vector<std::uint64_t>> neighbors_{}; // Both directions
+    std::unique_ptr<TMarker0Marker1AccumulatorsInterface> accumulators_;
 
   public:
-    explicit MarkerMarkerGraph(const MarkerMap &map_initial)
+    MarkerMarkerGraph(const MarkerMap &map_initial,
+                      std::unique_ptr<TMarker0Marker1AccumulatorsInterface> accumulators) :
+      accumulators_{std::move(accumulators)}
     {
       for (auto &marker : map_initial.m()) {
         if (marker.second.is_fixed()) {
@@ -73,6 +183,18 @@ namespace fvlam
     auto &fixed_markers() const
     { return fixed_markers_; }
 
+    auto &edges() const
+    { return edges_; }
+
+    auto &accumulators()
+    { return *accumulators_; }
+
+    // The edge is one of edges().
+    Transform3WithCovariance t_marker0_marker1(const Edge &edge) const
+    {
+      return accumulators_->t_marker0_marker1(static_cast<std::size_t>(&edge - edges_.data()));
+    }
+
     // This search order has the benefit of assigning indices in the same order as id values which
     // could be easier for debugging.
     void depth_first(std::uint64_t id, IdIxList &visited)
@@ -85,34 +207,19 @@ namespace fvlam
       // Mark this id as having been visited and that it is linked to a fixed marker
       visited.add(id);
 
-      // Follow the forward links
-      auto f_links = solve_tmm_map_.find(id);
-      if (f_links != solve_tmm_map_.end()) {
-        for (auto &f_link : f_links->second) {
-          depth_first(f_link.first, visited);
-        }
-      }
-
-      // follow the backward links
-      auto b_links = back_links_.find(id);
-      if (b_links != back_links_.end()) {
-        for (auto &b_link : b_links->second) {
-          depth_first(b_link, visited);
+      // Follow the links
+      auto links = neighbors_.find(id);
+      if (links != neighbors_.end()) {
+        for (auto link : links->second) {
+          depth_first(link, visited);
         }
       }
     }
 
-    IdIxList find_linked_nodes()
+    // Visit every marker reachable from id that has not been visited yet.
+    void breadth_first(std::uint64_t start_id, IdIxList &visited)
     {
-      IdIxList visited{};
-
-#if 1 // breadth first search
-      std::vector<std::uint64_t> work_list{};
-
-      // Add any fixed markers to the work list
-      for (auto &id_marker_pair : fixed_markers_) {
-        work_list.emplace_back(id_marker_pair.first);
-      }
+      std::vector<std::uint64_t> work_list{start_id};
 
       // Follow links from each entry in the work list.
       for (std::size_t i = 0; i < work_list.size(); i += 1) {
@@ -126,105 +233,161 @@ namespace fvlam
         // Mark this id as having been visited and that it is linked to a fixed marker
         visited.add(id);
 
-        // Follow the forward links
-        auto f_links = solve_tmm_map_.find(id);
-        if (f_links != solve_tmm_map_.end()) {
-          for (auto &f_link : f_links->second) {
-            if (visited.to_ix(f_link.first) == IdIxList::bad_ix) {
-              work_list.emplace_back(f_link.first);
-            }
-          }
-        }
-
-        // follow the backward links
-        auto b_links = back_links_.find(id);
-        if (b_links != back_links_.end()) {
-          for (auto &b_link : b_links->second) {
-            if (visited.to_ix(b_link) == IdIxList::bad_ix) {
-              work_list.emplace_back(b_link);
+        // Follow the links
+        auto links = neighbors_.find(id);
+        if (links != neighbors_.end()) {
+          for (auto link : links->second) {
+            if (visited.to_ix(link) == IdIxList::bad_ix) {
+              work_list.emplace_back(link);
             }
           }
         }
       }
-#else // depth first
+    }
+
+    IdIxList find_linked_nodes()
+    {
+      IdIxList visited{};
+
       // Start with any fixed markers:
       for (auto &id_marker_pair : fixed_markers_) {
+#if 1 // breadth first search
+        breadth_first(id_marker_pair.first, visited);
+#else // depth first
         depth_first(id_marker_pair.first, visited);
+#endif
       }
 
-#endif
       return visited;
     }
 
-    SolveTmm *lookup(std::uint64_t id0, std::uint64_t id1)
+    // Split the markers that are linked to a fixed marker into groups that are not
+    // linked to each other. The first id in each group is a fixed marker. This is
+    // the ix = 0 marker for that group.
+    std::vector<IdIxList> find_components()
     {
-      if (id0 > id1) {
-        std::swap(id0, id1);
-      }
-
-      auto f_links = solve_tmm_map_.find(id0);
-      if (f_links == solve_tmm_map_.end()) {
-        return nullptr;
-      }
+      std::vector<IdIxList> components{};
+      std::set<std::uint64_t> found{};
 
-      auto f_link = f_links->second.find(id1);
-      if (f_link == f_links->second.end()) {
-        return nullptr;
+      for (auto &id_marker_pair : fixed_markers_) {
+        if (found.count(id_marker_pair.first) != 0) {
+          continue;
+        }
+        components.emplace_back();
+        breadth_first(id_marker_pair.first, components.back());
+        for (std::size_t ix = 0; ix < components.back().size(); ix += 1) {
+          found.emplace(components.back().to_id(ix));
+        }
       }
 
-      return &f_link->second;
+      return components;
     }
 
-    SolveTmm &add_or_lookup(std::uint64_t id0, std::uint64_t id1, std::function<SolveTmm(void)> solve_tmm_factory)
+    std::size_t lookup(std::uint64_t id0, std::uint64_t id1) const
     {
       if (id0 > id1) {
         std::swap(id0, id1);
       }
 
-      // Look for thee forward link
-      auto f_links = solve_tmm_map_.find(id0);
-      if (f_links == solve_tmm_map_.end()) {
-        solve_tmm_map_.emplace(id0, std::map<std::uint64_t, SolveTmm>{});
-        f_links = solve_tmm_map_.find(id0);
-      }
+      auto it = edge_ix_.find(std::make_pair(id0, id1));
+      return it == edge_ix_.end() ? bad_edge_ix : it->second;
+    }
 
-      auto f_link = f_links->second.find(id1);
-      if (f_link != f_links->second.end()) {
-        return f_link->second;
+    // Returns the index of the edge, which is also its pair index in accumulators().
+    std::size_t add_or_lookup(std::uint64_t id0, std::uint64_t id1)
+    {
+      if (id0 > id1) {
+        std::swap(id0, id1);
       }
 
-      // Insert a forward link
-      f_links->second.emplace(id1, solve_tmm_factory());
-      f_link = f_links->second.find(id1);
-
-      // Insert a back link
-      auto b_links = back_links_.find(id1);
-      if (b_links == back_links_.end()) {
-        back_links_.emplace(id1, std::set<std::uint64_t>{});
-        b_links = back_links_.find(id1);
+      auto it = edge_ix_.find(std::make_pair(id0, id1));
+      if (it != edge_ix_.end()) {
+        return it->second;
       }
 
-      auto b_link = b_links->second.find(id0);
-      if (b_link == b_links->second.end()) {
-        b_links->second.emplace(id0);
-      }
+      // Add the edge and link the markers in both directions.
+      auto ix = accumulators_->add_pair();
+      edge_ix_.emplace(std::make_pair(id0, id1), ix);
+      edges_.emplace_back(Edge{id0, id1});
+      neighbors_[id0].emplace_back(id1);
+      neighbors_[id1].emplace_back(id0);
 
-      return f_link->second;
+      return ix;
     }
   };
 
   class BuildMarkerMapTmm : public BuildMarkerMapInterface
   {
 
-    using SolveTmmGraph = MarkerMarkerGraph<std::unique_ptr<SolveTMarker0Marker1Interface>>;
+    using SolveTmmGraph = MarkerMarkerGraph;
 
     const BuildMarkerMapTmmContext tmm_context_;
     Logger &logger_;
     MarkerMap map_initial_;
 
+    // Solves t_camera_marker for each observation once per frame. The poses
+    // and pairs are kept between frames so the storage is reused.
+    std::unique_ptr<SolveTMarker0Marker1Interface> frame_solver_;
+    std::vector<Transform3> t_camera_markers_{};
+    std::vector<TMarker0Marker1AccumulatorsInterface::Pair> frame_pairs_{};
+
     SolveTmmGraph solve_tmm_graph_;
     BuildMarkerMapTmmContext::BuildError error_;
 
+    // With shards, process() can be called from several threads at once. Each
+    // marker pair belongs to one shard, by its ids, and the shard's lock is only
+    // held while its pairs of one frame are accumulated. build() folds the shards
+    // into solve_tmm_graph_, whose accumulators are then a TMarker0Marker1Snapshot.
+    struct Shard
+    {
+      std::mutex mutex_{};
+      SolveTmmGraph graph_;
+      std::vector<std::size_t> merged_ix_{}; // Shard edge index -> solve_tmm_graph_ edge index
+
+      Shard(const MarkerMap &map_empty, std::unique_ptr<TMarker0Marker1AccumulatorsInterface> accumulators) :
+        graph_{map_empty, std::move(accumulators)}
+      {}
+    };
+
+    // What process() works in for one frame. Kept in a pool so the storage is
+    // reused by whichever thread takes it next.
+    struct FrameScratch
+    {
+      std::unique_ptr<SolveTMarker0Marker1Interface> solver_;
+      std::vector<Transform3> t_camera_markers_{};
+      std::vector<std::vector<TMarker0Marker1AccumulatorsInterface::Pair>> shard_pairs_{};
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_{};
+    TMarker0Marker1Snapshot *snapshot_{nullptr}; // solve_tmm_graph_'s accumulators when sharded
+    std::mutex scratch_mutex_{};
+    std::vector<std::unique_ptr<FrameScratch>> scratch_pool_{};
+
+    // State kept between incremental builds. Marker ids are used as the keys.
+    struct IsamEdge
+    {
+      bool added_{false};
+      std::size_t factor_index_{0}; // Index of this link's BetweenFactor in isam_
+      Transform3 measured_{}; // The measurement in that factor
+    };
+
+    // The rotations from the last Shonan solve, by marker id. Seeds the next solve.
+    std::map<std::uint64_t, gtsam::Rot3> shonan_rotations_{};
+
+    constexpr static std::size_t no_edge = SIZE_MAX;
+    gtsam::ISAM2 isam_;
+    gtsam::Values isam_estimate_{};
+    std::vector<IsamEdge> isam_edges_{}; // Parallel to solve_tmm_graph_.edges()
+
+    // The result of optimizing one group of linked markers.
+    struct ComponentSolution
+    {
+      std::unique_ptr<MarkerMap> map_{};
+      double nonlinear_optimization_error_{0.0};
+      double shonan_error_{0.0};
+      std::map<std::uint64_t, gtsam::Rot3> shonan_rotations_{};
+    };
+
     static fvlam::Marker find_fixed_marker(const MarkerMap &map)
     {
       for (auto &marker : map.m()) {
@@ -258,7 +421,7 @@ namespace fvlam
     }
 
     gtsam::SharedNoiseModel determine_between_factor_noise_model(const fvlam::Transform3WithCovariance &twc,
-                                                                 bool isotropic)
+                                                                 bool isotropic) const
     {
       switch (tmm_context_.mm_between_factor_noise_strategy_) {
         default:
@@ -281,37 +444,39 @@ namespace fvlam
       }
     }
 
-    gtsam::NonlinearFactorGraph load_pose_graph(const SolveTmmGraph::IdIxList &idix_list)
+    gtsam::NonlinearFactorGraph load_pose_graph(const SolveTmmGraph::IdIxList &idix_list) const
     {
       gtsam::NonlinearFactorGraph pose_graph{};
 
-      for (std::size_t ix0 = 0; ix0 < idix_list.size(); ix0 += 1)
-        for (std::size_t ix1 = ix0 + 1; ix1 < idix_list.size(); ix1 += 1) {
-          auto solve_tmm = solve_tmm_graph_.lookup(idix_list.to_id(ix0), idix_list.to_id(ix1));
-          if (solve_tmm) {
-            auto t_marker0_marker1 = (*solve_tmm)->t_marker0_marker1();
-
-            auto noise_model = determine_between_factor_noise_model(t_marker0_marker1,
-                                                                    tmm_context_.try_shonan_initialization_);
+      for (auto &edge : solve_tmm_graph_.edges()) {
+        // Skip links to markers that are not connected to a fixed marker.
+        auto ix0 = idix_list.to_ix(edge.id0_);
+        auto ix1 = idix_list.to_ix(edge.id1_);
+        if (ix0 == SolveTmmGraph::IdIxList::bad_ix || ix1 == SolveTmmGraph::IdIxList::bad_ix) {
+          continue;
+        }
 
-            // The t_marker0_marker1 measurements are always recorded with the marker with the
-            // lower id first - as the "world" marker and the higher id is the "body" marker. If
-            // when we reassign ids, the higher id ends up as the "world" marker, then the
-            // measurement has to be inverted.
-            bool interchange = idix_list.to_id(ix0) > idix_list.to_id(ix1);
-            auto ix0_bf = interchange ? ix1 : ix0;
-            auto ix1_bf = interchange ? ix0 : ix1;
+        auto t_marker0_marker1 = solve_tmm_graph_.t_marker0_marker1(edge);
 
-            logger_.debug() << ix0_bf << " " << ix1_bf << " " << t_marker0_marker1.tf().to_string();
+        auto noise_model = determine_between_factor_noise_model(t_marker0_marker1,
+                                                                tmm_context_.try_shonan_initialization_);
 
-            pose_graph.emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
-              ix0_bf, ix1_bf, t_marker0_marker1.tf().to<gtsam::Pose3>(),
-              noise_model);
-          }
+        // The t_marker0_marker1 measurements are always recorded with the marker with the
+        // lower id first - as the "world" marker and the higher id is the "body" marker.
+        if (logger_.output_debug()) {
+          logger_.debug() << ix0 << " " << ix1 << " " << t_marker0_marker1.tf().to_string();
         }
 
+        pose_graph.emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+          ix0, ix1, t_marker0_marker1.tf().to<gtsam::Pose3>(),
+          noise_model);
+      }
+
       // Add the prior for the fixed nodes.
       for (auto &id_marker_pair : solve_tmm_graph_.fixed_markers()) {
+        if (idix_list.to_ix(id_marker_pair.first) == SolveTmmGraph::IdIxList::bad_ix) {
+          continue;
+        }
         pose_graph.emplace_shared<gtsam::PriorFactor<gtsam::Pose3>>(
           idix_list.to_ix(id_marker_pair.first),
           id_marker_pair.second.t_map_marker().tf().to<gtsam::Pose3>(),
@@ -345,25 +510,45 @@ namespace fvlam
     // by the chordal method.
     void get_shonan_rotations(const SolveTmmGraph::IdIxList &idix_list,
                               const gtsam::NonlinearFactorGraph &pose_graph,
-                              gtsam::Values &initial_poses)
+                              gtsam::Values &initial_poses,
+                              ComponentSolution &solution) const
     {
       // Optimize rotations.
       auto shonan_measurements = load_shonan_measurements(pose_graph);
       gtsam::ShonanAveraging3 shonan(shonan_measurements);
-      auto shonan_initial = shonan.initializeRandomly();
-      auto shonan_result = shonan.run(shonan_initial);
-      error_.shonan_error_ = shonan_result.second;
+
+      // Seed the markers that were in the last build with their rotations from that build
+      // and new markers with the chordal estimate. Only the lowest level is tried from the
+      // warm start. If Shonan can not certify the solution there, start randomly instead.
+      gtsam::Values shonan_warm{};
+      for (const auto &key_value : initial_poses) {
+        auto previous = shonan_rotations_.find(idix_list.to_id(key_value.key));
+        shonan_warm.insert(key_value.key, previous != shonan_rotations_.end() ?
+                                          previous->second :
+                                          initial_poses.at<gtsam::Pose3>(key_value.key).rotation());
+      }
+
+      std::pair<gtsam::Values, double> shonan_result{};
+      try {
+        shonan_result = shonan.run(shonan_warm, 3, 3);
+      } catch (std::runtime_error &ex) {
+        logger_.debug() << "Shonan warm start not certified, starting randomly";
+        shonan_result = shonan.run(shonan.initializeRandomly());
+      }
+      solution.shonan_error_ = shonan_result.second;
 
       // Find the rotation that the shonan algorithm returned for the fixed
       // marker. Then figure out the delta rotation to rotate that shonan
       // rotation to the fixed rotation. Then apply this rotation to all
       // shonan rotations as we are entering them in the initial values.
+      // The marker with ix = 0 is a fixed marker.
       auto r_world_shonan{gtsam::Rot3::identity()};
-      auto fixed_marker_ix = idix_list.to_ix(solve_tmm_graph_.fixed_markers().begin()->first);
+      std::size_t fixed_marker_ix{0};
+      auto &fixed_marker = solve_tmm_graph_.fixed_markers().at(idix_list.to_id(fixed_marker_ix));
       for (const auto &key_value : shonan_result.first) {
         if (key_value.key == fixed_marker_ix) {
           r_world_shonan =
-            solve_tmm_graph_.fixed_markers().begin()->second.t_map_marker().tf().r().to<gtsam::Rot3>() *
+            fixed_marker.t_map_marker().tf().r().to<gtsam::Rot3>() *
             shonan_result.first.at<typename gtsam::Pose3::Rotation>(key_value.key).inverse();
           break;
         }
@@ -374,27 +559,31 @@ namespace fvlam
         gtsam::Key key = key_value.key;
         const auto &rot = shonan_result.first.at<gtsam::Rot3>(key);
         auto rot_f_world = r_world_shonan * rot;
-        logger_.debug() << key << " " << fvlam::Rotate3::from(rot_f_world).to_string();
+        if (logger_.output_debug()) {
+          logger_.debug() << key << " " << fvlam::Rotate3::from(rot_f_world).to_string();
+        }
+        solution.shonan_rotations_[idix_list.to_id(key)] = rot_f_world;
         auto initializedPose = gtsam::Pose3{rot_f_world, initial_poses.at<gtsam::Pose3>(key).translation()};
         initial_poses.update(key, initializedPose);
       }
     }
 
     gtsam::Values load_pose_initial(const SolveTmmGraph::IdIxList &idix_list,
-                                    const gtsam::NonlinearFactorGraph &pose_graph)
+                                    const gtsam::NonlinearFactorGraph &pose_graph,
+                                    ComponentSolution &solution) const
     {
       // initialize poses by the chordal method
       auto initial_poses = gtsam::InitializePose3::initialize(pose_graph);
 
       if (tmm_context_.try_shonan_initialization_) {
-        get_shonan_rotations(idix_list, pose_graph, initial_poses);
+        get_shonan_rotations(idix_list, pose_graph, initial_poses, solution);
       }
       return initial_poses;
     }
 
     std::unique_ptr<MarkerMap> load_map(const SolveTmmGraph::IdIxList &idix_list,
                                         const gtsam::NonlinearFactorGraph &pose_graph,
-                                        const gtsam::Values &pose_result)
+                                        const gtsam::Values &pose_result) const
     {
       auto map = std::make_unique<MarkerMap>(map_initial_.map_environment());
       gtsam::Marginals marginals{GtsamUtil::construct_marginals(pose_graph, pose_result)};
@@ -417,24 +606,156 @@ namespace fvlam
       return map;
     }
 
+    gtsam::ISAM2Params isam_params() const
+    {
+      return gtsam::ISAM2Params{gtsam::ISAM2GaussNewtonParams{}, 0.01,
+                                std::max(1, tmm_context_.isam_relinearize_skip_)};
+    }
+
+    // Add the links that are new or have new measurements since the last build to the
+    // iSAM2 solution, replacing the factors of links that changed. Markers that are new
+    // to the solution are initialized from a neighbor through the link measurement.
+    // Every frame processed since the last build goes into this one iSAM2 update, so
+    // a backlog of frames costs one update rather than one per frame.
+    std::unique_ptr<MarkerMap> build_incremental(const SolveTmmGraph::IdIxList &idix_list)
+    {
+      gtsam::NonlinearFactorGraph new_factors{};
+      gtsam::Values new_values{};
+      gtsam::FactorIndices remove_indices{};
+      std::vector<std::pair<std::size_t, Transform3>> new_factor_edges{}; // One per factor in new_factors
+
+      // Anchor the fixed markers the first time through. iSAM2 does not take constrained
+      // noise models so the prior is just very tight.
+      for (auto &id_marker_pair : solve_tmm_graph_.fixed_markers()) {
+        if (!isam_estimate_.exists(id_marker_pair.first)) {
+          auto pose = id_marker_pair.second.t_map_marker().tf().to<gtsam::Pose3>();
+          new_factors.emplace_shared<gtsam::PriorFactor<gtsam::Pose3>>(
+            id_marker_pair.first, pose, gtsam::noiseModel::Isotropic::Sigma(6, 1.0e-6));
+          new_values.insert(id_marker_pair.first, pose);
+          new_factor_edges.emplace_back(no_edge, Transform3{});
+        }
+      }
+
+      // Find the links that are new or have changed.
+      auto &edges = solve_tmm_graph_.edges();
+      isam_edges_.resize(edges.size());
+      for (std::size_t e = 0; e < edges.size(); e += 1) {
+        auto &edge = edges[e];
+        if (idix_list.to_ix(edge.id0_) == SolveTmmGraph::IdIxList::bad_ix ||
+            idix_list.to_ix(edge.id1_) == SolveTmmGraph::IdIxList::bad_ix) {
+          continue;
+        }
+
+        auto t_marker0_marker1 = solve_tmm_graph_.t_marker0_marker1(edge);
+        auto &isam_edge = isam_edges_[e];
+        if (isam_edge.added_ && isam_edge.measured_.equals(t_marker0_marker1.tf())) {
+          continue;
+        }
+        if (isam_edge.added_) {
+          remove_indices.emplace_back(isam_edge.factor_index_);
+        }
+
+        auto noise_model = determine_between_factor_noise_model(t_marker0_marker1,
+                                                                tmm_context_.try_shonan_initialization_);
+        new_factors.emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+          edge.id0_, edge.id1_, t_marker0_marker1.tf().to<gtsam::Pose3>(), noise_model);
+        new_factor_edges.emplace_back(e, t_marker0_marker1.tf());
+      }
+
+      // Initial values for markers that are new to the solution. Every new marker
+      // is reachable from a known one through new links.
+      auto known = [this, &new_values](std::uint64_t id) -> bool
+      {
+        return isam_estimate_.exists(id) || new_values.exists(id);
+      };
+      auto pose_of = [this, &new_values](std::uint64_t id) -> gtsam::Pose3
+      {
+        return new_values.exists(id) ? new_values.at<gtsam::Pose3>(id) : isam_estimate_.at<gtsam::Pose3>(id);
+      };
+      for (bool progress = true; progress;) {
+        progress = false;
+        for (auto &edge_measured : new_factor_edges) {
+          if (edge_measured.first == no_edge) {
+            continue;
+          }
+          auto &edge = edges[edge_measured.first];
+          auto t_marker0_marker1 = edge_measured.second.to<gtsam::Pose3>();
+          if (known(edge.id0_) && !known(edge.id1_)) {
+            new_values.insert(edge.id1_, pose_of(edge.id0_) * t_marker0_marker1);
+            progress = true;
+          } else if (!known(edge.id0_) && known(edge.id1_)) {
+            new_values.insert(edge.id0_, pose_of(edge.id1_) * t_marker0_marker1.inverse());
+            progress = true;
+          }
+        }
+      }
+
+      if (!new_factors.empty() || !remove_indices.empty()) {
+        try {
+          auto result = isam_.update(new_factors, new_values, remove_indices);
+          for (std::size_t i = 0; i < new_factor_edges.size(); i += 1) {
+            if (new_factor_edges[i].first != no_edge) {
+              auto &isam_edge = isam_edges_[new_factor_edges[i].first];
+              isam_edge.added_ = true;
+              isam_edge.factor_index_ = result.newFactorsIndices[i];
+              isam_edge.measured_ = new_factor_edges[i].second;
+            }
+          }
+          isam_estimate_ = isam_.calculateEstimate();
+        } catch (gtsam::IndeterminantLinearSystemException &ex) {
+          // The factors that failed would be sent again with every later build, so
+          // drop the solution and let the next build start over with all the links.
+          logger_.warn() << "Incremental map update failed, the next build starts over: " << ex.what();
+          isam_ = gtsam::ISAM2{isam_params()};
+          isam_estimate_.clear();
+          isam_edges_.clear();
+          return std::unique_ptr<MarkerMap>{};
+        }
+      }
+      error_.nonlinear_optimization_error_ = isam_.getFactorsUnsafe().error(isam_estimate_);
+
+      // The marginals come from the Bayes tree that iSAM2 maintains.
+      auto map = std::make_unique<MarkerMap>(map_initial_.map_environment());
+      for (const auto &key_value : isam_estimate_) {
+        auto id = static_cast<std::uint64_t>(key_value.key);
+
+        // Check to see if this is a fixed marker
+        auto fixed = solve_tmm_graph_.fixed_markers().find(id);
+        if (fixed != solve_tmm_graph_.fixed_markers().end()) {
+          map->add_marker(fixed->second);
+          continue;
+        }
+
+        auto pose = isam_estimate_.at<gtsam::Pose3>(key_value.key);
+        try {
+          auto cov = static_cast<gtsam::Matrix6>(isam_.marginalCovariance(key_value.key));
+          map->add_marker(Marker{id, GtsamUtil::transform3_with_covariance(pose, cov)});
+        } catch (gtsam::IndeterminantLinearSystemException &ex) {
+          map->add_marker(Marker{id, Transform3WithCovariance{Transform3::from(pose)}});
+        }
+      }
+
+      return map;
+    }
+
     void calc_remeasure_error(const MarkerMap &map)
     {
       double r_sum{0.0};
       double t_sum{0.0};
       uint64_t n{0};
 
-      for (auto it0 = map.m().begin(); it0 != map.m().end(); ++it0)
-        for (auto it1 = map.m().upper_bound(it0->first); it1 != map.m().end(); ++it1) {
-          auto solve_tmm = solve_tmm_graph_.lookup(it0->first, it1->first);
-          if (solve_tmm != nullptr) {
-            auto tmm_meas = (*solve_tmm)->t_marker0_marker1().tf();
-            auto tmm_calc = it0->second.t_map_marker().tf().inverse() *
-                            it1->second.t_map_marker().tf();
-            r_sum += tmm_calc.r().q().angularDistance(tmm_meas.r().q());
-            t_sum += (tmm_calc.t().t() - tmm_meas.t().t()).norm();
-            n += 1;
-          }
+      for (auto &edge : solve_tmm_graph_.edges()) {
+        auto marker0 = map.find_marker_const(edge.id0_);
+        auto marker1 = map.find_marker_const(edge.id1_);
+        if (marker0 != nullptr && marker1 != nullptr) {
+          auto tmm_meas = solve_tmm_graph_.t_marker0_marker1(edge).tf();
+          auto tmm_calc = marker0->t_map_marker().tf().inverse() *
+                          marker1->t_map_marker().tf();
+          r_sum += tmm_calc.r().q().angularDistance(tmm_meas.r().q());
+          t_sum += (tmm_calc.t().t() - tmm_meas.t().t()).norm();
+          n += 1;
         }
+      }
 
       if (n > 1) {
         r_sum /= n;
@@ -445,6 +766,135 @@ namespace fvlam
       error_.t_remeasure_error_ = t_sum;
     }
 
+    // Optimize the poses of the markers in one connected group.
+    ComponentSolution solve_component(const SolveTmmGraph::IdIxList &idix_list) const
+    {
+      ComponentSolution solution{};
+
+      // Prepare for full Pose optimization
+      auto pose_graph = load_pose_graph(idix_list);
+      if (logger_.output_debug()) {
+        pose_graph.print("pose_graph\n");
+      }
+
+      auto pose_initial = load_pose_initial(idix_list, pose_graph, solution);
+      if (logger_.output_debug()) {
+        pose_initial.print("pose_initial");
+      }
+
+      // Do the pose optimization
+      gtsam::GaussNewtonParams params;
+      if (logger_.output_debug()) {
+        params.setVerbosity("TERMINATION");
+      }
+
+      gtsam::GaussNewtonOptimizer optimizer(pose_graph, pose_initial, params);
+      auto pose_result = optimizer.optimize();
+      solution.nonlinear_optimization_error_ = pose_graph.error(pose_result);
+
+      solution.map_ = load_map(idix_list, pose_graph, pose_result);
+      return solution;
+    }
+
+    std::unique_ptr<FrameScratch> take_scratch()
+    {
+      {
+        std::lock_guard<std::mutex> lock{scratch_mutex_};
+        if (!scratch_pool_.empty()) {
+          auto scratch = std::move(scratch_pool_.back());
+          scratch_pool_.pop_back();
+          return scratch;
+        }
+      }
+      auto scratch = std::make_unique<FrameScratch>();
+      scratch->solver_ = tmm_context_.solve_tmm_factory_();
+      scratch->shard_pairs_.resize(shards_.size());
+      return scratch;
+    }
+
+    void return_scratch(std::unique_ptr<FrameScratch> scratch)
+    {
+      std::lock_guard<std::mutex> lock{scratch_mutex_};
+      scratch_pool_.emplace_back(std::move(scratch));
+    }
+
+    // The marker poses are solved without any lock, only the accumulation of each
+    // shard's pairs takes that shard's lock.
+    void process_sharded(const ObservationsSynced &observations_synced,
+                         const CameraInfoMap &camera_info_map)
+    {
+      auto scratch = take_scratch();
+
+      for (auto &observations : observations_synced.v()) {
+        auto camera_info_it = camera_info_map.m().find(observations.imager_frame_id());
+        if (camera_info_it == camera_info_map.m().end()) {
+          continue;
+        }
+
+        auto &t_camera_markers = scratch->t_camera_markers_;
+        t_camera_markers.clear();
+        for (auto &observation : observations.v()) {
+          t_camera_markers.emplace_back(scratch->solver_->solve_t_camera_marker(observation, camera_info_it->second));
+        }
+
+        // Sort the pairs into their shards, lower id first.
+        for (auto &pairs : scratch->shard_pairs_) {
+          pairs.clear();
+        }
+        auto &v = observations.v();
+        for (std::size_t m0 = 0; m0 < v.size(); m0 += 1) {
+          for (std::size_t m1 = m0 + 1; m1 < v.size(); m1 += 1) {
+            auto m0r = v[m1].id() < v[m0].id() ? m1 : m0;
+            auto m1r = m0r == m0 ? m1 : m0;
+            auto ids = std::make_pair(v[m0r].id(), v[m1r].id());
+            scratch->shard_pairs_[SolveTmmGraph::PairHash{}(ids) % shards_.size()].emplace_back(
+              TMarker0Marker1AccumulatorsInterface::Pair{SolveTmmGraph::bad_edge_ix, m0r, m1r});
+          }
+        }
+
+        for (std::size_t s = 0; s < shards_.size(); s += 1) {
+          auto &pairs = scratch->shard_pairs_[s];
+          if (pairs.empty()) {
+            continue;
+          }
+          auto &shard = *shards_[s];
+          std::lock_guard<std::mutex> lock{shard.mutex_};
+          for (auto &pair : pairs) {
+            pair.pair_ix_ = shard.graph_.add_or_lookup(v[pair.m0_].id(), v[pair.m1_].id());
+          }
+          shard.graph_.accumulators().accumulate_solved(t_camera_markers, pairs);
+        }
+      }
+
+      return_scratch(std::move(scratch));
+    }
+
+    // Bring solve_tmm_graph_ up to date with the shards. A shard's new pairs are
+    // appended so the edge indices of earlier builds stay the same, which the
+    // incremental build relies on.
+    void merge_shards()
+    {
+      for (auto &shard_ptr : shards_) {
+        auto &shard = *shard_ptr;
+        std::lock_guard<std::mutex> lock{shard.mutex_};
+        auto &edges = shard.graph_.edges();
+        for (auto i = shard.merged_ix_.size(); i < edges.size(); i += 1) {
+          shard.merged_ix_.emplace_back(solve_tmm_graph_.add_or_lookup(edges[i].id0_, edges[i].id1_));
+        }
+        for (std::size_t i = 0; i < edges.size(); i += 1) {
+          snapshot_->set(shard.merged_ix_[i], shard.graph_.t_marker0_marker1(edges[i]));
+        }
+      }
+    }
+
+    std::unique_ptr<TMarker0Marker1AccumulatorsInterface> make_graph_accumulators() const
+    {
+      if (tmm_context_.shard_count_ > 0) {
+        return std::make_unique<TMarker0Marker1Snapshot>();
+      }
+      return frame_solver_->make_accumulators();
+    }
+
   public:
     BuildMarkerMapTmm() = delete;
 
@@ -454,19 +904,46 @@ namespace fvlam
       tmm_context_{std::move(tmm_context)},
       logger_{logger},
       map_initial_{map_initial},
-      solve_tmm_graph_{map_initial},
-      error_{}
-    {}
+      frame_solver_{tmm_context_.solve_tmm_factory_()},
+      solve_tmm_graph_{map_initial, make_graph_accumulators()},
+      error_{},
+      isam_{isam_params()}
+    {
+      if (tmm_context_.shard_count_ > 0) {
+        snapshot_ = static_cast<TMarker0Marker1Snapshot *>(&solve_tmm_graph_.accumulators());
+        auto map_empty = MarkerMap{map_initial.map_environment()};
+        for (std::size_t s = 0; s < tmm_context_.shard_count_; s += 1) {
+          shards_.emplace_back(std::make_unique<Shard>(map_empty, frame_solver_->make_accumulators()));
+        }
+      }
+    }
+
+    bool process_is_concurrent() const override
+    {
+      return !shards_.empty();
+    }
 
     void process(const ObservationsSynced &observations_synced,
                  const CameraInfoMap &camera_info_map) override
     {
+      if (!shards_.empty()) {
+        process_sharded(observations_synced, camera_info_map);
+        return;
+      }
+
       // Walk through all the imagers
       for (auto &observations : observations_synced.v()) {
         // Find the camera_info for this imager
         auto camera_info_it = camera_info_map.m().find(observations.imager_frame_id());
         if (camera_info_it != camera_info_map.m().end()) {
+          // Solve each marker's pose once for this image.
+          t_camera_markers_.clear();
+          for (auto &observation : observations.v()) {
+            t_camera_markers_.emplace_back(frame_solver_->solve_t_camera_marker(observation, camera_info_it->second));
+          }
+
           // Walk through all pairs of observations
+          frame_pairs_.clear();
           for (std::size_t m0 = 0; m0 < observations.size(); m0 += 1)
             for (std::size_t m1 = m0 + 1; m1 < observations.size(); m1 += 1) {
               std::size_t m0r{m0};
@@ -478,46 +955,80 @@ namespace fvlam
                 m1r = m0;
               }
 
-              // Find the appropriate SolveTmmInterface
-              auto &solve_tmm = solve_tmm_graph_.add_or_lookup(observations.v()[m0r].id(), observations.v()[m1r].id(),
-                                                               tmm_context_.solve_tmm_factory_);
-              solve_tmm->accumulate(observations.v()[m0r], observations.v()[m1r], camera_info_it->second);
+              // Find the accumulator for this pair
+              auto pair_ix = solve_tmm_graph_.add_or_lookup(observations.v()[m0r].id(), observations.v()[m1r].id());
+              frame_pairs_.emplace_back(TMarker0Marker1AccumulatorsInterface::Pair{pair_ix, m0r, m1r});
             }
+          solve_tmm_graph_.accumulators().accumulate_solved(t_camera_markers_, frame_pairs_);
         }
       }
     }
 
     std::unique_ptr<MarkerMap> build() override
     {
-      auto idix_list = solve_tmm_graph_.find_linked_nodes();
+      if (!shards_.empty()) {
+        merge_shards();
+      }
+
+      if (tmm_context_.incremental_) {
+        auto idix_list = solve_tmm_graph_.find_linked_nodes();
+
+        // Make sure there are some markers linked to the fixed markers.
+        if (idix_list.size() == map_initial_.size()) {
+          return std::make_unique<MarkerMap>(map_initial_);
+        }
+
+        auto built_map = build_incremental(idix_list);
+        if (built_map) {
+          calc_remeasure_error(*built_map);
+          error_.valid_ = true;
+        }
+        return built_map;
+      }
+
+      // Each group of markers that is anchored by its own fixed marker is solved
+      // separately and concurrently.
+      auto components = solve_tmm_graph_.find_components();
 
       // Make sure there are some markers linked to the fixed markers.
-      if (idix_list.size() == map_initial_.size()) {
+      std::size_t linked_count{0};
+      for (auto &component : components) {
+        linked_count += component.size();
+      }
+      if (linked_count == map_initial_.size()) {
         return std::make_unique<MarkerMap>(map_initial_);
       }
 
-      // Prepare for full Pose optimization
-      auto pose_graph = load_pose_graph(idix_list);
-      if (logger_.output_debug()) {
-        pose_graph.print("pose_graph\n");
-      }
+      std::vector<ComponentSolution> solutions(components.size());
+      auto solve = [this, &components, &solutions](std::size_t c) -> void
+      {
+        // A component with only its fixed marker has nothing to solve.
+        if (components[c].size() > 1) {
+          solutions[c] = solve_component(components[c]);
+        }
+      };
 
-      auto pose_initial = load_pose_initial(idix_list, pose_graph);
-      if (logger_.output_debug()) {
-        pose_initial.print("pose_initial");
-      }
+      task_thread::WorkStealingPool::shared().parallel_for(components.size(), solve);
 
-      // Do the pose optimization
-      gtsam::GaussNewtonParams params;
-      if (logger_.output_debug()) {
-        params.setVerbosity("TERMINATION");
+      // Merge the components into one map.
+      auto built_map = std::make_unique<MarkerMap>(map_initial_.map_environment());
+      error_.nonlinear_optimization_error_ = 0.0;
+      error_.shonan_error_ = 0.0;
+      for (std::size_t c = 0; c < components.size(); c += 1) {
+        if (!solutions[c].map_) {
+          built_map->add_marker(solve_tmm_graph_.fixed_markers().at(components[c].to_id(0)));
+          continue;
+        }
+        for (auto &id_marker_pair : solutions[c].map_->m()) {
+          built_map->add_marker(id_marker_pair.second);
+        }
+        error_.nonlinear_optimization_error_ += solutions[c].nonlinear_optimization_error_;
+        error_.shonan_error_ += solutions[c].shonan_error_;
+        for (auto &id_rotation : solutions[c].shonan_rotations_) {
+          shonan_rotations_[id_rotation.first] = id_rotation.second;
+        }
       }
 
-      gtsam::GaussNewtonOptimizer optimizer(pose_graph, pose_initial, params);
-      auto pose_result = optimizer.optimize();
-      error_.nonlinear_optimization_error_ = pose_graph.error(pose_result);
-
-      auto built_map = load_map(idix_list, pose_graph, pose_result);
       calc_remeasure_error(*built_map);
       error_.valid_ = true; // Mark this error structure as having valid data.
       return built_map;
@@ -561,14 +1072,20 @@ namespace fvlam
   {
     const SolveTmmContextCvSolvePnp solve_tmm_context_;
     double marker_length_;
+    std::shared_ptr<CalibrationCache<CvCameraCalibration>> calibrations_; // Shared by the solvers from one factory
+    std::shared_ptr<CalibrationCache<UndistortionMap>> undistortions_; // Shared the same way, for undistort_lookup_
     EstimateTransform3MeanAndCovarianceOnManifold emac_manifold_; // Averaging in the vector space
     EstimateTransform3MeanAndCovarianceOnVectorSpace emac_space_; // Averaging on the manifold
 
   public:
     SolveTmmCvSolvePnp(const SolveTmmContextCvSolvePnp &solve_tmm_context,
-                       double marker_length) :
+                       double marker_length,
+                       std::shared_ptr<CalibrationCache<CvCameraCalibration>> calibrations,
+                       std::shared_ptr<CalibrationCache<UndistortionMap>> undistortions) :
       solve_tmm_context_{solve_tmm_context},
       marker_length_{marker_length},
+      calibrations_{std::move(calibrations)},
+      undistortions_{std::move(undistortions)},
       emac_manifold_{}, emac_space_{}
     {}
 
@@ -576,8 +1093,29 @@ namespace fvlam
                     const Observation &observation1,
                     const CameraInfo &camera_info) override
     {
-      auto t_camera_marker0 = observation0.solve_t_camera_marker(camera_info, marker_length_);
-      auto t_camera_marker1 = observation1.solve_t_camera_marker(camera_info, marker_length_);
+      if (solve_tmm_context_.undistort_lookup_) {
+        auto undistortion = undistortions_->get(camera_info);
+        accumulate_solved(observation0.solve_t_camera_marker(*undistortion, marker_length_),
+                          observation1.solve_t_camera_marker(*undistortion, marker_length_));
+        return;
+      }
+      auto calibration = calibrations_->get(camera_info);
+      accumulate_solved(observation0.solve_t_camera_marker(*calibration, marker_length_),
+                        observation1.solve_t_camera_marker(*calibration, marker_length_));
+    }
+
+    Transform3 solve_t_camera_marker(const Observation &observation,
+                                     const CameraInfo &camera_info) override
+    {
+      if (solve_tmm_context_.undistort_lookup_) {
+        return observation.solve_t_camera_marker(*undistortions_->get(camera_info), marker_length_);
+      }
+      return observation.solve_t_camera_marker(*calibrations_->get(camera_info), marker_length_);
+    }
+
+    void accumulate_solved(const Transform3 &t_camera_marker0,
+                           const Transform3 &t_camera_marker1) override
+    {
       auto t_marker0_marker1 = t_camera_marker0.inverse() * t_camera_marker1;
       if (solve_tmm_context_.average_on_space_not_manifold_) {
         emac_space_.accumulate(t_marker0_marker1);
@@ -593,6 +1131,14 @@ namespace fvlam
         solve_tmm_context_.average_on_space_not_manifold_ ? emac_space_.mean() : emac_manifold_.mean(),
         solve_tmm_context_.average_on_space_not_manifold_ ? emac_space_.cov() : emac_manifold_.cov()};
     }
+
+    std::unique_ptr<TMarker0Marker1AccumulatorsInterface> make_accumulators() const override
+    {
+      if (solve_tmm_context_.average_on_space_not_manifold_) {
+        return std::make_unique<TMarker0Marker1Accumulators<EstimateTransform3MeanAndCovarianceOnVectorSpace>>();
+      }
+      return std::make_unique<TMarker0Marker1Accumulators<EstimateTransform3MeanAndCovarianceOnManifold>>();
+    }
   };
 
   template<>
@@ -602,10 +1148,12 @@ namespace fvlam
   {
     return [
       solve_tmm_context{solve_tmm_context},
-      marker_length
+      marker_length,
+      calibrations{std::make_shared<CalibrationCache<CvCameraCalibration>>()},
+      undistortions{std::make_shared<CalibrationCache<UndistortionMap>>()}
     ]() -> std::unique_ptr<SolveTMarker0Marker1Interface>
     {
-      return std::make_unique<SolveTmmCvSolvePnp>(solve_tmm_context, marker_length);
+      return std::make_unique<SolveTmmCvSolvePnp>(solve_tmm_context, marker_length, calibrations, undistortions);
     };
   }
 }
@@ -5,6 +5,7 @@
 #include "fvlam/marker.hpp"
 #include "fvlam/observation.hpp"
 #include "fvlam/transform3_with_covariance.hpp"
+#include "fvlam/undistortion_map.hpp"
 #include "opencv2/calib3d/calib3d.hpp"
 
 namespace fvlam
@@ -156,8 +157,12 @@ namespace fvlam
 
   Transform3 Observation::solve_t_camera_marker(const CameraInfo &camera_info, double marker_length) const
   {
-    auto camera_calibration = camera_info.to<CvCameraCalibration>();
+    return solve_t_camera_marker(camera_info.to<CvCameraCalibration>(), marker_length);
+  }
 
+  Transform3 Observation::solve_t_camera_marker(const CvCameraCalibration &camera_calibration,
+                                                double marker_length) const
+  {
     // Build up two lists of corner points: 2D in the image frame, 3D in the marker frame.
     auto corners_f_marker{Marker::corners_f_marker<std::vector<cv::Point3d>>(marker_length)};
     auto corners_f_image{to<std::vector<cv::Point2d>>()};
@@ -174,6 +179,26 @@ namespace fvlam
     return Transform3(Rotate3::from(rvec), Translate3::from(tvec));
   }
 
+  Transform3 Observation::solve_t_camera_marker(const UndistortionMap &undistortion_map,
+                                                double marker_length) const
+  {
+    // With the corners in normalized coordinates PnP runs on an identity camera
+    // matrix without distortion.
+    auto corners_f_marker{Marker::corners_f_marker<std::vector<cv::Point3d>>(marker_length)};
+    std::vector<cv::Point2d> corners_f_normalized{};
+    for (auto &corner_f_image : corners_f_image_) {
+      auto normalized = undistortion_map.normalized(corner_f_image);
+      corners_f_normalized.emplace_back(cv::Point2d{normalized.x(), normalized.y()});
+    }
+
+    cv::Vec3d rvec, tvec;
+    cv::solvePnP(corners_f_marker, corners_f_normalized,
+                 cv::Matx33d::eye(), cv::noArray(),
+                 rvec, tvec);
+
+    return Transform3(Rotate3::from(rvec), Translate3::from(tvec));
+  }
+
   Transform3 Observation::solve_t_marker_camera(const CameraInfo &camera_info, double marker_length) const
   {
     return solve_t_camera_marker(camera_info, marker_length).inverse();
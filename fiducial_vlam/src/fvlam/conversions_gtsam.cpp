@@ -5,7 +5,6 @@
 #include "fvlam/transform3_with_covariance.hpp"
 #include <gtsam/geometry/Cal3DS2.h>
 #include <gtsam/geometry/Cal3_S2.h>
-#include <gtsam/geometry/PinholeCamera.h>
 #include <gtsam/geometry/Pose3.h>
 
 namespace fvlam
@@ -163,10 +162,48 @@ namespace fvlam
     };
   }
 
+  template<>
+  std::array<gtsam::Point3, Observation::ArraySize>
+  Marker::corners_f_marker<std::array<gtsam::Point3, Observation::ArraySize>>(double marker_length)
+  {
+    auto corners_f_marker = calc_corners3_f_marker(marker_length);
+    return std::array<gtsam::Point3, Observation::ArraySize>{
+      gtsam::Point3{corners_f_marker[0].t()},
+      gtsam::Point3{corners_f_marker[1].t()},
+      gtsam::Point3{corners_f_marker[2].t()},
+      gtsam::Point3{corners_f_marker[3].t()}
+    };
+  }
+
+  template<>
+  std::array<gtsam::Point3, Observation::ArraySize>
+  Marker::corners_f_world<std::array<gtsam::Point3, Observation::ArraySize>>(double marker_length) const
+  {
+    auto corners_f_world = calc_corners3_f_world(marker_length);
+    return std::array<gtsam::Point3, Observation::ArraySize>{
+      gtsam::Point3{corners_f_world[0].t()},
+      gtsam::Point3{corners_f_world[1].t()},
+      gtsam::Point3{corners_f_world[2].t()},
+      gtsam::Point3{corners_f_world[3].t()}
+    };
+  }
+
 // ==============================================================================
 // from fvlam/observation.hpp
 // ==============================================================================
 
+  template<>
+  std::array<gtsam::Point2, Observation::ArraySize>
+  Observation::to<std::array<gtsam::Point2, Observation::ArraySize>>() const
+  {
+    return std::array<gtsam::Point2, Observation::ArraySize>{
+      gtsam::Point2{corners_f_image_[0].x(), corners_f_image_[0].y()},
+      gtsam::Point2{corners_f_image_[1].x(), corners_f_image_[1].y()},
+      gtsam::Point2{corners_f_image_[2].x(), corners_f_image_[2].y()},
+      gtsam::Point2{corners_f_image_[3].x(), corners_f_image_[3].y()}
+    };
+  }
+
   template<>
   std::vector<gtsam::Point2> Observation::to<std::vector<gtsam::Point2>>() const
   {
@@ -189,47 +226,32 @@ namespace fvlam
     const Transform3 &t_world_camera,
     double marker_length)
   {
-    // can optimize this later
-//    std::cout << camera_calibration.fx() << " " << camera_calibration.fy() << std::endl;
-//    std::cout << camera_calibration.px() << " " << camera_calibration.py() << std::endl;
-//    std::cout << camera_calibration.k1() << " " << camera_calibration.k2() << " "
-//              << camera_calibration.p1() << " " << camera_calibration.p1() << std::endl;
+    // Cal3DS2 has no k3 so the CameraInfo made from it has k3 zero and
+    // project_points() uses the same model as gtsam.
+    auto camera_info = CameraInfo::from(camera_calibration);
+    auto t_camera_world = t_world_camera.inverse();
 
     return [
-      camera_calibration,
-      t_world_camera,
+      camera_info,
+      t_camera_world,
       marker_length]
       (const Marker &marker) -> Observation
     {
-      auto gtsam_t_world_camera = t_world_camera.to<gtsam::Pose3>();
-      auto camera = gtsam::PinholeCamera<gtsam::Cal3DS2>{gtsam_t_world_camera, camera_calibration};
-
-      Observation::Array corners_f_image;
-      auto corners_f_world = marker.corners_f_world<std::vector<gtsam::Point3>>(marker_length);
-      for (std::size_t i = 0; i < Observation::ArraySize; i += 1) {
-        auto &corner_f_world = corners_f_world[i];
-
-        try {
-          auto corner_f_image = camera.project(corner_f_world);
-
-          // If the point is outside of the image boundary, then don't save any of the points. This
-          // simulates when a marker can't be seen by a camera.
-          if (corner_f_image.x() < 0 || corner_f_image.x() >= 2 * camera_calibration.px() ||
-              corner_f_image.y() < 0 || corner_f_image.y() >= 2 * camera_calibration.py()) {
-            return Observation{marker.id()};
-          }
-
-          corners_f_image[i] = Translate2::from(corner_f_image);
-        }
-
-          // If the point can't be projected, then don't save any of the points. This
-          // simulates when a marker can't be seen by a camera.
-        catch (gtsam::CheiralityException &e) {
-          return Observation{marker.id()};
-        }
+      auto &camera_matrix = camera_info.camera_matrix();
+      auto corners_f_camera = transform_points(t_camera_world, marker.calc_corners3_f_world_points(marker_length));
+
+      // If a point is behind the camera or outside of the image boundary, then don't save
+      // any of the points. This simulates when a marker can't be seen by a camera.
+      Points2<Observation::ArraySize> corners_f_image;
+      if (!project_points(camera_matrix, camera_info.dist_coeffs(), corners_f_camera, corners_f_image) ||
+          !(corners_f_image.row(0).array() >= 0.).all() ||
+          !(corners_f_image.row(0).array() < 2. * camera_matrix(0, 2)).all() ||
+          !(corners_f_image.row(1).array() >= 0.).all() ||
+          !(corners_f_image.row(1).array() < 2. * camera_matrix(1, 2)).all()) {
+        return Observation{marker.id()};
       }
 
-      return Observation{marker.id(), corners_f_image};
+      return Observation{marker.id(), from_points2(corners_f_image)};
     };
   }
 }
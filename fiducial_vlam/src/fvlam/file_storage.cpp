@@ -1,5 +1,17 @@
 #pragma ide diagnostic ignored "modernize-use-nodiscard"
 
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
 #include "fvlam/camera_info.hpp"
 #include "fvlam/logger.hpp"
 #include "fvlam/marker.hpp"
@@ -535,7 +547,7 @@ namespace fvlam
   {
     other << "{";
 
-    other << "imager_frame_id" << imager_frame_id_;
+    other << "imager_frame_id" << imager_frame_id_.str();
 
     other << "observations" << "[";
     for (auto &observation : v_) {
@@ -575,7 +587,7 @@ namespace fvlam
     other << "stamp";
     stamp_.to(other);
 
-    other << "camera_frame_id" << camera_frame_id_;
+    other << "camera_frame_id" << camera_frame_id_.str();
 
     other << "v" << "[";
     for (auto &observations : v_) {
@@ -664,20 +676,25 @@ namespace fvlam
 // ObservationsSeries save/load
 // ==============================================================================
 
-  void ObservationsSeries::save(const std::string &filename, Logger &logger) const
+  bool ObservationsSeries::save(const std::string &filename, Logger &logger) const
   {
     cv::FileStorage fs(filename, cv::FileStorage::WRITE | cv::FileStorage::FORMAT_YAML);
     if (!fs.isOpened()) {
       logger.error() << "Could not create ObservationsSeries file :" << filename;
-      return;
+      return false;
     }
 
     fs << "observations_series";
     to(fs);
+    return true;
   }
 
   ObservationsSeries ObservationsSeries::load(const std::string &filename, Logger &logger)
   {
+    if (is_binary_file(filename)) {
+      return load_binary(filename, logger);
+    }
+
     cv::FileStorage fs(filename, cv::FileStorage::READ | cv::FileStorage::FORMAT_YAML);
     if (!fs.isOpened()) {
       logger.error() << "Could not open ObservationsSeries file :" << filename;
@@ -691,4 +708,839 @@ namespace fvlam
     auto os = ObservationsSeries::from(observations_series_node);
     return context.success() ? os : ObservationsSeries{MarkerMap{}, CameraInfoMap{}};
   }
+
+// ==============================================================================
+// ObservationsSeries binary save/load
+// ==============================================================================
+
+  using Mapped = ObservationsSeriesMapped;
+
+  static_assert(sizeof(Mapped::FileHeader) == 96, "FileHeader layout changed");
+  static_assert(sizeof(Mapped::FrameRecord) == 24, "FrameRecord layout changed");
+  static_assert(sizeof(Mapped::ObservationsRecord) == 16, "ObservationsRecord layout changed");
+  static_assert(sizeof(Mapped::ObservationRecord) == 112, "ObservationRecord layout changed");
+  static_assert(std::is_trivially_copyable<Mapped::ObservationRecord>::value, "Records are read in place");
+
+  static const char binary_magic[8] = {'F', 'V', 'L', 'A', 'M', 'O', 'S', '\0'};
+  static const std::uint32_t binary_byte_order = 0x01020304;
+
+  static std::uint64_t align8(std::uint64_t offset)
+  { return (offset + 7) & ~std::uint64_t{7}; }
+
+  static std::string header_string(const ObservationsSeries &header_series)
+  {
+    cv::FileStorage fs(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY | cv::FileStorage::FORMAT_YAML);
+    fs << "observations_series";
+    header_series.to(fs);
+    return fs.releaseAndGetString();
+  }
+
+  bool ObservationsSeries::save_binary(const std::string &filename, Logger &logger) const
+  {
+    auto header = header_string(ObservationsSeries{map_, camera_info_map_});
+
+    // Flatten the series into the three record arrays and intern the frame ids.
+    std::map<std::string, std::uint32_t> string_ixs{};
+    std::vector<std::string> strings{};
+    auto intern = [&string_ixs, &strings](const std::string &str) -> std::uint32_t
+    {
+      auto it = string_ixs.find(str);
+      if (it != string_ixs.end()) {
+        return it->second;
+      }
+      auto ix = static_cast<std::uint32_t>(strings.size());
+      string_ixs.emplace(str, ix);
+      strings.emplace_back(str);
+      return ix;
+    };
+
+    std::vector<Mapped::FrameRecord> frames{};
+    std::vector<Mapped::ObservationsRecord> observations_records{};
+    std::vector<Mapped::ObservationRecord> observation_records{};
+    frames.reserve(v_.size());
+
+    for (auto &observations_synced : v_) {
+      frames.emplace_back(Mapped::FrameRecord{observations_synced.stamp().sec(),
+                                              observations_synced.stamp().nanosec(),
+                                              intern(observations_synced.camera_frame_id()),
+                                              static_cast<std::uint32_t>(observations_synced.v().size()),
+                                              observations_records.size()});
+      for (auto &observations : observations_synced.v()) {
+        observations_records.emplace_back(Mapped::ObservationsRecord{intern(observations.imager_frame_id()),
+                                                                     static_cast<std::uint32_t>(observations.size()),
+                                                                     observation_records.size()});
+        for (auto &observation : observations.v()) {
+          Mapped::ObservationRecord record{};
+          record.id_ = observation.id();
+          record.is_valid_ = observation.is_valid() ? 1 : 0;
+          for (std::size_t i = 0; i < Observation::ArraySize; i += 1) {
+            record.corners_f_image_[2 * i] = observation.corners_f_image()[i].x();
+            record.corners_f_image_[2 * i + 1] = observation.corners_f_image()[i].y();
+          }
+          for (std::size_t i = 0; i < 4; i += 1) {
+            record.cov_[i] = observation.cov()(i / 2, i % 2);
+          }
+          observation_records.emplace_back(record);
+        }
+      }
+    }
+
+    std::uint64_t strings_size{0};
+    for (auto &str : strings) {
+      strings_size += sizeof(std::uint32_t) + str.size();
+    }
+
+    Mapped::FileHeader file_header{};
+    std::memcpy(file_header.magic_, binary_magic, sizeof(binary_magic));
+    file_header.version_ = Mapped::current_version;
+    file_header.byte_order_ = binary_byte_order;
+    file_header.header_offset_ = sizeof(Mapped::FileHeader);
+    file_header.header_size_ = header.size();
+    file_header.strings_offset_ = align8(file_header.header_offset_ + file_header.header_size_);
+    file_header.strings_count_ = strings.size();
+    file_header.frames_offset_ = align8(file_header.strings_offset_ + strings_size);
+    file_header.frame_count_ = frames.size();
+    file_header.observations_offset_ = file_header.frames_offset_ + frames.size() * sizeof(Mapped::FrameRecord);
+    file_header.observations_count_ = observations_records.size();
+    file_header.observation_offset_ = file_header.observations_offset_ +
+                                      observations_records.size() * sizeof(Mapped::ObservationsRecord);
+    file_header.observation_count_ = observation_records.size();
+
+    std::ofstream os{filename, std::ios::out | std::ios::binary | std::ios::trunc};
+    if (!os.is_open()) {
+      logger.error() << "Could not create ObservationsSeries file :" << filename;
+      return false;
+    }
+
+    std::uint64_t position{0};
+    auto write = [&os, &position](const void *data, std::uint64_t size) -> void
+    {
+      os.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+      position += size;
+    };
+    auto pad_to = [&write, &position](std::uint64_t offset) -> void
+    {
+      static const char zeros[8]{};
+      write(zeros, offset - position);
+    };
+
+    write(&file_header, sizeof(file_header));
+    write(header.data(), header.size());
+    pad_to(file_header.strings_offset_);
+    for (auto &str : strings) {
+      auto size = static_cast<std::uint32_t>(str.size());
+      write(&size, sizeof(size));
+      write(str.data(), str.size());
+    }
+    pad_to(file_header.frames_offset_);
+    write(frames.data(), frames.size() * sizeof(Mapped::FrameRecord));
+    write(observations_records.data(), observations_records.size() * sizeof(Mapped::ObservationsRecord));
+    write(observation_records.data(), observation_records.size() * sizeof(Mapped::ObservationRecord));
+
+    if (!os.good()) {
+      logger.error() << "Could not write ObservationsSeries file :" << filename;
+      return false;
+    }
+    return true;
+  }
+
+  ObservationsSeries ObservationsSeries::load_binary(const std::string &filename, Logger &logger)
+  {
+    auto mapped = ObservationsSeriesMapped::open(filename, logger);
+    if (!mapped) {
+      return ObservationsSeries{MarkerMap{}, CameraInfoMap{}};
+    }
+
+    auto observations_series = ObservationsSeries{mapped->map(), mapped->camera_info_map()};
+    observations_series.v_mutable().reserve(mapped->size());
+    for (std::size_t i = 0; i < mapped->size(); i += 1) {
+      observations_series.v_mutable().emplace_back(mapped->at(i));
+    }
+    return observations_series;
+  }
+
+  bool ObservationsSeries::is_binary_file(const std::string &filename)
+  {
+    std::ifstream is{filename, std::ios::in | std::ios::binary};
+    char magic[sizeof(binary_magic)]{};
+    is.read(magic, sizeof(magic));
+    return is.good() && std::memcmp(magic, binary_magic, sizeof(magic)) == 0;
+  }
+
+// ==============================================================================
+// ObservationsSeriesMapped class
+// ==============================================================================
+
+  ObservationsSeriesMapped::~ObservationsSeriesMapped()
+  {
+    if (data_ != nullptr) {
+      munmap(const_cast<std::uint8_t *>(data_), data_size_);
+    }
+  }
+
+  std::unique_ptr<ObservationsSeriesMapped> ObservationsSeriesMapped::open(const std::string &filename,
+                                                                           Logger &logger)
+  {
+    auto fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      logger.error() << "Could not open ObservationsSeries file :" << filename;
+      return std::unique_ptr<ObservationsSeriesMapped>{};
+    }
+
+    struct stat file_stat{};
+    void *data = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && static_cast<std::size_t>(file_stat.st_size) >= sizeof(FileHeader)) {
+      data = mmap(nullptr, static_cast<std::size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      logger.error() << "Could not map ObservationsSeries file :" << filename;
+      return std::unique_ptr<ObservationsSeriesMapped>{};
+    }
+
+    // The destructor unmaps the file if any of the checks below fail.
+    std::unique_ptr<ObservationsSeriesMapped> mapped{new ObservationsSeriesMapped{}};
+    mapped->filename_ = filename;
+    mapped->data_ = static_cast<const std::uint8_t *>(data);
+    mapped->data_size_ = static_cast<std::size_t>(file_stat.st_size);
+
+    auto &file_header = *reinterpret_cast<const FileHeader *>(mapped->data_);
+    auto fits = [size = mapped->data_size_](std::uint64_t offset, std::uint64_t count, std::uint64_t stride) -> bool
+    {
+      return offset <= size && count <= (size - offset) / stride && offset % 8 == 0;
+    };
+
+    if (std::memcmp(file_header.magic_, binary_magic, sizeof(binary_magic)) != 0 ||
+        file_header.byte_order_ != binary_byte_order ||
+        file_header.version_ != current_version) {
+      logger.error() << "ObservationsSeries file :" << filename << " is not a version "
+                     << current_version << " binary series for this host";
+      return std::unique_ptr<ObservationsSeriesMapped>{};
+    }
+
+    if (!fits(file_header.header_offset_, file_header.header_size_, 1) ||
+        !fits(file_header.strings_offset_, 0, 1) ||
+        !fits(file_header.frames_offset_, file_header.frame_count_, sizeof(FrameRecord)) ||
+        !fits(file_header.observations_offset_, file_header.observations_count_, sizeof(ObservationsRecord)) ||
+        !fits(file_header.observation_offset_, file_header.observation_count_, sizeof(ObservationRecord))) {
+      logger.error() << "ObservationsSeries file :" << filename << " is truncated";
+      return std::unique_ptr<ObservationsSeriesMapped>{};
+    }
+
+    // The map and camera infos
+    cv::FileStorage fs(std::string(reinterpret_cast<const char *>(mapped->data_ + file_header.header_offset_),
+                                   file_header.header_size_),
+                       cv::FileStorage::READ | cv::FileStorage::MEMORY | cv::FileStorage::FORMAT_YAML);
+    FileStorageContext context{logger};
+    auto root_node = context.make(fs.root());
+    auto observations_series_node = root_node.make(root_node()["observations_series"]);
+    auto header_series = ObservationsSeries::from(observations_series_node);
+    mapped->map_ = header_series.map();
+    mapped->camera_info_map_ = header_series.camera_info_map();
+
+    // The frame ids
+    auto offset = file_header.strings_offset_;
+    for (std::uint64_t i = 0; i < file_header.strings_count_; i += 1) {
+      std::uint32_t size{0};
+      if (!fits(0, offset + sizeof(size), 1)) {
+        break;
+      }
+      std::memcpy(&size, mapped->data_ + offset, sizeof(size));
+      offset += sizeof(size);
+      if (!fits(0, offset + size, 1)) {
+        break;
+      }
+      mapped->strings_.emplace_back(reinterpret_cast<const char *>(mapped->data_ + offset), size);
+      offset += size;
+    }
+    if (mapped->strings_.size() != file_header.strings_count_) {
+      logger.error() << "ObservationsSeries file :" << filename << " has a bad string table";
+      return std::unique_ptr<ObservationsSeriesMapped>{};
+    }
+
+    mapped->file_header_ = &file_header;
+    mapped->frames_ = reinterpret_cast<const FrameRecord *>(mapped->data_ + file_header.frames_offset_);
+    mapped->observations_ = reinterpret_cast<const ObservationsRecord *>(
+      mapped->data_ + file_header.observations_offset_);
+    mapped->observation_ = reinterpret_cast<const ObservationRecord *>(
+      mapped->data_ + file_header.observation_offset_);
+    return mapped;
+  }
+
+  ObservationsSynced ObservationsSeriesMapped::at(std::size_t i) const
+  {
+    // Indices that point outside of the file are treated as empty so a corrupt
+    // record can not read past the mapping.
+    auto string_at = [this](std::uint32_t ix) -> std::string
+    { return ix < strings_.size() ? strings_[ix] : std::string{}; };
+
+    auto &frame = frames_[i];
+    auto observations_synced = ObservationsSynced{Stamp{frame.sec_, frame.nanosec_},
+                                                  string_at(frame.camera_frame_id_ix_)};
+
+    auto observations_end = std::min<std::uint64_t>(frame.observations_begin_ + frame.observations_count_,
+                                                    file_header_->observations_count_);
+    for (auto k = frame.observations_begin_; k < observations_end; k += 1) {
+      auto &observations_record = observations_[k];
+      auto observations = Observations{string_at(observations_record.imager_frame_id_ix_)};
+
+      auto observation_end = std::min<std::uint64_t>(
+        observations_record.observation_begin_ + observations_record.observation_count_,
+        file_header_->observation_count_);
+      for (auto j = observations_record.observation_begin_; j < observation_end; j += 1) {
+        auto &record = observation_[j];
+        if (record.is_valid_ == 0) {
+          observations.v_mutable().emplace_back(Observation{});
+          continue;
+        }
+
+        auto &c = record.corners_f_image_;
+        Observation::Array corners_f_image{Translate2{c[0], c[1]}, Translate2{c[2], c[3]},
+                                           Translate2{c[4], c[5]}, Translate2{c[6], c[7]}};
+        Translate2::CovarianceMatrix cov{};
+        cov << record.cov_[0], record.cov_[1], record.cov_[2], record.cov_[3];
+        observations.v_mutable().emplace_back(Observation{record.id_, corners_f_image, cov});
+      }
+
+      observations_synced.v_mutable().emplace_back(observations);
+    }
+
+    return observations_synced;
+  }
+
+// ==============================================================================
+// MarkerMap binary snapshot
+// ==============================================================================
+
+  struct MapSnapshotHeader
+  {
+    char magic_[8]; // "FVLAMMC"
+    std::uint32_t version_;
+    std::uint32_t byte_order_;
+    std::uint64_t source_size_; // Size and modification time of the YAML file this
+    std::int64_t source_mtime_ns_; // snapshot was built from, 0 if none.
+    double marker_length_;
+    std::int32_t marker_dictionary_id_;
+    std::uint32_t description_size_; // The description follows, padded to 8 bytes
+    std::uint64_t marker_count_; // and then the markers.
+  };
+
+  struct MapSnapshotMarker
+  {
+    std::uint64_t id_;
+    std::uint32_t is_fixed_;
+    std::uint32_t flags_; // 1 -> tf valid, 2 -> cov valid
+    double q_[4]; // w, x, y, z
+    double t_[3];
+    double cov_[36]; // Row major
+    double corners3_f_world_[12];
+  };
+
+  static_assert(sizeof(MapSnapshotHeader) == 56, "MapSnapshotHeader layout changed");
+  static_assert(sizeof(MapSnapshotMarker) == 456, "MapSnapshotMarker layout changed");
+
+  static const char map_snapshot_magic[8] = {'F', 'V', 'L', 'A', 'M', 'M', 'C', '\0'};
+  static const std::uint32_t map_snapshot_version = 1;
+
+  static bool stat_source(const std::string &filename, std::uint64_t &size, std::int64_t &mtime_ns)
+  {
+    struct stat file_stat{};
+    if (stat(filename.c_str(), &file_stat) != 0) {
+      return false;
+    }
+    size = static_cast<std::uint64_t>(file_stat.st_size);
+    mtime_ns = static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    return true;
+  }
+
+  static bool save_map_snapshot(const MarkerMap &map, const std::string &filename,
+                                std::uint64_t source_size, std::int64_t source_mtime_ns)
+  {
+    auto &me = map.map_environment();
+
+    MapSnapshotHeader header{};
+    std::memcpy(header.magic_, map_snapshot_magic, sizeof(map_snapshot_magic));
+    header.version_ = map_snapshot_version;
+    header.byte_order_ = binary_byte_order;
+    header.source_size_ = source_size;
+    header.source_mtime_ns_ = source_mtime_ns;
+    header.marker_length_ = me.marker_length();
+    header.marker_dictionary_id_ = me.marker_dictionary_id();
+    header.description_size_ = static_cast<std::uint32_t>(me.description().size());
+    header.marker_count_ = map.size();
+
+    std::vector<MapSnapshotMarker> markers{};
+    markers.reserve(map.size());
+    for (auto &marker_pair : map.m()) {
+      auto &marker = marker_pair.second;
+      auto &twc = marker.t_map_marker();
+      MapSnapshotMarker record{};
+      record.id_ = marker.id();
+      record.is_fixed_ = marker.is_fixed() ? 1 : 0;
+      record.flags_ = (twc.tf().is_valid() ? 1 : 0) | (twc.is_cov_valid() ? 2 : 0);
+      auto &q = twc.tf().r().q();
+      record.q_[0] = q.w();
+      record.q_[1] = q.x();
+      record.q_[2] = q.y();
+      record.q_[3] = q.z();
+      for (int i = 0; i < 3; i += 1) {
+        record.t_[i] = twc.tf().t().t()(i);
+      }
+      Eigen::Map<Eigen::Matrix<double, 6, 6, Eigen::RowMajor>>{record.cov_} = twc.cov();
+      auto corners = marker.calc_corners3_f_world(me.marker_length());
+      for (std::size_t c = 0; c < Marker::ArraySize; c += 1) {
+        for (int i = 0; i < 3; i += 1) {
+          record.corners3_f_world_[3 * c + i] = corners[c].t()(i);
+        }
+      }
+      markers.emplace_back(record);
+    }
+
+    // Write to a temporary file and rename it so a reader never sees half a snapshot.
+    // The temporary file is removed if anything fails.
+    auto temp_filename = filename + ".tmp";
+    {
+      std::ofstream os{temp_filename, std::ios::out | std::ios::binary | std::ios::trunc};
+      if (!os.is_open()) {
+        std::remove(temp_filename.c_str());
+        return false;
+      }
+      static const char zeros[8]{};
+      os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      os.write(me.description().data(), static_cast<std::streamsize>(me.description().size()));
+      os.write(zeros, static_cast<std::streamsize>(align8(me.description().size()) - me.description().size()));
+      os.write(reinterpret_cast<const char *>(markers.data()),
+               static_cast<std::streamsize>(markers.size() * sizeof(MapSnapshotMarker)));
+      os.close();
+      if (os.fail()) {
+        std::remove(temp_filename.c_str());
+        return false;
+      }
+    }
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Returns false, without logging, if the file is missing, not a snapshot, or was
+  // built from a different source.
+  static bool load_map_snapshot(const std::string &filename, bool check_source,
+                                std::uint64_t source_size, std::int64_t source_mtime_ns,
+                                MarkerMap &map)
+  {
+    std::ifstream is{filename, std::ios::in | std::ios::binary | std::ios::ate};
+    if (!is.is_open()) {
+      return false;
+    }
+
+    // One read for the whole file
+    auto file_size = static_cast<std::size_t>(is.tellg());
+    if (file_size < sizeof(MapSnapshotHeader)) {
+      return false;
+    }
+    std::vector<std::uint64_t> buffer((file_size + 7) / 8);
+    auto data = reinterpret_cast<const char *>(buffer.data());
+    is.seekg(0);
+    if (!is.read(reinterpret_cast<char *>(buffer.data()), static_cast<std::streamsize>(file_size))) {
+      return false;
+    }
+
+    auto &header = *reinterpret_cast<const MapSnapshotHeader *>(data);
+    if (std::memcmp(header.magic_, map_snapshot_magic, sizeof(map_snapshot_magic)) != 0 ||
+        header.version_ != map_snapshot_version ||
+        header.byte_order_ != binary_byte_order ||
+        (check_source && (header.source_size_ != source_size || header.source_mtime_ns_ != source_mtime_ns))) {
+      return false;
+    }
+
+    auto markers_offset = sizeof(MapSnapshotHeader) + align8(header.description_size_);
+    if (markers_offset > file_size ||
+        header.marker_count_ > (file_size - markers_offset) / sizeof(MapSnapshotMarker)) {
+      return false;
+    }
+
+    map = MarkerMap{MapEnvironment{std::string(data + sizeof(MapSnapshotHeader), header.description_size_),
+                                   header.marker_dictionary_id_,
+                                   header.marker_length_}};
+
+    auto records = reinterpret_cast<const MapSnapshotMarker *>(data + markers_offset);
+    for (std::uint64_t i = 0; i < header.marker_count_; i += 1) {
+      auto &record = records[i];
+      auto tf = (record.flags_ & 1) == 0 ? Transform3{} :
+                Transform3{Rotate3{Rotate3::Derived{record.q_[0], record.q_[1], record.q_[2], record.q_[3]}},
+                           Translate3{record.t_[0], record.t_[1], record.t_[2]}};
+      Transform3::CovarianceMatrix cov = Eigen::Map<const Eigen::Matrix<double, 6, 6, Eigen::RowMajor>>{record.cov_};
+      auto twc = (record.flags_ & 2) == 0 ? Transform3WithCovariance{tf} : Transform3WithCovariance{tf, cov};
+      auto marker = Marker{record.id_, twc, record.is_fixed_ != 0};
+
+      auto &c = record.corners3_f_world_;
+      marker.cache_corners_f_world(header.marker_length_,
+                                   Marker::Array3{Translate3{c[0], c[1], c[2]}, Translate3{c[3], c[4], c[5]},
+                                                  Translate3{c[6], c[7], c[8]}, Translate3{c[9], c[10], c[11]}});
+      map.add_marker(std::move(marker));
+    }
+    return true;
+  }
+
+  bool MarkerMap::save_binary(const std::string &filename, Logger &logger) const
+  {
+    if (!save_map_snapshot(*this, filename, 0, 0)) {
+      logger.error() << "Could not create MarkerMap file :" << filename;
+      return false;
+    }
+    return true;
+  }
+
+  MarkerMap MarkerMap::load_binary(const std::string &filename, Logger &logger)
+  {
+    MarkerMap map{};
+    if (!load_map_snapshot(filename, false, 0, 0, map)) {
+      logger.error() << "Could not load MarkerMap snapshot file :" << filename;
+      return MarkerMap{};
+    }
+    return map;
+  }
+
+  MarkerMap MarkerMap::load_cached(const std::string &filename, Logger &logger)
+  {
+    std::uint64_t source_size{0};
+    std::int64_t source_mtime_ns{0};
+    if (!stat_source(filename, source_size, source_mtime_ns)) {
+      return load(filename, logger); // Let load report the problem
+    }
+
+    auto snapshot_filename = filename + ".snapshot";
+    MarkerMap map{};
+    if (load_map_snapshot(snapshot_filename, true, source_size, source_mtime_ns, map)) {
+      logger.info() << "Loaded MarkerMap snapshot " << snapshot_filename;
+      return map;
+    }
+
+    map = load(filename, logger);
+    if (map.marker_length() != 0.0 &&
+        !save_map_snapshot(map, snapshot_filename, source_size, source_mtime_ns)) {
+      logger.warn() << "Could not write MarkerMap snapshot " << snapshot_filename;
+    }
+    return map;
+  }
+
+// ==============================================================================
+// ObservationsSeriesWriter class
+// ==============================================================================
+
+  // cv::FileStorage has to be released before anything it writes is on disk. So
+  // ObservationsSeriesWriter writes each ObservationsSynced itself as one line of
+  // flow style YAML with the same keys as the to<cv::FileStorage> methods above.
+
+  static void flow_double(double d, std::ostream &os)
+  {
+    if (std::isnan(d)) {
+      os << ".Nan";
+    } else if (std::isinf(d)) {
+      os << (d < 0 ? "-.Inf" : ".Inf");
+    } else {
+      os << d;
+    }
+  }
+
+  static void flow_string(const std::string &str, std::ostream &os)
+  {
+    os << '"';
+    for (auto c : str) {
+      if (c == '"' || c == '\\') {
+        os << '\\';
+      }
+      os << c;
+    }
+    os << '"';
+  }
+
+  template<class T1D>
+  static void flow_1d(const T1D &v, std::ostream &os)
+  {
+    os << "[ ";
+    for (size_t r = 0; r < T1D::MaxSizeAtCompileTime; r += 1) {
+      os << (r == 0 ? "" : ", ");
+      flow_double(v(r), os);
+    }
+    os << " ]";
+  }
+
+  template<class T2D>
+  static void flow_2d(const T2D &m, std::ostream &os)
+  {
+    os << "[ ";
+    for (std::size_t r = 0; r < T2D::MaxRowsAtCompileTime; r += 1)
+      for (std::size_t c = 0; c < T2D::MaxColsAtCompileTime; c += 1) {
+        os << (r == 0 && c == 0 ? "" : ", ");
+        flow_double(m(r, c), os);
+      }
+    os << " ]";
+  }
+
+  static void flow_observation(const Observation &observation, std::ostream &os)
+  {
+    os << "{ is_valid: " << (observation.is_valid() ? 1 : 0);
+    if (observation.is_valid()) {
+      os << ", id: ";
+      flow_string(string_from_uint64(observation.id()), os);
+      os << ", corners: [ ";
+      for (std::size_t i = 0; i < Observation::ArraySize; i += 1) {
+        os << (i == 0 ? "" : ", ");
+        flow_1d(observation.corners_f_image()[i].t(), os);
+      }
+      os << " ], cov: ";
+      flow_2d(observation.cov(), os);
+    }
+    os << " }";
+  }
+
+  static void flow_observations_synced(const ObservationsSynced &observations_synced, std::ostream &os)
+  {
+    os << "{ stamp: { s: ";
+    flow_string(string_from_int32(observations_synced.stamp().sec()), os);
+    os << ", ns: ";
+    flow_string(string_from_uint32(observations_synced.stamp().nanosec()), os);
+    os << " }, camera_frame_id: ";
+    flow_string(observations_synced.camera_frame_id(), os);
+    os << ", v: [ ";
+    for (std::size_t i = 0; i < observations_synced.v().size(); i += 1) {
+      auto &observations = observations_synced.v()[i];
+      os << (i == 0 ? "{ imager_frame_id: " : ", { imager_frame_id: ");
+      flow_string(observations.imager_frame_id(), os);
+      os << ", observations: [ ";
+      for (std::size_t j = 0; j < observations.v().size(); j += 1) {
+        os << (j == 0 ? "" : ", ");
+        flow_observation(observations.v()[j], os);
+      }
+      os << " ] }";
+    }
+    os << " ] }";
+  }
+
+  bool ObservationsSeriesWriter::open(const MarkerMap &map, const CameraInfoMap &camera_info_map)
+  {
+    close();
+
+    // The header is small so let cv::FileStorage format it.
+    cv::FileStorage fs(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY | cv::FileStorage::FORMAT_YAML);
+    fs << "observations_series" << "{";
+    fs << "marker_map";
+    map.to(fs);
+    fs << "camera_info_map";
+    camera_info_map.to(fs);
+    fs << "}";
+    auto header = fs.releaseAndGetString();
+
+    os_.open(filename_, std::ios::out | std::ios::trunc);
+    if (!os_.is_open()) {
+      logger_.error() << "Could not create ObservationsSeries file :" << filename_;
+      return false;
+    }
+
+    os_ << std::setprecision(std::numeric_limits<double>::max_digits10);
+    os_ << header << (!header.empty() && header.back() == '\n' ? "" : "\n") << "   v:\n";
+    written_count_ = 0;
+    return true;
+  }
+
+  void ObservationsSeriesWriter::write(const ObservationsSynced &observations_synced)
+  {
+    if (!os_.is_open()) {
+      return;
+    }
+    os_ << "      - ";
+    flow_observations_synced(observations_synced, os_);
+    os_ << "\n";
+    written_count_ += 1;
+  }
+
+  void ObservationsSeriesWriter::flush()
+  {
+    if (os_.is_open()) {
+      os_.flush();
+    }
+  }
+
+  void ObservationsSeriesWriter::close()
+  {
+    if (os_.is_open()) {
+      os_.close();
+    }
+  }
+
+// ==============================================================================
+// ObservationsSeriesReader class
+// ==============================================================================
+
+  class MappedSource : public ObservationsSeriesReader::Source
+  {
+    std::unique_ptr<ObservationsSeriesMapped> mapped_;
+    std::size_t next_ix_{0};
+
+  public:
+    explicit MappedSource(std::unique_ptr<ObservationsSeriesMapped> mapped) :
+      mapped_{std::move(mapped)}
+    {}
+
+    bool next(ObservationsSynced &observations_synced) override
+    {
+      if (next_ix_ >= mapped_->size()) {
+        return false;
+      }
+      observations_synced = mapped_->at(next_ix_++);
+      return true;
+    }
+  };
+
+  // Both YAML writers put the frames last, as the items of the "v" sequence of
+  // observations_series. Each item is cut from the file at the lines that start
+  // an item and parsed on its own.
+  class YamlSource : public ObservationsSeriesReader::Source
+  {
+    Logger &logger_;
+    std::ifstream is_;
+    std::string item_prefix_{}; // The indent and dash that start an item
+    std::string next_item_line_{};
+    bool have_next_item_{false};
+
+    static std::size_t indent_of(const std::string &line)
+    {
+      auto indent = line.find_first_not_of(' ');
+      return indent == std::string::npos ? line.size() : indent;
+    }
+
+  public:
+    YamlSource(Logger &logger, std::ifstream is, std::string first_item_line) :
+      logger_{logger}, is_{std::move(is)},
+      item_prefix_{first_item_line.substr(0, indent_of(first_item_line) + 1)},
+      next_item_line_{std::move(first_item_line)},
+      have_next_item_{true}
+    {}
+
+    bool next(ObservationsSynced &observations_synced) override
+    {
+      if (!have_next_item_) {
+        return false;
+      }
+
+      std::string item = "%YAML:1.0\n---\nv:\n" + next_item_line_ + "\n";
+      have_next_item_ = false;
+
+      std::string line;
+      while (std::getline(is_, line)) {
+        if (line.compare(0, item_prefix_.size(), item_prefix_) == 0) {
+          next_item_line_ = line;
+          have_next_item_ = true;
+          break;
+        }
+        if (indent_of(line) < item_prefix_.size() - 1 && indent_of(line) < line.size()) {
+          break; // Something other than a frame follows the sequence
+        }
+        item += line + "\n";
+      }
+
+      try {
+        cv::FileStorage fs(item, cv::FileStorage::READ | cv::FileStorage::MEMORY | cv::FileStorage::FORMAT_YAML);
+        FileStorageContext context{logger_};
+        auto item_node = context.make(fs.root()["v"][0]);
+        observations_synced = ObservationsSynced::from(item_node);
+      } catch (const cv::Exception &e) {
+        // A recording that was not closed can end with a partial line.
+        logger_.warn() << "Stopped reading ObservationsSeries at a frame that could not be parsed: " << e.what();
+        have_next_item_ = false;
+        return false;
+      }
+      return true;
+    }
+  };
+
+  // When a YAML file can not be split, load all of it.
+  class LoadedSource : public ObservationsSeriesReader::Source
+  {
+    std::vector<ObservationsSynced> v_;
+    std::size_t next_ix_{0};
+
+  public:
+    explicit LoadedSource(std::vector<ObservationsSynced> v) :
+      v_{std::move(v)}
+    {}
+
+    bool next(ObservationsSynced &observations_synced) override
+    {
+      if (next_ix_ >= v_.size()) {
+        return false;
+      }
+      observations_synced = std::move(v_[next_ix_++]);
+      return true;
+    }
+  };
+
+  std::unique_ptr<ObservationsSeriesReader> ObservationsSeriesReader::open(const std::string &filename,
+                                                                           Logger &logger)
+  {
+    if (ObservationsSeries::is_binary_file(filename)) {
+      auto mapped = ObservationsSeriesMapped::open(filename, logger);
+      if (!mapped) {
+        return std::unique_ptr<ObservationsSeriesReader>{};
+      }
+      auto map = mapped->map();
+      auto camera_info_map = mapped->camera_info_map();
+      return std::make_unique<ObservationsSeriesReader>(std::move(map), std::move(camera_info_map),
+                                                        std::make_unique<MappedSource>(std::move(mapped)));
+    }
+
+    std::ifstream is{filename};
+    if (!is.is_open()) {
+      logger.error() << "Could not open ObservationsSeries file :" << filename;
+      return std::unique_ptr<ObservationsSeriesReader>{};
+    }
+
+    // Read the header, everything up to the frames sequence.
+    std::string header{};
+    std::string line{};
+    bool found_v{false};
+    while (std::getline(is, line)) {
+      if (line.compare(0, 5, "   v:") == 0) {
+        found_v = true;
+        break;
+      }
+      header += line + "\n";
+    }
+
+    // The line that starts the first item. An empty sequence is written as "v: []"
+    // or, by a writer that never got a frame, as a "v:" at the end of the file.
+    auto empty_sequence = found_v && line.find("[]", 5) != std::string::npos;
+    std::string first_item_line{};
+    if (found_v && !empty_sequence) {
+      while (std::getline(is, first_item_line) && first_item_line.find_first_not_of(' ') == std::string::npos) {}
+      auto indent = first_item_line.find_first_not_of(' ');
+      empty_sequence = indent == std::string::npos;
+    }
+    auto indent = first_item_line.find_first_not_of(' ');
+    auto have_items = indent != std::string::npos && first_item_line[indent] == '-';
+
+    // Not laid out the way the writers lay out a file.
+    if (!found_v || (!empty_sequence && !have_items)) {
+      auto observations_series = ObservationsSeries::load(filename, logger);
+      return std::make_unique<ObservationsSeriesReader>(
+        observations_series.map(), observations_series.camera_info_map(),
+        std::make_unique<LoadedSource>(std::move(observations_series.v_mutable())));
+    }
+
+    cv::FileStorage fs(header, cv::FileStorage::READ | cv::FileStorage::MEMORY | cv::FileStorage::FORMAT_YAML);
+    FileStorageContext context{logger};
+    auto root_node = context.make(fs.root());
+    auto observations_series_node = root_node.make(root_node()["observations_series"]);
+    auto header_series = ObservationsSeries::from(observations_series_node);
+
+    std::unique_ptr<Source> source{};
+    if (have_items) {
+      source = std::make_unique<YamlSource>(logger, std::move(is), first_item_line);
+    }
+    return std::make_unique<ObservationsSeriesReader>(header_series.map(), header_series.camera_info_map(),
+                                                      std::move(source));
+  }
 }
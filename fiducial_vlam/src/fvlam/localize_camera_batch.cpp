@@ -0,0 +1,135 @@
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "fvlam/camera_info.hpp"
+#include "fvlam/localize_camera_interface.hpp"
+#include "fvlam/logger.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/observation.hpp"
+#include "task_thread.hpp"
+
+namespace fvlam
+{
+
+// ==============================================================================
+// solve_t_map_cameras
+// ==============================================================================
+
+  template<class TLcContext>
+  static std::vector<Transform3WithCovariance> solve_batch(const TLcContext &lc_context,
+                                                           const ObservationsSynced *observations_synced,
+                                                           std::size_t count,
+                                                           const CameraInfoMap &camera_info_map,
+                                                           const MarkerMap &map,
+                                                           Logger &logger,
+                                                           std::size_t thread_count)
+  {
+    std::vector<Transform3WithCovariance> results(count);
+    if (count == 0) {
+      return results;
+    }
+
+    if (thread_count == 0) {
+      thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto run_count = std::min(thread_count, count);
+    auto run_length = (count + run_count - 1) / run_count;
+
+    // Each run is solved front to back by its own solver. The solvers only read the
+    // shared map and camera infos, and share the calibration caches.
+    auto caches = std::make_shared<LocalizeCameraCaches>();
+    auto solve_run = [&](std::size_t run) -> void
+    {
+      auto begin = run * run_length;
+      auto end = std::min(begin + run_length, count);
+      auto localize_camera = make_localize_camera(lc_context, logger, caches);
+      for (auto i = begin; i < end; i += 1) {
+        results[i] = localize_camera->solve_t_map_camera(observations_synced[i], camera_info_map, map);
+      }
+    };
+
+    // The calling thread works on one of the runs.
+    task_thread::WorkStealingPool::shared().parallel_for(run_count, solve_run, 1, run_count);
+
+    return results;
+  }
+
+  template<>
+  std::vector<Transform3WithCovariance> solve_t_map_cameras<LocalizeCameraCvContext>(
+    const LocalizeCameraCvContext &lc_context,
+    const ObservationsSynced *observations_synced, std::size_t count,
+    const CameraInfoMap &camera_info_map, const MarkerMap &map,
+    Logger &logger, std::size_t thread_count)
+  {
+    return solve_batch(lc_context, observations_synced, count, camera_info_map, map, logger, thread_count);
+  }
+
+  template<>
+  std::vector<Transform3WithCovariance> solve_t_map_cameras<LocalizeCameraGtsamFactorContext>(
+    const LocalizeCameraGtsamFactorContext &lc_context,
+    const ObservationsSynced *observations_synced, std::size_t count,
+    const CameraInfoMap &camera_info_map, const MarkerMap &map,
+    Logger &logger, std::size_t thread_count)
+  {
+    return solve_batch(lc_context, observations_synced, count, camera_info_map, map, logger, thread_count);
+  }
+
+// ==============================================================================
+// warm_up_localize_camera
+// ==============================================================================
+
+  void warm_up_localize_camera(LocalizeCameraInterface &localize_camera,
+                               const CameraInfoMap &camera_info_map,
+                               const MarkerMap &map)
+  {
+    if (camera_info_map.m().empty() || map.marker_length() == 0.) {
+      return;
+    }
+
+    // Put the first imager three marker lengths in front of the first marker with
+    // a pose, looking at it.
+    auto marker_it = std::find_if(map.m().begin(), map.m().end(),
+                                  [](const std::pair<const std::uint64_t, Marker> &marker_pair) -> bool
+                                  { return marker_pair.second.is_valid(); });
+    if (marker_it == map.m().end()) {
+      return;
+    }
+    auto &first_camera_info = camera_info_map.m().begin()->second;
+    auto t_marker_imager = Transform3{Rotate3::RzRyRx(M_PI, 0., 0.),
+                                      Translate3{0., 0., 3. * map.marker_length()}};
+    auto t_map_camera = marker_it->second.t_map_marker().tf() * t_marker_imager *
+                        first_camera_info.t_camera_imager().inverse();
+
+    // Project the corners of every marker in front of each imager with the pinhole
+    // model. The solvers take these as measured corners, they only need to be
+    // close enough to what a lens would see for the solve to take its usual path.
+    auto observations_synced = ObservationsSynced{Stamp{}, FrameId{"warm_up"}};
+    for (auto &camera_info_pair : camera_info_map.m()) {
+      auto &camera_info = camera_info_pair.second;
+      auto t_imager_map = (t_map_camera * camera_info.t_camera_imager()).inverse();
+      auto observations = Observations{camera_info.imager_frame_id()};
+      Points2<Observation::ArraySize> corners_f_image;
+      for (auto &marker_pair : map.m()) {
+        auto &marker = marker_pair.second;
+        if (!marker.is_valid()) {
+          continue;
+        }
+        auto corners_f_imager = transform_points(t_imager_map,
+                                                 marker.calc_corners3_f_world_points(map.marker_length()));
+        if (project_points(camera_info.camera_matrix(), CameraInfo::DistCoeffs::Zero(),
+                           corners_f_imager, corners_f_image) &&
+            (corners_f_image.row(0).array() >= 0.).all() &&
+            (corners_f_image.row(0).array() < static_cast<double>(camera_info.width())).all() &&
+            (corners_f_image.row(1).array() >= 0.).all() &&
+            (corners_f_image.row(1).array() < static_cast<double>(camera_info.height())).all()) {
+          observations.v_mutable().emplace_back(Observation{marker_pair.first, from_points2(corners_f_image)});
+        }
+      }
+      observations_synced.v_mutable().emplace_back(std::move(observations));
+    }
+
+    localize_camera.warm_up(observations_synced, camera_info_map, map);
+  }
+}
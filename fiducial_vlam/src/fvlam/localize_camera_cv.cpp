@@ -1,15 +1,20 @@
 #pragma clang diagnostic ignored "-Wunused-private-field"
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
+#include <mutex>
+
 #include "fvlam/camera_info.hpp"
 #include "fvlam/localize_camera_interface.hpp"
 #include "fvlam/logger.hpp"
 #include "fvlam/marker.hpp"
 #include "fvlam/observation.hpp"
+#include "fvlam/undistortion_map.hpp"
 #include "opencv2/aruco.hpp"
 #include "opencv2/calib3d/calib3d.hpp"
 #include "opencv2/core/core.hpp"
+#include "opencv2/core/ocl.hpp"
 #include "opencv2/imgproc.hpp"
+#include "task_thread.hpp"
 
 namespace fvlam
 {
@@ -22,6 +27,14 @@ namespace fvlam
   {
     LocalizeCameraCvContext lc_context_;
     Logger &logger_;
+    std::shared_ptr<LocalizeCameraCaches> caches_;
+
+    // The imagers of a rig are solved concurrently. The pool is sized the first
+    // time a rig with more imagers is seen. The solve can be called from several
+    // threads at once, a call that finds the pool in use solves its imagers on
+    // the calling thread. Everything else a call uses is its own or is locked.
+    std::mutex imager_pool_mutex_{};
+    std::unique_ptr<task_thread::ForkJoinPool> imager_pool_{};
 
     Transform3WithCovariance solve_one_t_map_camera(int i,
                                                     const ObservationsSynced &observations_synced,
@@ -36,37 +49,82 @@ namespace fvlam
     }
 
   public:
-    LocalizeCameraCv(const LocalizeCameraCvContext &lc_context, Logger &logger) :
-      lc_context_{lc_context}, logger_{logger}
+    LocalizeCameraCv(const LocalizeCameraCvContext &lc_context, Logger &logger,
+                     std::shared_ptr<LocalizeCameraCaches> caches) :
+      lc_context_{lc_context}, logger_{logger},
+      caches_{caches ? std::move(caches) : std::make_shared<LocalizeCameraCaches>()}
     {}
 
     Transform3WithCovariance solve_t_map_camera(const ObservationsSynced &observations_synced,
                                                 const CameraInfoMap &camera_info_map,
                                                 const MarkerMap &map) override
     {
-      if (observations_synced.size() == 1) {
+      auto imager_count = observations_synced.size();
+      if (imager_count == 0) {
+        return Transform3WithCovariance{};
+      }
+      if (imager_count == 1) {
         return solve_one_t_map_camera(0, observations_synced, camera_info_map, map);
+      }
+
+      // Solve each imager on its own thread. The calling thread takes one of them.
+      std::vector<Transform3WithCovariance> imager_results(imager_count);
+      std::unique_lock<std::mutex> pool_lock{imager_pool_mutex_, std::try_to_lock};
+      if (pool_lock.owns_lock()) {
+        if (!imager_pool_ || imager_pool_->thread_count() < imager_count - 1) {
+          imager_pool_ = std::make_unique<task_thread::ForkJoinPool>(imager_count - 1);
+        }
+        imager_pool_->parallel_for(imager_count,
+                                   [this, &imager_results, &observations_synced, &camera_info_map, &map](std::size_t i)
+                                   {
+                                     imager_results[i] = solve_one_t_map_camera(i, observations_synced,
+                                                                                camera_info_map, map);
+                                   });
+        pool_lock.unlock();
+      } else {
+        for (std::size_t i = 0; i < imager_count; i += 1) {
+          imager_results[i] = solve_one_t_map_camera(i, observations_synced, camera_info_map, map);
+        }
+      }
 
-      } else if (observations_synced.size() == 2) {
-        auto tmc0 = solve_one_t_map_camera(0, observations_synced, camera_info_map, map);
-        auto tmc1 = solve_one_t_map_camera(1, observations_synced, camera_info_map, map);
-        if (!tmc0.is_valid()) {
-          return tmc0;
+      // Fuse the imagers that found a pose. The mean of the translations and the
+      // normalized sum of the rotation quaternions, flipped into the same hemisphere.
+      // With two imagers this is the slerp midpoint.
+      std::size_t valid_count{0};
+      Eigen::Vector3d sum_t{Eigen::Vector3d::Zero()};
+      Eigen::Vector4d sum_q{Eigen::Vector4d::Zero()};
+      Eigen::Vector4d first_q{};
+      for (auto &tmc : imager_results) {
+        if (!tmc.is_valid()) {
+          continue;
         }
-        if (!tmc1.is_valid()) {
-          return tmc1;
+        Eigen::Vector4d q = tmc.tf().r().q().coeffs();
+        if (valid_count == 0) {
+          first_q = q;
+        } else if (q.dot(first_q) < 0.0) {
+          q = -q;
         }
+        sum_q += q;
+        sum_t += tmc.tf().t().t();
+        valid_count += 1;
+      }
 
-        auto mid_r = tmc0.tf().r().slerp(tmc1.tf().r(), 0.5);
-        auto mid_t = (tmc0.tf().t() + tmc1.tf().t()) * 0.5;
+      if (valid_count == 0) {
+        return Transform3WithCovariance{};
+      }
 
-        logger_.debug() << tmc0.tf().to_string() << " | "
-                       << tmc1.tf().to_string() << " | "
-                       << Transform3{mid_r, mid_t}.to_string();
+      auto mean_r = Rotate3{Eigen::Quaterniond{sum_q.normalized()}};
+      auto mean_t = Translate3{sum_t / static_cast<double>(valid_count)};
 
-        return Transform3WithCovariance(Transform3{mid_r, mid_t});
+      if (logger_.output_debug()) {
+        auto out = logger_.debug();
+        for (auto &tmc : imager_results) {
+          out << (tmc.is_valid() ? tmc.tf().to_string() : std::string{"invalid"}) << " | ";
+        }
+        out << Transform3{mean_r, mean_t}.to_string();
       }
-      return Transform3WithCovariance{};
+
+      return Transform3WithCovariance(Transform3{mean_r, mean_t});
     }
 
     // Given observations of fiducial markers and a map of world locations of those
@@ -75,15 +133,26 @@ namespace fvlam
                                                 const CameraInfo &camera_info,
                                                 const MarkerMap &map) override
     {
-      // Build up two lists of corner points: 2D in the image frame, 3D in the map/world frame
+      // Build up two lists of corner points: 2D in the image frame, 3D in the map/world frame.
+      // With the lookup the image corners are in normalized coordinates.
       std::vector<cv::Point3d> all_corners_f_map;
       std::vector<cv::Point2d> all_corners_f_image;
+      auto undistortion = lc_context_.undistort_lookup_ ?
+                          caches_->undistortions_.get(camera_info) :
+                          std::shared_ptr<const UndistortionMap>{};
 
       for (auto &observation : observations.v()) {
         auto marker_ptr = map.find_marker_const(observation.id());
         if (marker_ptr != nullptr) {
           marker_ptr->corners_f_world(map.marker_length(), all_corners_f_map);
-          observation.to(all_corners_f_image);
+          if (undistortion) {
+            for (auto &corner_f_image : observation.corners_f_image()) {
+              auto normalized = undistortion->normalized(corner_f_image);
+              all_corners_f_image.emplace_back(cv::Point2d{normalized.x(), normalized.y()});
+            }
+          } else {
+            observation.to(all_corners_f_image);
+          }
         }
       }
 
@@ -96,10 +165,17 @@ namespace fvlam
       // Figure out camera location.
       cv::Vec3d rvec, tvec;
       try {
-        auto cc = camera_info.to<CvCameraCalibration>();
-        cv::solvePnP(all_corners_f_map, all_corners_f_image,
-                     cc.first, cc.second,
-                     rvec, tvec);
+        if (undistortion) {
+          cv::solvePnP(all_corners_f_map, all_corners_f_image,
+                       cv::Matx33d::eye(), cv::noArray(),
+                       rvec, tvec);
+        } else {
+          auto calibration = caches_->cv_calibrations_.get(camera_info);
+          auto &cc = *calibration;
+          cv::solvePnP(all_corners_f_map, all_corners_f_image,
+                       cc.first, cc.second,
+                       rvec, tvec);
+        }
 
 #if 0 // Not sure if this is still needed
         // For certain cases, there is a chance that the multi marker solvePnP will
@@ -140,33 +216,278 @@ namespace fvlam
 
   template<>
   std::unique_ptr<LocalizeCameraInterface> make_localize_camera<LocalizeCameraCvContext>(
-    const LocalizeCameraCvContext &lc_context, Logger &logger)
+    const LocalizeCameraCvContext &lc_context, Logger &logger,
+    std::shared_ptr<LocalizeCameraCaches> caches)
   {
-    return std::make_unique<LocalizeCameraCv>(lc_context, logger);
+    return std::make_unique<LocalizeCameraCv>(lc_context, logger, std::move(caches));
   }
 
 // ==============================================================================
 // FiducialMarker class
 // ==============================================================================
 
-
+  // TImage is the image type that detection runs on. cv::Mat runs on the CPU.
+  // cv::UMat uploads the frame once and then every OpenCV call on it, the
+  // pyramid resize and the ArUco stages that support the T-API, can be
+  // dispatched to OpenCL.
+  template<class TImage>
   class FiducialMarker : public FiducialMarkerInterface
   {
     FiducialMarkerContext fm_context_;
     fvlam::MapEnvironment map_environment_;
     Logger &logger_;
+    cv::Ptr<cv::aruco::Dictionary> full_aruco_dictionary_;
     cv::Ptr<cv::aruco::Dictionary> localization_aruco_dictionary_;
     cv::Scalar border_color_;
     cv::Scalar text_color_;
     cv::Scalar corner_color_;
+    CalibrationCache<CvCameraCalibration> calibrations_{};
+
+    // Detector state that is kept across frames. The parameters are only rebuilt
+    // when a detection parameter changes. The output vectors keep their capacity
+    // so a steady-state frame does not reallocate them.
+    cv::Ptr<cv::aruco::DetectorParameters> detector_parameters_{};
+    int detector_corner_refinement_method_{-1};
+    std::vector<int> ids_{};
+    std::vector<std::vector<cv::Point2f>> corners_{};
+    std::vector<std::vector<cv::Point2f>> rejected_{};
+
+    cv::aruco::DetectorParameters &detector_parameters()
+    {
+      if (!detector_parameters_ ||
+          detector_corner_refinement_method_ != fm_context_.corner_refinement_method_) {
+        detector_parameters_ = cv::aruco::DetectorParameters::create();
+
+//     0 = CORNER_REFINE_NONE,     ///< Tag and corners detection based on the ArUco approach
+//     1 = CORNER_REFINE_SUBPIX,   ///< ArUco approach and refine the corners locations using corner subpixel accuracy
+//     2 = CORNER_REFINE_CONTOUR,  ///< ArUco approach and refine the corners locations using the contour-points line fitting
+//     3 = CORNER_REFINE_APRILTAG, ///< Tag and corners detection based on the AprilTag 2 approach @cite wang2016iros
+        detector_parameters_->cornerRefinementMethod = fm_context_.corner_refinement_method_;
+        detector_corner_refinement_method_ = fm_context_.corner_refinement_method_;
+      }
+      return *detector_parameters_;
+    }
+
+    // Dictionary restricted to the ids in the map. Decoding compares each candidate
+    // against every entry of the dictionary so a small dictionary is faster and
+    // rejects candidates that are not map markers. The detector returns an index
+    // into the restricted dictionary, dictionary_ids_ maps it back to the marker id.
+    // An empty dictionary_ids_ means the full dictionary is in use.
+    std::vector<int> dictionary_ids_{};
+    std::mutex restrict_mutex_{};
+    bool restrict_pending_{false};
+    std::vector<std::uint64_t> restrict_marker_ids_{};
+
+    int marker_id(int dictionary_index) const
+    {
+      return dictionary_ids_.empty() ? dictionary_index : dictionary_ids_[dictionary_index];
+    }
+
+    void update_dictionary()
+    {
+      std::vector<std::uint64_t> marker_ids;
+      {
+        std::lock_guard<std::mutex> lock{restrict_mutex_};
+        if (!restrict_pending_) {
+          return;
+        }
+        restrict_pending_ = false;
+        marker_ids.swap(restrict_marker_ids_);
+      }
+
+      std::vector<int> dictionary_ids;
+      cv::Mat bytes_list;
+      for (auto id : marker_ids) {
+        if (id < static_cast<std::uint64_t>(full_aruco_dictionary_->bytesList.rows)) {
+          dictionary_ids.emplace_back(static_cast<int>(id));
+          bytes_list.push_back(full_aruco_dictionary_->bytesList.row(static_cast<int>(id)));
+        }
+      }
+
+      if (dictionary_ids == dictionary_ids_) {
+        return;
+      }
+
+      // The ROI windows were made for the old set of ids.
+      roi_windows_.clear();
+      roi_tracked_ids_.clear();
+
+      if (dictionary_ids.empty()) {
+        localization_aruco_dictionary_ = full_aruco_dictionary_;
+        dictionary_ids_.clear();
+        return;
+      }
+
+      localization_aruco_dictionary_ = cv::makePtr<cv::aruco::Dictionary>(
+        bytes_list, full_aruco_dictionary_->markerSize, full_aruco_dictionary_->maxCorrectionBits);
+      dictionary_ids_.swap(dictionary_ids);
+      logger_.info() << "Detecting " << dictionary_ids_.size() << " marker ids from the map";
+    }
+
+    // ROI tracking state. The windows are where the markers were found in the last frame.
+    std::vector<cv::Rect> roi_windows_{};
+    std::vector<std::uint64_t> roi_tracked_ids_{};
+    int roi_frames_since_full_scan_{0};
+
+    // Detect markers in a window of the image and add them to observations. A marker
+    // that has already been found in an overlapping window is not added again.
+    void detect_in_window(TImage &gray_image, const cv::Rect &window, Observations &observations)
+    {
+      TImage gray_window = gray_image(window); // No copy, references the image data.
+      cv::aruco::detectMarkers(gray_window, localization_aruco_dictionary_, corners_, ids_,
+                               detector_parameters_, rejected_);
+
+      auto dx = static_cast<float>(window.x);
+      auto dy = static_cast<float>(window.y);
+      for (size_t i = 0; i < ids_.size(); i += 1) {
+        auto id = marker_id(ids_[i]);
+        if (contains_id(observations, id)) {
+          continue;
+        }
+        auto &c = corners_[i];
+        observations.v_mutable().emplace_back(Observation(id,
+                                                          c[0].x + dx, c[0].y + dy,
+                                                          c[1].x + dx, c[1].y + dy,
+                                                          c[2].x + dx, c[2].y + dy,
+                                                          c[3].x + dx, c[3].y + dy));
+      }
+    }
+
+    static bool contains_id(const Observations &observations, std::uint64_t id)
+    {
+      for (auto &observation : observations.v()) {
+        if (observation.id() == id) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Search only the windows around last frame's markers. Returns false if
+    // any marker that was being tracked was not found.
+    bool detect_in_roi_windows(TImage &gray_image, Observations &observations)
+    {
+      for (auto &window : roi_windows_) {
+        detect_in_window(gray_image, window, observations);
+      }
+
+      for (auto id : roi_tracked_ids_) {
+        if (!contains_id(observations, id)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Grow a marker's bounding box into a window and add it to the list. Windows
+    // that overlap are merged so the same pixels are not searched twice.
+    static void add_window(std::vector<cv::Rect> &windows,
+                           double x_min, double y_min, double x_max, double y_max, double padding,
+                           const cv::Rect &image_rect)
+    {
+      auto pad = padding * std::max(x_max - x_min, y_max - y_min);
+      auto x0 = static_cast<int>(std::floor(x_min - pad));
+      auto y0 = static_cast<int>(std::floor(y_min - pad));
+      auto x1 = static_cast<int>(std::ceil(x_max + pad));
+      auto y1 = static_cast<int>(std::ceil(y_max + pad));
+      auto window = cv::Rect{x0, y0, x1 - x0, y1 - y0} & image_rect;
+      if (window.empty()) {
+        return;
+      }
+
+      for (auto &w : windows) {
+        if (!(w & window).empty()) {
+          w |= window;
+          return;
+        }
+      }
+      windows.emplace_back(window);
+    }
+
+    // Make a window around each marker for the next frame.
+    void update_roi_windows(const TImage &gray_image, const Observations &observations)
+    {
+      roi_windows_.clear();
+      roi_tracked_ids_.clear();
+      cv::Rect image_rect{0, 0, gray_image.cols, gray_image.rows};
+
+      for (auto &observation : observations.v()) {
+        auto &cfi = observation.corners_f_image();
+        auto x_min = cfi[0].x(), x_max = cfi[0].x();
+        auto y_min = cfi[0].y(), y_max = cfi[0].y();
+        for (size_t j = 1; j < cfi.size(); j += 1) {
+          x_min = std::min(x_min, cfi[j].x());
+          x_max = std::max(x_max, cfi[j].x());
+          y_min = std::min(y_min, cfi[j].y());
+          y_max = std::max(y_max, cfi[j].y());
+        }
+        add_window(roi_windows_, x_min, y_min, x_max, y_max, fm_context_.roi_padding_, image_rect);
+        roi_tracked_ids_.emplace_back(observation.id());
+      }
+    }
+
+    // Pyramid detection state. Candidates are found on a downscaled copy of the image
+    // without corner refinement. Then the markers are detected again at full resolution
+    // in a window around each candidate using the configured corner refinement.
+    cv::Ptr<cv::aruco::DetectorParameters> coarse_detector_parameters_{cv::aruco::DetectorParameters::create()};
+    TImage pyramid_gray_{};
+    std::vector<cv::Rect> pyramid_windows_{};
+
+    void detect_full_frame(TImage &gray_image, Observations &observations)
+    {
+      cv::Rect image_rect{0, 0, gray_image.cols, gray_image.rows};
+      auto scale = fm_context_.pyramid_scale_;
+      if (scale <= 0.0 || scale >= 1.0) {
+        detect_in_window(gray_image, image_rect, observations);
+        return;
+      }
+
+      // Find candidates on the small image. INTER_AREA keeps the marker edges clean.
+      coarse_detector_parameters_->cornerRefinementMethod = cv::aruco::CORNER_REFINE_NONE;
+      cv::resize(gray_image, pyramid_gray_, cv::Size{}, scale, scale, cv::INTER_AREA);
+      cv::aruco::detectMarkers(pyramid_gray_, localization_aruco_dictionary_, corners_, ids_,
+                               coarse_detector_parameters_, rejected_);
+
+      // Map the candidate corners back to full resolution and make windows around them.
+      // The windows are grown by an extra pixel of the small image to cover the
+      // rounding from the downscale.
+      pyramid_windows_.clear();
+      for (auto &c : corners_) {
+        auto x_min = std::min({c[0].x, c[1].x, c[2].x, c[3].x}) - 1.0;
+        auto x_max = std::max({c[0].x, c[1].x, c[2].x, c[3].x}) + 1.0;
+        auto y_min = std::min({c[0].y, c[1].y, c[2].y, c[3].y}) - 1.0;
+        auto y_max = std::max({c[0].y, c[1].y, c[2].y, c[3].y}) + 1.0;
+        add_window(pyramid_windows_, x_min / scale, y_min / scale, x_max / scale, y_max / scale,
+                   fm_context_.roi_padding_, image_rect);
+      }
+
+      // Detect and refine at full resolution.
+      for (auto &window : pyramid_windows_) {
+        detect_in_window(gray_image, window, observations);
+      }
+    }
+
+    // The frame in the detection image type.
+    TImage image_{};
+
+    static void to_image(cv::Mat &gray_image, cv::Mat &image)
+    {
+      image = gray_image; // No copy
+    }
+
+    static void to_image(cv::Mat &gray_image, cv::UMat &image)
+    {
+      gray_image.copyTo(image); // Upload into a buffer that is reused from frame to frame
+    }
 
   public:
     FiducialMarker(const FiducialMarkerContext &fm_context,
                    const fvlam::MapEnvironment &map_environment,
                    Logger &logger) :
       fm_context_{fm_context}, map_environment_{map_environment}, logger_{logger},
-      localization_aruco_dictionary_{cv::aruco::getPredefinedDictionary(
+      full_aruco_dictionary_{cv::aruco::getPredefinedDictionary(
         cv::aruco::PREDEFINED_DICTIONARY_NAME(map_environment.marker_dictionary_id()))},
+      localization_aruco_dictionary_{full_aruco_dictionary_},
       border_color_{fm_context_.border_color_red_ * 255,
                     fm_context_.border_color_green_ * 255,
                     fm_context_.border_color_blue_ * 255},
@@ -178,29 +499,53 @@ namespace fvlam
     Observations detect_markers(cv::Mat &gray_image,
                                 const std::string &frame_id) override
     {
-      auto detectorParameters = cv::aruco::DetectorParameters::create();
+      auto observations = fvlam::Observations{frame_id};
+      detect_markers(gray_image, observations);
+      return observations;
+    }
 
-//     0 = CORNER_REFINE_NONE,     ///< Tag and corners detection based on the ArUco approach
-//     1 = CORNER_REFINE_SUBPIX,   ///< ArUco approach and refine the corners locations using corner subpixel accuracy
-//     2 = CORNER_REFINE_CONTOUR,  ///< ArUco approach and refine the corners locations using the contour-points line fitting
-//     3 = CORNER_REFINE_APRILTAG, ///< Tag and corners detection based on the AprilTag 2 approach @cite wang2016iros
-      detectorParameters->cornerRefinementMethod = fm_context_.corner_refinement_method_;
+    void detect_markers(cv::Mat &gray_image,
+                        Observations &observations) override
+    {
+      // Make sure the detector state is current
+      detector_parameters();
+      update_dictionary();
+      to_image(gray_image, image_);
+
+      observations.v_mutable().clear();
+      observations.v_mutable().reserve(std::max(roi_tracked_ids_.size(), ids_.size()));
+
+      // When ROI tracking is enabled, search only around the markers found in the last
+      // frame. Scan the full frame every N frames to pick up new markers, or whenever
+      // a tracked marker is lost.
+      auto full_scan_every_n = fm_context_.roi_full_scan_every_n_;
+      bool full_scan = full_scan_every_n <= 0 ||
+                       roi_windows_.empty() ||
+                       roi_frames_since_full_scan_ + 1 >= full_scan_every_n;
+
+      if (!full_scan) {
+        roi_frames_since_full_scan_ += 1;
+        if (!detect_in_roi_windows(image_, observations)) {
+          observations.v_mutable().clear();
+          full_scan = true;
+        }
+      }
 
-      // Detect markers
-      std::vector<int> ids;
-      std::vector<std::vector<cv::Point2f>> corners;
-      cv::aruco::detectMarkers(gray_image, localization_aruco_dictionary_, corners, ids, detectorParameters);
+      if (full_scan) {
+        roi_frames_since_full_scan_ = 0;
+        detect_full_frame(image_, observations);
+      }
 
-      // return the corners as an observations structure.
-      auto observations = fvlam::Observations{frame_id};
-      for (size_t i = 0; i < ids.size(); i += 1) {
-        observations.v_mutable().emplace_back(Observation(ids[i],
-                                                          corners[i][0].x, corners[i][0].y,
-                                                          corners[i][1].x, corners[i][1].y,
-                                                          corners[i][2].x, corners[i][2].y,
-                                                          corners[i][3].x, corners[i][3].y));
+      if (full_scan_every_n > 0) {
+        update_roi_windows(image_, observations);
       }
-      return observations;
+    }
+
+    void restrict_to_marker_ids(const std::vector<std::uint64_t> &marker_ids) override
+    {
+      std::lock_guard<std::mutex> lock{restrict_mutex_};
+      restrict_marker_ids_ = marker_ids;
+      restrict_pending_ = true;
     }
 
     // Draw the boundary around detected markers.
@@ -245,7 +590,8 @@ namespace fvlam
     {
       auto rvec = t_camera_marker.r().to<cv::Vec3d>();
       auto tvec = t_camera_marker.t().to<cv::Vec3d>();
-      auto cc = camera_info.to<CvCameraCalibration>();
+      auto calibration = calibrations_.get(camera_info);
+      auto &cc = *calibration;
 
       std::vector<cv::Point3f> axesPoints;
       axesPoints.emplace_back(cv::Point3f(0, 0, 0));
@@ -267,6 +613,13 @@ namespace fvlam
     const fvlam::MapEnvironment &map_environment,
     Logger &logger)
   {
-    return std::make_unique<FiducialMarker>(fm_context, map_environment, logger);
+    if (fm_context.detector_backend_ == 1) {
+      if (cv::ocl::haveOpenCL()) {
+        cv::ocl::setUseOpenCL(true);
+        return std::make_unique<FiducialMarker<cv::UMat>>(fm_context, map_environment, logger);
+      }
+      logger.warn() << "OpenCL is not available, detecting markers on the CPU.";
+    }
+    return std::make_unique<FiducialMarker<cv::Mat>>(fm_context, map_environment, logger);
   }
 }
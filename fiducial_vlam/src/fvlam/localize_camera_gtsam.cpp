@@ -1,10 +1,17 @@
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <vector>
+
 #include "fvlam/localize_camera_interface.hpp"
 #include "fvlam/camera_info.hpp"
 #include "fvlam/logger.hpp"
 #include "fvlam/marker.hpp"
 #include "fvlam/observation.hpp"
+#include "fvlam/undistortion_map.hpp"
+#include <gtsam/geometry/Cal3_S2.h>
 #include <gtsam/geometry/Cal3DS2.h>
 #include <gtsam/geometry/Point3.h>
 #include <gtsam/geometry/Pose3.h>
@@ -13,6 +20,253 @@
 namespace fvlam
 {
 
+// ==============================================================================
+// ResectionSolver class
+// ==============================================================================
+
+// A Levenberg-Marquardt solver for the single camera pose problem. The residual
+// and Jacobian are the same as QuadResectioningOffsetFactor's but the 6x6 normal
+// equations are accumulated directly in fixed-size matrices instead of building
+// a factor graph and running the generic optimizer. The buffers keep their
+// capacity from frame to frame so a steady-state solve does not allocate. An
+// imager whose calibration has no distortion, as with undistorted corners, is
+// projected with the plain pinhole model.
+  class ResectionSolver
+  {
+    struct Imager
+    {
+      std::shared_ptr<const gtsam::Cal3DS2> cal3ds2_;
+      bool pinhole_;
+      gtsam::Cal3_S2 cal3_s2_;
+      bool use_transform_;
+      gtsam::Pose3 t_camera_imager_;
+      std::size_t corners_begin_;
+      std::size_t corners_end_;
+    };
+
+    struct Corner
+    {
+      gtsam::Point3 point_f_world_;
+      gtsam::Point2 point_f_image_;
+    };
+
+    std::vector<Imager> imagers_{};
+    std::vector<Corner> corners_{};
+
+    // The same settings as the LevenbergMarquardtParams used with the factor graph.
+    static constexpr int default_max_iterations_{100};
+    static constexpr double relative_error_tol_{1e-8};
+    static constexpr double absolute_error_tol_{1e-8};
+    static constexpr double lambda_initial_{1e-5};
+    static constexpr double lambda_factor_{10.0};
+    static constexpr double lambda_upper_bound_{1e5};
+
+    template<class TCamera>
+    void accumulate(const Imager &imager, const TCamera &camera, const gtsam::Matrix6 &HT,
+                    gtsam::Matrix6 &information, gtsam::Vector6 &gradient, double &sum_squared) const
+    {
+      for (auto i = imager.corners_begin_; i < imager.corners_end_; i += 1) {
+        auto &corner = corners_[i];
+        gtsam::Matrix26 H;
+        gtsam::Vector2 e = camera.project(corner.point_f_world_, H) - corner.point_f_image_;
+        gtsam::Matrix26 J = imager.use_transform_ ? gtsam::Matrix26{H * HT} : H;
+        information.noalias() += J.transpose() * J;
+        gradient.noalias() += J.transpose() * e;
+        sum_squared += e.squaredNorm();
+      }
+    }
+
+    template<class TCamera>
+    double squared_error(const Imager &imager, const TCamera &camera) const
+    {
+      double sum_squared{0.0};
+      for (auto i = imager.corners_begin_; i < imager.corners_end_; i += 1) {
+        auto &corner = corners_[i];
+        sum_squared += (camera.project(corner.point_f_world_) - corner.point_f_image_).squaredNorm();
+      }
+      return sum_squared;
+    }
+
+    // Accumulate the whitened normal equations at pose. Returns false if a
+    // corner is behind the camera.
+    bool linearize(const gtsam::Pose3 &pose, double inv_variance,
+                   gtsam::Matrix6 &information, gtsam::Vector6 &gradient, double &error) const
+    {
+      information.setZero();
+      gradient.setZero();
+      double sum_squared{0.0};
+
+      try {
+        for (auto &imager : imagers_) {
+          gtsam::Matrix6 HT{gtsam::Matrix6::Identity()};
+          auto t_world_imager = imager.use_transform_ ?
+                                pose.compose(imager.t_camera_imager_, HT) :
+                                pose;
+          if (imager.pinhole_) {
+            accumulate(imager, gtsam::PinholeCamera<gtsam::Cal3_S2>{t_world_imager, imager.cal3_s2_}, HT,
+                       information, gradient, sum_squared);
+          } else {
+            accumulate(imager, gtsam::PinholeCamera<gtsam::Cal3DS2>{t_world_imager, *imager.cal3ds2_}, HT,
+                       information, gradient, sum_squared);
+          }
+        }
+      } catch (gtsam::CheiralityException &e) {
+        return false;
+      }
+
+      information *= inv_variance;
+      gradient *= inv_variance;
+      error = 0.5 * sum_squared * inv_variance;
+      return true;
+    }
+
+    bool evaluate(const gtsam::Pose3 &pose, double inv_variance, double &error) const
+    {
+      double sum_squared{0.0};
+
+      try {
+        for (auto &imager : imagers_) {
+          auto t_world_imager = imager.use_transform_ ? pose.compose(imager.t_camera_imager_) : pose;
+          sum_squared += imager.pinhole_ ?
+                         squared_error(imager, gtsam::PinholeCamera<gtsam::Cal3_S2>{t_world_imager, imager.cal3_s2_}) :
+                         squared_error(imager, gtsam::PinholeCamera<gtsam::Cal3DS2>{t_world_imager, *imager.cal3ds2_});
+        }
+      } catch (gtsam::CheiralityException &e) {
+        return false;
+      }
+
+      error = 0.5 * sum_squared * inv_variance;
+      return true;
+    }
+
+  public:
+    void clear()
+    {
+      imagers_.clear();
+      corners_.clear();
+    }
+
+    auto corner_count() const
+    { return corners_.size(); }
+
+    // Add the corners of the observed markers that are in the map.
+    void add_observations(const Observations &observations,
+                          const CameraInfo &camera_info,
+                          std::shared_ptr<const gtsam::Cal3DS2> cal3ds2,
+                          const MarkerMap &map)
+    {
+      auto use_transform = camera_info.t_camera_imager().is_valid();
+      auto corners_begin = corners_.size();
+
+      for (auto &observation : observations.v()) {
+        auto marker_ptr = map.find_marker_const(observation.id());
+        if (marker_ptr != nullptr) {
+          auto corners_f_world = marker_ptr->calc_corners3_f_world(map.marker_length());
+          auto &corners_f_image = observation.corners_f_image();
+          for (size_t j = 0; j < Marker::ArraySize; j += 1) {
+            corners_.emplace_back(Corner{corners_f_world[j].t(),
+                                         gtsam::Point2{corners_f_image[j].x(), corners_f_image[j].y()}});
+          }
+        }
+      }
+
+      if (corners_.size() > corners_begin) {
+        auto pinhole = cal3ds2->k().isZero(0.);
+        auto cal3_s2 = gtsam::Cal3_S2{cal3ds2->fx(), cal3ds2->fy(), cal3ds2->skew(), cal3ds2->px(), cal3ds2->py()};
+        imagers_.emplace_back(Imager{std::move(cal3ds2),
+                                     pinhole, cal3_s2,
+                                     use_transform,
+                                     use_transform ? camera_info.t_camera_imager().to<gtsam::Pose3>() : gtsam::Pose3{},
+                                     corners_begin, corners_.size()});
+      }
+    }
+
+    // Solve for the camera pose starting at t_map_camera_initial. rms_error is the
+    // RMS corner reprojection error in pixels of the result. If max_iterations (0 for
+    // the default) or the deadline is reached first, the best pose so far is returned
+    // and status says so.
+    Transform3WithCovariance solve(const gtsam::Pose3 &t_map_camera_initial,
+                                   double corner_measurement_sigma,
+                                   int max_iterations,
+                                   std::chrono::steady_clock::time_point deadline,
+                                   double &rms_error,
+                                   SolveStatus &status) const
+    {
+      status = SolveStatus::converged;
+      if (corners_.empty()) {
+        return Transform3WithCovariance{};
+      }
+
+      auto inv_variance = 1.0 / (corner_measurement_sigma * corner_measurement_sigma);
+      auto pose = t_map_camera_initial;
+      gtsam::Matrix6 information;
+      gtsam::Vector6 gradient;
+      double error;
+      if (!linearize(pose, inv_variance, information, gradient, error)) {
+        return Transform3WithCovariance{};
+      }
+
+      if (max_iterations <= 0) {
+        max_iterations = default_max_iterations_;
+      }
+
+      auto lambda = lambda_initial_;
+      bool converged{false};
+      int iteration{0};
+      for (; iteration < max_iterations; iteration += 1) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+          break;
+        }
+
+        // Increase the damping until a step reduces the error.
+        bool stepped{false};
+        gtsam::Pose3 new_pose;
+        double new_error{0.0};
+        while (lambda < lambda_upper_bound_) {
+          gtsam::Matrix6 damped = information;
+          damped.diagonal().array() += lambda;
+          gtsam::Vector6 delta = damped.ldlt().solve(-gradient);
+          new_pose = pose.retract(delta);
+          if (evaluate(new_pose, inv_variance, new_error) && new_error <= error) {
+            stepped = true;
+            break;
+          }
+          lambda *= lambda_factor_;
+        }
+
+        // No step reduced the error so this is a minimum.
+        if (!stepped) {
+          converged = true;
+          break;
+        }
+
+        auto decrease = error - new_error;
+        converged = decrease <= absolute_error_tol_ ||
+                         decrease <= relative_error_tol_ * error;
+        pose = new_pose;
+        lambda /= lambda_factor_;
+        if (!linearize(pose, inv_variance, information, gradient, error)) {
+          return Transform3WithCovariance{};
+        }
+        if (converged) {
+          break;
+        }
+      }
+
+      // Leaving the loop without converging means the budget ran out.
+      if (!converged) {
+        status = iteration == 0 ? SolveStatus::budget_seed : SolveStatus::budget_estimate;
+      }
+
+      rms_error = std::sqrt(2.0 * error / corners_.size()) * corner_measurement_sigma;
+
+      // With only the one pose variable, its marginal covariance is the inverse
+      // of the information matrix.
+      gtsam::Matrix6 cov = information.inverse();
+      return Transform3WithCovariance{Transform3::from(pose), GtsamUtil::cov_ros_from_gtsam(pose, cov)};
+    }
+  };
+
 // ==============================================================================
 // LocalizeCameraGtsamFactor class
 // ==============================================================================
@@ -21,9 +275,179 @@ namespace fvlam
   {
     LocalizeCameraGtsamFactorContext lc_context_;
     Logger &logger_;
+    std::shared_ptr<LocalizeCameraCaches> caches_; // Also used by lc_cv_
     std::unique_ptr<LocalizeCameraInterface> lc_cv_;
 
     gtsam::Symbol camera_key_{'c', 0};
+    ResectionSolver resection_solver_{};
+    SolveStatus last_solve_status_{SolveStatus::converged};
+
+    // With undistort_lookup_ the frame is undistorted into the arena and solved
+    // with the pinhole version of each imager's calibration.
+    ObservationsSyncedArena undistorted_arena_{};
+    CameraInfoMap pinhole_camera_info_map_{};
+    std::map<std::string, std::shared_ptr<const UndistortionMap>> pinhole_undistortions_{};
+
+    // Tracking state. The pose from the last frame, and the one before it for
+    // a constant velocity prediction, are used as the initial value for the
+    // optimizer in place of a PnP solve.
+    static constexpr double tracking_max_gap_seconds_{1.0}; // Longer gaps restart from PnP
+    bool tracking_valid_{false};
+    bool tracking_prev_valid_{false};
+    gtsam::Pose3 tracking_t_map_camera_{};
+    gtsam::Pose3 tracking_prev_t_map_camera_{};
+    double tracking_time_{0.0};
+    double tracking_prev_time_{0.0};
+
+    static double to_seconds(const Stamp &stamp)
+    {
+      return stamp.sec() + stamp.nanosec() * 1.0e-9;
+    }
+
+    bool tracking_initial(double time, gtsam::Pose3 &t_map_camera_initial) const
+    {
+      if (lc_context_.tracking_mode_ == 0 || !tracking_valid_) {
+        return false;
+      }
+
+      auto dt = time - tracking_time_;
+      if (dt <= 0.0 || dt > tracking_max_gap_seconds_) {
+        return false;
+      }
+
+      t_map_camera_initial = tracking_t_map_camera_;
+
+      // Constant velocity: repeat the last motion, scaled to this frame's interval.
+      auto dt_prev = tracking_time_ - tracking_prev_time_;
+      if (lc_context_.tracking_mode_ == 2 && tracking_prev_valid_ && dt_prev > 0.0) {
+        auto t_prev_last = tracking_prev_t_map_camera_.inverse() * tracking_t_map_camera_;
+        t_map_camera_initial = tracking_t_map_camera_ *
+                               gtsam::Pose3::Expmap(gtsam::Pose3::Logmap(t_prev_last) * (dt / dt_prev));
+      }
+      return true;
+    }
+
+    void update_tracking(double time, const Transform3WithCovariance &t_map_camera)
+    {
+      if (!t_map_camera.is_valid()) {
+        tracking_valid_ = false;
+        tracking_prev_valid_ = false;
+        return;
+      }
+      tracking_prev_valid_ = tracking_valid_;
+      tracking_prev_t_map_camera_ = tracking_t_map_camera_;
+      tracking_prev_time_ = tracking_time_;
+      tracking_valid_ = true;
+      tracking_t_map_camera_ = t_map_camera.tf().to<gtsam::Pose3>();
+      tracking_time_ = time;
+    }
+
+    // Turn the corners into ideal pixels. Imagers without a CameraInfo are left
+    // out, the solve would skip them anyway.
+    const ObservationsSynced &undistort(const ObservationsSynced &observations_synced,
+                                        const CameraInfoMap &camera_info_map)
+    {
+      undistorted_arena_.begin_frame(observations_synced.stamp(), observations_synced.camera_frame_id());
+      for (auto &observations : observations_synced.v()) {
+        auto ci_pair = camera_info_map.m().find(observations.imager_frame_id());
+        if (ci_pair == camera_info_map.m().end()) {
+          continue;
+        }
+        auto undistortion = caches_->undistortions_.get(ci_pair->second);
+        undistortion->undistort(observations, undistorted_arena_.add_observations(observations.imager_frame_id()));
+
+        // Only copy the pinhole CameraInfo when the imager's calibration changes.
+        auto &pinhole_undistortion = pinhole_undistortions_[ci_pair->first];
+        if (pinhole_undistortion != undistortion) {
+          pinhole_undistortion = undistortion;
+          pinhole_camera_info_map_.m_mutable()[ci_pair->first] = undistortion->pinhole_camera_info();
+        }
+      }
+      return undistorted_arena_.observations_synced();
+    }
+
+    // The number of observed corners that are on markers in the map.
+    static std::size_t known_corner_count(const ObservationsSynced &observations_synced,
+                                          const MarkerMap &map)
+    {
+      std::size_t count{0};
+      for (auto &observations : observations_synced.v()) {
+        for (auto &observation : observations.v()) {
+          if (map.find_marker_const(observation.id()) != nullptr) {
+            count += 4;
+          }
+        }
+      }
+      return count;
+    }
+
+    // The error of the corner measurement factors alone. The marker priors of the
+    // project between graph are left out, a constrained prior's error says nothing
+    // about how well the corners fit.
+    static double corner_factors_error(const gtsam::NonlinearFactorGraph &graph,
+                                       const gtsam::Values &values)
+    {
+      double error{0.0};
+      for (auto &factor : graph) {
+        if (factor && dynamic_cast<const gtsam::PriorFactor<gtsam::Pose3> *>(factor.get()) == nullptr) {
+          error += factor->error(values);
+        }
+      }
+      return error;
+    }
+
+    // Optimize the graph using Levenberg-Marquardt. rms_error is the RMS corner
+    // reprojection error in pixels of the result. The optimizer is stepped here,
+    // rather than with optimize(), so that it can be stopped at the deadline. LM
+    // only accepts steps that reduce the error so its values are always the best
+    // estimate so far.
+    Transform3WithCovariance optimize(const gtsam::NonlinearFactorGraph &graph,
+                                      const gtsam::Values &initial,
+                                      std::size_t corner_count,
+                                      std::chrono::steady_clock::time_point deadline,
+                                      double &rms_error,
+                                      SolveStatus &status)
+    {
+      auto params = gtsam::LevenbergMarquardtParams();
+      params.setRelativeErrorTol(1e-8);
+      params.setAbsoluteErrorTol(1e-8);
+      if (lc_context_.max_iterations_ > 0) {
+        params.setMaxIterations(lc_context_.max_iterations_);
+      }
+//      params.setVerbosity("TERMINATION");
+
+      try {
+        gtsam::LevenbergMarquardtOptimizer optimizer(graph, initial, params);
+
+        // The same termination tests as NonlinearOptimizer::optimize().
+        bool converged = optimizer.error() <= params.errorTol;
+        while (!converged && optimizer.iterations() < params.maxIterations &&
+               std::chrono::steady_clock::now() < deadline) {
+          auto current_error = optimizer.error();
+          optimizer.iterate();
+          converged = gtsam::checkConvergence(params.relativeErrorTol, params.absoluteErrorTol,
+                                              params.errorTol, current_error, optimizer.error());
+        }
+        status = converged ? SolveStatus::converged :
+                 optimizer.iterations() == 0 ? SolveStatus::budget_seed : SolveStatus::budget_estimate;
+
+        auto &result = optimizer.values();
+//        logger_.debug() << "initial error = " << graph.error(initial) << std::endl;
+//        logger_.debug() << "final error = " << graph.error(result) << std::endl;
+
+        // A factor's error() is half the sum of its squared whitened residuals.
+        rms_error = corner_count == 0 ? 0.0 :
+                    std::sqrt(2.0 * corner_factors_error(graph, result) / corner_count) *
+                    lc_context_.corner_measurement_sigma_;
+
+        // 5. Extract the result into a Transform3WithCovariance.
+        return GtsamUtil::extract_transform3_with_covariance(graph, result, camera_key_);
+
+      } catch (gtsam::CheiralityException &e) {
+      }
+
+      return Transform3WithCovariance{};
+    }
 
     void add_factors_resectioning(const Observations &observations,
                                   const MarkerMap &map,
@@ -43,8 +467,8 @@ namespace fvlam
         if (marker_ptr != nullptr) {
 
           // The marker corners as seen in the image.
-          auto corners_f_image = observation.to<std::vector<gtsam::Point2>>();
-          auto corners_f_map = marker_ptr->corners_f_world<std::vector<gtsam::Point3>>(map.marker_length());
+          auto corners_f_image = observation.to<std::array<gtsam::Point2, Observation::ArraySize>>();
+          auto corners_f_map = marker_ptr->corners_f_world<std::array<gtsam::Point3, Observation::ArraySize>>(map.marker_length());
 
           // Add factors to the graph.
           for (size_t j = 0; j < corners_f_image.size(); j += 1) {
@@ -77,8 +501,8 @@ namespace fvlam
         if (marker_ptr != nullptr) {
 
           // The marker corners as seen in the image.
-          auto corners_f_image = observation.to<std::vector<gtsam::Point2>>();
-          auto corners_f_marker = Marker::corners_f_marker<std::vector<gtsam::Point3>>(map.marker_length());
+          auto corners_f_image = observation.to<std::array<gtsam::Point2, Observation::ArraySize>>();
+          auto corners_f_marker = Marker::corners_f_marker<std::array<gtsam::Point3, Observation::ArraySize>>(map.marker_length());
 
           // Add factors to the graph.
           for (size_t j = 0; j < corners_f_image.size(); j += 1) {
@@ -138,8 +562,8 @@ namespace fvlam
         if (marker_ptr != nullptr) {
 
           // The marker corners as seen in the image.
-          auto corners_f_image = observation.to<std::vector<gtsam::Point2>>();
-          auto corners_f_map = marker_ptr->corners_f_world<std::vector<gtsam::Point3>>(map.marker_length());
+          auto corners_f_image = observation.to<std::array<gtsam::Point2, Observation::ArraySize>>();
+          auto corners_f_map = marker_ptr->corners_f_world<std::array<gtsam::Point3, Observation::ArraySize>>(map.marker_length());
 
           // Add factor to the graph.
           graph.emplace_shared<QuadResectioningOffsetFactor>(camera_key_, corners_f_image, corner_noise, corners_f_map,
@@ -159,7 +583,7 @@ namespace fvlam
                                gtsam::Values &initial)
     {
       // Create a GTSAM camera calibration structure.
-      auto cal3ds2 = std::make_shared<const gtsam::Cal3DS2>(camera_info.to<gtsam::Cal3DS2>());
+      auto cal3ds2 = caches_->gtsam_calibrations_.get(camera_info);
 
       switch (lc_context_.gtsam_factor_type_) {
         default:
@@ -184,16 +608,18 @@ namespace fvlam
         auto ci_pair = camera_info_map.m().find(observations.imager_frame_id());
         if (ci_pair != camera_info_map.m().end()) {
           auto &camera_info = ci_pair->second;
-          auto cal3ds2 = std::make_shared<const gtsam::Cal3DS2>(camera_info.to<gtsam::Cal3DS2>());
+          auto cal3ds2 = caches_->gtsam_calibrations_.get(camera_info);
           add_factors_quad_resectioning(observations, camera_info, map, cal3ds2, graph);
         }
       }
     }
 
   public:
-    LocalizeCameraGtsamFactor(const LocalizeCameraGtsamFactorContext &lc_context, Logger &logger) :
+    LocalizeCameraGtsamFactor(const LocalizeCameraGtsamFactorContext &lc_context, Logger &logger,
+                              std::shared_ptr<LocalizeCameraCaches> caches) :
       lc_context_{lc_context}, logger_{logger},
-      lc_cv_{make_localize_camera(fvlam::LocalizeCameraCvContext(), logger)}
+      caches_{caches ? std::move(caches) : std::make_shared<LocalizeCameraCaches>()},
+      lc_cv_{make_localize_camera(fvlam::LocalizeCameraCvContext(), logger, caches_)}
     {
       logger_.debug() << "Construct LocalizeCameraResectioning";
     }
@@ -202,10 +628,31 @@ namespace fvlam
                                                 const CameraInfoMap &camera_info_map,
                                                 const MarkerMap &map) override
     {
+      if (lc_context_.undistort_lookup_) {
+        auto &undistorted = undistort(observations_synced, camera_info_map);
+        return solve(undistorted, pinhole_camera_info_map_, map);
+      }
+      return solve(observations_synced, camera_info_map, map);
+    }
+
+  private:
+    Transform3WithCovariance solve(const ObservationsSynced &observations_synced,
+                                   const CameraInfoMap &camera_info_map,
+                                   const MarkerMap &map)
+    {
+      last_solve_status_ = SolveStatus::converged;
       if (observations_synced.empty()) {
         return Transform3WithCovariance{};
       }
 
+      // The time budget covers the whole call, including the PnP initial value.
+      auto deadline = std::chrono::steady_clock::time_point::max();
+      if (lc_context_.max_solve_ms_ > 0.) {
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     std::chrono::duration<double, std::milli>{lc_context_.max_solve_ms_});
+      }
+
       // Find an estimate of the camera pose to use as an initial value
       auto &observations_0 = observations_synced.v()[0];
       auto camera_info_pair_0 = camera_info_map.m().find(observations_0.imager_frame_id());
@@ -213,48 +660,123 @@ namespace fvlam
         return Transform3WithCovariance{};
       }
       auto &camera_info_0 = camera_info_pair_0->second;
-      auto t_map_camera_initial = lc_cv_->solve_t_map_camera(observations_0, camera_info_0, map);
-      if (!t_map_camera_initial.is_valid()) {
-        return Transform3WithCovariance{};
+
+      // When tracking, start from the pose of the last frame. Otherwise find an
+      // estimate with PnP.
+      auto time = to_seconds(observations_synced.stamp());
+      gtsam::Pose3 t_map_camera_initial{};
+      bool tracked = tracking_initial(time, t_map_camera_initial);
+      if (!tracked) {
+        auto t_map_camera_cv = lc_cv_->solve_t_map_camera(observations_0, camera_info_0, map);
+        if (!t_map_camera_cv.is_valid()) {
+          update_tracking(time, t_map_camera_cv);
+          return Transform3WithCovariance{};
+        }
+        t_map_camera_initial = t_map_camera_cv.tf().to<gtsam::Pose3>();
       }
 
       // 1. Allocate the graph and initial estimate
       gtsam::NonlinearFactorGraph graph{};
       gtsam::Values initial{};
 
+      bool use_resection_solver = lc_context_.gtsam_factor_type_ == 4;
+      if (use_resection_solver) {
 
-      // Add the camera initial value.
-      initial.insert(camera_key_, t_map_camera_initial.tf().to<gtsam::Pose3>());
+        // The resection solver does not use a graph, it takes the corners directly.
+        resection_solver_.clear();
+        for (auto &observations : observations_synced.v()) {
+          auto ci_pair = camera_info_map.m().find(observations.imager_frame_id());
+          if (ci_pair != camera_info_map.m().end()) {
+            resection_solver_.add_observations(observations, ci_pair->second,
+                                               caches_->gtsam_calibrations_.get(ci_pair->second), map);
+          }
+        }
 
-      // 2. add factors to the graph
-      if (observations_synced.size() == 1 && !camera_info_0.t_camera_imager().is_valid()) {
-        add_monocular_factors(observations_0, camera_info_0, map, graph, initial);
       } else {
-        add_multiocular_factors(observations_synced, camera_info_map, map, graph);
-      }
 
-      if (initial.empty()) {
-        return Transform3WithCovariance{};
+        // Add the camera initial value.
+        initial.insert(camera_key_, t_map_camera_initial);
+
+        // 2. add factors to the graph
+        if (observations_synced.size() == 1 && !camera_info_0.t_camera_imager().is_valid()) {
+          add_monocular_factors(observations_0, camera_info_0, map, graph, initial);
+        } else {
+          add_multiocular_factors(observations_synced, camera_info_map, map, graph);
+        }
+
+        if (initial.empty()) {
+          return Transform3WithCovariance{};
+        }
       }
 
-      // 4. Optimize the graph using Levenberg-Marquardt
-      auto params = gtsam::LevenbergMarquardtParams();
-      params.setRelativeErrorTol(1e-8);
-      params.setAbsoluteErrorTol(1e-8);
-//      params.setVerbosity("TERMINATION");
+      // 4. Optimize
+      auto corner_count = known_corner_count(observations_synced, map);
+      double rms_error{0.0};
+      auto solve_from = [&](const gtsam::Pose3 &t_map_camera_start) -> Transform3WithCovariance
+      {
+        if (use_resection_solver) {
+          return resection_solver_.solve(t_map_camera_start, lc_context_.corner_measurement_sigma_,
+                                         lc_context_.max_iterations_, deadline, rms_error, last_solve_status_);
+        }
+        initial.update(camera_key_, t_map_camera_start);
+        return optimize(graph, initial, corner_count, deadline, rms_error, last_solve_status_);
+      };
+
+      auto t_map_camera = solve_from(t_map_camera_initial);
+
+      // A tracked solve that did not converge to a good fit is redone from PnP,
+      // unless the time budget is already spent. Type 3 measures marker poses
+      // rather than corners so it has no corner error to judge the fit by.
+      auto has_corner_error = lc_context_.gtsam_factor_type_ != 3;
+      auto poor_fit = has_corner_error && rms_error > lc_context_.tracking_max_error_;
+      if (tracked && (!t_map_camera.is_valid() || poor_fit) &&
+          std::chrono::steady_clock::now() < deadline) {
+        auto t_map_camera_cv = lc_cv_->solve_t_map_camera(observations_0, camera_info_0, map);
+        if (!t_map_camera_cv.is_valid()) {
+          update_tracking(time, t_map_camera_cv);
+          return Transform3WithCovariance{};
+        }
+        t_map_camera = solve_from(t_map_camera_cv.tf().to<gtsam::Pose3>());
+      }
 
-      try {
-        auto result = gtsam::LevenbergMarquardtOptimizer(graph, initial, params).optimize();
-//        logger_.debug() << "initial error = " << graph.error(initial) << std::endl;
-//        logger_.debug() << "final error = " << graph.error(result) << std::endl;
+      update_tracking(time, t_map_camera);
+      return t_map_camera;
+    }
 
-        // 5. Extract the result into a Transform3WithCovariance.
-        return GtsamUtil::extract_transform3_with_covariance(graph, result, camera_key_);
+  public:
+    SolveStatus last_solve_status() const override
+    {
+      return last_solve_status_;
+    }
 
-      } catch (gtsam::CheiralityException &e) {
-      }
+    // The solve would replace the tracking pose with the made up one.
+    void warm_up(const ObservationsSynced &observations_synced,
+                 const CameraInfoMap &camera_info_map,
+                 const MarkerMap &map) override
+    {
+      auto tracking_valid = tracking_valid_;
+      auto tracking_prev_valid = tracking_prev_valid_;
+      auto tracking_t_map_camera = tracking_t_map_camera_;
+      auto tracking_prev_t_map_camera = tracking_prev_t_map_camera_;
+      auto tracking_time = tracking_time_;
+      auto tracking_prev_time = tracking_prev_time_;
+      auto last_solve_status = last_solve_status_;
+
+      solve_t_map_camera(observations_synced, camera_info_map, map);
+
+      tracking_valid_ = tracking_valid;
+      tracking_prev_valid_ = tracking_prev_valid;
+      tracking_t_map_camera_ = tracking_t_map_camera;
+      tracking_prev_t_map_camera_ = tracking_prev_t_map_camera;
+      tracking_time_ = tracking_time;
+      tracking_prev_time_ = tracking_prev_time;
+      last_solve_status_ = last_solve_status;
+    }
 
-      return Transform3WithCovariance{};
+    void reset_tracking() override
+    {
+      tracking_valid_ = false;
+      tracking_prev_valid_ = false;
     }
 
     // Given observations of fiducial markers and a map of world locations of those
@@ -314,8 +836,9 @@ namespace fvlam
 
   template<>
   std::unique_ptr<LocalizeCameraInterface> make_localize_camera<LocalizeCameraGtsamFactorContext>(
-    const LocalizeCameraGtsamFactorContext &lc_context, Logger &logger)
+    const LocalizeCameraGtsamFactorContext &lc_context, Logger &logger,
+    std::shared_ptr<LocalizeCameraCaches> caches)
   {
-    return std::make_unique<LocalizeCameraGtsamFactor>(lc_context, logger);
+    return std::make_unique<LocalizeCameraGtsamFactor>(lc_context, logger, std::move(caches));
   }
 }
@@ -0,0 +1,169 @@
+#include <cmath>
+#include <vector>
+
+#include "fvlam/camera_info.hpp"
+#include "fvlam/localize_camera_interface.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/observation.hpp"
+
+namespace fvlam
+{
+// ==============================================================================
+// LocalizeCameraStaticScene class
+// ==============================================================================
+
+  class LocalizeCameraStaticScene : public LocalizeCameraInterface
+  {
+    std::unique_ptr<LocalizeCameraInterface> localize_camera_;
+    double max_corner_motion_;
+
+    // What the last solution was computed from.
+    bool have_last_{false};
+    ObservationsSynced last_observations_synced_{Stamp{}, ""};
+    std::vector<std::size_t> last_calibration_hashes_{};
+    std::vector<Transform3::MuVector> last_t_map_markers_{};
+    double last_marker_length_{0.};
+    Transform3WithCovariance last_t_map_camera_{};
+
+    // The calibration of each imager in observations_synced order.
+    static bool calibration_hashes(const ObservationsSynced &observations_synced,
+                                   const CameraInfoMap &camera_info_map,
+                                   std::vector<std::size_t> &hashes)
+    {
+      hashes.clear();
+      for (auto &observations : observations_synced.v()) {
+        auto it = camera_info_map.m().find(observations.imager_frame_id());
+        if (it == camera_info_map.m().end()) {
+          return false;
+        }
+        hashes.emplace_back(it->second.calibration_hash());
+      }
+      return true;
+    }
+
+    // The map pose of each observed marker in observations_synced order. A marker
+    // missing from the map gets a NaN pose so it never matches.
+    static void t_map_markers(const ObservationsSynced &observations_synced,
+                              const MarkerMap &map,
+                              std::vector<Transform3::MuVector> &mus)
+    {
+      mus.clear();
+      for (auto &observations : observations_synced.v()) {
+        for (auto &observation : observations.v()) {
+          auto marker = map.find_marker_const(observation.id());
+          mus.emplace_back(marker == nullptr ?
+                           Transform3::MuVector::Constant(std::nan("")) :
+                           marker->t_map_marker().tf().mu());
+        }
+      }
+    }
+
+    // True if every imager sees the same markers, in the same order, as in the last
+    // solved frame and no corner has moved more than max_corner_motion_ pixels.
+    bool same_observations(const ObservationsSynced &observations_synced) const
+    {
+      auto &v = observations_synced.v();
+      auto &last_v = last_observations_synced_.v();
+      if (v.size() != last_v.size() ||
+          observations_synced.camera_frame_id() != last_observations_synced_.camera_frame_id()) {
+        return false;
+      }
+
+      auto max_corner_motion_squared = max_corner_motion_ * max_corner_motion_;
+      for (std::size_t i = 0; i < v.size(); i += 1) {
+        if (v[i].imager_frame_id() != last_v[i].imager_frame_id() ||
+            v[i].size() != last_v[i].size()) {
+          return false;
+        }
+        for (std::size_t j = 0; j < v[i].size(); j += 1) {
+          auto &observation = v[i].v()[j];
+          auto &last_observation = last_v[i].v()[j];
+          if (observation.id() != last_observation.id()) {
+            return false;
+          }
+          for (std::size_t c = 0; c < Observation::ArraySize; c += 1) {
+            if ((observation.corners_f_image()[c].t() -
+                 last_observation.corners_f_image()[c].t()).squaredNorm() > max_corner_motion_squared) {
+              return false;
+            }
+          }
+        }
+      }
+      return true;
+    }
+
+  public:
+    LocalizeCameraStaticScene(std::unique_ptr<LocalizeCameraInterface> localize_camera,
+                              double max_corner_motion) :
+      localize_camera_{std::move(localize_camera)}, max_corner_motion_{max_corner_motion}
+    {}
+
+    // A reused pose keeps the status of the solve it came from.
+    SolveStatus last_solve_status() const override
+    {
+      return localize_camera_->last_solve_status();
+    }
+
+    Transform3WithCovariance solve_t_map_camera(const Observations &observations,
+                                                const CameraInfo &camera_info,
+                                                const MarkerMap &map) override
+    {
+      return localize_camera_->solve_t_map_camera(observations, camera_info, map);
+    }
+
+    // A made up frame is not kept as the last frame.
+    void warm_up(const ObservationsSynced &observations_synced,
+                 const CameraInfoMap &camera_info_map,
+                 const MarkerMap &map) override
+    {
+      localize_camera_->warm_up(observations_synced, camera_info_map, map);
+    }
+
+    void reset_tracking() override
+    {
+      have_last_ = false;
+      localize_camera_->reset_tracking();
+    }
+
+    Transform3WithCovariance solve_t_map_camera(const ObservationsSynced &observations_synced,
+                                                const CameraInfoMap &camera_info_map,
+                                                const MarkerMap &map) override
+    {
+      // The frame only matches if the calibrations and the observed markers'
+      // poses are also unchanged, a new map or calibration is always solved.
+      std::vector<std::size_t> hashes{};
+      std::vector<Transform3::MuVector> mus{};
+      auto have_calibrations = calibration_hashes(observations_synced, camera_info_map, hashes);
+      if (have_last_ && have_calibrations &&
+          map.marker_length() == last_marker_length_ &&
+          hashes == last_calibration_hashes_ &&
+          same_observations(observations_synced)) {
+        t_map_markers(observations_synced, map, mus);
+        if (mus == last_t_map_markers_) {
+          return last_t_map_camera_;
+        }
+      }
+
+      auto t_map_camera = localize_camera_->solve_t_map_camera(observations_synced, camera_info_map, map);
+
+      // Only a valid solution is reused. The frame it came from stays the reference
+      // so slow drift eventually adds up to a new solve.
+      have_last_ = have_calibrations && t_map_camera.is_valid();
+      if (have_last_) {
+        last_observations_synced_ = observations_synced;
+        last_calibration_hashes_ = std::move(hashes);
+        t_map_markers(observations_synced, map, last_t_map_markers_);
+        last_marker_length_ = map.marker_length();
+        last_t_map_camera_ = t_map_camera;
+      }
+      return t_map_camera;
+    }
+  };
+
+  std::unique_ptr<LocalizeCameraInterface> make_static_scene_localize_camera(
+    std::unique_ptr<LocalizeCameraInterface> localize_camera,
+    double max_corner_motion)
+  {
+    return std::make_unique<LocalizeCameraStaticScene>(std::move(localize_camera), max_corner_motion);
+  }
+}
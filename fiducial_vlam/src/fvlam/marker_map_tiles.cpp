@@ -0,0 +1,218 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "fvlam/logger.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/marker_map_tiles.hpp"
+
+namespace fvlam
+{
+// ==============================================================================
+// MarkerMapTiles class
+// ==============================================================================
+
+  static const char *tiles_index_magic = "fvlam_map_tiles";
+  static const int tiles_index_version = 1;
+
+  static std::string index_filename(const std::string &directory)
+  {
+    return directory + "/tiles.txt";
+  }
+
+  static std::string environment_filename(const std::string &directory)
+  {
+    return directory + "/environment.fvmc";
+  }
+
+  static std::string tile_filename(const std::string &directory, const MarkerMapTiles::TileKey &key)
+  {
+    return directory + "/tile_" + std::to_string(key[0]) + "_" +
+           std::to_string(key[1]) + "_" + std::to_string(key[2]) + ".fvmc";
+  }
+
+  // The modification time of a file in nanoseconds. Save writes each file to a
+  // temporary and renames it so a new stamp means a complete new file.
+  static std::int64_t file_stamp(const std::string &filename)
+  {
+    struct stat st{};
+    if (stat(filename.c_str(), &st) != 0) {
+      return 0;
+    }
+    return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  }
+
+  // Index format, one line each:
+  //  fvlam_map_tiles <version>
+  //  tile_size <size>
+  //  tile <x> <y> <z> <id count> <id> <id> ...
+  MarkerMapTiles::MarkerMapTiles(std::string directory, Logger &logger) :
+    directory_{std::move(directory)}
+  {
+    // Take the stamp first so an index that is replaced while it is read is
+    // read again.
+    index_stamp_ = file_stamp(index_filename(directory_));
+
+    std::ifstream is{index_filename(directory_)};
+    if (!is.is_open()) {
+      logger.error() << "Could not open map tiles index :" << index_filename(directory_);
+      return;
+    }
+
+    std::string magic{};
+    int version{0};
+    std::string tile_size_label{};
+    double tile_size{0.};
+    is >> magic >> version >> tile_size_label >> tile_size;
+    if (!is || magic != tiles_index_magic || version != tiles_index_version ||
+        tile_size_label != "tile_size" || !(tile_size > 0.)) {
+      logger.error() << "Not a map tiles index :" << index_filename(directory_);
+      return;
+    }
+
+    std::string line{};
+    while (std::getline(is, line)) {
+      std::istringstream ss{line};
+      std::string label{};
+      TileKey key{};
+      std::size_t count{0};
+      if (!(ss >> label >> key[0] >> key[1] >> key[2] >> count) || label != "tile") {
+        continue;
+      }
+      auto &ids = tile_ids_[key];
+      std::uint64_t id{0};
+      while (ids.size() < count && ss >> id) {
+        ids.emplace_back(id);
+        id_tiles_.emplace(id, key);
+      }
+    }
+
+    auto environment_map = MarkerMap::load_binary(environment_filename(directory_), logger);
+    if (environment_map.marker_length() == 0.) {
+      tile_ids_.clear();
+      id_tiles_.clear();
+      return;
+    }
+    map_environment_ = environment_map.map_environment();
+    tile_size_ = tile_size;
+  }
+
+  bool MarkerMapTiles::find_tile(std::uint64_t id, TileKey &key) const
+  {
+    auto it = id_tiles_.find(id);
+    if (it == id_tiles_.end()) {
+      return false;
+    }
+    key = it->second;
+    return true;
+  }
+
+  MarkerMap MarkerMapTiles::load_tile(const TileKey &key, Logger &logger) const
+  {
+    if (tile_ids_.find(key) == tile_ids_.end()) {
+      return MarkerMap{map_environment_};
+    }
+    auto map = MarkerMap::load_binary(tile_filename(directory_, key), logger);
+    if (!map.map_environment().equals(map_environment_)) {
+      logger.warn() << "Map tile " << tile_filename(directory_, key) << " does not match the tiles index";
+      return MarkerMap{map_environment_};
+    }
+    return map;
+  }
+
+  std::int64_t MarkerMapTiles::tile_stamp(const TileKey &key) const
+  {
+    return file_stamp(tile_filename(directory_, key));
+  }
+
+  std::int64_t MarkerMapTiles::index_stamp(const std::string &directory)
+  {
+    return file_stamp(index_filename(directory));
+  }
+
+  MarkerMapTiles::TileKey MarkerMapTiles::tile_of(const Translate3 &position, double tile_size)
+  {
+    return TileKey{static_cast<int>(std::floor(position.x() / tile_size)),
+                   static_cast<int>(std::floor(position.y() / tile_size)),
+                   static_cast<int>(std::floor(position.z() / tile_size))};
+  }
+
+  bool MarkerMapTiles::save(const MarkerMap &map, double tile_size, const std::string &directory, Logger &logger)
+  {
+    if (!(tile_size > 0.)) {
+      logger.error() << "Map tile size must be positive :" << tile_size;
+      return false;
+    }
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+      logger.error() << "Could not create map tiles directory :" << directory;
+      return false;
+    }
+
+    std::map<TileKey, MarkerMap> tiles{};
+    std::size_t skipped_count{0};
+    for (auto &marker_pair : map.m()) {
+      auto &marker = marker_pair.second;
+      if (!marker.is_valid()) {
+        skipped_count += 1;
+        continue;
+      }
+      auto key = tile_of(marker.t_map_marker().tf().t(), tile_size);
+      auto it = tiles.find(key);
+      if (it == tiles.end()) {
+        it = tiles.emplace(key, MarkerMap{map.map_environment()}).first;
+      }
+      it->second.add_marker(marker);
+    }
+
+    if (!MarkerMap{map.map_environment()}.save_binary(environment_filename(directory), logger)) {
+      return false;
+    }
+    for (auto &tile_pair : tiles) {
+      if (!tile_pair.second.save_binary(tile_filename(directory, tile_pair.first), logger)) {
+        return false;
+      }
+    }
+
+    // Write to a temporary file and rename it so a reader never sees half an index.
+    // The temporary file is removed if anything fails.
+    auto filename = index_filename(directory);
+    auto temp_filename = filename + ".tmp";
+    {
+      std::ofstream os{temp_filename, std::ios::out | std::ios::trunc};
+      if (!os.is_open()) {
+        std::remove(temp_filename.c_str());
+        logger.error() << "Could not create map tiles index :" << filename;
+        return false;
+      }
+      os.precision(17);
+      os << tiles_index_magic << " " << tiles_index_version << "\n"
+         << "tile_size " << tile_size << "\n";
+      for (auto &tile_pair : tiles) {
+        auto &key = tile_pair.first;
+        os << "tile " << key[0] << " " << key[1] << " " << key[2] << " " << tile_pair.second.size();
+        for (auto &marker_pair : tile_pair.second.m()) {
+          os << " " << marker_pair.first;
+        }
+        os << "\n";
+      }
+      os.close();
+      if (os.fail()) {
+        std::remove(temp_filename.c_str());
+        logger.error() << "Could not write map tiles index :" << filename;
+        return false;
+      }
+    }
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      logger.error() << "Could not replace map tiles index :" << filename;
+      return false;
+    }
+
+    logger.info() << "Saved " << (map.size() - skipped_count) << " markers in " << tiles.size()
+                  << " map tiles to " << directory;
+    return true;
+  }
+}
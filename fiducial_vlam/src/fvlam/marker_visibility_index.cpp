@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+
+#include "fvlam/camera_info.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/marker_visibility_index.hpp"
+
+namespace fvlam
+{
+// ==============================================================================
+// MarkerVisibilityIndex class
+// ==============================================================================
+
+  MarkerVisibilityIndex::MarkerVisibilityIndex(const MarkerMap &map, double cell_size) :
+    cell_size_{cell_size > 0. ? cell_size : 2.0}, marker_length_{map.marker_length()}
+  {
+    entries_.reserve(map.size());
+    for (auto &id_marker_pair : map.m()) {
+      auto &marker = id_marker_pair.second;
+      if (!marker.is_valid()) {
+        continue;
+      }
+      auto &t_map_marker = marker.t_map_marker().tf();
+      entries_.emplace_back(Entry{marker.id(),
+                                  t_map_marker.t().t(),
+                                  t_map_marker.r().rotation_matrix().col(2)});
+      cells_[cell_of(entries_.back().position_)].emplace_back(entries_.size() - 1);
+    }
+  }
+
+  Eigen::Vector3i MarkerVisibilityIndex::cell_of(const Translate3::MuVector &position) const
+  {
+    return (position / cell_size_).array().floor().cast<int>().matrix();
+  }
+
+  // Visit the entries within radius of center. Only the cells that overlap the
+  // bounding box of the sphere are looked at.
+  template<class TFunc>
+  void MarkerVisibilityIndex::for_each_within(const Translate3::MuVector &center, double radius, TFunc func) const
+  {
+    auto radius_vector = Translate3::MuVector::Constant(radius);
+    auto lo = cell_of(center - radius_vector);
+    auto hi = cell_of(center + radius_vector);
+    auto radius_squared = radius * radius;
+
+    // A large radius over a small map is cheaper as a walk of the entries.
+    auto box_cells = static_cast<double>(hi.x() - lo.x() + 1) *
+                     static_cast<double>(hi.y() - lo.y() + 1) *
+                     static_cast<double>(hi.z() - lo.z() + 1);
+    if (box_cells > static_cast<double>(cells_.size())) {
+      for (auto &entry : entries_) {
+        if ((entry.position_ - center).squaredNorm() <= radius_squared) {
+          func(entry);
+        }
+      }
+      return;
+    }
+
+    Eigen::Vector3i cell{};
+    for (cell.x() = lo.x(); cell.x() <= hi.x(); cell.x() += 1) {
+      for (cell.y() = lo.y(); cell.y() <= hi.y(); cell.y() += 1) {
+        for (cell.z() = lo.z(); cell.z() <= hi.z(); cell.z() += 1) {
+          auto it = cells_.find(cell);
+          if (it == cells_.end()) {
+            continue;
+          }
+          for (auto ix : it->second) {
+            auto &entry = entries_[ix];
+            if ((entry.position_ - center).squaredNorm() <= radius_squared) {
+              func(entry);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<std::uint64_t> MarkerVisibilityIndex::markers_within(const Translate3 &center, double radius) const
+  {
+    std::vector<std::uint64_t> ids{};
+    for_each_within(center.t(), radius, [&ids](const Entry &entry) -> void
+    {
+      ids.emplace_back(entry.id_);
+    });
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  std::vector<std::uint64_t> MarkerVisibilityIndex::markers_in_view(const Transform3 &t_map_camera,
+                                                                    const CameraInfo &camera_info,
+                                                                    double max_range) const
+  {
+    auto &camera_matrix = camera_info.camera_matrix();
+    auto fx = camera_matrix(0, 0);
+    auto fy = camera_matrix(1, 1);
+    auto cx = camera_matrix(0, 2);
+    auto cy = camera_matrix(1, 2);
+    auto width = static_cast<double>(camera_info.width());
+    auto height = static_cast<double>(camera_info.height());
+
+    auto t_camera_map = t_map_camera.inverse();
+    auto r_camera_map = t_camera_map.r().rotation_matrix();
+    auto &t_camera_map_t = t_camera_map.t().t();
+    auto &camera_position = t_map_camera.t().t();
+    auto half_diagonal = marker_length_ * M_SQRT1_2;
+
+    std::vector<std::uint64_t> ids{};
+    for_each_within(camera_position, max_range, [&](const Entry &entry) -> void
+    {
+      // The pattern has to face the camera.
+      if (entry.normal_.dot(camera_position - entry.position_) <= 0.) {
+        return;
+      }
+
+      // The marker's bounding sphere has to be in front of the camera and overlap
+      // the image. The sphere's radius is grown to pixels at the center's depth.
+      Translate3::MuVector p = r_camera_map * entry.position_ + t_camera_map_t;
+      if (p.z() + half_diagonal <= 0.) {
+        return;
+      }
+      if (p.z() > half_diagonal) {
+        auto u = fx * p.x() / p.z() + cx;
+        auto v = fy * p.y() / p.z() + cy;
+        auto margin_u = fx * half_diagonal / (p.z() - half_diagonal);
+        auto margin_v = fy * half_diagonal / (p.z() - half_diagonal);
+        if (u < -margin_u || u > width + margin_u ||
+            v < -margin_v || v > height + margin_v) {
+          return;
+        }
+      }
+      ids.emplace_back(entry.id_);
+    });
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+}
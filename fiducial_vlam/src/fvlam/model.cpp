@@ -1,7 +1,6 @@
 
 
 #include "fvlam/model.hpp"
-#include <gtsam/geometry/Cal3DS2.h>
 #include "gtsam/inference/Symbol.h"
 #include <gtsam/linear/Sampler.h>
 #include "opencv2/core.hpp"
@@ -334,18 +333,22 @@ namespace fvlam
 
     for (auto &camera_info_pair : camera_info_map.m()) {
       const CameraInfo &camera_info = camera_info_pair.second;
-      auto gtsam_camera_calibration = camera_info.to<gtsam::Cal3DS2>();
-
-      auto project_t_world_marker_function = fvlam::Marker::project_t_world_marker(
-        gtsam_camera_calibration,
-        t_map_camera * camera_info.t_camera_imager(),
-        map_environment.marker_length());
+      auto &camera_matrix = camera_info.camera_matrix();
+      auto t_imager_map = (t_map_camera * camera_info.t_camera_imager()).inverse();
 
+      // A marker is seen only if all its corners are in front of the imager and
+      // inside the image, which is taken to be twice the principal point.
       auto observations = Observations{camera_info.imager_frame_id()};
+      Points2<Observation::ArraySize> corners_f_image;
       for (auto &marker : markers) {
-        auto observation = project_t_world_marker_function(marker);
-        if (observation.is_valid()) {
-          observations.v_mutable().emplace_back(observation);
+        auto corners_f_imager = transform_points(t_imager_map,
+                                                 marker.calc_corners3_f_world_points(map_environment.marker_length()));
+        if (project_points(camera_matrix, camera_info.dist_coeffs(), corners_f_imager, corners_f_image) &&
+            (corners_f_image.row(0).array() >= 0.).all() &&
+            (corners_f_image.row(0).array() < 2. * camera_matrix(0, 2)).all() &&
+            (corners_f_image.row(1).array() >= 0.).all() &&
+            (corners_f_image.row(1).array() < 2. * camera_matrix(1, 2)).all()) {
+          observations.v_mutable().emplace_back(Observation{marker.id(), from_points2(corners_f_image)});
         }
       }
       observations_synced.v_mutable().emplace_back(observations);
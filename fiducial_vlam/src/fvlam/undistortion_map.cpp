@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cmath>
+
+#include "fvlam/undistortion_map.hpp"
+
+namespace fvlam
+{
+// ==============================================================================
+// UndistortionMap class
+// ==============================================================================
+
+  UndistortionMap::UndistortionMap(const CameraInfo &camera_info, double grid_step) :
+    pinhole_camera_info_{camera_info.imager_frame_id(),
+                         camera_info.width(), camera_info.height(),
+                         camera_info.camera_matrix(), CameraInfo::DistCoeffs::Zero(),
+                         camera_info.t_camera_imager()},
+    camera_matrix_{camera_info.camera_matrix()},
+    dist_coeffs_{camera_info.dist_coeffs()},
+    no_distortion_{camera_info.dist_coeffs().isZero(0.)},
+    grid_step_{grid_step > 0. ? grid_step : default_grid_step},
+    grid_origin_{-2. * grid_step_},
+    grid_cols_{0}, grid_rows_{0}
+  {
+    // Without distortion, or without an image size to cover, there is no table.
+    if (no_distortion_ || camera_info.width() == 0 || camera_info.height() == 0) {
+      return;
+    }
+
+    // Two steps of margin on each side for corners found just off the image.
+    grid_cols_ = static_cast<int>(std::ceil((camera_info.width() - 2. * grid_origin_) / grid_step_)) + 1;
+    grid_rows_ = static_cast<int>(std::ceil((camera_info.height() - 2. * grid_origin_) / grid_step_)) + 1;
+    grid_.reserve(static_cast<std::size_t>(grid_cols_) * grid_rows_);
+    for (int row = 0; row < grid_rows_; row += 1) {
+      for (int col = 0; col < grid_cols_; col += 1) {
+        grid_.emplace_back(normalized_exact(Translate2{grid_origin_ + col * grid_step_,
+                                                       grid_origin_ + row * grid_step_}));
+      }
+    }
+
+    // The lookup is worst in the middle of a cell.
+    for (int row = 0; row < grid_rows_ - 1; row += 1) {
+      for (int col = 0; col < grid_cols_ - 1; col += 1) {
+        auto pixel = Translate2{grid_origin_ + (col + 0.5) * grid_step_,
+                                grid_origin_ + (row + 0.5) * grid_step_};
+        auto error = (ideal_pixel(pixel).t() -
+                      (camera_matrix_ * normalized_exact(pixel).homogeneous()).head<2>()).norm();
+        max_lookup_error_ = std::max(max_lookup_error_, error);
+      }
+    }
+  }
+
+  // The same model as OpenCV's with k1, k2, p1, p2, k3.
+  UndistortionMap::Normalized UndistortionMap::distort(const Normalized &undistorted,
+                                                       Eigen::Matrix2d &jacobian) const
+  {
+    auto k1 = dist_coeffs_(0);
+    auto k2 = dist_coeffs_(1);
+    auto p1 = dist_coeffs_(2);
+    auto p2 = dist_coeffs_(3);
+    auto k3 = dist_coeffs_(4);
+    auto x = undistorted.x();
+    auto y = undistorted.y();
+
+    auto r2 = x * x + y * y;
+    auto radial = 1. + r2 * (k1 + r2 * (k2 + r2 * k3));
+    auto d_radial = k1 + r2 * (2. * k2 + r2 * 3. * k3); // d radial / d r2
+
+    jacobian << radial + 2. * x * x * d_radial + 2. * p1 * y + 6. * p2 * x,
+      2. * x * y * d_radial + 2. * p1 * x + 2. * p2 * y,
+      2. * x * y * d_radial + 2. * p1 * x + 2. * p2 * y,
+      radial + 2. * y * y * d_radial + 6. * p1 * y + 2. * p2 * x;
+
+    return Normalized{x * radial + 2. * p1 * x * y + p2 * (r2 + 2. * x * x),
+                      y * radial + p1 * (r2 + 2. * y * y) + 2. * p2 * x * y};
+  }
+
+  UndistortionMap::Normalized UndistortionMap::distorted_normalized(const Translate2 &pixel) const
+  {
+    auto y_distorted = (pixel.y() - camera_matrix_(1, 2)) / camera_matrix_(1, 1);
+    auto x_distorted = (pixel.x() - camera_matrix_(0, 2) - camera_matrix_(0, 1) * y_distorted) /
+                       camera_matrix_(0, 0);
+    return Normalized{x_distorted, y_distorted};
+  }
+
+  UndistortionMap::Normalized UndistortionMap::normalized_exact(const Translate2 &pixel) const
+  {
+    auto distorted = distorted_normalized(pixel);
+    if (no_distortion_) {
+      return distorted;
+    }
+
+    // Newton's method from the distorted point, a real lens is close enough to the
+    // identity over the image that this converges in a few steps. Steps that don't
+    // reduce the residual are halved so a point past where the model folds back
+    // on itself ends up near the fold instead of far away.
+    auto undistorted = distorted;
+    Eigen::Matrix2d jacobian;
+    Normalized residual = distort(undistorted, jacobian) - distorted;
+    for (int i = 0; i < 20 && residual.squaredNorm() > 1.e-24; i += 1) {
+      Normalized step = jacobian.inverse() * residual;
+      if (!step.allFinite()) {
+        break;
+      }
+      Eigen::Matrix2d step_jacobian;
+      Normalized step_residual{};
+      bool reduced{false};
+      for (int halvings = 0; halvings < 10; halvings += 1) {
+        step_residual = distort(undistorted - step, step_jacobian) - distorted;
+        reduced = step_residual.squaredNorm() < residual.squaredNorm();
+        if (reduced) {
+          break;
+        }
+        step *= 0.5;
+      }
+      if (!reduced) {
+        break;
+      }
+      undistorted -= step;
+      residual = step_residual;
+      jacobian = step_jacobian;
+    }
+    return undistorted;
+  }
+
+  UndistortionMap::Normalized UndistortionMap::normalized(const Translate2 &pixel) const
+  {
+    if (grid_.empty()) {
+      return normalized_exact(pixel);
+    }
+
+    auto gx = (pixel.x() - grid_origin_) / grid_step_;
+    auto gy = (pixel.y() - grid_origin_) / grid_step_;
+    if (!(gx >= 0. && gy >= 0. && gx < grid_cols_ - 1 && gy < grid_rows_ - 1)) {
+      return normalized_exact(pixel);
+    }
+
+    auto col = static_cast<int>(gx);
+    auto row = static_cast<int>(gy);
+    auto fx = gx - col;
+    auto fy = gy - row;
+    auto n00 = &grid_[static_cast<std::size_t>(row) * grid_cols_ + col];
+    auto n10 = n00 + grid_cols_;
+    Normalized undistorted = (1. - fy) * ((1. - fx) * n00[0] + fx * n00[1]) +
+                             fy * ((1. - fx) * n10[0] + fx * n10[1]);
+
+    // The interpolation is good to a fraction of a pixel. One Newton step from
+    // there is as good as the iterative solve and costs one model evaluation.
+    Eigen::Matrix2d jacobian;
+    Normalized residual = distort(undistorted, jacobian) - distorted_normalized(pixel);
+    return undistorted - jacobian.inverse() * residual;
+  }
+
+  Translate2 UndistortionMap::ideal_pixel(const Translate2 &pixel) const
+  {
+    auto n = normalized(pixel);
+    return Translate2{camera_matrix_(0, 0) * n.x() + camera_matrix_(0, 1) * n.y() + camera_matrix_(0, 2),
+                      camera_matrix_(1, 1) * n.y() + camera_matrix_(1, 2)};
+  }
+
+  Observation UndistortionMap::undistort(const Observation &observation) const
+  {
+    if (!observation.is_valid()) {
+      return observation;
+    }
+    auto &corners_f_image = observation.corners_f_image();
+    return Observation{observation.id(),
+                       Observation::Array{ideal_pixel(corners_f_image[0]),
+                                          ideal_pixel(corners_f_image[1]),
+                                          ideal_pixel(corners_f_image[2]),
+                                          ideal_pixel(corners_f_image[3])},
+                       observation.cov()};
+  }
+
+  void UndistortionMap::undistort(const Observations &observations, Observations &undistorted) const
+  {
+    undistorted.reset(observations.imager_frame_id());
+    auto &v = undistorted.v_mutable();
+    for (auto &observation : observations.v()) {
+      v.emplace_back(undistort(observation));
+    }
+  }
+
+  template<>
+  UndistortionMap CameraInfo::to<UndistortionMap>() const
+  {
+    return UndistortionMap{*this};
+  }
+}
@@ -0,0 +1,47 @@
+
+#include "image_ingress.hpp"
+
+#include "cv_bridge/cv_bridge.h"
+#include "opencv2/imgproc.hpp"
+#include "sensor_msgs/image_encodings.hpp"
+
+namespace fiducial_vlam
+{
+// ==============================================================================
+// Mono8Ingress class
+// ==============================================================================
+
+  cv::Mat Mono8Ingress::gray(const sensor_msgs::msg::Image &image_msg)
+  {
+    namespace enc = sensor_msgs::image_encodings;
+
+    // Wrap the message data directly. The Mat does not own the data so it will not be
+    // released when the Mat is destroyed. Detection does not write into the gray image.
+    if (image_msg.encoding == enc::MONO8) {
+      return cv::Mat(static_cast<int>(image_msg.height), static_cast<int>(image_msg.width), CV_8UC1,
+                     const_cast<uint8_t *>(image_msg.data.data()), image_msg.step);
+    }
+
+    // Share the message data as the source of the conversion. cvtColor only reallocates
+    // pooled_gray_ when the frame size changes.
+    std::shared_ptr<void const> tracked_object;
+    auto source = cv_bridge::toCvShare(image_msg, tracked_object);
+
+    if (image_msg.encoding == enc::BGR8) {
+      cv::cvtColor(source->image, pooled_gray_, cv::COLOR_BGR2GRAY);
+    } else if (image_msg.encoding == enc::RGB8) {
+      cv::cvtColor(source->image, pooled_gray_, cv::COLOR_RGB2GRAY);
+    } else if (image_msg.encoding == enc::BGRA8) {
+      cv::cvtColor(source->image, pooled_gray_, cv::COLOR_BGRA2GRAY);
+    } else if (image_msg.encoding == enc::RGBA8) {
+      cv::cvtColor(source->image, pooled_gray_, cv::COLOR_RGBA2GRAY);
+    } else if (image_msg.encoding == enc::MONO16) {
+      source->image.convertTo(pooled_gray_, CV_8U, 1.0 / 256.0);
+    } else {
+      // Anything unusual (bayer, yuv, ...) goes through cv_bridge.
+      cv_bridge::cvtColor(source, enc::MONO8)->image.copyTo(pooled_gray_);
+    }
+
+    return pooled_gray_;
+  }
+}
@@ -1,14 +1,32 @@
 #pragma once
 #pragma ide diagnostic ignored "modernize-use-nodiscard"
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
 #include "fvlam/logger.hpp"
 
 namespace fiducial_vlam
 {
   class LoggerRos2 : public fvlam::Logger
   {
+    // Lines waiting for the background thread. When the thread falls this far
+    // behind, new lines are dropped rather than stalling the caller.
+    static constexpr std::size_t async_queue_capacity = 1024;
+
     rclcpp::Node &node_;
 
+    std::mutex mutex_{};
+    std::condition_variable cv_{};
+    std::deque<std::pair<Levels, std::string>> queue_{};
+    std::uint64_t dropped_count_{0};
+    bool quit_{false};
+    std::thread thread_{};
+
     static int severity_from_level(Levels level)
     {
       switch (level) {
@@ -26,11 +44,92 @@ namespace fiducial_vlam
       }
     }
 
+    void emit(Levels level, const std::string &line)
+    {
+      switch (level) {
+        case Levels::level_debug:
+          RCLCPP_DEBUG(node_.get_logger(), "%s", line.c_str());
+          break;
+        case Levels::level_info:
+          RCLCPP_INFO(node_.get_logger(), "%s", line.c_str());
+          break;
+        case Levels::level_warn:
+          RCLCPP_WARN(node_.get_logger(), "%s", line.c_str());
+          break;
+        case Levels::level_error:
+          RCLCPP_ERROR(node_.get_logger(), "%s", line.c_str());
+          break;
+        case Levels::level_fatal:
+          RCLCPP_FATAL(node_.get_logger(), "%s", line.c_str());
+          break;
+      }
+    }
+
+    void thread_loop()
+    {
+      std::deque<std::pair<Levels, std::string>> lines{};
+      while (true) {
+        std::uint64_t dropped_count{0};
+        bool quit{false};
+        {
+          std::unique_lock<std::mutex> lock{mutex_};
+          cv_.wait(lock, [this]() -> bool
+          { return quit_ || !queue_.empty(); });
+          lines.swap(queue_);
+          std::swap(dropped_count, dropped_count_);
+          quit = quit_;
+        }
+
+        for (auto &level_line : lines) {
+          emit(level_line.first, level_line.second);
+        }
+        lines.clear();
+        if (dropped_count > 0) {
+          RCLCPP_WARN(node_.get_logger(), "Logger dropped %lu lines", static_cast<unsigned long>(dropped_count));
+        }
+
+        if (quit) {
+          break;
+        }
+      }
+    }
+
   public:
     explicit LoggerRos2(rclcpp::Node &node) :
       node_{node}
     {}
 
+    // Flushes any queued lines before returning.
+    ~LoggerRos2() override
+    {
+      set_async(false);
+    }
+
+    // When async is set, log_line() only queues the line and a background thread
+    // hands it to rcutils, whose output handlers do the formatting and console or
+    // rosout writes. The caller still formats its own << arguments. Lines keep their
+    // order but are stamped by rcutils when the thread gets to them.
+    void set_async(bool async)
+    {
+      if (async == thread_.joinable()) {
+        return;
+      }
+
+      if (async) {
+        quit_ = false;
+        thread_ = std::thread{[this]() -> void
+                              { thread_loop(); }};
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        quit_ = true;
+      }
+      cv_.notify_one();
+      thread_.join();
+    }
+
     // Test if the requested level is high enough for output
     bool test_level(Levels level) const override
     {
@@ -40,23 +139,20 @@ namespace fiducial_vlam
     // Log a line of output at the specified level.
     void log_line(Levels level, std::string line) override
     {
-      switch (level) {
-        case Levels::level_debug:
-          RCLCPP_DEBUG(node_.get_logger(), line.c_str());
-          break;
-        case Levels::level_info:
-          RCLCPP_INFO(node_.get_logger(), line.c_str());
-          break;
-        case Levels::level_warn:
-          RCLCPP_WARN(node_.get_logger(), line.c_str());
-          break;
-        case Levels::level_error:
-          RCLCPP_ERROR(node_.get_logger(), line.c_str());
-          break;
-        case Levels::level_fatal:
-          RCLCPP_FATAL(node_.get_logger(), line.c_str());
-          break;
+      if (!thread_.joinable()) {
+        emit(level, line);
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (queue_.size() >= async_queue_capacity) {
+          dropped_count_ += 1;
+          return;
+        }
+        queue_.emplace_back(level, std::move(line));
       }
+      cv_.notify_one();
     }
   };
 }
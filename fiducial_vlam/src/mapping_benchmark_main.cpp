@@ -0,0 +1,379 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "fvlam/build_marker_map_interface.hpp"
+#include "fvlam/camera_info.hpp"
+#include "fvlam/localize_camera_interface.hpp"
+#include "fvlam/logger.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/model.hpp"
+#include "fvlam/observation.hpp"
+#include "task_thread.hpp"
+
+// Generate synthetic scenes of a square grid of markers on the floor and a camera
+// that flies over them looking down. The observations of each scene are fed to
+// BuildMarkerMapTmm, once a frame at a time and once with the frames processed
+// concurrently by a sharded builder, and the built map is then used by the
+// localizers. For each marker count the throughput, build time, peak memory and
+// accuracy are reported.
+// ROS is not used so the results are repeatable from run to run.
+//
+// usage: mapping_benchmark_main [marker_counts] [trajectory] [pixel_sigma] [thread_count]
+//   marker_counts  comma separated, default 100,1000,10000
+//   trajectory     raster or spiral, default raster
+//   pixel_sigma    noise added to each corner in pixels, default 0.0
+//   thread_count   for the sharded builder and the batch localizers, 0 uses every hardware thread
+
+namespace
+{
+  const double marker_spacing = 0.5; // meters between markers in the grid
+  const double camera_z = 2.0; // camera height above the markers
+  const double camera_step = 0.25; // meters between frames along the trajectory
+  const double row_spacing = 1.0; // meters between raster rows or spiral turns
+
+  struct Scene
+  {
+    std::vector<fvlam::Marker> markers_{};
+    std::vector<fvlam::Transform3> t_map_cameras_{};
+    std::vector<fvlam::ObservationsSynced> observations_synced_list_{};
+  };
+
+  std::vector<fvlam::Marker> gen_marker_grid(std::size_t marker_count)
+  {
+    auto side = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(marker_count))));
+    std::vector<fvlam::Marker> markers{};
+    for (std::size_t i = 0; i < marker_count; i += 1) {
+      auto x = static_cast<double>(i % side) * marker_spacing;
+      auto y = static_cast<double>(i / side) * marker_spacing;
+      markers.emplace_back(fvlam::Marker{i, fvlam::Transform3WithCovariance{
+        fvlam::Transform3{fvlam::Rotate3{}, fvlam::Translate3{x, y, 0.}}}});
+    }
+    return markers;
+  }
+
+  fvlam::Transform3 camera_looking_down(double x, double y)
+  {
+    return fvlam::Transform3{fvlam::Rotate3::RzRyRx(M_PI, 0., 0.), fvlam::Translate3{x, y, camera_z}};
+  }
+
+  // Back and forth along rows that cover the grid.
+  std::vector<fvlam::Transform3> gen_raster(double extent)
+  {
+    std::vector<fvlam::Transform3> t_map_cameras{};
+    auto steps = static_cast<int>(std::ceil(extent / camera_step));
+    int row_index = 0;
+    for (double y = 0.; y <= extent + 1.0e-9; y += row_spacing, row_index += 1) {
+      for (int i = 0; i <= steps; i += 1) {
+        auto x = (row_index % 2 == 0 ? i : steps - i) * camera_step;
+        t_map_cameras.emplace_back(camera_looking_down(x, y));
+      }
+    }
+    return t_map_cameras;
+  }
+
+  // Outward from the center of the grid along an Archimedean spiral.
+  std::vector<fvlam::Transform3> gen_spiral(double extent)
+  {
+    std::vector<fvlam::Transform3> t_map_cameras{};
+    auto center = extent / 2.;
+    auto b = row_spacing / (2. * M_PI);
+    auto max_radius = center * std::sqrt(2.);
+    double theta = 0.;
+    for (auto r = 0.; r <= max_radius; r = b * theta) {
+      t_map_cameras.emplace_back(camera_looking_down(center + r * std::cos(theta), center + r * std::sin(theta)));
+      // Advance by about camera_step of arc length.
+      theta += camera_step / std::max(std::sqrt(r * r + b * b), camera_step);
+    }
+    return t_map_cameras;
+  }
+
+  Scene gen_scene(const fvlam::MapEnvironment &map_environment,
+                  const fvlam::CameraInfoMap &camera_info_map,
+                  std::size_t marker_count,
+                  const std::string &trajectory,
+                  double pixel_sigma)
+  {
+    Scene scene{};
+    scene.markers_ = gen_marker_grid(marker_count);
+
+    auto side = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(marker_count))));
+    auto extent = static_cast<double>(side - 1) * marker_spacing;
+    scene.t_map_cameras_ = trajectory == "spiral" ? gen_spiral(extent) : gen_raster(extent);
+
+    // Only markers near the camera can be seen. Projecting just those keeps the
+    // generation time linear in the number of frames.
+    auto visible_radius = 2. * camera_z;
+    std::vector<fvlam::Marker> nearby{};
+
+    // normal_distribution needs a positive sigma, so there is none without noise.
+    std::mt19937 generator{42};
+    std::optional<std::normal_distribution<double>> noise{};
+    if (pixel_sigma > 0.) {
+      noise.emplace(0., pixel_sigma);
+    }
+
+    for (std::size_t c = 0; c < scene.t_map_cameras_.size(); c += 1) {
+      auto &camera_t = scene.t_map_cameras_[c].t();
+      nearby.clear();
+      for (auto &marker : scene.markers_) {
+        auto &marker_t = marker.t_map_marker().tf().t();
+        if (std::abs(marker_t.x() - camera_t.x()) < visible_radius &&
+            std::abs(marker_t.y() - camera_t.y()) < visible_radius) {
+          nearby.emplace_back(marker);
+        }
+      }
+
+      auto marker_observations = fvlam::MarkerObservations{map_environment, camera_info_map,
+                                                           scene.t_map_cameras_[c], nearby, c};
+      auto observations_synced = marker_observations.observations_synced();
+
+      if (noise) {
+        for (auto &observations : observations_synced.v_mutable()) {
+          for (auto &observation : observations.v_mutable()) {
+            auto corners_f_image = observation.corners_f_image();
+            for (auto &corner : corners_f_image) {
+              corner = fvlam::Translate2{corner.x() + (*noise)(generator), corner.y() + (*noise)(generator)};
+            }
+            observation = fvlam::Observation{observation.id(), corners_f_image, observation.cov()};
+          }
+        }
+      }
+
+      scene.observations_synced_list_.emplace_back(std::move(observations_synced));
+    }
+
+    return scene;
+  }
+
+  double peak_rss_mb()
+  {
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_maxrss) / 1024.; // ru_maxrss is in kB on Linux
+  }
+
+  double seconds_since(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  struct PoseErrors
+  {
+    std::size_t count_{0};
+    double t_mean_{0.};
+    double t_max_{0.};
+    double r_max_{0.};
+
+    void accumulate(const fvlam::Transform3 &truth, const fvlam::Transform3 &estimate)
+    {
+      auto t_error = (truth.t().t() - estimate.t().t()).norm();
+      auto r_error = truth.r().q().angularDistance(estimate.r().q());
+      t_mean_ += (t_error - t_mean_) / static_cast<double>(++count_);
+      t_max_ = std::max(t_max_, t_error);
+      r_max_ = std::max(r_max_, r_error);
+    }
+  };
+
+  template<class TLcContext>
+  void run_localizer(const char *name,
+                     const TLcContext &lc_context,
+                     const Scene &scene,
+                     const fvlam::CameraInfoMap &camera_info_map,
+                     const fvlam::MarkerMap &map,
+                     std::size_t thread_count,
+                     fvlam::Logger &logger)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto t_map_cameras = fvlam::solve_t_map_cameras(lc_context, scene.observations_synced_list_,
+                                                    camera_info_map, map, logger, thread_count);
+    auto solve_s = seconds_since(start);
+
+    PoseErrors errors{};
+    for (std::size_t i = 0; i < t_map_cameras.size(); i += 1) {
+      if (t_map_cameras[i].is_valid()) {
+        errors.accumulate(scene.t_map_cameras_[i], t_map_cameras[i].tf());
+      }
+    }
+
+    std::cout << std::fixed
+              << "  localize " << std::setw(8) << name
+              << std::setw(10) << std::setprecision(1) << static_cast<double>(t_map_cameras.size()) / solve_s
+              << " fps" << std::setw(8) << errors.count_ << "/" << t_map_cameras.size() << " solved"
+              << ", t err mean " << std::setprecision(4) << errors.t_mean_
+              << " max " << errors.t_max_
+              << " m, r err max " << errors.r_max_ << " rad" << std::endl;
+  }
+
+  void run_marker_count(std::size_t marker_count,
+                        const std::string &trajectory,
+                        double pixel_sigma,
+                        std::size_t thread_count,
+                        fvlam::Logger &logger)
+  {
+    auto map_environment = fvlam::MapEnvironmentGen::Default();
+    auto camera_info_map = fvlam::CameraInfoMapGen::Simulation();
+
+    auto gen_start = std::chrono::steady_clock::now();
+    auto scene = gen_scene(map_environment, camera_info_map, marker_count, trajectory, pixel_sigma);
+    auto gen_s = seconds_since(gen_start);
+
+    std::size_t observation_count{0};
+    for (auto &observations_synced : scene.observations_synced_list_) {
+      for (auto &observations : observations_synced.v()) {
+        observation_count += observations.size();
+      }
+    }
+
+    // Marker 0 is the fixed marker that anchors the map.
+    auto map_initial = fvlam::MarkerMap{map_environment};
+    map_initial.add_marker(fvlam::Marker{scene.markers_[0].id(), scene.markers_[0].t_map_marker(), true});
+
+    auto solve_tmm_factory = fvlam::make_solve_tmm_factory(fvlam::SolveTmmContextCvSolvePnp{true},
+                                                           map_environment.marker_length());
+    auto bmm = fvlam::make_build_marker_map(fvlam::BuildMarkerMapTmmContext{solve_tmm_factory},
+                                            logger, map_initial);
+
+    auto &frames = scene.observations_synced_list_;
+    auto report_build = [&scene, &frames, marker_count](const char *name, double process_s, double build_s,
+                                                        const fvlam::MarkerMap &built_map) -> void
+    {
+      PoseErrors errors{};
+      for (auto &marker : scene.markers_) {
+        auto built_marker = built_map.find_marker_const(marker.id());
+        if (built_marker != nullptr) {
+          errors.accumulate(marker.t_map_marker().tf(), built_marker->t_map_marker().tf());
+        }
+      }
+
+      std::cout << std::fixed
+                << "  build   " << std::setw(8) << name << " process " << std::setprecision(1)
+                << static_cast<double>(frames.size()) / process_s << " fps"
+                << ", build " << std::setprecision(3) << build_s << " s"
+                << ", " << errors.count_ << "/" << marker_count << " mapped"
+                << ", t err mean " << std::setprecision(4) << errors.t_mean_
+                << " max " << errors.t_max_
+                << " m, r err max " << errors.r_max_ << " rad" << std::endl;
+    };
+
+    std::cout << std::fixed << std::setprecision(3)
+              << marker_count << " markers, " << frames.size() << " frames, "
+              << observation_count << " observations, generated in " << gen_s << " s" << std::endl;
+
+    auto process_start = std::chrono::steady_clock::now();
+    for (auto &observations_synced : frames) {
+      bmm->process(observations_synced, camera_info_map);
+    }
+    auto process_s = seconds_since(process_start);
+
+    auto build_start = std::chrono::steady_clock::now();
+    auto built_map = bmm->build();
+    auto build_s = seconds_since(build_start);
+    report_build("serial", process_s, build_s, *built_map);
+
+    // The frames again, processed on every thread with the pairs split over a few
+    // shards per thread, the way vmap_node takes frames with bmm_tmm_shards.
+    std::size_t shard_count{4 * std::max(1u, std::thread::hardware_concurrency())};
+    bool try_shonan{false};
+    auto noise_strategy = fvlam::BuildMarkerMapTmmContext::NoiseStrategy::minimum;
+    double fixed_sigma_r{0.1};
+    double fixed_sigma_t{0.3};
+    bool incremental{false};
+    auto bmm_sharded = fvlam::make_build_marker_map(fvlam::BuildMarkerMapTmmContext{solve_tmm_factory,
+                                                                                    try_shonan,
+                                                                                    noise_strategy,
+                                                                                    fixed_sigma_r,
+                                                                                    fixed_sigma_t,
+                                                                                    incremental,
+                                                                                    shard_count},
+                                                    logger, map_initial);
+
+    process_start = std::chrono::steady_clock::now();
+    task_thread::WorkStealingPool::shared().parallel_for(
+      frames.size(),
+      [&bmm_sharded, &frames, &camera_info_map](std::size_t i) -> void
+      {
+        bmm_sharded->process(frames[i], camera_info_map);
+      },
+      4, thread_count);
+    process_s = seconds_since(process_start);
+
+    build_start = std::chrono::steady_clock::now();
+    auto built_map_sharded = bmm_sharded->build();
+    build_s = seconds_since(build_start);
+    report_build("sharded", process_s, build_s, *built_map_sharded);
+
+    run_localizer("cv", fvlam::LocalizeCameraCvContext{},
+                  scene, camera_info_map, *built_map, thread_count, logger);
+
+    double corner_measurement_sigma{std::max(pixel_sigma, 0.5)};
+    int gtsam_factor_type{2};
+    bool use_marker_covariance{false};
+    int tracking_mode{1};
+    double tracking_max_error{2.0};
+    int max_iterations{0};
+    double max_solve_ms{0.};
+    bool undistort_lookup{false};
+    run_localizer("gtsam", fvlam::LocalizeCameraGtsamFactorContext{corner_measurement_sigma,
+                                                                   gtsam_factor_type,
+                                                                   use_marker_covariance,
+                                                                   tracking_mode,
+                                                                   tracking_max_error,
+                                                                   max_iterations,
+                                                                   max_solve_ms,
+                                                                   undistort_lookup},
+                  scene, camera_info_map, *built_map, thread_count, logger);
+
+    // The configurations run smallest first so this is the peak of the largest one.
+    std::cout << "  peak rss " << std::setprecision(1) << peak_rss_mb() << " MB" << std::endl;
+  }
+
+  std::vector<std::size_t> parse_counts(const std::string &arg)
+  {
+    std::vector<std::size_t> counts{};
+    std::stringstream ss{arg};
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      if (!item.empty()) {
+        counts.emplace_back(std::max(2ul, std::stoul(item)));
+      }
+    }
+    std::sort(counts.begin(), counts.end());
+    return counts;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  auto counts = parse_counts(argc > 1 ? argv[1] : "100,1000,10000");
+  std::string trajectory{argc > 2 ? argv[2] : "raster"};
+  double pixel_sigma = argc > 3 ? std::stod(argv[3]) : 0.0;
+  std::size_t thread_count = argc > 4 ? std::stoul(argv[4]) : 0;
+
+  if (counts.empty() || (trajectory != "raster" && trajectory != "spiral")) {
+    std::cerr << "usage: " << argv[0] << " [marker_counts] [raster|spiral] [pixel_sigma] [thread_count]" << std::endl;
+    return 1;
+  }
+
+  fvlam::LoggerCout logger{fvlam::Logger::level_warn};
+
+  std::cout << "trajectory " << trajectory << ", pixel sigma " << pixel_sigma
+            << ", marker spacing " << marker_spacing << " m, camera height " << camera_z << " m" << std::endl;
+
+  for (auto marker_count : counts) {
+    run_marker_count(marker_count, trajectory, pixel_sigma, thread_count, logger);
+  }
+
+  return 0;
+}
@@ -1,15 +1,31 @@
+#include <algorithm>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
 
 #include "cv_bridge/cv_bridge.h"
 #include "fiducial_vlam_msgs/msg/map.hpp"
 #include "fiducial_vlam_msgs/msg/observations_synced.hpp"
+#include "fiducial_vlam_msgs/msg/observations_synced_packed.hpp"
 #include "fvlam/camera_info.hpp"
 #include "fvlam/localize_camera_interface.hpp"
 #include "fvlam/logger.hpp"
 #include "fvlam/marker.hpp"
+#include "fvlam/marker_map_tiles.hpp"
 #include "fvlam/observation.hpp"
+#include "rclcpp/expand_topic_or_service_name.hpp"
 #include "sensor_msgs/msg/camera_info.hpp"
 #include "sensor_msgs/msg/image.hpp"
+#include "camera_info_cache.hpp"
+#include "image_ingress.hpp"
+#include "in_process_observations.hpp"
+#include "latency_trace.hpp"
 #include "observation_maker.hpp"
+#include "stage_latency.hpp"
+#include "task_thread.hpp"
 #include "vdet_context.hpp"
 
 
@@ -23,7 +39,11 @@ namespace fvlam
   FiducialMarkerContext FiducialMarkerContext::from<fiducial_vlam::VdetContext>(
     fiducial_vlam::VdetContext &other)
   {
-    FiducialMarkerContext cxt{other.det_corner_refinement_method_};
+    FiducialMarkerContext cxt{other.det_corner_refinement_method_,
+                              other.det_roi_full_scan_every_n_,
+                              other.det_roi_padding_,
+                              other.det_pyramid_scale_,
+                              other.det_detector_backend_};
     cxt.border_color_red_ = 0;
     cxt.border_color_green_ = 1.0;
     cxt.border_color_blue_ = 0.;
@@ -35,11 +55,13 @@ namespace fiducial_vlam
 {
   struct SomDiagnostics
   {
-    std::uint64_t sub_camera_info_count_{0};
-    std::uint64_t sub_image_raw_count_{0};
-    std::uint64_t empty_observations_count_{0};
-    std::uint64_t pub_observations_count_{0};
-    std::uint64_t pub_image_marked_count_{0};
+    // Updated from the executor and, when pipelined, the detect stage.
+    std::atomic<std::uint64_t> sub_camera_info_count_{0};
+    std::atomic<std::uint64_t> sub_image_raw_count_{0};
+    std::atomic<std::uint64_t> dropped_image_raw_count_{0};
+    std::atomic<std::uint64_t> empty_observations_count_{0};
+    std::atomic<std::uint64_t> pub_observations_count_{0};
+    std::atomic<std::uint64_t> pub_image_marked_count_{0};
     rclcpp::Time start_time_;
 
     explicit SomDiagnostics(const rclcpp::Time &start_time) :
@@ -52,6 +74,8 @@ namespace fiducial_vlam
   struct SmmDiagnostics
   {
     std::uint64_t sub_map_count_{0};
+    std::uint64_t sub_map_delta_count_{0};
+    std::uint64_t skip_map_delta_count_{0};
     rclcpp::Time start_time_;
 
     explicit SmmDiagnostics(const rclcpp::Time &start_time) :
@@ -68,26 +92,68 @@ namespace fiducial_vlam
 
   class ObservationPublisher : public ObservationPublisherInterface
   {
+    struct SentCalibration
+    {
+      std::uint64_t calibration_id_;
+      int sent_id_only_count_;
+    };
+
     rclcpp::Node &node_;
     fvlam::Logger &logger_;
     const std::string &pub_observations_synced_topic_;
+    const int camera_info_every_n_;
+    const bool in_process_;
+    const bool packed_;
+    const std::string in_process_topic_;
 
     rclcpp::Publisher<fiducial_vlam_msgs::msg::ObservationsSynced>::SharedPtr pub_observations_{};
+    rclcpp::Publisher<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>::SharedPtr pub_observations_packed_{};
+    std::map<std::string, SentCalibration> sent_calibrations_{};
 
-  public:
-    ObservationPublisher(rclcpp::Node &node, fvlam::Logger &logger,
-                         const std::string &pub_observations_synced_topic) :
-      node_{node}, logger_{logger}, pub_observations_synced_topic_{pub_observations_synced_topic}
-    {}
+    // Fill in the calibration id and, if the receivers have seen this calibration
+    // recently enough, strip the message down to its imager_frame_id and id.
+    void version_camera_info(fiducial_vlam_msgs::msg::CameraInfo &ci_msg)
+    {
+      ci_msg.calibration_id = calibration_id(ci_msg);
+      if (camera_info_every_n_ <= 1) {
+        return;
+      }
 
-    void publish_observations_synced(const fvlam::CameraInfoMap &camera_info_map,
-                                     const fvlam::ObservationsSynced &observations_synced)
+      auto sent = sent_calibrations_.find(ci_msg.imager_frame_id);
+      if (sent == sent_calibrations_.end() ||
+          sent->second.calibration_id_ != ci_msg.calibration_id ||
+          sent->second.sent_id_only_count_ + 1 >= camera_info_every_n_) {
+        sent_calibrations_.insert_or_assign(ci_msg.imager_frame_id, SentCalibration{ci_msg.calibration_id, 0});
+        return;
+      }
+
+      sent->second.sent_id_only_count_ += 1;
+      ci_msg = fiducial_vlam_msgs::msg::CameraInfo{}
+        .set__imager_frame_id(ci_msg.imager_frame_id)
+        .set__calibration_id(ci_msg.calibration_id);
+    }
+
+    static void fill_observations(fiducial_vlam_msgs::msg::Observations &msg_item,
+                                  const fvlam::Observations &observations)
+    {
+      msg_item.observations = observations.to<std::vector<fiducial_vlam_msgs::msg::Observation>>();
+    }
+
+    static void fill_observations(fiducial_vlam_msgs::msg::ObservationsPacked &msg_item,
+                                  const fvlam::Observations &observations)
+    {
+      msg_item = observations.to<fiducial_vlam_msgs::msg::ObservationsPacked>();
+    }
+
+    // Create the ObservationSynced message in either the plain or the packed format.
+    template<class TMsg>
+    std::unique_ptr<TMsg> make_observations_synced_msg(const fvlam::CameraInfoMap &camera_info_map,
+                                                       const fvlam::ObservationsSynced &observations_synced)
     {
-      // Create the ObservationSynced message.
-      auto msg = fiducial_vlam_msgs::msg::ObservationsSynced{}
-        .set__header(std_msgs::msg::Header{}
-                       .set__stamp(observations_synced.stamp().to<builtin_interfaces::msg::Time>())
-                       .set__frame_id(observations_synced.camera_frame_id()));
+      auto msg = std::make_unique<TMsg>();
+      msg->header.stamp = observations_synced.stamp().to<builtin_interfaces::msg::Time>();
+      msg->header.frame_id = observations_synced.camera_frame_id();
+      msg->observations_synced.reserve(observations_synced.v().size());
 
       // Add the observattions
       for (auto &observations : observations_synced.v()) {
@@ -97,19 +163,76 @@ namespace fiducial_vlam
           continue;
         }
 
-        auto msg_item = fiducial_vlam_msgs::msg::Observations{}
-          .set__camera_info(ci->second.to<fiducial_vlam_msgs::msg::CameraInfo>())
-          .set__observations(observations.to<std::vector<fiducial_vlam_msgs::msg::Observation>>());
+        auto ci_msg = ci->second.to<fiducial_vlam_msgs::msg::CameraInfo>();
+        version_camera_info(ci_msg);
 
-        msg.observations_synced.emplace_back(msg_item);
+        msg->observations_synced.emplace_back();
+        auto &msg_item = msg->observations_synced.back();
+        fill_observations(msg_item, observations);
+        msg_item.camera_info = std::move(ci_msg);
       }
 
-      // Publish the message.
-      if (!pub_observations_) {
+      return msg;
+    }
+
+    // Published as a unique_ptr so that intra-process subscribers, when enabled,
+    // receive it without a copy.
+    template<class TMsg>
+    void publish_msg(typename rclcpp::Publisher<TMsg>::SharedPtr &pub,
+                     const fvlam::CameraInfoMap &camera_info_map,
+                     const fvlam::ObservationsSynced &observations_synced)
+    {
+      if (!pub) {
+        pub = node_.create_publisher<TMsg>(pub_observations_synced_topic_, 2);
+      }
+
+      // The in-process subscribers don't subscribe to the topic so, if nobody else
+      // is listening, skip building the message.
+      if (in_process_ && pub->get_subscription_count() == 0) {
+        return;
+      }
+
+      pub->publish(make_observations_synced_msg<TMsg>(camera_info_map, observations_synced));
+    }
+
+  public:
+    ObservationPublisher(rclcpp::Node &node, fvlam::Logger &logger,
+                         const std::string &pub_observations_synced_topic,
+                         int camera_info_every_n, bool in_process, bool packed) :
+      node_{node}, logger_{logger}, pub_observations_synced_topic_{pub_observations_synced_topic},
+      camera_info_every_n_{camera_info_every_n}, in_process_{in_process}, packed_{packed},
+      in_process_topic_{rclcpp::expand_topic_or_service_name(pub_observations_synced_topic,
+                                                             node.get_name(), node.get_namespace())}
+    {}
+
+    void warm_up() override
+    {
+      if (packed_ && !pub_observations_packed_) {
+        pub_observations_packed_ = node_.create_publisher<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>(
+          pub_observations_synced_topic_, 2);
+      } else if (!packed_ && !pub_observations_) {
         pub_observations_ = node_.create_publisher<fiducial_vlam_msgs::msg::ObservationsSynced>(
           pub_observations_synced_topic_, 2);
       }
-      pub_observations_->publish(msg);
+    }
+
+    void publish_observations_synced(const fvlam::CameraInfoMap &camera_info_map,
+                                     const fvlam::ObservationsSynced &observations_synced)
+    {
+      // Hand the observations straight to subscribers composed into this process.
+      if (in_process_ && InProcessObservations::has_subscribers(in_process_topic_)) {
+        InProcessObservations::publish(in_process_topic_,
+                                       std::make_shared<const fvlam::CameraInfoMap>(camera_info_map),
+                                       std::make_shared<const fvlam::ObservationsSynced>(observations_synced));
+      }
+
+      if (packed_) {
+        publish_msg<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>(
+          pub_observations_packed_, camera_info_map, observations_synced);
+      } else {
+        publish_msg<fiducial_vlam_msgs::msg::ObservationsSynced>(
+          pub_observations_, camera_info_map, observations_synced);
+      }
 //      diagnostics_.pub_observations_count_ += 1;
     }
 
@@ -125,9 +248,13 @@ namespace fiducial_vlam
   std::unique_ptr<ObservationPublisherInterface> make_observation_publisher(
     rclcpp::Node &node,
     fvlam::Logger &logger,
-    const std::string &pub_observations_synced_topic)
+    const std::string &pub_observations_synced_topic,
+    int camera_info_every_n,
+    bool in_process,
+    bool packed)
   {
-    return std::make_unique<ObservationPublisher>(node, logger, pub_observations_synced_topic);
+    return std::make_unique<ObservationPublisher>(node, logger, pub_observations_synced_topic,
+                                                  camera_info_every_n, in_process, packed);
   }
 
 // ==============================================================================
@@ -141,12 +268,17 @@ namespace fiducial_vlam
     VdetContext &cxt_;
     fvlam::MapEnvironment map_environment_;
     ObservationMakerInterface::OnObservationCallback on_observation_callback_;
+    ObservationMakerInterface::OnWarmUpCallback on_warm_up_callback_;
 
     SomDiagnostics diagnostics_;
+    StageLatencies own_stage_latencies_{};
+    StageLatencies &stage_latencies_;
 
     std::unique_ptr<ObservationPublisherInterface> observation_publisher_;
 
     std::unique_ptr<fvlam::FiducialMarkerInterface> fiducial_marker_{};
+    Mono8Ingress mono8_ingress_{};
+    fvlam::ObservationsSyncedArena observations_arena_{};
 
     rclcpp::Subscription<sensor_msgs::msg::Image>::SharedPtr sub_image_raw_;
     rclcpp::Subscription<sensor_msgs::msg::CameraInfo>::SharedPtr sub_camera_info_;
@@ -154,21 +286,71 @@ namespace fiducial_vlam
     sensor_msgs::msg::CameraInfo::SharedPtr camera_info_msg_{};
     std_msgs::msg::Header::_stamp_type last_image_stamp_{};
 
+    // Set when the detector should be run on a blank image at the next camera_info:
+    // at the first one, when the image size changes, and after a new map has
+    // restricted the dictionary.
+    std::atomic<bool> warm_up_pending_{true};
+    std::uint32_t warm_up_width_{0};
+    std::uint32_t warm_up_height_{0};
+    std::vector<std::uint64_t> restricted_marker_ids_{}; // The ids last given to restrict_to_marker_ids()
+
     rclcpp::Publisher<sensor_msgs::msg::Image>::SharedPtr pub_image_marked_{};
+    std::chrono::steady_clock::time_point last_image_marked_time_{};
+    std::unique_ptr<task_thread::LatestTaskThread> annotate_stage_{};
+
+    // When pipelined, detection runs on its own thread or on the process-wide pool.
+    // Declared last so they are stopped before the objects their tasks use are destroyed.
+    std::unique_ptr<task_thread::LatestTaskThread> detect_stage_{};
+    std::unique_ptr<task_thread::SharedWorkerPool::Client> detect_pool_client_{};
+
+    template<class TTask>
+    std::size_t push_detect(TTask task)
+    {
+      return detect_pool_client_ ?
+             detect_pool_client_->push(std::move(task)) :
+             detect_stage_->push(std::move(task));
+    }
 
   public:
     SingleObservationMaker(rclcpp::Node &node, fvlam::Logger &logger, VdetContext &cxt,
                            const fvlam::MapEnvironment &map_environment,
-                           const ObservationMakerInterface::OnObservationCallback &on_observation_callback) :
+                           const ObservationMakerInterface::OnObservationCallback &on_observation_callback,
+                           StageLatencies *stage_latencies,
+                           const ObservationMakerInterface::OnWarmUpCallback &on_warm_up_callback) :
       node_{node}, logger_{logger}, cxt_{cxt}, map_environment_{map_environment},
       on_observation_callback_{on_observation_callback},
+      on_warm_up_callback_{on_warm_up_callback},
       diagnostics_{node.now()},
-      observation_publisher_{make_observation_publisher(node, logger, cxt.det_pub_observations_topic_)}
+      stage_latencies_{stage_latencies ? *stage_latencies : own_stage_latencies_},
+      observation_publisher_{make_observation_publisher(node, logger, cxt.det_pub_observations_topic_,
+                                                         cxt.det_pub_camera_info_every_n_,
+                                                         cxt.det_pub_observations_in_process_,
+                                                         cxt.det_pub_observations_packed_)}
     {
       // Initialize work objects after parameters have been loaded.
       auto fiducial_marker_context = fvlam::FiducialMarkerContext::from(cxt_);
       fiducial_marker_ = make_fiducial_marker(fiducial_marker_context, map_environment_, logger_);
 
+      // The image_marked publisher is created up front so its subscribers can be counted.
+      if (cxt_.det_pub_image_marked_enable_) {
+        pub_image_marked_ = node_.create_publisher<sensor_msgs::msg::Image>(
+          cxt_.det_pub_image_marked_topic_, 2);
+        annotate_stage_ = std::make_unique<task_thread::LatestTaskThread>();
+      }
+
+      // Creating a publisher takes a while the first time so do it before there
+      // are frames waiting.
+      if (cxt_.det_warm_up_enable_ && cxt_.det_pub_observations_enable_) {
+        observation_publisher_->warm_up();
+      }
+
+      if (cxt_.det_pipeline_enable_ && cxt_.det_pipeline_pool_threads_ > 0) {
+        detect_pool_client_ = std::make_unique<task_thread::SharedWorkerPool::Client>(
+          task_thread::SharedWorkerPool::shared(cxt_.det_pipeline_pool_threads_));
+      } else if (cxt_.det_pipeline_enable_) {
+        detect_stage_ = std::make_unique<task_thread::LatestTaskThread>();
+      }
+
       // ROS subscriptions
       auto camera_info_qos = cxt_.det_sub_camera_info_best_effort_not_reliable_ ?
                              rclcpp::QoS{rclcpp::SensorDataQoS(rclcpp::KeepLast(1))} :
@@ -185,6 +367,17 @@ namespace fiducial_vlam
           // one, or two image_raw messages.
           camera_info_msg_ = std::move(msg);
           diagnostics_.sub_camera_info_count_ += 1;
+
+          if (cxt_.det_warm_up_enable_) {
+            if (camera_info_msg_->width != warm_up_width_ || camera_info_msg_->height != warm_up_height_) {
+              warm_up_width_ = camera_info_msg_->width;
+              warm_up_height_ = camera_info_msg_->height;
+              warm_up_pending_ = true;
+            }
+            if (warm_up_pending_.exchange(false)) {
+              start_warm_up();
+            }
+          }
         });
 
       auto image_raw_qos = cxt_.det_sub_image_raw_best_effort_not_reliable_ ?
@@ -212,6 +405,16 @@ namespace fiducial_vlam
 
             // If we have just done a calibration and want to publish the marked captured
             // images then there is nothing to do with this image so ignore it.
+          } else if (detect_stage_ || detect_pool_client_) {
+
+            // Hand the frame to the detect stage. If the previous frame is still
+            // waiting to be processed, it is stale and gets dropped.
+            diagnostics_.dropped_image_raw_count_ += push_detect(
+              [this, image_msg = std::move(msg), camera_info_msg = camera_info_msg_]() mutable -> void
+              {
+                process_image(std::move(image_msg), *camera_info_msg);
+              });
+
           } else {
 
             process_image(std::move(msg), *camera_info_msg_);
@@ -222,6 +425,29 @@ namespace fiducial_vlam
         });
     }
 
+    void on_marker_map(const fvlam::MarkerMap &marker_map) override
+    {
+      if (!cxt_.det_restrict_dictionary_to_map_) {
+        return;
+      }
+      std::vector<std::uint64_t> marker_ids;
+      marker_ids.reserve(marker_map.size());
+      for (auto &marker_pair : marker_map.m()) {
+        marker_ids.emplace_back(marker_pair.first);
+      }
+
+      // The map is republished periodically. Only a change of ids needs a new
+      // dictionary.
+      if (marker_ids == restricted_marker_ids_) {
+        return;
+      }
+      restricted_marker_ids_ = marker_ids;
+      fiducial_marker_->restrict_to_marker_ids(marker_ids);
+
+      // Rebuild the restricted dictionary before the next frame needs it.
+      warm_up_pending_ = true;
+    }
+
     void report_diagnostics(fvlam::Logger &logger,
                             const rclcpp::Time &end_time) override
     {
@@ -230,89 +456,50 @@ namespace fiducial_vlam
     }
 
   private:
-    void process_image(sensor_msgs::msg::Image::UniquePtr image_msg,
-                       sensor_msgs::msg::CameraInfo &sensor_ci_msg)
+    // The detection work that the first frame would otherwise wait for runs on
+    // the thread that detects. It never replaces a frame waiting to be detected,
+    // it is tried again with the next camera_info instead. If a frame arrives
+    // before the detect stage picks this up, the frame replaces it and does the
+    // work itself.
+    void start_warm_up()
     {
-      auto stamp = fvlam::Stamp::from(image_msg->header.stamp);
-
-      // Convert ROS to OpenCV
-      cv_bridge::CvImagePtr gray{cv_bridge::toCvCopy(*image_msg, "mono8")};
-
-      // If we are going to publish an annotated image, make a copy of
-      // the original message image. If no annotated image is to be published,
-      // then just make an empty image pointer. The routines need to check
-      // that the pointer is valid before drawing into it.
-      cv_bridge::CvImage color_marked;
-
-      if (cxt_.det_pub_image_marked_enable_) {
-
-        // The toCvShare only makes ConstCvImage because they don't want
-        // to modify the original message data. I want to modify the original
-        // data so I create another CvImage that is not const and steal the
-        // image data. This seems to work now but may not in the future! (3/29/2020)
-        // tracked_object is just a dummy variable, it is not tracking anything.
-        std::shared_ptr<void const> tracked_object;
-        // const_color_marked points to the image data that is owned by image_msg.
-        auto const_color_marked = cv_bridge::toCvShare(*image_msg, tracked_object);
-        // mat_with_msg_data also references data that is owned by image_msg.
-        cv::Mat mat_with_msg_data = const_color_marked->image; // opencv does not copy the image data on assignment.
-        // color_marked now also references data that is owned by image_msg
-        color_marked = cv_bridge::CvImage{const_color_marked->header,
-                                          const_color_marked->encoding,
-                                          mat_with_msg_data};
-        // When mat_with_msg_data is destroyed, it does not release the image data because it does not own the data.
-        // When const_color_marked is destroyed, it does not release the image data because it does not own the data.
-        // tracked_object does not really track anything.
-        // When color_marked is destroyed at the end of this method, it will not release the image data because
-        //  it does not own the data.
-        // The image data will finally get released when the image_msg variable is destroyed because it owns the
-        //  image data. image_msg gets destroyed last thing in this method because it is passed by value. But that
-        //  is after color_marked is destroyed so there is no chance that the data will be references after being
-        //  released.
-
-//        // Change image_marked to use the standard parent frame
-//        image_msg->header.frame_id = cxt_.det_pub_map_frame_id_;
-      }
-
-      // Detect the markers in this image and create a list of
-      // observations.
-      auto imager_frame_id = cxt_.det_pub_imager_frame_id_.empty() ?
-                             image_msg->header.frame_id : cxt_.det_pub_imager_frame_id_;
-      auto observations = fiducial_marker_->detect_markers(gray->image, imager_frame_id);
-
-      auto camera_frame_id = cxt_.det_pub_camera_frame_id_.empty() ?
-                             image_msg->header.frame_id : cxt_.det_pub_camera_frame_id_;
-      auto observations_synced = fvlam::ObservationsSynced(stamp, camera_frame_id);
-      observations_synced.v_mutable().emplace_back(observations);
-
-      if (observations.empty()) {
-        diagnostics_.empty_observations_count_ += 1;
+      if (detect_stage_ || detect_pool_client_) {
+        auto task = [this, camera_info_msg = camera_info_msg_]() -> void
+        {
+          warm_up(*camera_info_msg);
+        };
+        auto pushed = detect_pool_client_ ?
+                      detect_pool_client_->push_if_empty(std::move(task)) :
+                      detect_stage_->push_if_empty(std::move(task));
+        if (!pushed) {
+          warm_up_pending_ = true;
+        }
+      } else {
+        warm_up(*camera_info_msg_);
       }
+    }
 
-      // Debugging hint: If the markers in color_marked are not outlined
-      // in green, then they haven't been detected.
-
-      // Annotate the image_marked with the markers that were found.
-      if (cxt_.det_pub_image_marked_enable_) {
-
-        fiducial_marker_->annotate_image_with_detected_markers(color_marked.image, observations);
-
-        // The marking has been happening on the original message.
-        auto image_marked_frame_id = cxt_.det_pub_image_marked_frame_id_.empty() ?
-                                     image_msg->header.frame_id : cxt_.det_pub_image_marked_frame_id_;
-        image_msg->header.frame_id = image_marked_frame_id;
-
-        // Republish it now.
-        if (!pub_image_marked_) {
-          pub_image_marked_ = node_.create_publisher<sensor_msgs::msg::Image>(
-            cxt_.det_pub_image_marked_topic_, 2);
-        }
-        pub_image_marked_->publish(std::move(image_msg));
-        diagnostics_.pub_image_marked_count_ += 1;
+    void warm_up(const sensor_msgs::msg::CameraInfo &sensor_ci_msg)
+    {
+      // The detector builds its dictionary and sizes its buffers on the first image.
+      // Nothing is found on a blank one and the result is thrown away.
+      cv::Mat gray = cv::Mat::zeros(static_cast<int>(sensor_ci_msg.height),
+                                    static_cast<int>(sensor_ci_msg.width), CV_8UC1);
+      auto observations = fvlam::Observations{fvlam::FrameId{}};
+      fiducial_marker_->detect_markers(gray, observations);
+
+      if (on_warm_up_callback_) {
+        auto &imager_frame_id = cxt_.det_pub_imager_frame_id_.empty() ?
+                                sensor_ci_msg.header.frame_id : cxt_.det_pub_imager_frame_id_;
+        on_warm_up_callback_(make_camera_info_map(imager_frame_id, sensor_ci_msg));
       }
+    }
 
-      // Create our CameraInfo message by first creating a CameraInfo structure
-      // from a ROS2 CameraIndo message.
+    // Create our CameraInfo message by first creating a CameraInfo structure
+    // from a ROS2 CameraIndo message.
+    fvlam::CameraInfoMap make_camera_info_map(const std::string &imager_frame_id,
+                                              const sensor_msgs::msg::CameraInfo &sensor_ci_msg)
+    {
       auto t_camera_imager = (cxt_.det_t_camera_imager_yaw_ == 0.0 &&
                               cxt_.det_t_camera_imager_pitch_ == 0.0 &&
                               cxt_.det_t_camera_imager_roll_ == 0.0 &&
@@ -332,15 +519,111 @@ namespace fiducial_vlam
                                            t_camera_imager};
       auto camera_info_map = fvlam::CameraInfoMap{};
       camera_info_map.m_mutable().emplace(camera_info.imager_frame_id(), camera_info);
+      return camera_info_map;
+    }
+
+    void process_image(sensor_msgs::msg::Image::UniquePtr image_msg,
+                       sensor_msgs::msg::CameraInfo &sensor_ci_msg)
+    {
+      auto stamp = fvlam::Stamp::from(image_msg->header.stamp);
+      auto &trace = LatencyTrace::instance();
+      trace.record(LatencyTrace::det_image_received, stamp);
+
+      // Convert ROS to OpenCV. A mono8 image is not copied, gray references the
+      // message data which lives until the end of this method.
+      cv::Mat gray;
+      {
+        ScopedLatency latency{stage_latencies_[StageLatencies::ingress]};
+        gray = mono8_ingress_.gray(*image_msg);
+      }
+
+      // Detect the markers in this image and create a list of
+      // observations. They are built in storage reused from the last frame.
+      auto &imager_frame_id = cxt_.det_pub_imager_frame_id_.empty() ?
+                              image_msg->header.frame_id : cxt_.det_pub_imager_frame_id_;
+      auto &camera_frame_id = cxt_.det_pub_camera_frame_id_.empty() ?
+                              image_msg->header.frame_id : cxt_.det_pub_camera_frame_id_;
+      auto &observations_synced = observations_arena_.begin_frame(stamp, camera_frame_id);
+      auto &observations = observations_arena_.add_observations(imager_frame_id);
+      {
+        ScopedLatency latency{stage_latencies_[StageLatencies::detect]};
+        fiducial_marker_->detect_markers(gray, observations);
+      }
+      trace.record(LatencyTrace::det_markers_detected, stamp);
+
+      if (observations.empty()) {
+        diagnostics_.empty_observations_count_ += 1;
+      }
+
+      auto camera_info_map = make_camera_info_map(imager_frame_id, sensor_ci_msg);
 
 
       // publish the observations if requested
       if (cxt_.det_pub_observations_enable_) {
+        ScopedLatency latency{stage_latencies_[StageLatencies::publish_observations]};
         observation_publisher_->publish_observations_synced(camera_info_map, observations_synced);
+        trace.record(LatencyTrace::det_observations_published, stamp);
       }
 
       // Callback with the observations.
       on_observation_callback_(camera_info_map, observations_synced);
+
+      // Annotating the image is for debugging so it happens after the observations
+      // have gone out. Nothing is done if this frame would not be published.
+      if (image_marked_wanted()) {
+        annotate_stage_->push(
+          [this, image_msg = std::move(image_msg), observations]() mutable -> void
+          {
+            annotate_and_publish_image_marked(std::move(image_msg), observations);
+          });
+      }
+    }
+
+    // Only annotate when image_marked has subscribers and the rate limit allows it.
+    bool image_marked_wanted()
+    {
+      if (!pub_image_marked_ || pub_image_marked_->get_subscription_count() == 0) {
+        return false;
+      }
+
+      auto time_now = std::chrono::steady_clock::now();
+      if (cxt_.det_pub_image_marked_max_hz_ > 0.0 &&
+          time_now - last_image_marked_time_ < std::chrono::duration<double>(1.0 / cxt_.det_pub_image_marked_max_hz_)) {
+        return false;
+      }
+      last_image_marked_time_ = time_now;
+      return true;
+    }
+
+    void annotate_and_publish_image_marked(sensor_msgs::msg::Image::UniquePtr image_msg,
+                                           const fvlam::Observations &observations)
+    {
+      ScopedLatency latency{stage_latencies_[StageLatencies::annotate]};
+
+      // The toCvShare only makes ConstCvImage because they don't want
+      // to modify the original message data. I want to modify the original
+      // data so I create another CvImage that is not const and steal the
+      // image data. This seems to work now but may not in the future! (3/29/2020)
+      // tracked_object is just a dummy variable, it is not tracking anything.
+      std::shared_ptr<void const> tracked_object;
+      // const_color_marked points to the image data that is owned by image_msg.
+      auto const_color_marked = cv_bridge::toCvShare(*image_msg, tracked_object);
+      // color_marked references data that is owned by image_msg. opencv does not
+      // copy the image data on assignment. image_msg outlives color_marked.
+      cv::Mat color_marked = const_color_marked->image;
+
+      // Debugging hint: If the markers in color_marked are not outlined
+      // in green, then they haven't been detected.
+      fiducial_marker_->annotate_image_with_detected_markers(color_marked, observations);
+
+      // The marking has been happening on the original message.
+      auto image_marked_frame_id = cxt_.det_pub_image_marked_frame_id_.empty() ?
+                                   image_msg->header.frame_id : cxt_.det_pub_image_marked_frame_id_;
+      image_msg->header.frame_id = image_marked_frame_id;
+
+      // Republish it now.
+      pub_image_marked_->publish(std::move(image_msg));
+      diagnostics_.pub_image_marked_count_ += 1;
     }
   };
 
@@ -349,9 +632,12 @@ namespace fiducial_vlam
     rclcpp::Node &node,
     fvlam::Logger &logger,
     const fvlam::MapEnvironment &map_environment,
-    const ObservationMakerInterface::OnObservationCallback &on_observation_callback)
+    const ObservationMakerInterface::OnObservationCallback &on_observation_callback,
+    StageLatencies *stage_latencies,
+    const ObservationMakerInterface::OnWarmUpCallback &on_warm_up_callback)
   {
-    return std::make_unique<SingleObservationMaker>(node, logger, cxt, map_environment, on_observation_callback);
+    return std::make_unique<SingleObservationMaker>(node, logger, cxt, map_environment, on_observation_callback,
+                                                    stage_latencies, on_warm_up_callback);
   }
 
 // ==============================================================================
@@ -364,37 +650,115 @@ namespace fiducial_vlam
     fvlam::Logger &logger_;
     VdetContext &cxt_;
     MarkerMapSubscriberInterface::OnMapEnvironmentChanged on_map_environment_changed_;
+    MarkerMapSubscriberInterface::OnMarkerMap on_marker_map_;
 
     SmmDiagnostics diagnostics_;
-    fvlam::MarkerMap marker_map_{};
+
+    // The live map. A new map is built completely, index and corner caches included,
+    // on the map callback and then swapped in with std::atomic_store. Readers take a
+    // snapshot with std::atomic_load and never wait for a map to be converted. A
+    // snapshot is never modified, a delta is applied to a copy.
+    std::shared_ptr<const fvlam::MarkerMap> marker_map_{std::make_shared<const fvlam::MarkerMap>()};
     fvlam::MapEnvironment map_environment_{};
+    std::uint64_t map_version_{0};
+
+    // With its own callback group, maps are converted on that group and the
+    // callbacks are called from notify_timer_ on the node's default group, the
+    // group of the image path. The callbacks may then replace the objects the
+    // image callbacks use.
+    std::atomic<bool> notify_pending_{false};
+    fvlam::MapEnvironment notified_environment_{};
+    rclcpp::TimerBase::SharedPtr notify_timer_{};
 
     rclcpp::Subscription<fiducial_vlam_msgs::msg::Map>::SharedPtr sub_map_{};
 
+    void notify(const fvlam::MarkerMap &marker_map)
+    {
+      if (!notified_environment_.equals(marker_map.map_environment())) {
+        notified_environment_ = marker_map.map_environment();
+        on_map_environment_changed_(marker_map.map_environment());
+      }
+      on_marker_map_(marker_map);
+    }
+
+    // Apply a delta to a copy of the current map. Returns nullptr if the delta is not
+    // based on the current map, a full map will come along later. Only the changed
+    // markers are converted.
+    std::shared_ptr<const fvlam::MarkerMap> apply_map_delta(fiducial_vlam_msgs::msg::Map &msg)
+    {
+      if (map_version_ == 0 || msg.base_version != map_version_ ||
+          !map_environment_.equals(fvlam::MapEnvironment::from(msg.map_environment))) {
+        return std::shared_ptr<const fvlam::MarkerMap>{};
+      }
+
+      auto marker_map = std::make_shared<fvlam::MarkerMap>(*marker_map());
+      for (auto &marker_msg : msg.markers) {
+        marker_map->replace_marker(fvlam::Marker::from(marker_msg));
+      }
+      for (auto id : msg.removed_ids) {
+        marker_map->remove_marker(id);
+      }
+      return marker_map;
+    }
+
   public:
     MarkerMapSubscriber(rclcpp::Node &node, fvlam::Logger &logger, VdetContext &cxt,
-                        const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed) :
+                        const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed,
+                        const MarkerMapSubscriberInterface::OnMarkerMap &on_marker_map,
+                        rclcpp::CallbackGroup::SharedPtr map_callback_group) :
       node_{node}, logger_{logger}, cxt_{cxt},
       on_map_environment_changed_{on_map_environment_changed},
+      on_marker_map_{on_marker_map},
       diagnostics_{node.now()}
     {
+      rclcpp::SubscriptionOptions options{};
+      if (map_callback_group) {
+        options.callback_group = map_callback_group;
+        notify_timer_ = node.create_wall_timer(
+          std::chrono::milliseconds(50),
+          [this]() -> void
+          {
+            if (notify_pending_.exchange(false)) {
+              notify(*marker_map());
+            }
+          });
+      }
+
       sub_map_ = node.create_subscription<fiducial_vlam_msgs::msg::Map>(
         cxt_.det_sub_map_topic_,
         1,
         [this](const fiducial_vlam_msgs::msg::Map::UniquePtr msg) -> void
         {
-          marker_map_ = fvlam::MarkerMap::from(*msg);
-          diagnostics_.sub_map_count_ += 1;
-          if (!map_environment_.equals(marker_map_.map_environment())) {
-            map_environment_ = marker_map_.map_environment();
-            on_map_environment_changed_(marker_map_.map_environment());
+          std::shared_ptr<const fvlam::MarkerMap> marker_map{};
+          if (msg->is_delta) {
+            diagnostics_.sub_map_delta_count_ += 1;
+            marker_map = apply_map_delta(*msg);
+            if (!marker_map) {
+              diagnostics_.skip_map_delta_count_ += 1;
+              return;
+            }
+          } else {
+            diagnostics_.sub_map_count_ += 1;
+            marker_map = std::make_shared<const fvlam::MarkerMap>(fvlam::MarkerMap::from(*msg));
           }
-        });
+          std::atomic_store(&marker_map_, marker_map);
+          map_version_ = msg->map_version;
+          if (!map_environment_.equals(marker_map->map_environment())) {
+            map_environment_ = marker_map->map_environment();
+          }
+
+          if (notify_timer_) {
+            notify_pending_ = true;
+            return;
+          }
+          notify(*marker_map);
+        },
+        options);
     }
 
-    fvlam::MarkerMap const &marker_map() const override
+    std::shared_ptr<const fvlam::MarkerMap> marker_map() const override
     {
-      return marker_map_;
+      return std::atomic_load(&marker_map_);
     }
 
     void report_diagnostics(fvlam::Logger &logger,
@@ -409,9 +773,286 @@ namespace fiducial_vlam
     VdetContext &cxt,
     rclcpp::Node &node,
     fvlam::Logger &logger,
-    const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed)
+    const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed,
+    const MarkerMapSubscriberInterface::OnMarkerMap &on_marker_map,
+    rclcpp::CallbackGroup::SharedPtr map_callback_group)
+  {
+    return std::make_unique<MarkerMapSubscriber>(node, logger, cxt, on_map_environment_changed, on_marker_map,
+                                                 std::move(map_callback_group));
+  }
+
+// ==============================================================================
+// TiledMarkerMapSubscriber class
+// ==============================================================================
+
+  class TiledMarkerMapSubscriber : public MarkerMapSubscriberInterface
+  {
+    using TileKey = fvlam::MarkerMapTiles::TileKey;
+
+    // How often the loader looks for an index that vmap_node has saved again.
+    static constexpr std::chrono::milliseconds index_check_period{1000};
+
+    struct ResidentTile
+    {
+      std::shared_ptr<const fvlam::MarkerMap> map_;
+      std::int64_t stamp_; // MarkerMapTiles::tile_stamp() when it was loaded
+    };
+
+    fvlam::Logger &logger_;
+    MarkerMapSubscriberInterface::OnMapEnvironmentChanged on_map_environment_changed_;
+    MarkerMapSubscriberInterface::OnMarkerMap on_marker_map_;
+    std::string tiles_directory_;
+
+    // The index is replaced, not changed, when it is read again so the threads
+    // share it like the merged map.
+    std::shared_ptr<const fvlam::MarkerMapTiles> tiles_;
+    int tiles_radius_;
+
+    // On the localize thread: the tiles last asked for.
+    std::set<TileKey> wanted_tiles_{};
+
+    // On the loader thread: the tiles held. A tile is evicted once it is more than
+    // one tile from every wanted tile so a camera on a tile border doesn't make
+    // the neighbours load and evict over and over.
+    std::map<TileKey, ResidentTile> resident_tiles_{};
+    std::set<TileKey> loaded_wanted_tiles_{};
+
+    // The merged map of the resident tiles, swapped in like MarkerMapSubscriber's.
+    std::shared_ptr<const fvlam::MarkerMap> marker_map_{};
+
+    // On the notify timer: the environment last passed to on_map_environment_changed_.
+    bool environment_notified_{false};
+    fvlam::MapEnvironment notified_environment_{};
+
+    std::atomic<std::uint64_t> resident_count_{0};
+    std::atomic<std::uint64_t> load_count_{0};
+    std::atomic<std::uint64_t> evict_count_{0};
+    std::atomic<std::uint64_t> index_load_count_{0};
+
+    std::atomic<bool> notify_pending_{false};
+    rclcpp::TimerBase::SharedPtr notify_timer_{};
+    rclcpp::TimerBase::SharedPtr index_timer_{};
+
+    // Declared last so its thread is joined before the state its tasks use goes away.
+    task_thread::LatestTaskThread loader_{};
+
+    static bool near(const TileKey &a, const TileKey &b, int distance)
+    {
+      return std::abs(a[0] - b[0]) <= distance &&
+             std::abs(a[1] - b[1]) <= distance &&
+             std::abs(a[2] - b[2]) <= distance;
+    }
+
+    std::shared_ptr<const fvlam::MarkerMapTiles> tiles() const
+    {
+      return std::atomic_load(&tiles_);
+    }
+
+    // On the loader thread: read the index again if it has been saved since it was
+    // last read. Resident tiles that were rewritten, or are no longer in the index,
+    // are dropped so the next load_tiles() reads them again. All of them are
+    // dropped if the map environment changed.
+    bool reload_index()
+    {
+      auto tiles = this->tiles();
+      if (fvlam::MarkerMapTiles::index_stamp(tiles_directory_) == tiles->stamp()) {
+        return false;
+      }
+
+      auto new_tiles = std::make_shared<const fvlam::MarkerMapTiles>(tiles_directory_, logger_);
+      if (!new_tiles->is_valid()) {
+        return false;
+      }
+      index_load_count_ += 1;
+
+      auto same_environment = new_tiles->map_environment().equals(tiles->map_environment());
+      for (auto it = resident_tiles_.begin(); it != resident_tiles_.end();) {
+        if (same_environment &&
+            new_tiles->tile_ids().find(it->first) != new_tiles->tile_ids().end() &&
+            new_tiles->tile_stamp(it->first) == it->second.stamp_) {
+          ++it;
+          continue;
+        }
+        it = resident_tiles_.erase(it);
+        evict_count_ += 1;
+      }
+
+      std::atomic_store(&tiles_, std::shared_ptr<const fvlam::MarkerMapTiles>{std::move(new_tiles)});
+      return true;
+    }
+
+    void load_tiles(const std::set<TileKey> &wanted_tiles, bool changed)
+    {
+      auto tiles = this->tiles();
+      loaded_wanted_tiles_ = wanted_tiles;
+
+      for (auto it = resident_tiles_.begin(); it != resident_tiles_.end();) {
+        auto keep = std::any_of(wanted_tiles.begin(), wanted_tiles.end(),
+                                [&it](const TileKey &key) -> bool
+                                { return near(it->first, key, 1); });
+        if (keep) {
+          ++it;
+          continue;
+        }
+        it = resident_tiles_.erase(it);
+        evict_count_ += 1;
+        changed = true;
+      }
+
+      for (auto &key : wanted_tiles) {
+        if (resident_tiles_.find(key) == resident_tiles_.end()) {
+          // Take the stamp first so a tile that is replaced while it loads is
+          // loaded again.
+          auto stamp = tiles->tile_stamp(key);
+          resident_tiles_.emplace(key, ResidentTile{
+            std::make_shared<const fvlam::MarkerMap>(tiles->load_tile(key, logger_)), stamp});
+          load_count_ += 1;
+          changed = true;
+        }
+      }
+
+      if (!changed) {
+        return;
+      }
+
+      auto marker_map = std::make_shared<fvlam::MarkerMap>(tiles->map_environment());
+      for (auto &tile_pair : resident_tiles_) {
+        for (auto &marker_pair : tile_pair.second.map_->m()) {
+          marker_map->add_marker(marker_pair.second);
+        }
+      }
+      std::atomic_store(&marker_map_, std::shared_ptr<const fvlam::MarkerMap>{std::move(marker_map)});
+      resident_count_ = resident_tiles_.size();
+      notify_pending_ = true;
+    }
+
+  public:
+    TiledMarkerMapSubscriber(const std::string &tiles_directory, int tiles_radius,
+                             rclcpp::Node &node, fvlam::Logger &logger,
+                             const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed,
+                             const MarkerMapSubscriberInterface::OnMarkerMap &on_marker_map) :
+      logger_{logger},
+      on_map_environment_changed_{on_map_environment_changed},
+      on_marker_map_{on_marker_map},
+      tiles_directory_{tiles_directory},
+      tiles_{std::make_shared<const fvlam::MarkerMapTiles>(tiles_directory, logger)},
+      tiles_radius_{std::max(0, tiles_radius)},
+      marker_map_{std::make_shared<const fvlam::MarkerMap>(tiles_->map_environment())}
+    {
+      if (tiles_->is_valid()) {
+        logger_.info() << "Map tiles " << tiles_directory << ": " << tiles_->tile_ids().size()
+                       << " tiles of size " << tiles_->tile_size();
+        notify_pending_ = true;
+      }
+
+      notify_timer_ = node.create_wall_timer(
+        std::chrono::milliseconds(50),
+        [this]() -> void
+        {
+          if (!notify_pending_.exchange(false)) {
+            return;
+          }
+          auto marker_map = this->marker_map();
+          if (!environment_notified_ || !marker_map->map_environment().equals(notified_environment_)) {
+            environment_notified_ = true;
+            notified_environment_ = marker_map->map_environment();
+            on_map_environment_changed_(marker_map->map_environment());
+          }
+          on_marker_map_(*marker_map);
+        });
+
+      // vmap_node saves the tiles again after every build. A residency change that
+      // is waiting looks at the index first, so this check only goes in when the
+      // loader is idle.
+      index_timer_ = node.create_wall_timer(
+        index_check_period,
+        [this]() -> void
+        {
+          loader_.push_if_empty([this]() -> void
+                                {
+                                  if (reload_index()) {
+                                    load_tiles(loaded_wanted_tiles_, true);
+                                  }
+                                });
+        });
+    }
+
+    std::shared_ptr<const fvlam::MarkerMap> marker_map() const override
+    {
+      return std::atomic_load(&marker_map_);
+    }
+
+    void update_residency(const fvlam::ObservationsSynced &observations_synced,
+                          const fvlam::Transform3WithCovariance &t_map_camera) override
+    {
+      auto tiles = this->tiles();
+      if (!tiles->is_valid()) {
+        return;
+      }
+
+      std::set<TileKey> wanted_tiles{};
+      if (t_map_camera.is_valid()) {
+        // The camera's tile and its neighbours, the neighbours are the prefetch.
+        auto center = tiles->tile_of(t_map_camera.tf().t());
+        for (auto &tile_pair : tiles->tile_ids()) {
+          if (near(tile_pair.first, center, tiles_radius_)) {
+            wanted_tiles.emplace(tile_pair.first);
+          }
+        }
+
+      } else {
+        // Without a pose, load the tiles of observed markers that aren't held.
+        // The tiles already held stay wanted until there is a pose again.
+        auto marker_map = this->marker_map();
+        TileKey key{};
+        for (auto &observations : observations_synced.v()) {
+          for (auto &observation : observations.v()) {
+            if (marker_map->find_marker_const(observation.id()) == nullptr &&
+                tiles->find_tile(observation.id(), key)) {
+              wanted_tiles.emplace(key);
+            }
+          }
+        }
+        if (wanted_tiles.empty()) {
+          return;
+        }
+        wanted_tiles.insert(wanted_tiles_.begin(), wanted_tiles_.end());
+      }
+
+      if (wanted_tiles.empty() || wanted_tiles == wanted_tiles_) {
+        return;
+      }
+      wanted_tiles_ = wanted_tiles;
+
+      // Only the newest residency set waiting matters.
+      loader_.push([this, wanted_tiles = std::move(wanted_tiles)]() -> void
+                   {
+                     auto changed = reload_index();
+                     load_tiles(wanted_tiles, changed);
+                   });
+    }
+
+    void report_diagnostics(fvlam::Logger &logger,
+                            const rclcpp::Time &end_time) override
+    {
+      (void) end_time;
+      logger.info() << "Map tiles resident: " << resident_count_.load()
+                    << ", loaded " << load_count_.exchange(0)
+                    << ", evicted " << evict_count_.exchange(0)
+                    << ", index reads " << index_load_count_.exchange(0);
+    }
+  };
+
+  std::unique_ptr<MarkerMapSubscriberInterface> make_tiled_marker_map_subscriber(
+    const std::string &tiles_directory,
+    int tiles_radius,
+    rclcpp::Node &node,
+    fvlam::Logger &logger,
+    const MarkerMapSubscriberInterface::OnMapEnvironmentChanged &on_map_environment_changed,
+    const MarkerMapSubscriberInterface::OnMarkerMap &on_marker_map)
   {
-    return std::make_unique<MarkerMapSubscriber>(node, logger, cxt, on_map_environment_changed);
+    return std::make_unique<TiledMarkerMapSubscriber>(tiles_directory, tiles_radius, node, logger,
+                                                      on_map_environment_changed, on_marker_map);
   }
 
 }
@@ -1,59 +1,187 @@
-
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
 #include <memory>
 
 #include "fiducial_vlam_msgs/msg/observations_synced.hpp"
 #include "fvlam/camera_info.hpp"
 #include "fvlam/logger.hpp"
 #include "fvlam/observation.hpp"
-#include "message_filters/subscriber.h"
-#include "message_filters/synchronizer.h"
-#include "message_filters/sync_policies/approximate_time.h"
+#include "camera_info_cache.hpp"
+#include "latency_trace.hpp"
 #include "observation_maker.hpp"
 #include "vloc_context.hpp"
 
 namespace fiducial_vlam
 {
 // ==============================================================================
-// SingleObservationMaker class
+// MultiObservationMaker class
 // ==============================================================================
 
+  // Syncs the ObservationsSynced messages from any number of vdet_nodes. Messages
+  // whose stamps are within loc_multi_sync_slop_ms of each other form a group. A
+  // group is sent on as soon as every topic has reported. With a deadline set, a
+  // group that is still incomplete that long after its first message arrived is
+  // sent with whatever has arrived. Older groups are dropped when a newer one is
+  // sent so the output stamps never go backwards.
   class MultiObservationMaker : public ObservationMakerInterface
   {
+    // At most this many groups wait for their missing messages.
+    static constexpr std::size_t max_pending_groups = 8;
+
+    struct Group
+    {
+      std::vector<fiducial_vlam_msgs::msg::ObservationsSynced::SharedPtr> msgs_;
+      std::size_t count_{0};
+      std::chrono::steady_clock::time_point first_arrival_;
+    };
+
     rclcpp::Node &node_;
     fvlam::Logger &logger_;
     VlocContext &cxt_;
     ObservationMakerInterface::OnObservationCallback on_observation_callback_;
 
     std::unique_ptr<ObservationPublisherInterface> observation_publisher_;
-
-    using approximate_sync_policy = message_filters::sync_policies::ApproximateTime<
-      fiducial_vlam_msgs::msg::ObservationsSynced,
-      fiducial_vlam_msgs::msg::ObservationsSynced>;
+    CameraInfoCache camera_info_cache_{};
+    fvlam::CameraInfoMap camera_info_map_{};
+    std::uint64_t camera_info_map_decode_count_{0};
+    fvlam::ObservationsSyncedArena observations_arena_{};
 
     std::vector<std::string> sub_topics_{};
+    std::vector<rclcpp::Subscription<fiducial_vlam_msgs::msg::ObservationsSynced>::SharedPtr> subs_{};
+    rclcpp::TimerBase::SharedPtr deadline_timer_{};
 
-    std::shared_ptr<message_filters::Subscriber<fiducial_vlam_msgs::msg::ObservationsSynced>> left_sub_;
-    std::shared_ptr<message_filters::Subscriber<fiducial_vlam_msgs::msg::ObservationsSynced>> right_sub_;
+    std::int64_t slop_ns_;
+    std::chrono::steady_clock::duration deadline_;
+    std::map<std::int64_t, Group> pending_groups_{}; // Indexed by the stamp of the first message
+    std::int64_t last_sent_ns_{0};
 
-    std::shared_ptr<message_filters::Synchronizer<approximate_sync_policy> > syncApproximate_;
+    std::uint64_t complete_count_{0};
+    std::uint64_t partial_count_{0};
+    std::uint64_t dropped_count_{0};
 
-    void observations_sync(const fiducial_vlam_msgs::msg::ObservationsSynced::SharedPtr m0,
-                           const fiducial_vlam_msgs::msg::ObservationsSynced::SharedPtr m1)
+    static std::int64_t to_ns(const builtin_interfaces::msg::Time &stamp)
     {
-      auto stamp = fvlam::Stamp::from(m0->header.stamp);
-      auto &camera_frame_id = m0->header.frame_id;
+      return static_cast<std::int64_t>(stamp.sec) * 1000000000 + stamp.nanosec;
+    }
 
-      auto camera_info0 = fvlam::CameraInfo::from(m0->observations_synced[0].camera_info);
-      auto camera_info1 = fvlam::CameraInfo::from(m1->observations_synced[0].camera_info);
-      auto camera_info_map = fvlam::CameraInfoMap{};
-      camera_info_map.m_mutable().emplace(camera_info0.imager_frame_id(), camera_info0);
-      camera_info_map.m_mutable().emplace(camera_info1.imager_frame_id(), camera_info1);
+    void on_observations(std::size_t topic_index, fiducial_vlam_msgs::msg::ObservationsSynced::SharedPtr msg)
+    {
+      // A message for a group that has already been sent is too late.
+      auto stamp_ns = to_ns(msg->header.stamp);
+      if (stamp_ns <= last_sent_ns_ + slop_ns_) {
+        dropped_count_ += 1;
+        return;
+      }
 
-      auto observations0 = fvlam::Observations::from(m0->observations_synced[0]);
-      auto observations1 = fvlam::Observations::from(m1->observations_synced[0]);
-      auto observations_synced = fvlam::ObservationsSynced{stamp, camera_frame_id};
-      observations_synced.v_mutable().emplace_back(observations0);
-      observations_synced.v_mutable().emplace_back(observations1);
+      // Find the group this message belongs to, or start a new one.
+      auto it = pending_groups_.lower_bound(stamp_ns - slop_ns_);
+      if (it == pending_groups_.end() || it->first > stamp_ns + slop_ns_) {
+        if (pending_groups_.size() >= max_pending_groups) {
+          dropped_count_ += 1;
+          pending_groups_.erase(pending_groups_.begin());
+        }
+        Group group{};
+        group.msgs_.resize(sub_topics_.size());
+        group.first_arrival_ = std::chrono::steady_clock::now();
+        it = pending_groups_.emplace(stamp_ns, std::move(group)).first;
+      }
+
+      auto &group = it->second;
+      if (!group.msgs_[topic_index]) {
+        group.count_ += 1;
+      }
+      group.msgs_[topic_index] = std::move(msg);
+
+      if (group.count_ == sub_topics_.size()) {
+        complete_count_ += 1;
+        send_group(it);
+      }
+    }
+
+    void on_deadline_timer()
+    {
+      auto now = std::chrono::steady_clock::now();
+
+      // Send the newest group that is past its deadline. Anything older goes with it.
+      auto newest_expired = pending_groups_.end();
+      for (auto it = pending_groups_.begin(); it != pending_groups_.end(); ++it) {
+        if (now - it->second.first_arrival_ >= deadline_) {
+          newest_expired = it;
+        }
+      }
+      if (newest_expired != pending_groups_.end()) {
+        partial_count_ += 1;
+        send_group(newest_expired);
+      }
+    }
+
+    // Send this group and drop it and every older group.
+    void send_group(std::map<std::int64_t, Group>::iterator it)
+    {
+      auto msgs = std::move(it->second.msgs_);
+      for (auto drop = pending_groups_.begin(); drop != it; ++drop) {
+        dropped_count_ += 1;
+      }
+      last_sent_ns_ = it->first;
+      pending_groups_.erase(pending_groups_.begin(), std::next(it));
+
+      observations_sync(msgs);
+    }
+
+    void observations_sync(const std::vector<fiducial_vlam_msgs::msg::ObservationsSynced::SharedPtr> &msgs)
+    {
+      const fiducial_vlam_msgs::msg::ObservationsSynced *first{nullptr};
+
+      // Wait until the full calibration for every imager has arrived. The map is
+      // only rebuilt when a calibration or the set of imagers changes.
+      auto decode_count = camera_info_cache_.decode_count();
+      std::size_t imager_count{0};
+      bool map_current{decode_count == camera_info_map_decode_count_};
+      for (auto &msg : msgs) {
+        if (!msg) {
+          continue;
+        }
+        first = first ? first : msg.get();
+        for (auto &observations_msg : msg->observations_synced) {
+          if (camera_info_cache_.camera_info(observations_msg.camera_info) == nullptr) {
+            return;
+          }
+          imager_count += 1;
+          map_current = map_current &&
+                        camera_info_map_.m().count(observations_msg.camera_info.imager_frame_id) != 0;
+        }
+      }
+
+      if (!map_current || imager_count != camera_info_map_.m().size() ||
+          camera_info_cache_.decode_count() != decode_count) {
+        camera_info_map_.m_mutable().clear();
+        for (auto &msg : msgs) {
+          if (msg) {
+            for (auto &observations_msg : msg->observations_synced) {
+              auto camera_info = camera_info_cache_.camera_info(observations_msg.camera_info);
+              camera_info_map_.m_mutable().emplace(camera_info->imager_frame_id(), *camera_info);
+            }
+          }
+        }
+        camera_info_map_decode_count_ = camera_info_cache_.decode_count();
+      }
+      auto &camera_info_map = camera_info_map_;
+
+      // The observations are built in storage reused from the last group.
+      auto &observations_synced = observations_arena_.begin_frame(fvlam::Stamp::from(first->header.stamp),
+                                                                  first->header.frame_id);
+      for (auto &msg : msgs) {
+        if (msg) {
+          for (auto &observations_msg : msg->observations_synced) {
+            observations_arena_.add_observations(observations_msg.camera_info.imager_frame_id)
+              .assign_from(observations_msg);
+          }
+        }
+      }
+
+      LatencyTrace::instance().record(LatencyTrace::det_observations_synced, observations_synced.stamp());
 
       // Publish these observations so that vmap can listen to them to create maps
       observation_publisher_->publish_observations_synced(camera_info_map, observations_synced);
@@ -67,8 +195,17 @@ namespace fiducial_vlam
                           const ObservationMakerInterface::OnObservationCallback &on_observation_callback) :
       node_{node}, logger_{logger}, cxt_{cxt},
       on_observation_callback_{on_observation_callback},
-      observation_publisher_{make_observation_publisher(node_, logger_, cxt_.loc_pub_observations_topic_)}
+      observation_publisher_{make_observation_publisher(node_, logger_, cxt_.loc_pub_observations_topic_,
+                                                          cxt_.loc_pub_camera_info_every_n_,
+                                                          cxt_.loc_pub_observations_in_process_,
+                                                          cxt_.loc_pub_observations_packed_)},
+      slop_ns_{static_cast<std::int64_t>(std::max(0., cxt.loc_multi_sync_slop_ms_) * 1.0e6)},
+      deadline_{std::chrono::milliseconds{std::max(0, cxt.loc_multi_sync_deadline_ms_)}}
     {
+      if (cxt_.loc_warm_up_enable_) {
+        observation_publisher_->warm_up();
+      }
+
       // Split the sub topics to figure out how many vdet_nodes are broadcasting observations_synced messages.
       std::size_t previous{0};
       std::size_t current = cxt.loc_sub_multi_observations_topic_.find(':');
@@ -79,21 +216,39 @@ namespace fiducial_vlam
       }
       sub_topics_.push_back(cxt.loc_sub_multi_observations_topic_.substr(previous, current - previous));
 
-      left_sub_ = std::make_shared<message_filters::Subscriber<fiducial_vlam_msgs::msg::ObservationsSynced> >(
-        &node, sub_topics_[0]);
-      right_sub_ = std::make_shared<message_filters::Subscriber<fiducial_vlam_msgs::msg::ObservationsSynced> >(
-        &node, sub_topics_[1]);
+      for (std::size_t i = 0; i < sub_topics_.size(); i += 1) {
+        subs_.emplace_back(node_.create_subscription<fiducial_vlam_msgs::msg::ObservationsSynced>(
+          sub_topics_[i], 10,
+          [this, i](fiducial_vlam_msgs::msg::ObservationsSynced::SharedPtr msg) -> void
+          {
+            on_observations(i, std::move(msg));
+          }));
+      }
 
-      syncApproximate_ = std::make_shared<message_filters::Synchronizer<approximate_sync_policy> >(
-        approximate_sync_policy(10), *left_sub_, *right_sub_);
-      syncApproximate_->registerCallback(&MultiObservationMaker::observations_sync, this);
+      // The timer checks a few times per deadline so a partial group goes out close to it.
+      if (deadline_.count() > 0) {
+        auto period = std::max(std::chrono::steady_clock::duration{std::chrono::milliseconds{1}}, deadline_ / 4);
+        deadline_timer_ = node_.create_wall_timer(period, [this]() -> void
+        { on_deadline_timer(); });
+      }
+    }
+
+    void on_marker_map(const fvlam::MarkerMap &marker_map) override
+    {
+      (void) marker_map; // The observations are detected by vdet_nodes.
     }
 
     void report_diagnostics(fvlam::Logger &logger,
                             const rclcpp::Time &end_time) override
     {
-      (void) logger;
       (void) end_time;
+      logger.info() << "Synced observations from " << sub_topics_.size() << " topics, "
+                    << complete_count_ << " complete, "
+                    << partial_count_ << " at the deadline, "
+                    << dropped_count_ << " dropped";
+      complete_count_ = 0;
+      partial_count_ = 0;
+      dropped_count_ = 0;
     }
   };
 
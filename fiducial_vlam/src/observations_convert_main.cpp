@@ -0,0 +1,56 @@
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "fvlam/logger.hpp"
+#include "fvlam/observations_series.hpp"
+
+// Convert a recorded ObservationsSeries between the YAML and the binary formats.
+// The input format is detected from the file contents. The output is binary if
+// its name ends in .fvos and YAML otherwise.
+//
+// usage: observations_convert_main <input_file> <output_file>
+
+namespace
+{
+  bool ends_with(const std::string &str, const std::string &suffix)
+  {
+    return str.size() >= suffix.size() &&
+           std::equal(suffix.rbegin(), suffix.rend(), str.rbegin());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " <input_file> <output_file>" << std::endl;
+    return 1;
+  }
+
+  std::string input{argv[1]};
+  std::string output{argv[2]};
+
+  fvlam::LoggerCout logger{fvlam::Logger::level_info};
+
+  // A file that could not be read loads as an empty series. Stop before the
+  // output is overwritten with it.
+  auto observations_series = fvlam::ObservationsSeries::load(input, logger);
+  if (observations_series.map().marker_length() == 0. || observations_series.v().empty()) {
+    logger.error() << "No observations loaded from " << input;
+    return 1;
+  }
+  logger.info() << "Loaded " << observations_series.v().size() << " frames from " << input
+                << (fvlam::ObservationsSeries::is_binary_file(input) ? " (binary)" : " (yaml)");
+
+  auto saved = ends_with(output, ".fvos") ?
+               observations_series.save_binary(output, logger) :
+               observations_series.save(output, logger);
+  if (!saved) {
+    logger.error() << "Could not write " << output;
+    return 1;
+  }
+
+  logger.info() << "Wrote " << output;
+  return 0;
+}
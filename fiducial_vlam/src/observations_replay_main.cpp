@@ -0,0 +1,267 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fvlam/build_marker_map_interface.hpp"
+#include "fvlam/camera_info.hpp"
+#include "fvlam/localize_camera_interface.hpp"
+#include "fvlam/logger.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/observation.hpp"
+#include "fvlam/observations_series.hpp"
+#include "stage_latency.hpp"
+
+// Replay a recorded ObservationsSeries through the map builder and then localize
+// every frame against the built map, as fast as the CPU allows. There is no ROS
+// executor and no pacing so a recording that took an hour to capture replays in
+// seconds. Each run uses one set of settings. Sweeps are run as several processes,
+// each line starting with "result" sums up one run for scripts to collect.
+//
+// usage: observations_replay_main <series_file> [setting=value ...]
+//   shonan=0|1              BuildMarkerMapTmmContext try_shonan_initialization, default 0
+//   noise=0|1|2             noise strategy: estimation, minimum, fixed, default 1
+//   sigma_r=<double>        fixed between factor rotation sigma, default 0.1
+//   sigma_t=<double>        fixed between factor translation sigma, default 0.3
+//   incremental=0|1         keep an iSAM2 solution between builds, default 0
+//   average_on_space=0|1    SolveTmmContextCvSolvePnp averaging, default 1
+//   build_every_n=<int>     also build after every n frames like vmap does, 0 builds once at the end
+//   localizer=cv|gtsam|none the localizer run against the built map, default cv
+//   threads=<int>           threads for localization, 0 uses every hardware thread
+//   map_out=<file>          save the built map
+//   poses_out=<file>        save one line per frame: index sec nanosec x y z qw qx qy qz
+
+namespace
+{
+  using Settings = std::map<std::string, std::string>;
+
+  double seconds_since(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  bool parse_settings(int argc, char **argv, Settings &settings)
+  {
+    for (int i = 2; i < argc; i += 1) {
+      std::string arg{argv[i]};
+      auto eq = arg.find('=');
+      if (eq == std::string::npos || eq == 0) {
+        std::cerr << "expected setting=value, got " << arg << std::endl;
+        return false;
+      }
+      settings[arg.substr(0, eq)] = arg.substr(eq + 1);
+    }
+    return true;
+  }
+
+  std::string setting(const Settings &settings, const std::string &name, const std::string &default_value)
+  {
+    auto it = settings.find(name);
+    return it == settings.end() ? default_value : it->second;
+  }
+
+  void report_latency(const char *name, const fiducial_vlam::LatencyHistogram &histogram)
+  {
+    auto summary = histogram.summary();
+    std::cout << std::fixed << std::setprecision(3)
+              << "  " << std::setw(8) << name << std::setw(8) << summary.count_
+              << " samples, p50 " << summary.p50_ms_
+              << " ms, p95 " << summary.p95_ms_
+              << " ms, p99 " << summary.p99_ms_
+              << " ms, max " << summary.max_ms_ << " ms" << std::endl;
+  }
+
+  void save_poses(const std::string &filename,
+                  const std::vector<fvlam::ObservationsSynced> &frames,
+                  const std::vector<fvlam::Transform3WithCovariance> &t_map_cameras)
+  {
+    std::ofstream out{filename};
+    out << std::setprecision(9);
+    for (std::size_t i = 0; i < t_map_cameras.size(); i += 1) {
+      if (!t_map_cameras[i].is_valid()) {
+        continue;
+      }
+      auto &tf = t_map_cameras[i].tf();
+      auto &q = tf.r().q();
+      out << i << " " << frames[i].stamp().sec() << " " << frames[i].stamp().nanosec() << " "
+          << tf.t().x() << " " << tf.t().y() << " " << tf.t().z() << " "
+          << q.w() << " " << q.x() << " " << q.y() << " " << q.z() << "\n";
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Settings settings{};
+  if (argc < 2 || !parse_settings(argc, argv, settings)) {
+    std::cerr << "usage: " << argv[0] << " <series_file> [setting=value ...]" << std::endl;
+    return 1;
+  }
+
+  fvlam::LoggerCout logger{fvlam::Logger::level_warn};
+
+  auto localizer = setting(settings, "localizer", "cv");
+  if (localizer != "cv" && localizer != "gtsam" && localizer != "none") {
+    std::cerr << "localizer must be cv, gtsam or none" << std::endl;
+    return 1;
+  }
+  auto build_every_n = std::stoul(setting(settings, "build_every_n", "0"));
+  std::size_t thread_count = std::stoul(setting(settings, "threads", "0"));
+
+  auto load_start = std::chrono::steady_clock::now();
+  auto reader = fvlam::ObservationsSeriesReader::open(argv[1], logger);
+  if (!reader) {
+    std::cerr << "could not open " << argv[1] << std::endl;
+    return 1;
+  }
+  auto open_s = seconds_since(load_start);
+
+  auto &map_initial = reader->map();
+  auto &camera_info_map = reader->camera_info_map();
+
+  auto solve_tmm_factory = fvlam::make_solve_tmm_factory(
+    fvlam::SolveTmmContextCvSolvePnp{setting(settings, "average_on_space", "1") != "0"},
+    map_initial.marker_length());
+  auto bmm_context = fvlam::BuildMarkerMapTmmContext{
+    solve_tmm_factory,
+    setting(settings, "shonan", "0") != "0",
+    static_cast<fvlam::BuildMarkerMapTmmContext::NoiseStrategy>(std::stoi(setting(settings, "noise", "1"))),
+    std::stod(setting(settings, "sigma_r", "0.1")),
+    std::stod(setting(settings, "sigma_t", "0.3")),
+    setting(settings, "incremental", "0") != "0"};
+  auto bmm = fvlam::make_build_marker_map(bmm_context, logger, map_initial);
+
+  // Stream the frames into the map builder. They are kept for localization.
+  fiducial_vlam::LatencyHistogram read_latency{};
+  fiducial_vlam::LatencyHistogram process_latency{};
+  fiducial_vlam::LatencyHistogram build_latency{};
+  std::vector<fvlam::ObservationsSynced> frames{};
+  std::unique_ptr<fvlam::MarkerMap> built_map{};
+
+  auto replay_start = std::chrono::steady_clock::now();
+  while (true) {
+    auto read_start = std::chrono::steady_clock::now();
+    fvlam::ObservationsSynced observations_synced{fvlam::Stamp{}, ""};
+    if (!reader->next(observations_synced)) {
+      break;
+    }
+    read_latency.record(std::chrono::steady_clock::now() - read_start);
+
+    {
+      fiducial_vlam::ScopedLatency latency{process_latency};
+      bmm->process(observations_synced, camera_info_map);
+    }
+    frames.emplace_back(std::move(observations_synced));
+
+    if (build_every_n > 0 && frames.size() % build_every_n == 0) {
+      fiducial_vlam::ScopedLatency latency{build_latency};
+      built_map = bmm->build();
+    }
+  }
+
+  if (frames.empty()) {
+    std::cerr << "no frames in " << argv[1] << std::endl;
+    return 1;
+  }
+
+  // Make sure the map covers every frame.
+  if (build_every_n == 0 || frames.size() % build_every_n != 0) {
+    fiducial_vlam::ScopedLatency latency{build_latency};
+    built_map = bmm->build();
+  }
+  auto replay_s = seconds_since(replay_start);
+
+  if (!built_map) {
+    std::cerr << "the map build failed" << std::endl;
+    return 1;
+  }
+
+  auto build_error = fvlam::BuildMarkerMapTmmContext::BuildError::from(*bmm, *built_map);
+
+  // Localize every frame against the built map.
+  std::vector<fvlam::Transform3WithCovariance> t_map_cameras{};
+  double localize_s{0.};
+  if (localizer != "none") {
+    auto localize_start = std::chrono::steady_clock::now();
+    if (localizer == "cv") {
+      t_map_cameras = fvlam::solve_t_map_cameras(fvlam::LocalizeCameraCvContext{},
+                                                  frames, camera_info_map, *built_map, logger, thread_count);
+    } else {
+      double corner_measurement_sigma{0.5};
+      int gtsam_factor_type{2};
+      bool use_marker_covariance{false};
+      int tracking_mode{1};
+      double tracking_max_error{2.0};
+      int max_iterations{0};
+      double max_solve_ms{0.};
+      bool undistort_lookup{false};
+      t_map_cameras = fvlam::solve_t_map_cameras(fvlam::LocalizeCameraGtsamFactorContext{corner_measurement_sigma,
+                                                                                         gtsam_factor_type,
+                                                                                         use_marker_covariance,
+                                                                                         tracking_mode,
+                                                                                         tracking_max_error,
+                                                                                         max_iterations,
+                                                                                         max_solve_ms,
+                                                                                         undistort_lookup},
+                                                 frames, camera_info_map, *built_map, logger, thread_count);
+    }
+    localize_s = seconds_since(localize_start);
+  }
+
+  std::size_t solved_count{0};
+  for (auto &t_map_camera : t_map_cameras) {
+    solved_count += t_map_camera.is_valid() ? 1 : 0;
+  }
+
+  auto map_out = setting(settings, "map_out", "");
+  if (!map_out.empty()) {
+    built_map->save(map_out, logger);
+  }
+  auto poses_out = setting(settings, "poses_out", "");
+  if (!poses_out.empty()) {
+    save_poses(poses_out, frames, t_map_cameras);
+  }
+
+  std::cout << std::fixed << std::setprecision(3)
+            << argv[1] << ": " << frames.size() << " frames, opened in " << open_s << " s" << std::endl
+            << "  replay " << replay_s << " s (" << std::setprecision(1)
+            << static_cast<double>(frames.size()) / replay_s << " fps)"
+            << ", " << built_map->m().size() << " markers mapped" << std::endl;
+  if (build_error.valid_) {
+    std::cout << "  " << build_error.to_string() << std::endl;
+  }
+  if (localizer != "none") {
+    std::cout << std::setprecision(3)
+              << "  localize " << localizer << " " << localize_s << " s (" << std::setprecision(1)
+              << static_cast<double>(frames.size()) / localize_s << " fps), "
+              << solved_count << "/" << frames.size() << " solved" << std::endl;
+  }
+  std::cout << "latency:" << std::endl;
+  report_latency("read", read_latency);
+  report_latency("process", process_latency);
+  report_latency("build", build_latency);
+
+  // One line for sweep scripts. The settings are echoed so the lines can be
+  // collected from many runs and sorted.
+  std::cout << std::setprecision(6) << "result";
+  for (auto &s : settings) {
+    std::cout << " " << s.first << "=" << s.second;
+  }
+  std::cout << " frames=" << frames.size()
+            << " markers=" << built_map->m().size()
+            << " replay_s=" << replay_s
+            << " localize_s=" << localize_s
+            << " solved=" << solved_count;
+  if (build_error.valid_) {
+    std::cout << " r_remeasure=" << build_error.r_remeasure_error_
+              << " t_remeasure=" << build_error.t_remeasure_error_
+              << " nonlinear=" << build_error.nonlinear_optimization_error_
+              << " shonan_error=" << build_error.shonan_error_;
+  }
+  std::cout << std::endl;
+
+  return 0;
+}
@@ -1,7 +1,9 @@
 
 #include "fiducial_math.hpp"
 
-#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 #include "observation.hpp"
 #include "opencv2/core.hpp"
 #include "rclcpp/rclcpp.hpp"
@@ -11,206 +13,190 @@ namespace fiducial_vlam
 {
 
 // ==============================================================================
-// KalmanFilterX class
+// CornerFilters class
 // ==============================================================================
 
-  // A class the implements a Kalman Filter. This filter is implemented using
-  // opencv's Matx matrices. This implementation follows the opencv KalmanFilter
-  // implementation.
-
-  template<typename Type, int StateDims, int MeasurementDims>
-  class KalmanFilterX
+  // Constant velocity Kalman filters for the corners of all the markers being
+  // followed. Each corner coordinate has a 2 element state: position and velocity.
+  // The transition, measurement and noise matrices are the same for every
+  // coordinate:
+  //    A = [1 dt; 0 1], H = [1 0], Q = [dt*dt dt; dt 1] * q, R = r
+  // All eight coordinates of a marker start with the same covariance and see the
+  // same sequence of predicts and updates so they also share one covariance.
+  // That leaves a symmetric 2x2 covariance per marker, and the 2x2 algebra is
+  // written out in closed form.
+  //
+  // The filters are stored as structure-of-arrays indexed by a marker slot. The
+  // per-coordinate arrays are slot * 8 + coordinate so one marker's coordinates are
+  // contiguous and the inner loops over them vectorize. Slots of markers that
+  // are no longer followed are reused.
+
+  class CornerFilters
   {
   public:
-    using ValueType = Type;
-    using StateType = cv::Vec<Type, StateDims>;
-    using MeasurementType = cv::Vec<Type, MeasurementDims>;
-    using StateCovType = cv::Matx<Type, StateDims, StateDims>;
-    using MeasurementCovType = cv::Matx<Type, MeasurementDims, MeasurementDims>;
+    static constexpr int Coords = 8;
 
   private:
-    // temporary matrices
-    cv::Matx<Type, StateDims, StateDims> temp1;
-    cv::Matx<Type, MeasurementDims, StateDims> temp2;
-    cv::Matx<Type, MeasurementDims, MeasurementDims> temp3;
-    cv::Matx<Type, MeasurementDims, StateDims> temp4;
-    cv::Vec<Type, MeasurementDims> temp5;
-
-    StateType x_k_prime;                              // predicted state (x'(k)): x(k)=A*x(k-1)+B*u(k)
-    StateCovType error_cov_k_prime;                   // priori error estimate covariance matrix (P'(k)): P'(k)=A*P(k-1)*At + Q)*/
-    cv::Matx<Type, StateDims, MeasurementDims> gain;  // Kalman gain matrix (K(k)): K(k)=P'(k)*Ht*inv(H*P'(k)*Ht+R)
+    // Per slot
+    std::vector<int> ids_{}; // -1 -> slot not in use
+    std::vector<int> frames_skipped_{};
+    std::vector<std::uint8_t> observed_{};
+    std::vector<std::uint8_t> fresh_{}; // started this frame, the state is the measurement
+    std::vector<float> p00_{};
+    std::vector<float> p01_{};
+    std::vector<float> p11_{};
+
+    // Per slot * Coords
+    std::vector<float> pos_{};
+    std::vector<float> vel_{};
+    std::vector<float> z_{};
+
+    std::vector<int> free_slots_{};
+    std::vector<int> slot_from_id_{}; // aruco ids are small so index directly
 
   public:
-    cv::Matx<Type, StateDims, StateDims> transition_matrix;         // state transition matrix (A)
-    cv::Matx<Type, MeasurementDims, StateDims> measurement_matrix;  // measurement matrix (H)
-    StateCovType process_noise_cov;                                 // process noise covariance matrix (Q)
-    MeasurementCovType measurement_noise_cov;                       // measurement noise covariance matrix (R)
-
-    struct FilterState
-    {
-      StateType x_k;                                  // corrected state (x(k)): x(k)=x'(k)+K(k)*(z(k)-H*x'(k))
-      StateCovType error_cov_k;                       // posteriori error estimate covariance matrix (P(k)): P(k)=(I-K(k)*H)*P'(k)
-    };
-
-    const StateType &predict(FilterState &fs); //
-    const StateType &update(FilterState &fs,
-                            const MeasurementType &measurement); //
-  };
-
-  template<typename Type, int StateDims, int MeasureDims>
-  const typename KalmanFilterX<Type, StateDims, MeasureDims>::StateType &
-  KalmanFilterX<Type, StateDims, MeasureDims>::predict(FilterState &fs)
-  {
-    // update the state: x'(k) = A*x(k)
-    x_k_prime = transition_matrix * fs.x_k;
-
-    // update error covariance matrices: temp1 = A*P(k)
-    temp1 = transition_matrix * fs.error_cov_k;
-
-    // P'(k) = temp1*At + Q
-    cv::gemm(temp1, transition_matrix, 1, process_noise_cov, 1, error_cov_k_prime, cv::GEMM_2_T);
-
-    // handle the case when there will be measurement before the next predict.
-    fs.x_k = x_k_prime;
-    fs.error_cov_k = error_cov_k_prime;
-
-    return x_k_prime;
-  }
-
-  template<typename Type, int StateDims, int MeasureDims>
-  const typename KalmanFilterX<Type, StateDims, MeasureDims>::StateType &
-  KalmanFilterX<Type, StateDims, MeasureDims>::update(FilterState &d,
-                                                      const MeasurementType &measurement)
-  {
-    // temp2 = H*P'(k)
-    temp2 = measurement_matrix * error_cov_k_prime;
-
-    // temp3 = temp2*Ht + R
-    cv::gemm(temp2, measurement_matrix, 1, measurement_noise_cov, 1, temp3, cv::GEMM_2_T);
-
-    // temp4 = inv(temp3)*temp2 = Kt(k)
-    solve(temp3, temp2, temp4, cv::DECOMP_SVD);
+    std::size_t slot_count() const
+    { return ids_.size(); }
 
-    // K(k)
-    gain = temp4.t();
+    int id(int slot) const
+    { return ids_[slot]; }
 
-    // temp5 = z(k) - H*x'(k)
-    temp5 = measurement - measurement_matrix * x_k_prime;
+    bool observed(int slot) const
+    { return observed_[slot] != 0; }
 
-    // x(k) = x'(k) + K(k)*temp5
-    d.x_k = x_k_prime + gain * temp5;
+    int &frames_skipped(int slot)
+    { return frames_skipped_[slot]; }
 
-    // P(k) = P'(k) - K(k)*temp2
-    d.error_cov_k = error_cov_k_prime - gain * temp2;
+    void clear_observed()
+    {
+      std::fill(observed_.begin(), observed_.end(), 0);
+      std::fill(fresh_.begin(), fresh_.end(), 0);
+    }
 
-    return d.x_k;
-  }
+    // Record a measurement for a marker. A marker that is not being followed
+    // gets a slot and starts with the measurement as its state.
+    int measure(int id, const std::vector<cv::Point2f> &marker_corners)
+    {
+      if (id >= static_cast<int>(slot_from_id_.size())) {
+        slot_from_id_.resize(id + 1, -1);
+      }
 
-// ==============================================================================
-// CVFType class
-// ==============================================================================
+      auto slot = slot_from_id_[id];
+      bool fresh = slot < 0;
+      if (fresh) {
+        slot = allocate_slot(id);
+      }
 
-// Constant Velocity Kalman Filter. This class has a 2 element state vector. The
-// state variables are position and velocity.
+      auto z = &z_[slot * Coords];
+      for (int c = 0; c < 4; c += 1) {
+        z[c * 2] = marker_corners[c].x;
+        z[c * 2 + 1] = marker_corners[c].y;
+      }
 
-  class CVFType : public KalmanFilterX<float, 2, 1>
-  {
-  public:
-    CVFType() = default; //
-    void init(ValueType dt,
-              ValueType process_std_dev,
-              ValueType measurement_std_dev); //
-    void init_filter_state(FilterState &fs,
-                           ValueType measurement_0); //
-  };
+      if (fresh) {
+        auto x = &pos_[slot * Coords];
+        auto v = &vel_[slot * Coords];
+        for (int k = 0; k < Coords; k += 1) {
+          x[k] = z[k];
+          v[k] = 0.;
+        }
+        p00_[slot] = p01_[slot] = p11_[slot] = 10.; // Large uncertainty to start with.
+        fresh_[slot] = 1;
+      }
 
-  void CVFType::init(ValueType dt,
-                     ValueType process_std_dev,
-                     ValueType measurement_std_dev)
-  {
-    transition_matrix = {1, dt, 0, 1};
-    measurement_matrix = {1, 0};
-    process_noise_cov = StateCovType{dt * dt, dt, dt, 1.} * process_std_dev * process_std_dev;
-    measurement_noise_cov = MeasurementCovType{measurement_std_dev * measurement_std_dev};
-  }
+      observed_[slot] = 1;
+      frames_skipped_[slot] = 0;
+      return slot;
+    }
 
-  void CVFType::init_filter_state(FilterState &fs,
-                                  ValueType measurement_0)
-  {
-    fs.x_k = StateType{measurement_0, 0.}; // (phi, delta_phi)
-    fs.error_cov_k = {10., 10., 10., 10.}; // Large uncertainty to start with.
-  }
+    // Predict every followed marker forward by dt and update the ones that were observed.
+    void predict_and_update(float dt, float process_std_dev, float measurement_std_dev)
+    {
+      auto q = process_std_dev * process_std_dev;
+      auto r = measurement_std_dev * measurement_std_dev;
 
-// ==============================================================================
-// MarkerFilter class
-// ==============================================================================
+      for (std::size_t slot = 0; slot < ids_.size(); slot += 1) {
+        if (ids_[slot] < 0 || fresh_[slot]) {
+          continue;
+        }
 
-  class MarkerFilter
-  {
-    using FilterStates = std::array<CVFType::FilterState, 8>;
+        // P'(k) = A*P(k-1)*At + Q
+        auto p00 = p00_[slot] + 2 * dt * p01_[slot] + dt * dt * p11_[slot] + dt * dt * q;
+        auto p01 = p01_[slot] + dt * p11_[slot] + dt * q;
+        auto p11 = p11_[slot] + q;
+
+        auto x = &pos_[slot * Coords];
+        auto v = &vel_[slot * Coords];
+
+        if (!observed_[slot]) {
+          for (int k = 0; k < Coords; k += 1) {
+            x[k] += dt * v[k];
+          }
+          p00_[slot] = p00;
+          p01_[slot] = p01;
+          p11_[slot] = p11;
+          continue;
+        }
 
-    bool observed_{false};
-    int frames_skipped_{0};
-    FilterStates filter_states_{};
+        // K(k) = P'(k)*Ht*inv(H*P'(k)*Ht+R)
+        auto k0 = p00 / (p00 + r);
+        auto k1 = p01 / (p00 + r);
+
+        // x(k) = x'(k) + K(k)*(z(k)-H*x'(k))
+        auto z = &z_[slot * Coords];
+        for (int k = 0; k < Coords; k += 1) {
+          auto x_prime = x[k] + dt * v[k];
+          auto innovation = z[k] - x_prime;
+          x[k] = x_prime + k0 * innovation;
+          v[k] += k1 * innovation;
+        }
 
-    template<typename Func>
-    static void for_each(FilterStates &filter_states,
-                         std::vector<cv::Point2f> &marker_corners,
-                         Func func)
-    {
-      func(filter_states[0], marker_corners[0].x);
-      func(filter_states[1], marker_corners[0].y);
-      func(filter_states[2], marker_corners[1].x);
-      func(filter_states[3], marker_corners[1].y);
-      func(filter_states[4], marker_corners[2].x);
-      func(filter_states[5], marker_corners[2].y);
-      func(filter_states[6], marker_corners[3].x);
-      func(filter_states[7], marker_corners[3].y);
+        // P(k) = (I-K(k)*H)*P'(k)
+        p00_[slot] = (1 - k0) * p00;
+        p01_[slot] = (1 - k0) * p01;
+        p11_[slot] = p11 - k1 * p01;
+      }
     }
 
-    static FilterStates init_filter_states(CVFType &cv, std::vector<cv::Point2f> &marker_corners)
+    void corners(int slot, std::vector<cv::Point2f> &marker_corners) const
     {
-      FilterStates fs{};
-      for_each(fs, marker_corners, [&cv](CVFType::FilterState &filter_state, CVFType::ValueType &measurement) -> void
-      {
-        cv.init_filter_state(filter_state, measurement);
-      });
-      return fs;
+      auto x = &pos_[slot * Coords];
+      marker_corners.resize(4);
+      for (int c = 0; c < 4; c += 1) {
+        marker_corners[c] = cv::Point2f{x[c * 2], x[c * 2 + 1]};
+      }
     }
 
-  public:
-    MarkerFilter(CVFType &cv, std::vector<cv::Point2f> &marker_corners) :
-      observed_{true}, // constructed because a new marker was observed.
-      frames_skipped_{0},
-      filter_states_{init_filter_states(cv, marker_corners)}
-    {}
-
-    auto &observed()
-    { return observed_; } //
-    auto &frames_skipped()
-    { return frames_skipped_; } //
-
-    std::vector<cv::Point2f> predict_only(CVFType &cv,
-                                          int id)
+    void free_slot(int slot)
     {
-      (void)id;
-      std::vector<cv::Point2f> marker_corners{cv::Point2f{}, cv::Point2f{}, cv::Point2f{}, cv::Point2f{}};
-      for_each(filter_states_, marker_corners,
-               [&cv](CVFType::FilterState &filter_state, CVFType::ValueType &measurement) -> void
-               {
-                 measurement = cv.predict(filter_state)(0);
-               });
-      return marker_corners;
+      slot_from_id_[ids_[slot]] = -1;
+      ids_[slot] = -1;
+      free_slots_.emplace_back(slot);
     }
 
-    void predict_and_update(CVFType &cv, std::vector<cv::Point2f> &marker_corners)
+  private:
+    int allocate_slot(int id)
     {
-      for_each(filter_states_, marker_corners,
-               [&cv](CVFType::FilterState &filter_state, CVFType::ValueType &measurement) -> void
-               {
-                 cv.predict(filter_state);
-                 measurement = cv.update(filter_state, measurement)(0);
-               });
+      int slot;
+      if (!free_slots_.empty()) {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+      } else {
+        slot = static_cast<int>(ids_.size());
+        ids_.emplace_back(-1);
+        frames_skipped_.emplace_back(0);
+        observed_.emplace_back(0);
+        fresh_.emplace_back(0);
+        p00_.emplace_back(0.);
+        p01_.emplace_back(0.);
+        p11_.emplace_back(0.);
+        pos_.resize(pos_.size() + Coords);
+        vel_.resize(vel_.size() + Coords);
+        z_.resize(z_.size() + Coords);
+      }
+      ids_[slot] = id;
+      slot_from_id_[id] = slot;
+      return slot;
     }
   };
 
@@ -222,8 +208,8 @@ namespace fiducial_vlam
   {
     const VlocContext &cxt_;
     rclcpp::Time last_time_stamp_{0, 0};
-    CVFType cv_{};
-    std::map<int, MarkerFilter> marker_filters_{};
+    CornerFilters filters_{};
+    std::vector<int> observation_slots_{};
 
   public:
     SmoothObservationsImpl(const VlocContext &cxt) :
@@ -242,70 +228,47 @@ namespace fiducial_vlam
         return;
       }
 
-      // Initialize the shared filter state
       float dt = (time_stamp - last_time_stamp_).seconds();
       last_time_stamp_ = time_stamp;
-      cv_.init(dt, cxt_.loc_corner_filter_process_std_, cxt_.loc_corner_filter_measure_std_);
 
-      // Clear out the visited flag on all the filters. At the end of
-      // this routine all non-visited elements are moved ahead by the filter
+      // Clear out the observed flag on all the filters. At the end of
+      // this routine all non-observed filters are moved ahead by the filter
       // and potentially added back into the observations list.
-      clear_visited();
+      filters_.clear_observed();
 
-      // Walk through the observations updating the corner locations with the filtered
-      // locations.
+      // Record the measurements. Markers we have not seen before start a new filter.
+      observation_slots_.clear();
       for (size_t i = 0; i < aruco_ids.size(); i += 1) {
-        auto marker_id = aruco_ids[i];
-        auto &marker_corners = aruco_corners[i];
-
-        // Have we seen this filter before?
-        auto it = marker_filters_.find(marker_id);
-        if (it != marker_filters_.end()) {
-          // A marker we have been following and filtering. So update
-          // the corner locations with the filtered location.
-          it->second.predict_and_update(cv_, marker_corners);
-          it->second.observed() = true;
-          it->second.frames_skipped() = 0;
-
-        } else {
-          // A marker we have not seen before. Add it to the list.
-          marker_filters_.emplace(marker_id, MarkerFilter{cv_, marker_corners});
-        }
+        observation_slots_.emplace_back(filters_.measure(aruco_ids[i], aruco_corners[i]));
+      }
+
+      // Run all the filters in one pass.
+      filters_.predict_and_update(dt, cxt_.loc_corner_filter_process_std_, cxt_.loc_corner_filter_measure_std_);
+
+      // Update the corner locations with the filtered locations.
+      for (size_t i = 0; i < aruco_ids.size(); i += 1) {
+        filters_.corners(observation_slots_[i], aruco_corners[i]);
       }
 
-      // All of the markers that were observed have been processed. Now walk through
-      // the filters and remove filters for markers that have not been observed.
-      for (auto it = marker_filters_.begin(); it != marker_filters_.end();) {
-        // If this marker was observed this frame, then leave it alone.
-        if (it->second.observed()) {
-          ++it;
+      // Now walk through the filters and remove filters for markers that have not been
+      // observed for too many frames. Markers that were observed recently are added back
+      // into the observation list with their predicted location.
+      for (size_t slot = 0; slot < filters_.slot_count(); slot += 1) {
+        if (filters_.id(slot) < 0 || filters_.observed(slot)) {
           continue;
         }
 
-        // This marker was not observed in this frame. If there have been too many
-        // skipped frames, then remove this filter from the map.
-        it->second.frames_skipped() += 1;
-        if (it->second.frames_skipped() >= cxt_.loc_corner_filter_max_skipped_) {
-          it = marker_filters_.erase(it);
+        filters_.frames_skipped(slot) += 1;
+        if (filters_.frames_skipped(slot) >= cxt_.loc_corner_filter_max_skipped_) {
+          filters_.free_slot(slot);
           continue;
         }
 
-        // This marker was not observed in this frame, but it was observed recently.
-        // Add it back in the observation list with the predicted location.
-        aruco_ids.emplace_back(it->first);
-        aruco_corners.emplace_back(it->second.predict_only(cv_, it->first));
-        ++it;
-      }
-    }
-
-  private:
-    void clear_visited()
-    {
-      for (auto &marker_filter_pair : marker_filters_) {
-        marker_filter_pair.second.observed() = false;
+        aruco_ids.emplace_back(filters_.id(slot));
+        aruco_corners.emplace_back();
+        filters_.corners(slot, aruco_corners.back());
       }
     }
-
   };
 
   std::unique_ptr<SmoothObservationsInterface> make_smooth_observations(const VlocContext &cxt)
@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fvlam/build_marker_map_interface.hpp"
+#include "fvlam/camera_info.hpp"
+#include "fvlam/factors_gtsam.hpp"
+#include "fvlam/localize_camera_interface.hpp"
+#include "fvlam/logger.hpp"
+#include "fvlam/marker.hpp"
+#include "fvlam/model.hpp"
+#include "fvlam/observation.hpp"
+
+// Time the factors and solvers that the localizers and the map builder spend
+// their time in, one operation at a time, on the MonoParallelGrid model scene.
+// Each benchmark reports nanoseconds and heap allocations per operation so that
+// a change to a factor or solver can be checked for both speed and allocation
+// churn without ROS or recorded data.
+//
+// usage: solver_benchmark_main [filter] [min_seconds]
+//   filter       only run benchmarks whose name contains this string, default all
+//   min_seconds  minimum time spent in each benchmark, default 0.5
+
+// ==============================================================================
+// Allocation counting
+// ==============================================================================
+
+// Every heap allocation in the process goes through malloc, calloc or realloc,
+// operator new included and so does Eigen's aligned allocation on x86-64. These
+// wrap glibc's implementations and only add a relaxed counter increment.
+namespace
+{
+  std::atomic<std::uint64_t> allocation_count{0};
+}
+
+extern "C"
+{
+  void *__libc_malloc(std::size_t size);
+  void *__libc_calloc(std::size_t count, std::size_t size);
+  void *__libc_realloc(void *ptr, std::size_t size);
+
+  void *malloc(std::size_t size)
+  {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+  }
+
+  void *calloc(std::size_t count, std::size_t size)
+  {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+  }
+
+  void *realloc(void *ptr, std::size_t size)
+  {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+  }
+}
+
+namespace
+{
+// ==============================================================================
+// Bench class
+// ==============================================================================
+
+  class Bench
+  {
+    std::string filter_;
+    double min_seconds_;
+
+  public:
+    Bench(std::string filter, double min_seconds) :
+      filter_{std::move(filter)}, min_seconds_{min_seconds}
+    {
+      std::cout << std::left << std::setw(40) << "benchmark" << std::right
+                << std::setw(14) << "ns/op" << std::setw(14) << "allocs/op"
+                << std::setw(12) << "ops" << std::endl;
+    }
+
+    // Run func once to warm caches and lazily built state, then in batches that
+    // double in size until min_seconds_ have been spent. Only the timed runs are
+    // counted.
+    void run(const std::string &name, const std::function<void()> &func)
+    {
+      if (!filter_.empty() && name.find(filter_) == std::string::npos) {
+        return;
+      }
+
+      func();
+
+      std::uint64_t ops{0};
+      std::uint64_t allocations{0};
+      double seconds{0.};
+      for (std::uint64_t batch = 1; seconds < min_seconds_ || ops < 10; batch *= 2) {
+        auto allocations_start = allocation_count.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t i = 0; i < batch; i += 1) {
+          func();
+        }
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        allocations += allocation_count.load(std::memory_order_relaxed) - allocations_start;
+        ops += batch;
+      }
+
+      std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+                << std::setw(14) << std::setprecision(1) << 1.0e9 * seconds / static_cast<double>(ops)
+                << std::setw(14) << std::setprecision(2)
+                << static_cast<double>(allocations) / static_cast<double>(ops)
+                << std::setw(12) << ops << std::endl;
+    }
+  };
+
+  // Keep the optimizer from discarding a result that is otherwise unused.
+  template<class T>
+  void do_not_optimize(const T &value)
+  {
+    asm volatile("" : : "r"(&value) : "memory");
+  }
+
+// ==============================================================================
+// Factor benchmarks
+// ==============================================================================
+
+  void run_factors(Bench &bench,
+                   const fvlam::MarkerModel &model,
+                   fvlam::Logger &logger)
+  {
+    auto &target_observations = model.target_observations_list()[0];
+    auto &observations = target_observations.observations_synced().v()[0];
+    auto &camera_info = model.camera_info_map().m().at(observations.imager_frame_id());
+    auto marker_length = model.environment().marker_length();
+
+    auto &observation = observations.v()[0];
+    auto &marker = *std::find_if(model.targets().begin(), model.targets().end(),
+                                 [&observation](const fvlam::Marker &m) -> bool
+                                 { return m.id() == observation.id(); });
+
+    auto cal3ds2 = std::make_shared<const gtsam::Cal3DS2>(camera_info.to<gtsam::Cal3DS2>());
+    auto corner_noise = gtsam::noiseModel::Isotropic::Sigma(2, 0.5);
+    auto quad_noise = gtsam::noiseModel::Isotropic::Sigma(2 * fvlam::Observation::ArraySize, 0.5);
+
+    auto camera_f_world = target_observations.t_map_camera().to<gtsam::Pose3>();
+    auto marker_f_world = marker.t_map_marker().tf().to<gtsam::Pose3>();
+    auto corners_f_image = observation.to<std::array<gtsam::Point2, fvlam::Observation::ArraySize>>();
+    auto corners_f_world = marker.corners_f_world<std::array<gtsam::Point3, fvlam::Observation::ArraySize>>(
+      marker_length);
+    auto corners_f_marker = fvlam::Marker::corners_f_marker<std::array<gtsam::Point3, fvlam::Observation::ArraySize>>(
+      marker_length);
+
+    gtsam::Symbol camera_key{'c', 0};
+    gtsam::Symbol marker_key{'m', marker.id()};
+    gtsam::Matrix H1{};
+    gtsam::Matrix H2{};
+
+    auto resectioning = fvlam::ResectioningFactor{camera_key, corners_f_image[0], corner_noise,
+                                                  corners_f_world[0], cal3ds2, logger};
+    bench.run("ResectioningFactor error", [&]() -> void
+    {
+      do_not_optimize(resectioning.evaluateError(camera_f_world));
+    });
+    bench.run("ResectioningFactor error+H", [&]() -> void
+    {
+      do_not_optimize(resectioning.evaluateError(camera_f_world, H1));
+    });
+
+    auto project_between = fvlam::ProjectBetweenFactor{corners_f_image[0], corner_noise,
+                                                       marker_key, camera_key,
+                                                       corners_f_marker[0], cal3ds2, logger};
+    bench.run("ProjectBetweenFactor error", [&]() -> void
+    {
+      do_not_optimize(project_between.evaluateError(marker_f_world, camera_f_world));
+    });
+    bench.run("ProjectBetweenFactor error+H", [&]() -> void
+    {
+      do_not_optimize(project_between.evaluateError(marker_f_world, camera_f_world, H1, H2));
+    });
+
+    std::shared_ptr<const gtsam::Cal3DS2> quad_cal3ds2{cal3ds2};
+    auto quad = fvlam::QuadResectioningOffsetFactor{camera_key, corners_f_image, quad_noise, corners_f_world,
+                                                    false, gtsam::Pose3{}, quad_cal3ds2, logger,
+                                                    std::string("m") + std::to_string(marker.id())};
+    bench.run("QuadResectioningOffsetFactor error", [&]() -> void
+    {
+      do_not_optimize(quad.evaluateError(camera_f_world));
+    });
+    bench.run("QuadResectioningOffsetFactor error+H", [&]() -> void
+    {
+      do_not_optimize(quad.evaluateError(camera_f_world, H1));
+    });
+
+    // The marginals of a single camera resectioned from every corner in the frame.
+    gtsam::NonlinearFactorGraph graph{};
+    for (auto &obs : observations.v()) {
+      for (auto &target : model.targets()) {
+        if (target.id() != obs.id()) {
+          continue;
+        }
+        auto obs_corners_f_image = obs.to<std::array<gtsam::Point2, fvlam::Observation::ArraySize>>();
+        auto obs_corners_f_world = target.corners_f_world<std::array<gtsam::Point3, fvlam::Observation::ArraySize>>(
+          marker_length);
+        for (std::size_t j = 0; j < obs_corners_f_image.size(); j += 1) {
+          graph.emplace_shared<fvlam::ResectioningFactor>(camera_key, obs_corners_f_image[j], corner_noise,
+                                                          obs_corners_f_world[j], cal3ds2, logger);
+        }
+      }
+    }
+    gtsam::Values initial{};
+    initial.insert(camera_key, camera_f_world);
+    auto result = gtsam::LevenbergMarquardtOptimizer(graph, initial).optimize();
+    auto marginals = fvlam::GtsamUtil::construct_marginals(graph, result);
+
+    bench.run("GtsamUtil::construct_marginals", [&]() -> void
+    {
+      do_not_optimize(fvlam::GtsamUtil::construct_marginals(graph, result));
+    });
+    bench.run("GtsamUtil::extract_t3_with_cov", [&]() -> void
+    {
+      do_not_optimize(fvlam::GtsamUtil::extract_transform3_with_covariance(marginals, result, camera_key));
+    });
+  }
+
+// ==============================================================================
+// Localizer benchmarks
+// ==============================================================================
+
+  void run_localizer(Bench &bench,
+                     const std::string &name,
+                     std::unique_ptr<fvlam::LocalizeCameraInterface> localize_camera,
+                     const fvlam::MarkerModel &model,
+                     const fvlam::MarkerMap &map)
+  {
+    // Cycle through the frames so that tracking localizers see a moving camera.
+    auto &target_observations_list = model.target_observations_list();
+    std::size_t frame{0};
+    bench.run(name, [&]() -> void
+    {
+      auto &observations_synced = target_observations_list[frame].observations_synced();
+      frame = (frame + 1) % target_observations_list.size();
+      do_not_optimize(localize_camera->solve_t_map_camera(observations_synced, model.camera_info_map(), map));
+    });
+  }
+
+  void run_localizers(Bench &bench,
+                      const fvlam::MarkerModel &model,
+                      fvlam::Logger &logger)
+  {
+    auto map = fvlam::MarkerMap{model.environment()};
+    for (auto &marker : model.targets()) {
+      map.add_marker(marker);
+    }
+
+    run_localizer(bench, "LocalizeCameraCv",
+                  fvlam::make_localize_camera(fvlam::LocalizeCameraCvContext{}, logger),
+                  model, map);
+
+    auto lc_cv_lookup_context = fvlam::LocalizeCameraCvContext{};
+    lc_cv_lookup_context.undistort_lookup_ = true;
+    run_localizer(bench, "LocalizeCameraCv undistort_lookup",
+                  fvlam::make_localize_camera(lc_cv_lookup_context, logger),
+                  model, map);
+
+    static const char *factor_type_names[] = {"resectioning", "project_between", "quad_resectioning",
+                                              "pose_between", "resection_solver"};
+    double corner_measurement_sigma{0.5};
+    bool use_marker_covariance{false};
+    int tracking_mode{0};
+    double tracking_max_error{2.0};
+    int max_iterations{0};
+    double max_solve_ms{0.};
+    for (bool undistort_lookup : {false, true}) {
+      for (int gtsam_factor_type = 0; gtsam_factor_type < 5; gtsam_factor_type += 1) {
+        auto lc_context = fvlam::LocalizeCameraGtsamFactorContext{corner_measurement_sigma,
+                                                                  gtsam_factor_type,
+                                                                  use_marker_covariance,
+                                                                  tracking_mode,
+                                                                  tracking_max_error,
+                                                                  max_iterations,
+                                                                  max_solve_ms,
+                                                                  undistort_lookup};
+        run_localizer(bench, std::string("LocalizeCameraGtsam ") + factor_type_names[gtsam_factor_type] +
+                             (undistort_lookup ? " undistort_lookup" : ""),
+                      fvlam::make_localize_camera(lc_context, logger),
+                      model, map);
+      }
+    }
+  }
+
+// ==============================================================================
+// Map builder benchmark
+// ==============================================================================
+
+  void run_build(Bench &bench,
+                 const fvlam::MarkerModel &model,
+                 fvlam::Logger &logger)
+  {
+    // The first marker is the fixed marker that anchors the map.
+    auto &marker0 = model.targets()[0];
+    auto map_initial = fvlam::MarkerMap{model.environment()};
+    map_initial.add_marker(fvlam::Marker{marker0.id(), marker0.t_map_marker(), true});
+
+    auto solve_tmm_factory = fvlam::make_solve_tmm_factory(fvlam::SolveTmmContextCvSolvePnp{true},
+                                                           model.environment().marker_length());
+    auto bmm = fvlam::make_build_marker_map(fvlam::BuildMarkerMapTmmContext{solve_tmm_factory},
+                                            logger, map_initial);
+
+    for (auto &target_observations : model.target_observations_list()) {
+      bmm->process(target_observations.observations_synced(), model.camera_info_map());
+    }
+
+    bench.run("BuildMarkerMapTmm::build", [&]() -> void
+    {
+      do_not_optimize(bmm->build());
+    });
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string filter{argc > 1 ? argv[1] : ""};
+  double min_seconds = argc > 2 ? std::stod(argv[2]) : 0.5;
+
+  if (min_seconds <= 0.) {
+    std::cerr << "usage: " << argv[0] << " [filter] [min_seconds]" << std::endl;
+    return 1;
+  }
+
+  fvlam::LoggerCout logger{fvlam::Logger::level_warn};
+  auto model = fvlam::MarkerModelGen::MonoParallelGrid()();
+
+  std::cout << "MonoParallelGrid: " << model.targets().size() << " markers, "
+            << model.target_observations_list().size() << " frames" << std::endl;
+
+  Bench bench{filter, min_seconds};
+  run_factors(bench, model, logger);
+  run_localizers(bench, model, logger);
+  run_build(bench, model, logger);
+
+  return 0;
+}
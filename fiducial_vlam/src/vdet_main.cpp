@@ -16,8 +16,10 @@ int main(int argc, char **argv)
   rclcpp::executors::SingleThreadedExecutor executor;
 
   // Create and add node
+  // With intra-process comms, the messages published by unique_ptr reach
+  // subscribers in this process without being copied or serialized.
   rclcpp::NodeOptions options{};
-  options.use_intra_process_comms(false);
+  options.use_intra_process_comms(true);
   auto node = fiducial_vlam::vdet_node_factory(options);
 
   executor.add_node(node);
@@ -78,6 +78,7 @@ namespace fiducial_vlam
     {
       // Get parameters from the command line
       setup_parameters();
+      logger_.set_async(cxt_.det_log_async_);
 
       marker_map_subscriber_ = make_marker_map_subscriber(
         cxt_, *this, logger_,
@@ -90,6 +91,10 @@ namespace fiducial_vlam
             [this](const fvlam::CameraInfoMap &,
                    const fvlam::ObservationsSynced &) -> void
             {});
+        },
+        [this](const fvlam::MarkerMap &marker_map) -> void
+        {
+          observation_maker_->on_marker_map(marker_map);
         });
 
 
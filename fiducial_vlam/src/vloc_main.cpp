@@ -1,4 +1,6 @@
 
+#include <memory>
+
 #include "fiducial_vlam/fiducial_vlam.hpp"
 
 #include "rclcpp/rclcpp.hpp"
@@ -11,18 +13,29 @@ int main(int argc, char **argv)
   // Init ROS
   rclcpp::init(argc, argv);
 
-  // Create single-threaded executor
-  rclcpp::executors::SingleThreadedExecutor executor;
-
   // Create and add node
+  // With intra-process comms, the messages published by unique_ptr reach
+  // subscribers in this process without being copied or serialized.
   rclcpp::NodeOptions options{};
-  options.use_intra_process_comms(false);
+  options.use_intra_process_comms(true);
   auto node = fiducial_vlam::vloc_node_factory(options);
 
-  executor.add_node(node);
+  // The node has declared loc_executor_threads. A multi-threaded executor only
+  // helps when the node puts its callbacks in separate groups, see
+  // loc_callback_groups_enable.
+  auto executor_threads = node->get_parameter("loc_executor_threads").as_int();
+  std::unique_ptr<rclcpp::Executor> executor{};
+  if (executor_threads == 1) {
+    executor = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+  } else {
+    executor = std::make_unique<rclcpp::executors::MultiThreadedExecutor>(
+      rclcpp::ExecutorOptions{}, static_cast<std::size_t>(executor_threads > 1 ? executor_threads : 0));
+  }
+
+  executor->add_node(node);
 
   // Spin until rclcpp::ok() returns false
-  executor.spin();
+  executor->spin();
 
   // Shut down ROS
   rclcpp::shutdown();
@@ -1,10 +1,13 @@
 
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 
 //#define ENABLE_TIMING
 
 #include "cv_bridge/cv_bridge.h"
+#include "diagnostic_msgs/msg/diagnostic_array.hpp"
 #include "fiducial_vlam/fiducial_vlam.hpp"
 #include "fiducial_vlam_msgs/msg/map.hpp"
 #include "fiducial_vlam_msgs/msg/observations.hpp"
@@ -22,8 +25,11 @@
 #include "sensor_msgs/msg/camera_info.hpp"
 #include "tf2_geometry_msgs/tf2_geometry_msgs.h"
 #include "tf2_msgs/msg/tf_message.hpp"
+#include "latency_trace.hpp"
 #include "logger_ros2.hpp"
 #include "observation_maker.hpp"
+#include "stage_latency.hpp"
+#include "task_thread.hpp"
 #include "vdet_context.hpp"
 #include "vloc_context.hpp"
 
@@ -37,8 +43,8 @@ namespace fvlam
   LocalizeCameraCvContext LocalizeCameraCvContext::from<fiducial_vlam::VlocContext>(
     fiducial_vlam::VlocContext &other)
   {
-    (void) other;
     LocalizeCameraCvContext cxt{};
+    cxt.undistort_lookup_ = other.loc_undistort_lookup_;
     return cxt;
   }
 
@@ -52,7 +58,12 @@ namespace fvlam
   {
     LocalizeCameraGtsamFactorContext cxt{other.loc_corner_measurement_sigma_,
                                          other.loc_gtsam_factor_type_,
-                                         other.loc_use_marker_covariance_};
+                                         other.loc_use_marker_covariance_,
+                                         other.loc_gtsam_tracking_mode_,
+                                         other.loc_gtsam_tracking_max_error_,
+                                         other.loc_gtsam_max_iterations_,
+                                         other.loc_gtsam_max_solve_ms_,
+                                         other.loc_undistort_lookup_};
     return cxt;
   }
 
@@ -83,6 +94,7 @@ namespace fiducial_vlam
   {
     LoggerRos2 logger_;
     VlocDiagnostics diagnostics_;
+    StageLatencies stage_latencies_{};
 
     VlocContext cxt_{};
     VdetContext det_cxt_{};
@@ -91,10 +103,26 @@ namespace fiducial_vlam
     std::unique_ptr<ObservationMakerInterface> observation_maker_{};
 
     std::unique_ptr<fvlam::LocalizeCameraInterface> localize_camera_{};
+    // Outlives the localizers get_lc() replaces so calibrations are not converted again.
+    std::shared_ptr<fvlam::LocalizeCameraCaches> localize_camera_caches_{
+      std::make_shared<fvlam::LocalizeCameraCaches>()};
     std::unique_ptr<fvlam::FiducialMarkerInterface> fiducial_marker_{};
 //    fvlam::MarkerMap marker_map_{};
 
+    // Written by validate_parameters(), read by the localize path.
+    std::mutex cxt_snapshot_mutex_{};
+    std::shared_ptr<const VlocContext> cxt_snapshot_{};
+
+    // The parameters that the localizer's context refers to. Only the localize
+    // path touches these, get_lc() copies a newer snapshot in before a solve.
+    VlocContext lc_cxt_{};
+    std::shared_ptr<const VlocContext> lc_cxt_source_{};
+
+    // The map the localizer last solved against, also only for the localize path.
+    std::shared_ptr<const fvlam::MarkerMap> lc_marker_map_{};
+
     int current_loc_camera_algorithm_{};
+    double current_loc_static_scene_max_motion_{};
 
     std::unique_ptr<sensor_msgs::msg::CameraInfo> camera_info_msg_{};
     std_msgs::msg::Header::_stamp_type last_image_stamp_{};
@@ -106,15 +134,40 @@ namespace fiducial_vlam
     rclcpp::Publisher<geometry_msgs::msg::PoseWithCovarianceStamped>::SharedPtr pub_base_pose_{};
     rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pub_base_odom_{};
     rclcpp::Publisher<tf2_msgs::msg::TFMessage>::SharedPtr pub_tf_{};
+    rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr pub_diagnostics_{};
 
     rclcpp::Subscription<sensor_msgs::msg::Image>::SharedPtr sub_image_raw_;
     rclcpp::Subscription<sensor_msgs::msg::CameraInfo>::SharedPtr sub_camera_info_;
     rclcpp::Subscription<fiducial_vlam_msgs::msg::Map>::SharedPtr sub_map_;
 
     rclcpp::TimerBase::SharedPtr timer_{};
+    rclcpp::TimerBase::SharedPtr diagnostics_timer_{};
+
+    // With loc_callback_groups_enable, the map subscription and the diagnostics
+    // timer each have a group so that neither delays the image path, which stays
+    // on the default group. The command timer stays on the default group because
+    // the parameter services that set loc_cmd run there.
+    rclcpp::CallbackGroup::SharedPtr map_callback_group_{};
+    rclcpp::CallbackGroup::SharedPtr control_callback_group_{};
+
+    // When pipelined, localization and publishing run on this thread. Declared
+    // last so it is joined before the objects its tasks use are destroyed.
+    std::unique_ptr<task_thread::LatestTaskThread> localize_stage_{};
 
     void validate_parameters()
-    {}
+    {
+      // The parameter callback runs on the executor. The localize path gets a
+      // copy of the parameters instead of reading cxt_ while they change.
+      auto cxt_snapshot = std::make_shared<const VlocContext>(cxt_);
+      std::lock_guard<std::mutex> lock{cxt_snapshot_mutex_};
+      cxt_snapshot_ = std::move(cxt_snapshot);
+    }
+
+    std::shared_ptr<const VlocContext> cxt_snapshot()
+    {
+      std::lock_guard<std::mutex> lock{cxt_snapshot_mutex_};
+      return cxt_snapshot_;
+    }
 
     void setup_parameters()
     {
@@ -139,26 +192,98 @@ namespace fiducial_vlam
     }
 
     // Create a LocalizeCameraInterface object if one has not been created yet or
-    // the parameter type has changed.
-    fvlam::LocalizeCameraInterface &get_lc()
+    // the parameter type has changed. Only called from the localize path, on
+    // the localize stage when there is one, with a snapshot of the parameters.
+    fvlam::LocalizeCameraInterface &get_lc(const std::shared_ptr<const VlocContext> &cxt_ptr)
     {
+      // The localizer's context holds references to lc_cxt_ so a new snapshot
+      // is copied into it rather than swapped.
+      if (cxt_ptr != lc_cxt_source_) {
+        lc_cxt_ = *cxt_ptr;
+        lc_cxt_source_ = cxt_ptr;
+      }
+      auto &cxt = lc_cxt_;
+
       // Check that a LocalizeCameraInterface has been instantiated
-      if (!localize_camera_ || cxt_.loc_camera_algorithm_ != current_loc_camera_algorithm_) {
-        if (cxt_.loc_camera_algorithm_ == 1) {
-          auto localize_camera_context = fvlam::LocalizeCameraGtsamFactorContext::from(cxt_);
-          localize_camera_ = make_localize_camera(localize_camera_context, logger_);
+      if (!localize_camera_ ||
+          cxt.loc_camera_algorithm_ != current_loc_camera_algorithm_ ||
+          cxt.loc_static_scene_max_motion_ != current_loc_static_scene_max_motion_) {
+        if (cxt.loc_camera_algorithm_ == 1) {
+          auto localize_camera_context = fvlam::LocalizeCameraGtsamFactorContext::from(cxt);
+          localize_camera_ = make_localize_camera(localize_camera_context, logger_, localize_camera_caches_);
 
         } else {
-          auto localize_camera_context = fvlam::LocalizeCameraCvContext::from(cxt_);
-          localize_camera_ = make_localize_camera(localize_camera_context, logger_);
+          auto localize_camera_context = fvlam::LocalizeCameraCvContext::from(cxt);
+          localize_camera_ = make_localize_camera(localize_camera_context, logger_, localize_camera_caches_);
         }
 
-        current_loc_camera_algorithm_ = cxt_.loc_camera_algorithm_;
+        // Skip the solve while the observations don't change.
+        if (cxt.loc_static_scene_max_motion_ > 0.) {
+          localize_camera_ = fvlam::make_static_scene_localize_camera(std::move(localize_camera_),
+                                                                      cxt.loc_static_scene_max_motion_);
+        }
+
+        current_loc_camera_algorithm_ = cxt.loc_camera_algorithm_;
+        current_loc_static_scene_max_motion_ = cxt.loc_static_scene_max_motion_;
       }
 
       return *localize_camera_;
     }
 
+    // Create the publishers for the enabled messages now rather than when their
+    // first message is ready to go.
+    void create_publishers()
+    {
+      if (cxt_.loc_pub_camera_pose_enable_ && !pub_camera_pose_) {
+        pub_camera_pose_ = create_publisher<geometry_msgs::msg::PoseWithCovarianceStamped>(
+          cxt_.loc_pub_camera_pose_topic_, 2);
+      }
+      if (cxt_.loc_pub_camera_odom_enable_ && !pub_camera_odom_) {
+        pub_camera_odom_ = create_publisher<nav_msgs::msg::Odometry>(
+          cxt_.loc_pub_camera_odom_topic_, 2);
+      }
+      if (cxt_.loc_pub_base_pose_enable_ && !pub_base_pose_) {
+        pub_base_pose_ = create_publisher<geometry_msgs::msg::PoseWithCovarianceStamped>(
+          cxt_.loc_pub_base_pose_topic_, 2);
+      }
+      if (cxt_.loc_pub_base_odom_enable_ && !pub_base_odom_) {
+        pub_base_odom_ = create_publisher<nav_msgs::msg::Odometry>(
+          cxt_.loc_pub_base_odom_topic_, 2);
+      }
+      if ((cxt_.loc_pub_tf_camera_enable_ || cxt_.loc_pub_tf_base_enable_ || cxt_.loc_pub_tf_imager_enable_) &&
+          !pub_tf_) {
+        pub_tf_ = create_publisher<tf2_msgs::msg::TFMessage>(
+          "/tf", 2);
+      }
+      if (cxt_.loc_pub_diagnostics_enable_ && !pub_diagnostics_) {
+        pub_diagnostics_ = create_publisher<diagnostic_msgs::msg::DiagnosticArray>(
+          cxt_.loc_pub_diagnostics_topic_, 2);
+      }
+    }
+
+    // Called by the observation maker once its detector has warmed up. A solve of
+    // a made up frame fills the localizer's calibration caches and builds its
+    // solver so the first real frame doesn't pay for them. With the pipeline, the
+    // localize stage does this if it has nothing better to do.
+    void on_warm_up_callback(const fvlam::CameraInfoMap &camera_info_map)
+    {
+      auto cxt = cxt_snapshot();
+      if (!cxt->loc_warm_up_enable_) {
+        return;
+      }
+
+      if (!localize_stage_) {
+        fvlam::warm_up_localize_camera(get_lc(cxt), camera_info_map, *marker_map_subscriber_->marker_map());
+        return;
+      }
+
+      localize_stage_->push_if_empty(
+        [this, cxt, camera_info_map]() -> void
+        {
+          fvlam::warm_up_localize_camera(get_lc(cxt), camera_info_map, *marker_map_subscriber_->marker_map());
+        });
+    }
+
   public:
     explicit VlocNode(const rclcpp::NodeOptions &options) :
       Node("vloc_node", options),
@@ -167,31 +292,68 @@ namespace fiducial_vlam
     {
       // Get parameters from the command line
       setup_parameters();
+      logger_.set_async(cxt_.loc_log_async_);
+      if (!cxt_.loc_latency_trace_file_.empty()) {
+        LatencyTrace::instance().set_keep_records(true);
+      }
 
-      marker_map_subscriber_ = make_marker_map_subscriber(
-        det_cxt_, *this, logger_,
-        [this](const fvlam::MapEnvironment &map_environment) -> void
-        {
-          // Create an observation_maker single or multi depending on whether the
-          // loc_sub_multi_observations_topic_ parameter is blank.
-          if (cxt_.loc_sub_multi_observations_topic_.empty()) {
-            observation_maker_ = make_single_observation_maker(
-              det_cxt_, *this, logger_, map_environment,
-              [this](const fvlam::CameraInfoMap &camera_info_map,
-                     const fvlam::ObservationsSynced &observations_synced) -> void
-              {
-                on_observation_callback(camera_info_map, observations_synced);
-              });
-          } else {
-            observation_maker_ = make_multi_observation_maker(
-              cxt_, *this, logger_,
-              [this](const fvlam::CameraInfoMap &camera_info_map,
-                     const fvlam::ObservationsSynced &observations_synced) -> void
-              {
-                on_observation_callback(camera_info_map, observations_synced);
-              });
-          }
-        });
+      if (cxt_.loc_pipeline_enable_) {
+        localize_stage_ = std::make_unique<task_thread::LatestTaskThread>();
+      }
+
+      if (cxt_.loc_callback_groups_enable_) {
+        map_callback_group_ = create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+        control_callback_group_ = create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+      }
+
+      auto on_map_environment_changed = [this](const fvlam::MapEnvironment &map_environment) -> void
+      {
+        // Create an observation_maker single or multi depending on whether the
+        // loc_sub_multi_observations_topic_ parameter is blank.
+        if (cxt_.loc_sub_multi_observations_topic_.empty()) {
+          observation_maker_ = make_single_observation_maker(
+            det_cxt_, *this, logger_, map_environment,
+            [this](const fvlam::CameraInfoMap &camera_info_map,
+                   const fvlam::ObservationsSynced &observations_synced) -> void
+            {
+              on_observation_callback(camera_info_map, observations_synced);
+            },
+            &stage_latencies_,
+            [this](const fvlam::CameraInfoMap &camera_info_map) -> void
+            {
+              on_warm_up_callback(camera_info_map);
+            });
+        } else {
+          observation_maker_ = make_multi_observation_maker(
+            cxt_, *this, logger_,
+            [this](const fvlam::CameraInfoMap &camera_info_map,
+                   const fvlam::ObservationsSynced &observations_synced) -> void
+            {
+              on_observation_callback(camera_info_map, observations_synced);
+            });
+        }
+      };
+      auto on_marker_map = [this](const fvlam::MarkerMap &marker_map) -> void
+      {
+        observation_maker_->on_marker_map(marker_map);
+      };
+
+      // The map comes either whole from vmap_node's map topic or as tiles from
+      // disk around where the camera is.
+      if (cxt_.loc_map_tiles_dir_.empty()) {
+        marker_map_subscriber_ = make_marker_map_subscriber(
+          det_cxt_, *this, logger_, on_map_environment_changed, on_marker_map, map_callback_group_);
+      } else {
+        marker_map_subscriber_ = make_tiled_marker_map_subscriber(
+          cxt_.loc_map_tiles_dir_, cxt_.loc_map_tiles_radius_, *this, logger_,
+          on_map_environment_changed, on_marker_map);
+      }
+
+      // Do the one time setup that would otherwise land on the first frame.
+      if (cxt_.loc_warm_up_enable_) {
+        create_publishers();
+        get_lc(cxt_snapshot());
+      }
 
 #if 0
       // Initialize work objects after parameters have been loaded.
@@ -268,6 +430,18 @@ namespace fiducial_vlam
           timer_callback();
         });
 
+      if (control_callback_group_) {
+        diagnostics_timer_ = create_wall_timer(
+          std::chrono::milliseconds(1000),
+          [this]() -> void
+          {
+            if (cxt_.loc_pub_diagnostics_enable_) {
+              publish_stage_latencies(now());
+            }
+          },
+          control_callback_group_);
+      }
+
       logger_.info()
         << "Using opencv " << CV_VERSION_MAJOR << "."
         << CV_VERSION_MINOR << "." << CV_VERSION_REVISION << "\n"
@@ -284,13 +458,59 @@ namespace fiducial_vlam
       (void) sub_map_;
     }
 
+    ~VlocNode() override
+    {
+      // Stop the observation maker first because it might be pushing
+      // observations to the localize stage.
+      observation_maker_.reset();
+      localize_stage_.reset();
+    }
+
   private:
     void on_observation_callback(const fvlam::CameraInfoMap &camera_info_map,
                                  const fvlam::ObservationsSynced &observations_synced)
     {
-      // Find the camera pose from the observations.
-      auto t_map_camera = get_lc().solve_t_map_camera(
-        observations_synced, camera_info_map, marker_map_subscriber_->marker_map());
+      LatencyTrace::instance().record(LatencyTrace::loc_observations_received, observations_synced.stamp());
+
+      if (!localize_stage_) {
+        localize_and_publish(camera_info_map, observations_synced);
+        return;
+      }
+
+      // Hand these observations to the localize stage. Observations that are still
+      // waiting from an earlier frame are stale and get dropped.
+      diagnostics_.dropped_observations_count_ += localize_stage_->push(
+        [this, camera_info_map, observations_synced]() -> void
+        {
+          localize_and_publish(camera_info_map, observations_synced);
+        });
+    }
+
+    void localize_and_publish(const fvlam::CameraInfoMap &camera_info_map,
+                              const fvlam::ObservationsSynced &observations_synced)
+    {
+      // Find the camera pose from the observations. Hold on to the current map
+      // and parameters while using them in case new ones arrive.
+      auto cxt_ptr = cxt_snapshot();
+      auto &cxt = *cxt_ptr;
+      auto marker_map = marker_map_subscriber_->marker_map();
+      if (marker_map != lc_marker_map_) {
+        // A pose solved against the old map is no seed for the new one.
+        get_lc(cxt_ptr).reset_tracking();
+        lc_marker_map_ = marker_map;
+      }
+      fvlam::Transform3WithCovariance t_map_camera{};
+      {
+        ScopedLatency latency{stage_latencies_[StageLatencies::localize]};
+        t_map_camera = get_lc(cxt_ptr).solve_t_map_camera(observations_synced, camera_info_map, *marker_map);
+      }
+      if (get_lc(cxt_ptr).last_solve_status() != fvlam::SolveStatus::converged) {
+        diagnostics_.budget_t_map_camera_count_ += 1;
+      }
+      marker_map_subscriber_->update_residency(observations_synced, t_map_camera);
+
+      // Everything from here on is building and publishing messages.
+      ScopedLatency latency{stage_latencies_[StageLatencies::publish_pose]};
 
       if (!t_map_camera.is_valid()) {
         diagnostics_.invalid_t_map_camera_count_ += 1;
@@ -299,32 +519,32 @@ namespace fiducial_vlam
       if (t_map_camera.is_valid()) {
 
         // Header to use with pose, odometry, and tf messages
-        auto map_frame_id = cxt_.loc_pub_map_frame_id_.empty() ?
-                            observations_synced.camera_frame_id() : cxt_.loc_pub_map_frame_id_;
+        auto map_frame_id = cxt.loc_pub_map_frame_id_.empty() ?
+                            observations_synced.camera_frame_id() : cxt.loc_pub_map_frame_id_;
         auto po_header = std_msgs::msg::Header{}
           .set__frame_id(map_frame_id)
           .set__stamp(observations_synced.stamp().to<builtin_interfaces::msg::Time>());
 
         // Publish the camera pose/odometry in the map frame
-        if (cxt_.loc_pub_camera_pose_enable_) {
+        if (cxt.loc_pub_camera_pose_enable_) {
           auto msg = geometry_msgs::msg::PoseWithCovarianceStamped{}
             .set__header(po_header)
             .set__pose(t_map_camera.to<geometry_msgs::msg::PoseWithCovariance>());
           if (!pub_camera_pose_) {
             pub_camera_pose_ = create_publisher<geometry_msgs::msg::PoseWithCovarianceStamped>(
-              cxt_.loc_pub_camera_pose_topic_, 2);
+              cxt.loc_pub_camera_pose_topic_, 2);
           }
           pub_camera_pose_->publish(msg);
           diagnostics_.pub_camera_pose_count_ += 1;
         }
-        if (cxt_.loc_pub_camera_odom_enable_) {
+        if (cxt.loc_pub_camera_odom_enable_) {
           auto msg = nav_msgs::msg::Odometry{}
             .set__header(po_header)
             .set__child_frame_id(observations_synced.camera_frame_id())
             .set__pose(t_map_camera.to<geometry_msgs::msg::PoseWithCovariance>());
           if (!pub_camera_odom_) {
             pub_camera_odom_ = create_publisher<nav_msgs::msg::Odometry>(
-              cxt_.loc_pub_camera_odom_topic_, 2);
+              cxt.loc_pub_camera_odom_topic_, 2);
           }
           pub_camera_odom_->publish(msg);
           diagnostics_.pub_camera_odom_count_ += 1;
@@ -335,34 +555,34 @@ namespace fiducial_vlam
         // t_map_base have the same covariance.
         auto t_map_base = fvlam::Transform3WithCovariance{
           t_map_camera.tf() * fvlam::Transform3{
-            fvlam::Rotate3::RzRyRx(cxt_.loc_t_base_camera_yaw_,
-                                   cxt_.loc_t_base_camera_pitch_,
-                                   cxt_.loc_t_base_camera_roll_),
-            fvlam::Translate3{cxt_.loc_t_base_camera_x_,
-                              cxt_.loc_t_base_camera_y_,
-                              cxt_.loc_t_base_camera_z_}}.inverse(),
+            fvlam::Rotate3::RzRyRx(cxt.loc_t_base_camera_yaw_,
+                                   cxt.loc_t_base_camera_pitch_,
+                                   cxt.loc_t_base_camera_roll_),
+            fvlam::Translate3{cxt.loc_t_base_camera_x_,
+                              cxt.loc_t_base_camera_y_,
+                              cxt.loc_t_base_camera_z_}}.inverse(),
           t_map_camera.cov()};
 
         // Publish the base pose/odometry in the map frame
-        if (cxt_.loc_pub_base_pose_enable_) {
+        if (cxt.loc_pub_base_pose_enable_) {
           auto msg = geometry_msgs::msg::PoseWithCovarianceStamped{}
             .set__header(po_header)
             .set__pose(t_map_base.to<geometry_msgs::msg::PoseWithCovariance>());
           if (!pub_base_pose_) {
             pub_base_pose_ = create_publisher<geometry_msgs::msg::PoseWithCovarianceStamped>(
-              cxt_.loc_pub_base_pose_topic_, 2);
+              cxt.loc_pub_base_pose_topic_, 2);
           }
           pub_base_pose_->publish(msg);
           diagnostics_.pub_base_pose_count_ += 1;
         }
-        if (cxt_.loc_pub_base_odom_enable_) {
+        if (cxt.loc_pub_base_odom_enable_) {
           auto msg = nav_msgs::msg::Odometry{}
             .set__header(po_header)
-            .set__child_frame_id(cxt_.loc_pub_base_odom_child_frame_id_)
+            .set__child_frame_id(cxt.loc_pub_base_odom_child_frame_id_)
             .set__pose(t_map_base.to<geometry_msgs::msg::PoseWithCovariance>());
           if (!pub_base_odom_) {
             pub_base_odom_ = create_publisher<nav_msgs::msg::Odometry>(
-              cxt_.loc_pub_base_odom_topic_, 2);
+              cxt.loc_pub_base_odom_topic_, 2);
           }
           pub_base_odom_->publish(msg);
           diagnostics_.pub_base_odom_count_ += 1;
@@ -372,7 +592,7 @@ namespace fiducial_vlam
         tf2_msgs::msg::TFMessage tfs_msg;
 
         // Publish the camera's tf
-        if (cxt_.loc_pub_tf_camera_enable_) {
+        if (cxt.loc_pub_tf_camera_enable_) {
           auto msg = geometry_msgs::msg::TransformStamped{}
             .set__header(po_header)
             .set__child_frame_id(observations_synced.camera_frame_id())
@@ -381,16 +601,16 @@ namespace fiducial_vlam
         }
 
         // Publish the base's tf
-        if (cxt_.loc_pub_tf_base_enable_) {
+        if (cxt.loc_pub_tf_base_enable_) {
           auto msg = geometry_msgs::msg::TransformStamped{}
             .set__header(po_header)
-            .set__child_frame_id(cxt_.loc_pub_tf_base_link_id_)
+            .set__child_frame_id(cxt.loc_pub_tf_base_link_id_)
             .set__transform(t_map_base.tf().to<geometry_msgs::msg::Transform>());
           tfs_msg.transforms.emplace_back(msg);
         }
 
         // Publish the imagers' tf. Walk through the camera_info_map publishing a tf for each
-        if (cxt_.loc_pub_tf_imager_enable_) {
+        if (cxt.loc_pub_tf_imager_enable_) {
           for (auto &camera_info_pair : camera_info_map.m()) {
             auto &camera_info = camera_info_pair.second;
             auto msg = geometry_msgs::msg::TransformStamped{}
@@ -442,6 +662,7 @@ namespace fiducial_vlam
           pub_tf_->publish(tfs_msg);
           diagnostics_.pub_tf_count_ += 1;
         }
+        LatencyTrace::instance().record(LatencyTrace::loc_pose_published, observations_synced.stamp());
       }
     }
 
@@ -537,7 +758,10 @@ namespace fiducial_vlam
         auto camera_info = fvlam::CameraInfo::from(*camera_info_msg);
 
         // Find the camera pose from the observations.
-        auto t_map_camera = get_lc().solve_t_map_camera(observations, camera_info, marker_map_);
+        auto t_map_camera = get_lc(cxt_snapshot()).solve_t_map_camera(observations, camera_info, marker_map_);
+        if (get_lc(cxt_snapshot()).last_solve_status() != fvlam::SolveStatus::converged) {
+          diagnostics_.budget_t_map_camera_count_ += 1;
+        }
 
         if (!t_map_camera.is_valid()) {
           diagnostics_.invalid_t_map_camera_count_ += 1;
@@ -736,11 +960,57 @@ namespace fiducial_vlam
 
         if (cmd == "diagnostics") {
           diagnostics_.report(logger_, now());
+          stage_latencies_.report(logger_);
+          stage_latencies_.reset();
+          auto &trace = LatencyTrace::instance();
+          trace.report(logger_);
+          if (!cxt_.loc_latency_trace_file_.empty()) {
+            trace.write(cxt_.loc_latency_trace_file_, logger_);
+          }
+          trace.reset();
 
         } else {
           logger_.warn() << "Invalid command: " << cmd;
         }
       }
+
+      if (cxt_.loc_pub_diagnostics_enable_ && !diagnostics_timer_) {
+        publish_stage_latencies(time_now);
+      }
+    }
+
+    // One status per pipeline stage with the latencies recorded since the last
+    // diagnostics command.
+    void publish_stage_latencies(const rclcpp::Time &time_now)
+    {
+      auto msg = diagnostic_msgs::msg::DiagnosticArray{}
+        .set__header(std_msgs::msg::Header{}.set__stamp(time_now));
+
+      auto key_value = [](const std::string &key, const std::string &value) -> diagnostic_msgs::msg::KeyValue
+      {
+        return diagnostic_msgs::msg::KeyValue{}.set__key(key).set__value(value);
+      };
+
+      for (int stage = 0; stage < StageLatencies::stage_count; stage += 1) {
+        auto summary = stage_latencies_.histograms_[stage].summary();
+        auto status = diagnostic_msgs::msg::DiagnosticStatus{}
+          .set__level(diagnostic_msgs::msg::DiagnosticStatus::OK)
+          .set__name(std::string{get_name()} + ": latency " + StageLatencies::stage_name(stage))
+          .set__hardware_id(get_fully_qualified_name())
+          .set__message("milliseconds");
+        status.values.emplace_back(key_value("count", std::to_string(summary.count_)));
+        status.values.emplace_back(key_value("p50", std::to_string(summary.p50_ms_)));
+        status.values.emplace_back(key_value("p95", std::to_string(summary.p95_ms_)));
+        status.values.emplace_back(key_value("p99", std::to_string(summary.p99_ms_)));
+        status.values.emplace_back(key_value("max", std::to_string(summary.max_ms_)));
+        msg.status.emplace_back(status);
+      }
+
+      if (!pub_diagnostics_) {
+        pub_diagnostics_ = create_publisher<diagnostic_msgs::msg::DiagnosticArray>(
+          cxt_.loc_pub_diagnostics_topic_, 2);
+      }
+      pub_diagnostics_->publish(msg);
     }
   };
 
@@ -751,47 +1021,32 @@ namespace fiducial_vlam
 
   void VlocDiagnostics::report(fvlam::Logger &logger, const rclcpp::Time &end_time)
   {
+    // Take and zero each count at once so an increment from the localize stage
+    // between the report and the reset is not lost.
     double per_sec = 1.0 / (end_time - start_time_).seconds();
-    logger.info() << "Received camera_info: " << sub_camera_info_count_
-                  << " (" << per_sec * sub_camera_info_count_ << " /sec)";
-    logger.info() << "Received image_raw: " << sub_image_raw_count_
-                  << " (" << per_sec * sub_image_raw_count_ << " /sec)";
-    logger.info() << "Received map: " << sub_map_count_
-                  << " (" << per_sec * sub_map_count_ << " /sec)";
-
-    logger.info() << "Empty observations: " << empty_observations_count_
-                  << " (" << per_sec * empty_observations_count_ << " /sec)";
-    logger.info() << "Invalid t_map_camera: " << invalid_t_map_camera_count_
-                  << " (" << per_sec * invalid_t_map_camera_count_ << " /sec)";
-
-    logger.info() << "Published observations: " << pub_observations_count_
-                  << " (" << per_sec * pub_observations_count_ << " /sec)";
-    logger.info() << "Published camera_pose: " << pub_camera_pose_count_
-                  << " (" << per_sec * pub_camera_pose_count_ << " /sec)";
-    logger.info() << "Published camera_odom: " << pub_camera_odom_count_
-                  << " (" << per_sec * pub_camera_odom_count_ << " /sec)";
-    logger.info() << "Published base_pose: " << pub_base_pose_count_
-                  << " (" << per_sec * pub_base_pose_count_ << " /sec)";
-    logger.info() << "Published base_odom: " << pub_base_odom_count_
-                  << " (" << per_sec * pub_base_odom_count_ << " /sec)";
-    logger.info() << "Published tf: " << pub_tf_count_
-                  << " (" << per_sec * pub_tf_count_ << " /sec)";
-    logger.info() << "Published imaged_marked: " << pub_image_marked_count_
-                  << " (" << per_sec * pub_image_marked_count_ << " /sec)";
-
-
-    sub_camera_info_count_ = 0;
-    sub_image_raw_count_ = 0;
-    sub_map_count_ = 0;
-    empty_observations_count_ = 0;
-    invalid_t_map_camera_count_ = 0;
-    pub_observations_count_ = 0;
-    pub_camera_pose_count_ = 0;
-    pub_camera_odom_count_ = 0;
-    pub_base_pose_count_ = 0;
-    pub_base_odom_count_ = 0;
-    pub_tf_count_ = 0;
-    pub_image_marked_count_ = 0;
+    auto line = [&logger, per_sec](const char *label, std::atomic<std::uint64_t> &count) -> void
+    {
+      auto n = count.exchange(0);
+      logger.info() << label << n << " (" << per_sec * n << " /sec)";
+    };
+
+    line("Received camera_info: ", sub_camera_info_count_);
+    line("Received image_raw: ", sub_image_raw_count_);
+    line("Received map: ", sub_map_count_);
+
+    line("Empty observations: ", empty_observations_count_);
+    line("Invalid t_map_camera: ", invalid_t_map_camera_count_);
+    line("Solve budget exhausted: ", budget_t_map_camera_count_);
+    line("Dropped stale observations: ", dropped_observations_count_);
+
+    line("Published observations: ", pub_observations_count_);
+    line("Published camera_pose: ", pub_camera_pose_count_);
+    line("Published camera_odom: ", pub_camera_odom_count_);
+    line("Published base_pose: ", pub_base_pose_count_);
+    line("Published base_odom: ", pub_base_odom_count_);
+    line("Published tf: ", pub_tf_count_);
+    line("Published imaged_marked: ", pub_image_marked_count_);
+
     start_time_ = end_time;
   }
 }
@@ -2,6 +2,8 @@
 #include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <sstream>
 
 #include "cv_bridge/cv_bridge.h"
 #include "fiducial_vlam/fiducial_vlam.hpp"
@@ -17,6 +19,7 @@
 #include "calibrate.hpp"
 #include "cv_utils.hpp"
 #include "fiducial_math.hpp"
+#include "image_ingress.hpp"
 #include "map.hpp"
 #include "observation.hpp"
 #include "vlocx_context.hpp"
@@ -218,6 +221,7 @@ namespace fiducial_vlam
     std::unique_ptr<CvFiducialMathInterface> fm_{};
     std::unique_ptr<ProcessImageInterface> lc_pi_{};
     std::unique_ptr<CalibrateCameraInterface> cc_pi_{};
+    Mono8Ingress mono8_ingress_{};
 
     std::unique_ptr<Map> map_{};
     std::unique_ptr<sensor_msgs::msg::CameraInfo> camera_info_msg_{};
@@ -236,6 +240,15 @@ namespace fiducial_vlam
     rclcpp::Subscription<fiducial_vlam_msgs::msg::Map>::SharedPtr map_sub_;
     rclcpp::TimerBase::SharedPtr calibrate_timer_{};
 
+    // The per marker tf messages are refilled in place on every frame and their
+    // child frame ids are formatted once per marker id. The ids are formatted again
+    // if psl_camera_frame_id changes.
+    tf2_msgs::msg::TFMessage cameras_tf_message_{};
+    tf2_msgs::msg::TFMessage markers_tf_message_{};
+    std::string per_marker_camera_frame_id_{};
+    std::map<int, std::string> camera_child_frame_ids_{};
+    std::map<int, std::string> marker_child_frame_ids_{};
+
     void validate_parameters()
     {
       cxt_.loc_t_camera_base_ = TransformWithCovariance(TransformWithCovariance::mu_type{
@@ -384,6 +397,10 @@ namespace fiducial_vlam
         16,
         [this](const fiducial_vlam_msgs::msg::Map::UniquePtr msg) -> void
         {
+          // This node only uses full maps. Deltas are skipped.
+          if (msg->is_delta) {
+            return;
+          }
           map_ = std::make_unique<Map>(*msg);
         });
 
@@ -419,8 +436,12 @@ namespace fiducial_vlam
     {
       rclcpp::Time time_stamp{stamp};
 
-      // Convert ROS to OpenCV
-      cv_bridge::CvImagePtr gray{cv_bridge::toCvCopy(*image_msg, "mono8")};
+      // Convert ROS to OpenCV. Calibration holds on to the images it captures so
+      // it gets its own copy. Otherwise a mono8 image is not copied.
+      cv_bridge::CvImagePtr gray{cxt_.loc_calibrate_not_localize_ ?
+                                 cv_bridge::toCvCopy(*image_msg, "mono8") :
+                                 std::make_shared<cv_bridge::CvImage>(image_msg->header, "mono8",
+                                                                      mono8_ingress_.gray(*image_msg))};
 
       // If we are going to publish an annotated image, make a copy of
       // the original message image. If no annotated image is to be published,
@@ -428,9 +449,9 @@ namespace fiducial_vlam
       // that the pointer is valid before drawing into it.
       cv_bridge::CvImage color_marked;
 
-//      if (cxt_.psl_publish_image_marked_ &&
-//          count_subscribers(cxt_.psl_image_marked_pub_topic_) > 0) {
-      if (psl_cxt_.psl_publish_image_marked_) {
+      // Skip the annotation work when nobody is listening.
+      if (psl_cxt_.psl_publish_image_marked_ &&
+          image_marked_pub_->get_subscription_count() > 0) {
 
         // The toCvShare only makes ConstCvImage because they don't want
         // to modify the original message data. I want to modify the original
@@ -532,7 +553,7 @@ namespace fiducial_vlam
           // if requested, publish the camera tf as determined from each marker.
           if (psl_cxt_.psl_publish_camera_tf_per_marker_) {
             auto t_map_cameras = markers_t_map_cameras(observations, *camera_info, *map_);
-            auto tf_message = to_cameras_tf_message(stamp, observations, t_map_cameras);
+            auto &tf_message = to_cameras_tf_message(stamp, observations, t_map_cameras);
             if (!tf_message.transforms.empty()) {
               tf_message_pub_->publish(tf_message);
             }
@@ -542,7 +563,7 @@ namespace fiducial_vlam
           if (psl_cxt_.psl_publish_marker_tf_per_marker_) {
             auto t_map_markers = markers_t_map_markers(observations, *camera_info,
                                                        map_->marker_length(), t_map_camera);
-            auto tf_message = to_markers_tf_message(stamp, observations, t_map_markers);
+            auto &tf_message = to_markers_tf_message(stamp, observations, t_map_markers);
             if (!tf_message.transforms.empty()) {
               tf_message_pub_->publish(tf_message);
             }
@@ -597,66 +618,81 @@ namespace fiducial_vlam
       return tf_message;
     }
 
-    tf2_msgs::msg::TFMessage to_cameras_tf_message(
-      std_msgs::msg::Header::_stamp_type stamp,
-      const Observations &observations,
-      const std::vector<TransformWithCovariance> &t_map_cameras)
+    const std::string &child_frame_id(std::map<int, std::string> &child_frame_ids, int id, bool camera_not_marker)
     {
-      tf2_msgs::msg::TFMessage tf_message;
+      if (per_marker_camera_frame_id_ != psl_cxt_.psl_camera_frame_id_) {
+        per_marker_camera_frame_id_ = psl_cxt_.psl_camera_frame_id_;
+        camera_child_frame_ids_.clear();
+        marker_child_frame_ids_.clear();
+      }
 
-      geometry_msgs::msg::TransformStamped msg;
-      msg.header.stamp = stamp;
-      msg.header.frame_id = psl_cxt_.psl_map_frame_id_;
+      auto it = child_frame_ids.find(id);
+      if (it != child_frame_ids.end()) {
+        return it->second;
+      }
+
+      std::ostringstream oss_child_frame_id;
+      if (camera_not_marker) {
+        oss_child_frame_id << psl_cxt_.psl_camera_frame_id_ << "_m" << std::setfill('0') << std::setw(3) << id;
+      } else {
+        oss_child_frame_id << "m_" << std::setfill('0') << std::setw(3) << id << psl_cxt_.psl_camera_frame_id_;
+      }
+      return child_frame_ids.emplace(id, oss_child_frame_id.str()).first->second;
+    }
+
+    // Fill tf_message with a transform for each valid entry of t_map_xs. The
+    // transforms already in the message are overwritten so that their strings keep
+    // their storage from one frame to the next.
+    void fill_per_marker_tf_message(tf2_msgs::msg::TFMessage &tf_message,
+                                    std::map<int, std::string> &child_frame_ids,
+                                    bool camera_not_marker,
+                                    std_msgs::msg::Header::_stamp_type stamp,
+                                    const Observations &observations,
+                                    const std::vector<TransformWithCovariance> &t_map_xs)
+    {
+      std::size_t count{0};
 
       if (!psl_cxt_.psl_camera_frame_id_.empty()) {
 
         for (size_t i = 0; i < observations.size(); i += 1) {
           auto &observation = observations.observations()[i];
-          auto &t_map_camera = t_map_cameras[i];
-
-          if (t_map_camera.is_valid()) {
-            std::ostringstream oss_child_frame_id;
-            oss_child_frame_id << psl_cxt_.psl_camera_frame_id_ << "_m" << std::setfill('0') << std::setw(3)
-                               << observation.id();
-            msg.child_frame_id = oss_child_frame_id.str();
-            msg.transform = tf2::toMsg(t_map_camera.transform());
-            tf_message.transforms.emplace_back(msg);
+          auto &t_map_x = t_map_xs[i];
+
+          if (t_map_x.is_valid()) {
+            if (count == tf_message.transforms.size()) {
+              tf_message.transforms.emplace_back();
+            }
+            auto &msg = tf_message.transforms[count];
+            msg.header.stamp = stamp;
+            msg.header.frame_id = psl_cxt_.psl_map_frame_id_;
+            msg.child_frame_id = child_frame_id(child_frame_ids, observation.id(), camera_not_marker);
+            msg.transform = tf2::toMsg(t_map_x.transform());
+            count += 1;
           }
         }
       }
 
-      return tf_message;
+      tf_message.transforms.resize(count);
     }
 
-    tf2_msgs::msg::TFMessage to_markers_tf_message(
+    const tf2_msgs::msg::TFMessage &to_cameras_tf_message(
       std_msgs::msg::Header::_stamp_type stamp,
       const Observations &observations,
-      const std::vector<TransformWithCovariance> &t_map_markers)
+      const std::vector<TransformWithCovariance> &t_map_cameras)
     {
-      tf2_msgs::msg::TFMessage tf_message;
-
-      geometry_msgs::msg::TransformStamped msg;
-      msg.header.stamp = stamp;
-      msg.header.frame_id = psl_cxt_.psl_map_frame_id_;
-
-      if (!psl_cxt_.psl_camera_frame_id_.empty()) {
-
-        for (size_t i = 0; i < observations.size(); i += 1) {
-          auto &observation = observations.observations()[i];
-          auto &t_map_marker = t_map_markers[i];
-
-          if (t_map_marker.is_valid()) {
-            std::ostringstream oss_child_frame_id;
-            oss_child_frame_id << "m_" << std::setfill('0') << std::setw(3)
-                               << observation.id() << psl_cxt_.psl_camera_frame_id_;
-            msg.child_frame_id = oss_child_frame_id.str();
-            msg.transform = tf2::toMsg(t_map_marker.transform());
-            tf_message.transforms.emplace_back(msg);
-          }
-        }
-      }
+      fill_per_marker_tf_message(cameras_tf_message_, camera_child_frame_ids_, true,
+                                 stamp, observations, t_map_cameras);
+      return cameras_tf_message_;
+    }
 
-      return tf_message;
+    const tf2_msgs::msg::TFMessage &to_markers_tf_message(
+      std_msgs::msg::Header::_stamp_type stamp,
+      const Observations &observations,
+      const std::vector<TransformWithCovariance> &t_map_markers)
+    {
+      fill_per_marker_tf_message(markers_tf_message_, marker_child_frame_ids_, false,
+                                 stamp, observations, t_map_markers);
+      return markers_tf_message_;
     }
 
     std::vector<TransformWithCovariance> markers_t_map_cameras(
@@ -1,21 +1,38 @@
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <future>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "fiducial_vlam/fiducial_vlam.hpp"
 #include "fiducial_vlam_msgs/msg/map.hpp"
 #include "fiducial_vlam_msgs/msg/observations_synced.hpp"
+#include "fiducial_vlam_msgs/msg/observations_synced_packed.hpp"
 #include "fvlam/build_marker_map_interface.hpp"
 #include "fvlam/camera_info.hpp"
 #include "fvlam/logger.hpp"
 #include "fvlam/marker.hpp"
+#include "fvlam/marker_map_tiles.hpp"
+#include "fvlam/marker_visibility_index.hpp"
 #include "fvlam/observation.hpp"
 #include "fvlam/transform3_with_covariance.hpp"
+#include "rclcpp/expand_topic_or_service_name.hpp"
 #include "rclcpp/rclcpp.hpp"
 #include "tf2_msgs/msg/tf_message.hpp"
 #include "visualization_msgs/msg/marker_array.hpp"
+#include "camera_info_cache.hpp"
+#include "in_process_observations.hpp"
+#include "latency_trace.hpp"
 #include "logger_ros2.hpp"
+#include "task_thread.hpp"
 #include "vmap_context.hpp"
 
 
@@ -56,7 +73,8 @@ namespace fvlam
   BuildMarkerMapRecorderContext BuildMarkerMapRecorderContext::from<fiducial_vlam::BmmContext>(
     fiducial_vlam::BmmContext &other)
   {
-    return BuildMarkerMapRecorderContext{other.bmm_recorded_observations_name_};
+    return BuildMarkerMapRecorderContext{other.bmm_recorded_observations_name_,
+                                         other.bmm_recorded_flush_every_n_};
   }
 
 // ==============================================================================
@@ -68,7 +86,7 @@ namespace fvlam
     fiducial_vlam::BmmContext &other, const MarkerMap &map_initial)
   {
     auto solve_tmm_factory = make_solve_tmm_factory(
-      fvlam::SolveTmmContextCvSolvePnp{other.average_on_space_not_manifold_},
+      fvlam::SolveTmmContextCvSolvePnp{other.average_on_space_not_manifold_, other.bmm_tmm_undistort_lookup_},
       map_initial.marker_length());
 
     return BuildMarkerMapTmmContext{
@@ -76,12 +94,105 @@ namespace fvlam
       other.bmm_tmm_try_shonan_,
       static_cast<fvlam::BuildMarkerMapTmmContext::NoiseStrategy>(other.bmm_tmm_noise_strategy_),
       other.bmm_tmm_fixed_sigma_r_,
-      other.bmm_tmm_fixed_sigma_t_};
+      other.bmm_tmm_fixed_sigma_t_,
+      other.bmm_tmm_incremental_,
+      static_cast<std::size_t>(std::max(0, other.bmm_tmm_shards_)),
+      std::max(1, other.bmm_tmm_isam_relinearize_skip_)};
   }
 }
 
 namespace fiducial_vlam
 {
+// ==============================================================================
+// KeyframeSelector class
+// ==============================================================================
+
+  // Decides if a frame adds enough to the map to be worth processing. A frame is
+  // kept if it sees a pair of markers together that no kept frame has seen, or if
+  // the corners of the markers it shares with the last kept frame have moved far
+  // enough to give new viewpoints. Frames from a hovering camera are dropped.
+  class KeyframeSelector
+  {
+    double min_corner_motion_;
+    std::set<std::pair<std::uint64_t, std::uint64_t>> seen_pairs_{};
+    fvlam::ObservationsSynced last_kept_{fvlam::Stamp{}, ""};
+    bool have_last_kept_{false};
+
+    bool has_new_pair(const fvlam::ObservationsSynced &observations_synced) const
+    {
+      for (auto &observations : observations_synced.v()) {
+        auto &v = observations.v();
+        for (std::size_t i = 0; i < v.size(); i += 1) {
+          for (std::size_t j = i + 1; j < v.size(); j += 1) {
+            if (seen_pairs_.count(std::minmax(v[i].id(), v[j].id())) == 0) {
+              return true;
+            }
+          }
+        }
+      }
+      return false;
+    }
+
+    // The mean pixel motion of the corners of markers that are seen by the same
+    // imager in this frame and the last kept frame. Infinite if none are shared.
+    double mean_corner_motion(const fvlam::ObservationsSynced &observations_synced) const
+    {
+      double motion_sum{0.};
+      std::size_t corner_count{0};
+
+      for (auto &observations : observations_synced.v()) {
+        for (auto &last_observations : last_kept_.v()) {
+          if (last_observations.imager_frame_id() != observations.imager_frame_id()) {
+            continue;
+          }
+          for (auto &observation : observations.v()) {
+            for (auto &last_observation : last_observations.v()) {
+              if (last_observation.id() != observation.id()) {
+                continue;
+              }
+              for (std::size_t c = 0; c < fvlam::Observation::ArraySize; c += 1) {
+                motion_sum += (observation.corners_f_image()[c].t() -
+                               last_observation.corners_f_image()[c].t()).norm();
+              }
+              corner_count += fvlam::Observation::ArraySize;
+            }
+          }
+        }
+      }
+
+      return corner_count == 0 ? std::numeric_limits<double>::infinity() :
+             motion_sum / static_cast<double>(corner_count);
+    }
+
+  public:
+    explicit KeyframeSelector(double min_corner_motion) :
+      min_corner_motion_{min_corner_motion}
+    {}
+
+    // Returns true if the frame should be processed. The kept frame becomes the
+    // reference for the motion test of the next frames.
+    bool select(const fvlam::ObservationsSynced &observations_synced)
+    {
+      if (have_last_kept_ &&
+          !has_new_pair(observations_synced) &&
+          mean_corner_motion(observations_synced) < min_corner_motion_) {
+        return false;
+      }
+
+      for (auto &observations : observations_synced.v()) {
+        auto &v = observations.v();
+        for (std::size_t i = 0; i < v.size(); i += 1) {
+          for (std::size_t j = i + 1; j < v.size(); j += 1) {
+            seen_pairs_.emplace(std::minmax(v[i].id(), v[j].id()));
+          }
+        }
+      }
+      last_kept_ = observations_synced;
+      have_last_kept_ = true;
+      return true;
+    }
+  };
+
 // ==============================================================================
 // BuildMarkerMapController class
 // ==============================================================================
@@ -94,105 +205,359 @@ namespace fiducial_vlam
     BmmContext bmm_cxt_;
     int bmm_use_every_n_msg_;
     int bmm_cnt_every_n_msg_{0};
+    std::map<std::string, KeyframeSelector> keyframe_selectors_{}; // By camera frame id, one per robot
+    CameraInfoCache camera_info_cache_{};
     std::unique_ptr<fvlam::MarkerMap> map_initial_;
-    std::unique_ptr<fvlam::BuildMarkerMapInterface> bmm_interface_{};
-    rclcpp::Subscription<fiducial_vlam_msgs::msg::ObservationsSynced>::SharedPtr sub_observations_{};
+    std::vector<rclcpp::Subscription<fiducial_vlam_msgs::msg::ObservationsSynced>::SharedPtr> sub_observations_{};
+    std::vector<rclcpp::Subscription<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>::SharedPtr> sub_observations_packed_{};
     bool pause_capture_{false};
     bool map_environment_inited{false};
     fvlam::MapEnvironment map_environment_{};
 
+    // The map builder is owned by the task thread. Observations and builds are queued
+    // to it in the order they arrive so a long build does not block the executor and
+    // observations that arrive during a build are processed when it finishes.
+    std::unique_ptr<task_thread::TaskThread<fvlam::BuildMarkerMapInterface>> bmm_task_{};
+    std::future<std::unique_ptr<fvlam::MarkerMap>> build_future_{};
+
+    // A builder whose process() is concurrent, bmm_tmm_shards for instance, takes
+    // frames on the process-wide worker pool as they arrive and bmm_task_ only
+    // builds. This lets a map server that takes frames from many robots use every
+    // core. The builder is still owned by bmm_task_.
+    fvlam::BuildMarkerMapInterface *bmm_concurrent_{nullptr};
+    std::mutex in_flight_mutex_{};
+    std::condition_variable in_flight_cv_{};
+    std::size_t frames_in_flight_{0};
+
+    // Observations taken directly from a publisher in this process arrive on that
+    // publisher's thread. This guards the state both paths share with the executor.
+    std::mutex mutex_{};
+    std::vector<std::unique_ptr<InProcessObservations::Subscription>> in_process_observations_{};
+
+    // With its own callback group, an observations callback can be running while
+    // the node destroys this controller. The callbacks go through the gate, which
+    // the destructor closes, rather than capture this.
+    struct Gate
+    {
+      std::mutex mutex_{};
+      BuildMarkerMapController *controller_{nullptr};
+    };
+    std::shared_ptr<Gate> gate_{std::make_shared<Gate>()};
+
+    template<class TMsg>
+    auto gated_callback()
+    {
+      return [gate = gate_](typename TMsg::UniquePtr msg) -> void
+      {
+        std::lock_guard<std::mutex> lock{gate->mutex_};
+        if (gate->controller_ != nullptr) {
+          gate->controller_->on_observations_msg(*msg);
+        }
+      };
+    }
+
+    // Count an arriving message and return true if it should be processed.
+    // Called with mutex_ held.
+    bool count_and_gate_msg()
+    {
+      diagnostics_.sub_observations_count_ += 1;
+      bmm_cnt_every_n_msg_ += 1;
+
+      if (!bmm_task_ || pause_capture_ || bmm_cnt_every_n_msg_ < bmm_use_every_n_msg_) {
+        return false;
+      }
+      bmm_cnt_every_n_msg_ = 0;
+      return true;
+    }
+
+    template<class TMsg>
+    void on_observations_msg(TMsg &msg)
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+
+      // Every message goes through the cache, even skipped ones, because a
+      // publisher may send the full calibration only every few messages.
+      auto camera_info_map = camera_info_cache_.camera_info_map(msg);
+      if (!count_and_gate_msg()) {
+        return;
+      }
+      if (!camera_info_map) {
+        diagnostics_.no_calibration_count_ += 1;
+        return;
+      }
+
+      // From the observations message, pick out the CameraInfo and Observations
+      process_observations(std::move(camera_info_map),
+                           std::make_shared<const fvlam::ObservationsSynced>(
+                             fvlam::ObservationsSynced::from(msg)));
+    }
+
+    // Called with mutex_ held.
+    void process_observations(std::shared_ptr<const fvlam::CameraInfoMap> camera_info_map,
+                              std::shared_ptr<const fvlam::ObservationsSynced> observations_synced)
+    {
+      LatencyTrace::instance().record(LatencyTrace::map_observations_received, observations_synced->stamp());
+
+      // Drop frames that would add nothing new to the map. Each camera is compared
+      // with its own last kept frame.
+      if (bmm_cxt_.bmm_keyframe_enable_) {
+        auto &keyframe_selector = keyframe_selectors_.try_emplace(
+          observations_synced->camera_frame_id(), bmm_cxt_.bmm_keyframe_min_corner_motion_).first->second;
+        if (!keyframe_selector.select(*observations_synced)) {
+          diagnostics_.keyframe_skip_count_ += 1;
+          return;
+        }
+      }
+
+      // Bound the memory held for a map builder that has fallen behind. Builds are
+      // queued on the same thread and are never dropped, only frames.
+      auto frames_waiting = bmm_concurrent_ ? frames_in_flight() : bmm_task_->tasks_in_queue();
+      if (bmm_cxt_.bmm_build_queue_max_frames_ > 0 &&
+          frames_waiting >= static_cast<std::size_t>(bmm_cxt_.bmm_build_queue_max_frames_)) {
+        diagnostics_.queue_full_skip_count_ += 1;
+        return;
+      }
+
+      diagnostics_.process_observations_count_ += 1;
+
+      if (bmm_concurrent_) {
+        process_concurrent(std::move(camera_info_map), std::move(observations_synced));
+        return;
+      }
+
+      // Send these observations off for processing. Both are shared, not copied,
+      // they are never modified once handed out.
+      bmm_task_->push(
+        [camera_info_map = std::move(camera_info_map),
+          observations_synced = std::move(observations_synced)](fvlam::BuildMarkerMapInterface &bmm) -> void
+        {
+          bmm.process(*observations_synced, *camera_info_map);
+          LatencyTrace::instance().record(LatencyTrace::map_observations_processed, observations_synced->stamp());
+        });
+    }
+
+    // Called with mutex_ held.
+    void process_concurrent(std::shared_ptr<const fvlam::CameraInfoMap> camera_info_map,
+                            std::shared_ptr<const fvlam::ObservationsSynced> observations_synced)
+    {
+      {
+        std::lock_guard<std::mutex> lock{in_flight_mutex_};
+        frames_in_flight_ += 1;
+      }
+
+      task_thread::WorkStealingPool::shared().submit(
+        [this, camera_info_map = std::move(camera_info_map),
+          observations_synced = std::move(observations_synced)]() -> void
+        {
+          try {
+            bmm_concurrent_->process(*observations_synced, *camera_info_map);
+            LatencyTrace::instance().record(LatencyTrace::map_observations_processed, observations_synced->stamp());
+          } catch (const std::exception &e) {
+            logger_.error() << "Map frame processing failed: " << e.what();
+          }
+
+          std::lock_guard<std::mutex> lock{in_flight_mutex_};
+          frames_in_flight_ -= 1;
+          in_flight_cv_.notify_all();
+        });
+    }
+
+    std::size_t frames_in_flight()
+    {
+      std::lock_guard<std::mutex> lock{in_flight_mutex_};
+      return frames_in_flight_;
+    }
+
+    void wait_for_frames_in_flight()
+    {
+      std::unique_lock<std::mutex> lock{in_flight_mutex_};
+      in_flight_cv_.wait(lock, [this]() -> bool
+      { return frames_in_flight_ == 0; });
+    }
+
+    // psm_sub_observations_topic holds one or more topics separated by ':'.
+    static std::vector<std::string> split_topics(const std::string &topics)
+    {
+      std::vector<std::string> split{};
+      std::size_t previous{0};
+      std::size_t current = topics.find(':');
+      while (current != std::string::npos) {
+        split.push_back(topics.substr(previous, current - previous));
+        previous = current + 1;
+        current = topics.find(':', previous);
+      }
+      split.push_back(topics.substr(previous));
+      return split;
+    }
+
   public:
     BuildMarkerMapController(rclcpp::Node &node, fvlam::Logger &logger, VmapDiagnostics &diagnostics,
                              BmmContext bmm_cxt, const PsmContext &psm_cxt,
-                             std::unique_ptr<fvlam::MarkerMap> map_initial) :
+                             std::unique_ptr<fvlam::MarkerMap> map_initial,
+                             rclcpp::CallbackGroup::SharedPtr observations_callback_group) :
       node_{node}, logger_{logger}, diagnostics_{diagnostics},
       bmm_cxt_{std::move(bmm_cxt)}, bmm_use_every_n_msg_{std::max(1, bmm_cxt.bmm_use_every_n_msg_)},
       map_initial_{std::move(map_initial)}
     {
+      std::unique_ptr<fvlam::BuildMarkerMapInterface> bmm_interface{};
+
       // Instantiate a BuildMarkerMap class based on the parameter settings.
       switch (bmm_cxt_.bmm_algorithm_) {
         default:
         case 0: // record observations to file
-          bmm_interface_ = make_build_marker_map(fvlam::BuildMarkerMapRecorderContext::from(bmm_cxt_),
-                                                 logger_, *map_initial_);
+          bmm_interface = make_build_marker_map(fvlam::BuildMarkerMapRecorderContext::from(bmm_cxt_),
+                                                logger_, *map_initial_);
           break;
 
         case 1: // t_marker0_marker1 techniques
-          bmm_interface_ = make_build_marker_map(fvlam::BuildMarkerMapTmmContext::from(bmm_cxt_, *map_initial_),
-                                                 logger_, *map_initial_);
+          bmm_interface = make_build_marker_map(fvlam::BuildMarkerMapTmmContext::from(bmm_cxt_, *map_initial_),
+                                                logger_, *map_initial_);
           break;
 
         case 2: // isam_betweenfactor technique
           break;
       }
 
-      if (!bmm_interface_) {
+      if (!bmm_interface) {
         return;
       }
 
-      // Set up a subscriber for observations messages
-      (void) sub_observations_;
-      sub_observations_ = node_.create_subscription<fiducial_vlam_msgs::msg::ObservationsSynced>(
-        psm_cxt.psm_sub_observations_topic_,
-        rclcpp::QoS{rclcpp::ServicesQoS()},
-        [this](fiducial_vlam_msgs::msg::ObservationsSynced::UniquePtr msg) -> void
-        {
-          diagnostics_.sub_observations_count_ += 1;
-          bmm_cnt_every_n_msg_ += 1;
-
-          if (bmm_interface_ && !pause_capture_ && bmm_cnt_every_n_msg_ >= bmm_use_every_n_msg_) {
-            diagnostics_.process_observations_count_ += 1;
-            bmm_cnt_every_n_msg_ = 0;
+      if (bmm_interface->process_is_concurrent()) {
+        bmm_concurrent_ = bmm_interface.get();
+      }
+      bmm_task_ = std::make_unique<task_thread::TaskThread<fvlam::BuildMarkerMapInterface>>(
+        std::move(bmm_interface), !bmm_cxt_.bmm_build_on_thread_);
+
+      // Set up a subscriber for each observations topic. When the publisher is composed
+      // into this process the observations can be taken directly, without a message.
+      auto topics = split_topics(psm_cxt.psm_sub_observations_topic_);
+      if (psm_cxt.psm_sub_observations_in_process_) {
+        for (auto &topic : topics) {
+          in_process_observations_.emplace_back(InProcessObservations::subscribe(
+            rclcpp::expand_topic_or_service_name(topic, node_.get_name(), node_.get_namespace()),
+            [this](const std::shared_ptr<const fvlam::CameraInfoMap> &camera_info_map,
+                   const std::shared_ptr<const fvlam::ObservationsSynced> &observations_synced) -> void
+            {
+              // Called on the publisher's thread.
+              std::lock_guard<std::mutex> lock{mutex_};
+              if (count_and_gate_msg()) {
+                process_observations(camera_info_map, observations_synced);
+              }
+            }));
+        }
+        return;
+      }
 
-            // From the observations message, pick out the CameraInfo and Observations
-            auto camera_info_map = fvlam::CameraInfoMap::from(*msg);
-            auto observations_synced = fvlam::ObservationsSynced::from(*msg);
+      gate_->controller_ = this;
+      rclcpp::SubscriptionOptions options{};
+      options.callback_group = std::move(observations_callback_group);
+
+      // The packed and plain formats carry the same information.
+      for (auto &topic : topics) {
+        if (psm_cxt.psm_sub_observations_packed_) {
+          sub_observations_packed_.emplace_back(
+            node_.create_subscription<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>(
+              topic,
+              rclcpp::QoS{rclcpp::ServicesQoS()},
+              gated_callback<fiducial_vlam_msgs::msg::ObservationsSyncedPacked>(),
+              options));
+        } else {
+          sub_observations_.emplace_back(
+            node_.create_subscription<fiducial_vlam_msgs::msg::ObservationsSynced>(
+              topic,
+              rclcpp::QoS{rclcpp::ServicesQoS()},
+              gated_callback<fiducial_vlam_msgs::msg::ObservationsSynced>(),
+              options));
+        }
+      }
+    }
 
-            // Send these observations off for processing
-            bmm_interface_->process(observations_synced, camera_info_map);
-          }
-        });
+    // Waits for an observations callback that is running on another thread, and
+    // for frames still being processed on the worker pool.
+    ~BuildMarkerMapController()
+    {
+      {
+        std::lock_guard<std::mutex> lock{gate_->mutex_};
+        gate_->controller_ = nullptr;
+      }
+      in_process_observations_.clear();
+      wait_for_frames_in_flight();
     }
 
-    // Invoke the map builder method and report on the optimizattion errors
+    // Returns a map if a build has completed since the last call. Otherwise queues
+    // a build if one is not already running and returns an empty pointer.
     std::unique_ptr<fvlam::MarkerMap> build()
     {
-      if (!bmm_interface_) {
-        return std::unique_ptr<fvlam::MarkerMap>{};
-      }
-      diagnostics_.build_count += 1;
-      auto map = bmm_interface_->build();
-      if (!map) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (!bmm_task_) {
         return std::unique_ptr<fvlam::MarkerMap>{};
       }
 
-      // Log the errors. Have to test for the different builder types
-      auto error_tmm = fvlam::BuildMarkerMapTmmContext::BuildError::from(*bmm_interface_, *map);
-      if (error_tmm.valid_) {
-        logger_.info() << error_tmm.to_string();
+      // If a build is in progress, check to see if it is complete.
+      if (build_future_.valid()) {
+        if (build_future_.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) {
+          return std::unique_ptr<fvlam::MarkerMap>{};
+        }
+        return build_future_.get();
       }
 
-      return map;
+      // Queue up a build behind any observations that are waiting to be processed.
+      diagnostics_.build_count += 1;
+      std::promise<std::unique_ptr<fvlam::MarkerMap>> build_promise{};
+      build_future_ = build_promise.get_future();
+
+      bmm_task_->push(
+        [this, promise = std::move(build_promise)](fvlam::BuildMarkerMapInterface &bmm) mutable -> void
+        {
+          std::unique_ptr<fvlam::MarkerMap> map{};
+          try {
+            map = bmm.build();
+          } catch (const std::exception &e) {
+            logger_.error() << "Map build failed: " << e.what();
+          }
+
+          // Log the errors. Have to test for the different builder types
+          if (map) {
+            auto error_tmm = fvlam::BuildMarkerMapTmmContext::BuildError::from(bmm, *map);
+            if (error_tmm.valid_) {
+              logger_.info() << error_tmm.to_string();
+            }
+          }
+
+          promise.set_value(std::move(map));
+        });
+
+      // If the build ran on this thread, it is already complete.
+      if (build_future_.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+        return build_future_.get();
+      }
+      return std::unique_ptr<fvlam::MarkerMap>{};
     }
 
     void pause()
     {
-      if (bmm_interface_) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (bmm_task_) {
         pause_capture_ = true;
       }
     }
 
     void resume()
     {
-      if (bmm_interface_) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (bmm_task_) {
         pause_capture_ = false;
       }
     }
 
+    // Waits for a build that is in progress to complete.
     void finish()
     {
-      if (bmm_interface_) {
-        bmm_interface_.reset(nullptr);
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (bmm_task_) {
+        wait_for_frames_in_flight();
+        bmm_concurrent_ = nullptr;
+        bmm_task_.reset(nullptr);
       }
     }
   };
@@ -211,8 +576,20 @@ namespace fiducial_vlam
     BmmContext bmm_cxt_{};
 
     std::unique_ptr<BuildMarkerMapController> bmm_controller_{};
+
+    // With map_callback_groups_enable, observations are taken on their own group so
+    // that map building and publishing on the timer does not hold them up.
+    rclcpp::CallbackGroup::SharedPtr observations_callback_group_{};
     std::unique_ptr<fvlam::MarkerMap> marker_map_{}; // Map that gets updated and published.
-    rclcpp::Time exit_build_map_time_;
+
+    // Spatial index over marker_map_ for region publishing. Built when first needed
+    // and dropped whenever marker_map_ is replaced.
+    std::unique_ptr<fvlam::MarkerVisibilityIndex> visibility_index_{};
+
+    // Delta publishing state. published_map_ is the map as subscribers last saw it.
+    std::unique_ptr<fvlam::MarkerMap> published_map_{};
+    std::uint64_t map_version_{0};
+    int periods_since_full_map_{0};
 
     // ROS publishers
     rclcpp::Publisher<fiducial_vlam_msgs::msg::Map>::SharedPtr pub_map_{};
@@ -259,14 +636,23 @@ namespace fiducial_vlam
     explicit VmapNode(const rclcpp::NodeOptions &options) :
       Node{"vmap_node", options},
       logger_{*this},
-      diagnostics_{now()},
-      exit_build_map_time_{now()}
+      diagnostics_{now()}
     {
       // Get parameters from the command line
       setup_parameters();
+      logger_.set_async(cxt_.map_log_async_);
+      if (!cxt_.map_latency_trace_file_.empty()) {
+        LatencyTrace::instance().set_keep_records(true);
+      }
+
+      if (cxt_.map_callback_groups_enable_) {
+        observations_callback_group_ = create_callback_group(
+          rclcpp::CallbackGroupType::MutuallyExclusive);
+      }
 
       // Initialize the map. Load from file or otherwise.
       marker_map_ = make_initial_marker_map(false);
+      reset_visibility_index();
 
       // ROS publishers.
       pub_map_ = create_publisher<fiducial_vlam_msgs::msg::Map>(
@@ -306,17 +692,9 @@ namespace fiducial_vlam
       // Publish only if there is a map. There might not
       // be a map if no markers have been observed.
       if (marker_map_) {
-        rclcpp::Time enter_build_map_time{now()};
-        // Give a little time for other tasks to process. For large optimizations, this timer routine
-        // sucks up CPU cycles and other tasks are starved. Sometimes, the call to build_map takes longer than the
-        // timer period so the timer_callback gets called again immediately when it exits. The following tests
-        // attempt to prevent this a bit by skipping calls to build_map when the time between timer callbacks
-        // is too short. The real solution is a separate thread for the long-running build_map routine.
-        if ((enter_build_map_time - exit_build_map_time_) >=
-            std::chrono::milliseconds(psm_cxt_.timer_period_milliseconds_) / 2) {
-          build_marker_map();
-        }
-        exit_build_map_time_ = now();
+        // Pick up a map that has finished building and start the next build. The
+        // build itself runs on the controller's task thread.
+        build_marker_map();
 
         // Publish any map we have built to this point.
         publish_marker_map_and_visualization(now());
@@ -340,54 +718,179 @@ namespace fiducial_vlam
         auto marker_map = bmm_controller_->build();
         if (marker_map) {
           // Have a new built map. log it.
-          logger_.debug() << marker_map->to_string();
+          if (logger_.output_debug()) {
+            logger_.debug() << marker_map->to_string();
+          }
 
           // Save the map
           if (!cxt_.map_save_filename_.empty()) {
             marker_map->save(cxt_.map_save_filename_, logger_);
           }
+          if (!cxt_.map_save_tiles_dir_.empty()) {
+            fvlam::MarkerMapTiles::save(*marker_map, cxt_.map_save_tile_size_, cxt_.map_save_tiles_dir_, logger_);
+          }
 
           // Replace the current map
           marker_map_ = std::move(marker_map);
+          reset_visibility_index();
         }
       }
     }
 
+    // The markers in marker_map_ that are new or different from published_map_ and
+    // the ids of the markers in published_map_ that are gone.
+    void find_map_changes(std::vector<const fvlam::Marker *> &changed, std::vector<std::uint64_t> &removed) const
+    {
+      for (auto &id_marker_pair : marker_map_->m()) {
+        auto published = published_map_->find_marker_const(id_marker_pair.first);
+        if (published == nullptr || !published->equals(id_marker_pair.second)) {
+          changed.emplace_back(&id_marker_pair.second);
+        }
+      }
+      for (auto &id_marker_pair : published_map_->m()) {
+        if (marker_map_->find_marker_const(id_marker_pair.first) == nullptr) {
+          removed.emplace_back(id_marker_pair.first);
+        }
+      }
+    }
+
+    // Build the index for a new marker_map_ here rather than in the first
+    // publish that needs it.
+    void reset_visibility_index()
+    {
+      visibility_index_.reset();
+      if (marker_map_ && psm_cxt_.psm_pub_region_radius_ > 0. &&
+          (psm_cxt_.psm_pub_visuals_enable_ || psm_cxt_.psm_pub_tf_marker_enable_)) {
+        region_marker_ids();
+      }
+    }
+
+    // The sorted ids of the markers within psm_pub_region_radius of the region
+    // center. Only called when the radius is set.
+    std::vector<std::uint64_t> region_marker_ids()
+    {
+      // The cell size only affects speed. A cell about the size of the region
+      // keeps the cells visited per query to a handful.
+      if (!visibility_index_) {
+        visibility_index_ = std::make_unique<fvlam::MarkerVisibilityIndex>(*marker_map_,
+                                                                           psm_cxt_.psm_pub_region_radius_);
+      }
+      return visibility_index_->markers_within(fvlam::Translate3{psm_cxt_.psm_pub_region_x_,
+                                                                 psm_cxt_.psm_pub_region_y_,
+                                                                 psm_cxt_.psm_pub_region_z_},
+                                               psm_cxt_.psm_pub_region_radius_);
+    }
+
     void publish_marker_map_and_visualization(const rclcpp::Time &stamp)
     {
-      diagnostics_.pub_map_count_ += 1;
       auto header = std_msgs::msg::Header{}
         .set__stamp(stamp)
         .set__frame_id(psm_cxt_.psm_pub_map_frame_id_);
 
-      // Create the map message and publish it. (always)
-      auto msg = marker_map_->to<fiducial_vlam_msgs::msg::Map>()
-        .set__header(header); // set header after setting map - TODO change Map msg to be stamped and have vector
-      pub_map_->publish(msg);
+      // With deltas enabled, a full map goes out every few periods so new subscribers
+      // can start, and only the changes go out in between. Nothing is sent for
+      // the map in a period where it has not changed.
+      auto delta_enable = psm_cxt_.psm_pub_map_delta_enable_;
+      std::vector<const fvlam::Marker *> changed{};
+      std::vector<std::uint64_t> removed{};
+      auto send_delta = delta_enable && published_map_ &&
+                        published_map_->map_environment().equals(marker_map_->map_environment()) &&
+                        ++periods_since_full_map_ < std::max(1, psm_cxt_.psm_pub_map_full_every_n_);
+      if (send_delta) {
+        find_map_changes(changed, removed);
+      }
 
-      // Create and publish the marker visualization
-      if (psm_cxt_.psm_pub_visuals_enable_) {
-        diagnostics_.pub_visuals_count_ += 1;
-        auto visuals_msg = visualization_msgs::msg::MarkerArray{};
-        for (auto &id_marker_pair : marker_map_->m()) {
-          auto marker_msg = id_marker_pair.second.to<visualization_msgs::msg::Marker>()
-            .set__header(header); // set header after setting marker.
-          visuals_msg.markers.emplace_back(marker_msg);
+      // Visuals and marker tfs can be limited to a region of the map. The map
+      // message always has every marker because localizers need all of them.
+      auto use_region = psm_cxt_.psm_pub_region_radius_ > 0. &&
+                        (psm_cxt_.psm_pub_visuals_enable_ || psm_cxt_.psm_pub_tf_marker_enable_);
+      std::vector<std::uint64_t> region_ids{};
+      if (use_region) {
+        region_ids = region_marker_ids();
+      }
+      auto in_region = [use_region, &region_ids](std::uint64_t id) -> bool
+      {
+        return !use_region || std::binary_search(region_ids.begin(), region_ids.end(), id);
+      };
+
+      if (!send_delta || !changed.empty() || !removed.empty()) {
+        // Create the map message and publish it. Published as a unique_ptr so that
+        // intra-process subscribers, when enabled, receive it without a copy.
+        std::unique_ptr<fiducial_vlam_msgs::msg::Map> msg{};
+        if (send_delta) {
+          diagnostics_.pub_map_delta_count_ += 1;
+          msg = std::make_unique<fiducial_vlam_msgs::msg::Map>();
+          msg->map_environment = marker_map_->map_environment().to<fiducial_vlam_msgs::msg::MapEnvironment>();
+          msg->markers.reserve(changed.size());
+          for (auto marker : changed) {
+            msg->markers.emplace_back(marker->to<fiducial_vlam_msgs::msg::Marker>());
+          }
+          msg->removed_ids = removed;
+          msg->is_delta = true;
+          msg->base_version = map_version_;
+        } else {
+          diagnostics_.pub_map_count_ += 1;
+          msg = std::make_unique<fiducial_vlam_msgs::msg::Map>(marker_map_->to<fiducial_vlam_msgs::msg::Map>());
+          periods_since_full_map_ = 0;
+        }
+        msg->header = header; // set header after setting map - TODO change Map msg to be stamped and have vector
+        if (delta_enable) {
+          msg->map_version = ++map_version_;
+          published_map_ = std::make_unique<fvlam::MarkerMap>(*marker_map_);
+        }
+        pub_map_->publish(std::move(msg));
+
+        // Create and publish the marker visualization. rviz keeps markers it has been
+        // sent so a delta only needs the markers that changed.
+        if (psm_cxt_.psm_pub_visuals_enable_) {
+          diagnostics_.pub_visuals_count_ += 1;
+          auto visuals_msg = std::make_unique<visualization_msgs::msg::MarkerArray>();
+          if (send_delta) {
+            visuals_msg->markers.reserve(changed.size() + removed.size());
+            for (auto marker : changed) {
+              if (!in_region(marker->id())) {
+                continue;
+              }
+              visuals_msg->markers.emplace_back(marker->to<visualization_msgs::msg::Marker>()
+                                                  .set__header(header));
+            }
+            for (auto id : removed) {
+              visuals_msg->markers.emplace_back(visualization_msgs::msg::Marker{}
+                                                  .set__header(header)
+                                                  .set__id(static_cast<int>(id))
+                                                  .set__action(visualization_msgs::msg::Marker::DELETE));
+            }
+          } else if (use_region) {
+            visuals_msg->markers.reserve(region_ids.size());
+            for (auto id : region_ids) {
+              auto marker_msg = marker_map_->find_marker_const(id)->to<visualization_msgs::msg::Marker>()
+                .set__header(header); // set header after setting marker.
+              visuals_msg->markers.emplace_back(std::move(marker_msg));
+            }
+          } else {
+            visuals_msg->markers.reserve(marker_map_->m().size());
+            for (auto &id_marker_pair : marker_map_->m()) {
+              auto marker_msg = id_marker_pair.second.to<visualization_msgs::msg::Marker>()
+                .set__header(header); // set header after setting marker.
+              visuals_msg->markers.emplace_back(std::move(marker_msg));
+            }
+          }
+          pub_visuals_->publish(std::move(visuals_msg));
         }
-        pub_visuals_->publish(visuals_msg);
       }
 
       // Create and publish the marker transform tree
       if (psm_cxt_.psm_pub_tf_marker_enable_) {
         diagnostics_.pub_tf_count_ += 1;
         tf2_msgs::msg::TFMessage tfs_msg;
-        for (auto &id_marker_pair : marker_map_->m()) {
-          auto &t_world_marker = id_marker_pair.second.t_map_marker().tf();
+        auto add_marker_tf = [this, &header, &tfs_msg](const fvlam::Marker &marker) -> void
+        {
+          auto &t_world_marker = marker.t_map_marker().tf();
 
           std::ostringstream oss_child_frame_id;
           oss_child_frame_id << psm_cxt_.psm_pub_tf_marker_child_frame_id_
                              << std::setfill('0') << std::setw(3)
-                             << id_marker_pair.first;
+                             << marker.id();
 
           auto tf_stamped_msg = geometry_msgs::msg::TransformStamped{}
             .set__header(header)
@@ -395,6 +898,15 @@ namespace fiducial_vlam
             .set__transform(t_world_marker.to<geometry_msgs::msg::Transform>());
 
           tfs_msg.transforms.emplace_back(tf_stamped_msg);
+        };
+        if (use_region) {
+          for (auto id : region_ids) {
+            add_marker_tf(*marker_map_->find_marker_const(id));
+          }
+        } else {
+          for (auto &id_marker_pair : marker_map_->m()) {
+            add_marker_tf(id_marker_pair.second);
+          }
         }
         pub_tf_->publish(tfs_msg);
       }
@@ -414,7 +926,7 @@ namespace fiducial_vlam
         }
         bmm_controller_ = std::make_unique<BuildMarkerMapController>(
           *this, logger_, diagnostics_, bmm_cxt_, psm_cxt_,
-          make_initial_marker_map(true));
+          make_initial_marker_map(true), observations_callback_group_);
 
       } else if (cmd == "pause") {
         if (bmm_controller_) {
@@ -434,6 +946,12 @@ namespace fiducial_vlam
 
       } else if (cmd == "diagnostics") {
         diagnostics_.report(logger_, now());
+        auto &trace = LatencyTrace::instance();
+        trace.report(logger_);
+        if (!cxt_.map_latency_trace_file_.empty()) {
+          trace.write(cxt_.map_latency_trace_file_, logger_);
+        }
+        trace.reset();
 
       } else {
         logger_.warn() << "Invalid command: " << cmd;
@@ -480,7 +998,9 @@ namespace fiducial_vlam
         logger_.info() << "Loading map file: " << filename;
 
         // load the map.
-        auto map_from_file = fvlam::MarkerMap::load(filename, logger_);
+        auto map_from_file = cxt_.map_load_use_snapshot_ ?
+                             fvlam::MarkerMap::load_cached(filename, logger_) :
+                             fvlam::MarkerMap::load(filename, logger_);
 
         // If we successfully read the map, then return it or just the fixed nodes.
         if (map_from_file.marker_length() != 0.0) {
@@ -532,10 +1052,18 @@ namespace fiducial_vlam
                   << " (" << per_sec * sub_observations_count_ << " /sec)";
     logger.info() << "Processed Observations: " << process_observations_count_
                   << " (" << per_sec * process_observations_count_ << " /sec)";
+    logger.info() << "Skipped without calibration: " << no_calibration_count_
+                  << " (" << per_sec * no_calibration_count_ << " /sec)";
+    logger.info() << "Skipped non-keyframes: " << keyframe_skip_count_
+                  << " (" << per_sec * keyframe_skip_count_ << " /sec)";
+    logger.info() << "Skipped with the builder queue full: " << queue_full_skip_count_
+                  << " (" << per_sec * queue_full_skip_count_ << " /sec)";
     logger.info() << "Builds: " << build_count
                   << " (" << per_sec * build_count << " /sec)";
     logger.info() << "Published Maps: " << pub_map_count_
                   << " (" << per_sec * pub_map_count_ << " /sec)";
+    logger.info() << "Published Map Deltas: " << pub_map_delta_count_
+                  << " (" << per_sec * pub_map_delta_count_ << " /sec)";
     logger.info() << "Published Visuals: " << pub_visuals_count_
                   << " (" << per_sec * pub_visuals_count_ << " /sec)";
     logger.info() << "Published Tfs: " << pub_tf_count_
@@ -543,8 +1071,12 @@ namespace fiducial_vlam
 
     sub_observations_count_ = 0;
     process_observations_count_ = 0;
+    no_calibration_count_ = 0;
+    keyframe_skip_count_ = 0;
+    queue_full_skip_count_ = 0;
     build_count = 0;
     pub_map_count_ = 0;
+    pub_map_delta_count_ = 0;
     pub_visuals_count_ = 0;
     pub_tf_count_ = 0;
     start_time_ = end_time;